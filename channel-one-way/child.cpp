@@ -4,18 +4,80 @@
 #include <string.h>
 
 #include <fbl/auto_call.h>
+#include <msgpool/msgpool.h>
+#include <trace/syscalls.h>
+#include <typed/handle.h>
+#include <zircon/process.h>
 #include <zircon/syscalls.h>
 
-zx_status_t child(zx_handle_t channel) {
-    // Close this end of the channel if we exit.
-    auto channel_cleanup = fbl::MakeAutoCall([channel]() {
-        zx_handle_close(channel);
-    });
+namespace {
 
+zx_status_t send_ack(const typed::Handle& channel, uint64_t received) {
     while (true) {
-        zx_status_t st = zx_object_wait_one(
-            channel,
-            ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+        zx_status_t st = trace::channel_write(channel.get(), 0, &received,
+                                              sizeof(received), nullptr, 0);
+        if (st != ZX_ERR_SHOULD_WAIT) {
+            return st;
+        }
+        st = trace::object_wait_one(
+            channel.get(), ZX_CHANNEL_WRITABLE | ZX_CHANNEL_PEER_CLOSED,
+            ZX_TIME_INFINITE, nullptr);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+}
+
+// Maps the payload VMO that came with a kFlagVmo message. |inline_payload|
+// holds the payload's length.
+zx_status_t map_payload(const typed::Handle& vmo, const uint8_t* inline_payload,
+                        uint32_t inline_size, const uint8_t** payload,
+                        size_t* payload_size, zx_vaddr_t* mapping,
+                        size_t* mapping_size) {
+    uint64_t length;
+    if (inline_size != sizeof(length) || !vmo) {
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+    memcpy(&length, inline_payload, sizeof(length));
+
+    uint64_t vmo_size;
+    zx_status_t st = zx_vmo_get_size(vmo.get(), &vmo_size);
+    if (st != ZX_OK) {
+        return st;
+    }
+    if (length > vmo_size) {
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+
+    // The mapping keeps the pages alive, so the handle can go right after.
+    st = zx_vmar_map(zx_vmar_root_self(), ZX_VM_PERM_READ, 0, vmo.get(), 0,
+                     vmo_size, mapping);
+    if (st != ZX_OK) {
+        return st;
+    }
+    *payload = reinterpret_cast<const uint8_t*>(*mapping);
+    *payload_size = length;
+    *mapping_size = vmo_size;
+    return ZX_OK;
+}
+
+} // namespace
+
+zx_status_t child(zx_handle_t handle, const options_t& options) {
+    // Our end of the channel closes when |channel| goes out of scope.
+    typed::Handle channel(handle);
+
+    // Messages vary in length; |message| grows to the largest one so far and
+    // reuses its pooled buffers after that.
+    msgpool::Message message;
+    uint32_t expected = 0;
+    // Heap allocations by messages other than the first of a run, which
+    // is where the buffers may have to grow. Steady state should make none.
+    uint64_t steady_heap_allocs = 0;
+
+    while (true) {
+        zx_status_t st = trace::object_wait_one(
+            channel.get(), ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
             ZX_TIME_INFINITE, nullptr);
 
         if (st != ZX_OK) {
@@ -23,34 +85,97 @@ zx_status_t child(zx_handle_t channel) {
             return st;
         }
 
-        char buffer[kMessageLength];
-        memset(buffer, 0, kMessageLength);
-
-        st = zx_channel_read(
-            channel,
-            0,              // options
-            buffer,         // buffer to read into
-            nullptr,        // handles
-            sizeof(buffer), // bytes available in the buffer
-            0,              // number of handles
-            nullptr,        // Actual bytes read, don't care
-            nullptr         // Actual handles read, don't care
-            );
+        uint64_t heap_allocs = msgpool::GetStats().heap_allocs;
+        st = message.Read(channel.get());
+        if (expected > 0) {
+            steady_heap_allocs += msgpool::GetStats().heap_allocs - heap_allocs;
+        }
 
         if (st == ZX_ERR_PEER_CLOSED) {
             // No more data to read, and the peer closed the connection.
             // Exit gracefully.
-            LOG("Peer closed, goodbye!\n");
+            if (options.bench) {
+                histogram::PrintValue(stdout,
+                                      "channel-one-way.child.steady_heap_allocs",
+                                      "allocs",
+                                      static_cast<double>(steady_heap_allocs),
+                                      options.format);
+            } else {
+                LOG("Peer closed, goodbye!\n");
+            }
             return ZX_OK;
         } else if (st != ZX_OK) {
             ERR("zx_channel_read failed with st = %d\n", st);
             return st;
         }
 
-        // Make sure buffer is null terminated then print it.
-        buffer[kMessageLength - 1] = '\0';
-        LOG("%s\n", buffer);
+        uint32_t actual_bytes = message.num_bytes();
+        const uint8_t* bytes = static_cast<const uint8_t*>(message.bytes());
+        typed::Handle vmo(message.num_handles() > 0 ? message.TakeHandle(0)
+                                                    : ZX_HANDLE_INVALID);
+
+        message_header_t header;
+        if (actual_bytes < sizeof(header)) {
+            ERR("short message of %u bytes\n", actual_bytes);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        memcpy(&header, bytes, sizeof(header));
+        if (header.sequence != expected) {
+            ERR("expected message %u, got %u\n", expected, header.sequence);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        expected++;
+
+        const uint8_t* payload = bytes + sizeof(header);
+        size_t payload_size = actual_bytes - sizeof(header);
+
+        // Large payloads arrive in a VMO; read them in place.
+        zx_vaddr_t mapping = 0;
+        size_t mapping_size = 0;
+        if (header.flags & kFlagVmo) {
+            st = map_payload(vmo, payload, static_cast<uint32_t>(payload_size),
+                             &payload, &payload_size, &mapping, &mapping_size);
+            if (st != ZX_OK) {
+                ERR("failed to map payload, st = %d\n", st);
+                return st;
+            }
+        }
+        auto unmap = fbl::MakeAutoCall([mapping, mapping_size]() {
+            if (mapping != 0) {
+                zx_vmar_unmap(zx_vmar_root_self(), mapping, mapping_size);
+            }
+        });
+
+        if (!options.bench) {
+            // The payload isn't NUL-terminated; its length is all we need.
+            LOG("%.*s%s\n", static_cast<int>(payload_size),
+                reinterpret_cast<const char*>(payload),
+                (header.flags & kFlagVmo) ? " (vmo)" : "");
+            continue;
+        }
+
+        // Touch every page of a mapped payload so the benchmark pays for
+        // faulting it in, as a real consumer would. An inline payload was
+        // already copied into |message|.
+        if (mapping != 0) {
+            volatile uint8_t sink = 0;
+            for (size_t offset = 0; offset < payload_size; offset += 4096) {
+                sink = sink + payload[offset];
+            }
+        }
+
+        bool end_of_run = header.flags & kFlagEndOfRun;
+        if (end_of_run || expected % kAckInterval == 0) {
+            st = send_ack(channel, expected);
+            if (st != ZX_OK) {
+                ERR("failed to send ack, st = %d\n", st);
+                return st;
+            }
+        }
+        if (end_of_run) {
+            expected = 0;
+        }
     }
 
     return ZX_OK;
-}
\ No newline at end of file
+}
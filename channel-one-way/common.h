@@ -3,11 +3,61 @@
 #include <stdio.h>
 #include <zircon/types.h>
 
-zx_status_t parent(zx_handle_t channel);
-zx_status_t child(zx_handle_t channel);
+#include <histogram/histogram.h>
+#include <logger/logger.h>
 
-#define ERR(fmt, ...) fprintf(stderr, LOG_PREFIX " " fmt, ##__VA_ARGS__);
-#define LOG(fmt, ...) fprintf(stdout, LOG_PREFIX " " fmt, ##__VA_ARGS__);
+// Options shared by the parent and the child. The parent forwards its command
+// line to the child, so both sides always agree on the mode.
+typedef struct options {
+    // Measure throughput across message sizes instead of running the demo.
+    bool bench;
+    // Most messages sent per message size.
+    uint64_t messages;
+    // Most bytes sent per message size; large messages stop here first.
+    uint64_t bytes;
+    // How the benchmark reports its results.
+    histogram::Format format;
+    // Payloads larger than this many bytes go into a VMO and only its handle
+    // is sent. Anything over kMaxPayload always does.
+    uint64_t vmo_threshold;
+    // Compare inline and VMO transfers across payload sizes instead.
+    bool crossover;
+    // Write every traced IPC call to <trace>.<process id>.json as a Chrome
+    // trace when the process exits. nullptr disables the dump; events are
+    // recorded either way.
+    const char* trace;
+} options_t;
 
-// Number of bytes in the message we're going to send over the channel.
-constexpr size_t kMessageLength = 32;
\ No newline at end of file
+zx_status_t parent(zx_handle_t channel, const options_t& options);
+zx_status_t child(zx_handle_t channel, const options_t& options);
+
+// Every message starts with this header and the payload follows it directly.
+// The payload's length is whatever is left of the message; the parent sends
+// the two as separate fragments so the payload is never copied into a
+// staging buffer first.
+typedef struct message_header {
+    // Counts up from 0 within a demo or benchmark run.
+    uint32_t sequence;
+    uint32_t flags;
+} message_header_t;
+
+// Set on the last message of a benchmark run.
+constexpr uint32_t kFlagEndOfRun = 1u << 0;
+// The payload is in the VMO that comes with the message. The inline payload is
+// then a uint64_t holding its length; the VMO itself is rounded up to pages.
+constexpr uint32_t kFlagVmo = 1u << 1;
+
+constexpr size_t kMaxPayload = ZX_CHANNEL_MAX_MSG_BYTES - sizeof(message_header_t);
+
+// By default only payloads that don't fit in one message go into a VMO. On
+// the host backend a fresh memfd per payload (creating, filling, mapping and
+// faulting it in) never catches up with copying through the socket, even at
+// 4 MiB; run --crossover to find the point on other systems.
+constexpr uint64_t kDefaultVmoThreshold = kMaxPayload;
+
+// Benchmark flow control. Zircon channels don't push back on a writer, so the
+// child reports how many messages it has received every kAckInterval messages
+// (and at the end of a run) and the parent never gets more than kMaxUnacked
+// ahead of it. Acks are a single uint64_t.
+constexpr uint32_t kAckInterval = 64;
+constexpr uint32_t kMaxUnacked = 4 * kAckInterval;
@@ -1,96 +1,113 @@
 // This program creates a child process and hands it one end of a channel.
 // Then it sends periodic messages to the child process which prints them out
 // on stdout.
-
+//
+// Usage: channel-one-way [--bench] [--crossover] [--messages=N] [--bytes=N]
+//                        [--vmo-threshold=N] [--format=text|csv|json]
+//                        [--trace=PREFIX]
+//
+// Messages are a small header followed by a payload of any length up to the
+// channel's limit, written as two fragments. --bench streams messages of 16 B
+// up to 64 KiB to the child and reports the throughput at each size; each
+// size sends at most --messages messages and --bytes bytes.
+// Payloads over --vmo-threshold bytes are written into a VMO and only its
+// handle goes through the channel; the child maps it to read the payload.
+// This holds for --bench too, whose sizes all fit inline under the default.
+// --crossover sends payloads from 1 KiB to 4 MiB both ways and reports the
+// size from which the VMO is faster.
+// --trace=PREFIX writes each process's IPC calls to PREFIX.<pid>.json as a
+// Chrome trace when it exits.
+
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include <fbl/auto_call.h>
-#include <lib/fdio/spawn.h>
+#include <spawn/spawn.h>
+#include <trace/trace.h>
 
-#include <zircon/process.h>
-#include <zircon/processargs.h>
 #include <zircon/syscalls.h>
 #include <zircon/types.h>
 
 #include "common.h"
 
-// Pass this as a command line argument to start as a child, otherwise start
-// as a parent.
-const char* kCmdLineChild = "child";
-
-// Create a channel, spawn a child process and give it one end of the channel
-// we just created.
-zx_status_t spawn_child(const char* path, zx_handle_t* out) {
-    zx_status_t st;
-
-    const uint32_t kFlags = FDIO_SPAWN_CLONE_ALL;
-    const char* kChildProcessArgs[] = {kCmdLineChild, nullptr};
-    char error_bufffer[FDIO_SPAWN_ERR_MSG_MAX_LENGTH];
-
-    // Create a channel.
-    zx_handle_t mine = ZX_HANDLE_INVALID;
-    zx_handle_t other = ZX_HANDLE_INVALID;
-    st = zx_channel_create(0, &mine, &other);
-    if (st != ZX_OK) {
-        fprintf(stderr, "[PARENT]: Failed to create channel, st = %d\n", st);
-        return st;
-    }
-    *out = mine;
-
-    // Cleanup the channels we just created if something goes wrong below.
-    auto cleanup_on_failure = fbl::MakeAutoCall([mine, other]() {
-        zx_handle_close(mine);
-        zx_handle_close(other);
-    });
-
-    // This struct is a list of things that we're going to pass to the child
-    // process.
-    const fdio_spawn_action_t actions[] = {
-        {.action = FDIO_SPAWN_ACTION_SET_NAME, .name = {.data = "child"}},
-        {.action = FDIO_SPAWN_ACTION_ADD_HANDLE, .h = {.id = PA_USER0, .handle = other}},
-    };
-
-    // Start the child process.
-    st = fdio_spawn_etc(
-        ZX_HANDLE_INVALID, // Job handle, invalid uses default job
-        kFlags,
-        path,
-        kChildProcessArgs, // child process arguments.
-        nullptr,           // environment, not needed for us.
-        countof(actions),
-        actions,
-        nullptr, // process out handle, ignored for now.
-        error_bufffer);
-
-    if (st != ZX_OK) {
-        fprintf(stderr, "could not spawn child process, st = %d\n", st);
-        fprintf(stderr, "reason: %s\n", error_bufffer);
-        return st;
+// Parses the options shared by the parent and the child. Returns false if an
+// argument is malformed.
+bool parse_options(int argc, const char* argv[], options_t* options) {
+    options->bench = false;
+    options->messages = 200000;
+    options->bytes = 1ull << 30;
+    options->format = histogram::Format::kText;
+    options->trace = nullptr;
+    options->vmo_threshold = kDefaultVmoThreshold;
+    options->crossover = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (!strcmp(arg, spawn::kChildArg)) {
+            continue;
+        } else if (!strcmp(arg, "--bench")) {
+            options->bench = true;
+        } else if (!strncmp(arg, "--messages=", 11)) {
+            options->messages = strtoull(arg + 11, nullptr, 0);
+        } else if (!strncmp(arg, "--bytes=", 8)) {
+            options->bytes = strtoull(arg + 8, nullptr, 0);
+        } else if (!strcmp(arg, "--crossover")) {
+            options->bench = true;
+            options->crossover = true;
+        } else if (!strncmp(arg, "--vmo-threshold=", 16)) {
+            options->vmo_threshold = strtoull(arg + 16, nullptr, 0);
+        } else if (!strncmp(arg, "--trace=", 8)) {
+            options->trace = arg + 8;
+        } else if (!strncmp(arg, "--format=", 9)) {
+            if (!histogram::ParseFormat(arg + 9, &options->format)) {
+                fprintf(stderr, "unknown format '%s'\n", arg + 9);
+                return false;
+            }
+        } else {
+            fprintf(stderr, "unknown argument '%s'\n", arg);
+            return false;
+        }
     }
-
-    cleanup_on_failure.cancel();
-    return ZX_OK;
+    return true;
 }
 
 int main(int argc, const char* argv[]) {
-    bool is_child = false;
+    bool is_child = spawn::IsChild(argc, argv);
 
-    for (int i = 0; i < argc; i++) {
-        if (!strcmp(kCmdLineChild, argv[i])) {
-            is_child = true;
-        }
+    options_t options;
+    if (!parse_options(argc, argv, &options)) {
+        return -1;
+    }
+    if (options.trace != nullptr) {
+        trace::Start(options.trace, is_child ? "child" : "parent");
     }
 
     if (is_child) {
-        zx_handle_t to_parent = zx_take_startup_handle(PA_HND(PA_USER0, 0));
-        return child(to_parent);
+        zx_handle_t to_parent;
+        zx_status_t st = spawn::TakeBootstrap(&to_parent);
+        if (st != ZX_OK) {
+            fprintf(stderr, "[CHILD]: Failed to take bootstrap channel, st = %d\n", st);
+            return st;
+        }
+        return child(to_parent, options);
     } else {
-        zx_handle_t to_child;
-        char path[64];
-        snprintf(path, sizeof(path), "/boot/bin/%s", argv[0]);
-        spawn_child(path, &to_child);
-        return parent(to_child);
+        char path[PATH_MAX];
+        const char* args[spawn::kMaxArgs + 2];
+        zx_status_t st = spawn::SelfPath(argv[0], path, sizeof(path));
+        if (st == ZX_OK) {
+            st = spawn::ChildArgs(argc, argv, args);
+        }
+        if (st != ZX_OK) {
+            fprintf(stderr, "[PARENT]: Can't build child command line, st = %d\n", st);
+            return st;
+        }
+        spawn::child_t to_child = {};
+        st = spawn::Spawn(path, args, &to_child, 1);
+        if (st != ZX_OK) {
+            return st;
+        }
+        return parent(to_child.channel, options);
     }
 
     // Shouldn't get here.
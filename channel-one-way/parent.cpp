@@ -1,42 +1,333 @@
 #define LOG_PREFIX "[PARNT]"
 #include "common.h"
 
+#include <inttypes.h>
 #include <string.h>
 
-#include <fbl/auto_call.h>
+#include <memory>
+
 #include <sys/types.h>
+#include <trace/syscalls.h>
+#include <typed/handle.h>
 #include <zircon/syscalls.h>
 
 // Send this many messages before quitting.
 constexpr uint kNumMessages = 10;
 
-// Put some delays between actions so it's easier to follow the output of
-// stdout. Also, since both processes share stdout, these delays prevent
-// interleaving.
-constexpr uint kMessageTimeoutMs = 100;
+namespace {
+
+// Sends |header| followed by |payload_size| bytes of |payload| as one message.
+// The kernel gathers the two fragments, so the payload is read straight from
+// the caller's buffer.
+zx_status_t write_message(const typed::Handle& channel,
+                          const message_header_t& header,
+                          const void* payload, uint32_t payload_size) {
+    if (payload_size > kMaxPayload) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    const zx_channel_iovec_t fragments[] = {
+        {&header, sizeof(header), 0},
+        {payload, payload_size, 0},
+    };
+    return trace::channel_write(channel.get(), ZX_CHANNEL_WRITE_USE_IOVEC,
+                                fragments, countof(fragments), nullptr, 0);
+}
+
+// Copies |size| bytes of |payload| into a new VMO.
+zx_status_t make_payload_vmo(const void* payload, uint64_t size,
+                             typed::Handle* out) {
+    zx_status_t st = zx_vmo_create(size, 0, out->reset_and_get_address());
+    if (st != ZX_OK) {
+        return st;
+    }
+    return zx_vmo_write(out->get(), payload, 0, size);
+}
+
+// Sends |header| with kFlagVmo and the length of the payload in |vmo|, and
+// hands |vmo| over to the child. On the host backend a write that fails
+// leaves the handle with us, so |vmo| can be sent again after SHOULD_WAIT.
+zx_status_t write_vmo_message(const typed::Handle& channel,
+                              message_header_t header, uint64_t size,
+                              typed::Handle* vmo) {
+    header.flags |= kFlagVmo;
+    const zx_channel_iovec_t fragments[] = {
+        {&header, sizeof(header), 0},
+        {&size, sizeof(size), 0},
+    };
+    zx_handle_t handle = vmo->get();
+    zx_status_t st = trace::channel_write(
+        channel.get(), ZX_CHANNEL_WRITE_USE_IOVEC, fragments,
+        countof(fragments), &handle, 1);
+    if (st == ZX_OK) {
+        vmo->release();
+    }
+    return st;
+}
+
+// Reads every ack the child has sent so far into |acked|.
+zx_status_t drain_acks(const typed::Handle& channel, uint64_t* acked) {
+    while (true) {
+        uint64_t received;
+        uint32_t actual_bytes;
+        zx_status_t st = trace::channel_read(
+            channel.get(), 0, &received, nullptr, sizeof(received), 0,
+            &actual_bytes, nullptr);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            return ZX_OK;
+        } else if (st != ZX_OK) {
+            return st;
+        } else if (actual_bytes != sizeof(received)) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        *acked = received;
+    }
+}
+
+// Waits for |signals| while picking up acks, until one of |signals| other than
+// READABLE is asserted or |done()| holds.
+template <typename Done>
+zx_status_t wait_for(const typed::Handle& channel, zx_signals_t signals,
+                     uint64_t* acked, Done done) {
+    while (!done()) {
+        zx_signals_t observed;
+        zx_status_t st = trace::object_wait_one(
+            channel.get(), signals | ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+            ZX_TIME_INFINITE, &observed);
+        if (st != ZX_OK) {
+            return st;
+        }
+        if (observed & ZX_CHANNEL_READABLE) {
+            st = drain_acks(channel, acked);
+            if (st != ZX_OK) {
+                return st;
+            }
+        } else if (observed & ZX_CHANNEL_PEER_CLOSED) {
+            return ZX_ERR_PEER_CLOSED;
+        }
+        if (observed & signals & ~ZX_CHANNEL_READABLE) {
+            return ZX_OK;
+        }
+    }
+    return ZX_OK;
+}
+
+// Per-run state of the benchmark sender.
+typedef struct sender {
+    const typed::Handle& channel;
+    // Messages in the run, messages sent so far, and messages the child has
+    // acked.
+    uint64_t total;
+    uint64_t sent;
+    uint64_t acked;
+} sender_t;
 
-zx_status_t parent(zx_handle_t channel) {
-    // Close the channel when we exit this scope.
-    auto channel_cleanup = fbl::MakeAutoCall([channel]() {
-        zx_handle_close(channel);
+// Sends one message with |write(header)|, first waiting until the child has
+// caught up and retrying while the channel is full.
+template <typename Write>
+zx_status_t send_one(sender_t* sender, Write write) {
+    zx_status_t st = wait_for(sender->channel, 0, &sender->acked, [sender] {
+        return sender->sent - sender->acked < kMaxUnacked;
     });
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    message_header_t header = {
+        static_cast<uint32_t>(sender->sent),
+        sender->sent + 1 == sender->total ? kFlagEndOfRun : 0};
+    while ((st = write(header)) == ZX_ERR_SHOULD_WAIT) {
+        st = wait_for(sender->channel, ZX_CHANNEL_WRITABLE, &sender->acked,
+                      [] { return false; });
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+    if (st != ZX_OK) {
+        ERR("zx_channel_write failed with st = %d\n", st);
+        return st;
+    }
+    sender->sent++;
+    return ZX_OK;
+}
+
+// Sends |count| payloads of |size| bytes and returns once the child has
+// received all of them. Payloads up to |vmo_threshold| bytes are copied
+// through the channel, split into kMaxPayload messages if they have to be;
+// larger ones go in a VMO each.
+zx_status_t bench_run(const typed::Handle& channel, const uint8_t* payload,
+                      uint64_t size, uint64_t count, uint64_t vmo_threshold) {
+    bool use_vmo = size > vmo_threshold;
+    uint64_t messages_per_payload =
+        use_vmo ? 1 : (size + kMaxPayload - 1) / kMaxPayload;
+    if (messages_per_payload == 0) {
+        messages_per_payload = 1;
+    }
+    sender_t sender = {channel, count * messages_per_payload, 0, 0};
+
+    for (uint64_t i = 0; i < count; i++) {
+        zx_status_t st;
+        if (use_vmo) {
+            typed::Handle vmo;
+            st = make_payload_vmo(payload, size, &vmo);
+            if (st != ZX_OK) {
+                ERR("failed to fill payload VMO, st = %d\n", st);
+                return st;
+            }
+            st = send_one(&sender, [&](const message_header_t& header) {
+                return write_vmo_message(channel, header, size, &vmo);
+            });
+            if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        }
+
+        for (uint64_t m = 0; m < messages_per_payload; m++) {
+            uint64_t offset = m * kMaxPayload;
+            uint32_t len = static_cast<uint32_t>(
+                size - offset < kMaxPayload ? size - offset : kMaxPayload);
+            st = send_one(&sender, [&](const message_header_t& header) {
+                return write_message(channel, header, payload + offset, len);
+            });
+            if (st != ZX_OK) {
+                return st;
+            }
+        }
+    }
+
+    return wait_for(channel, 0, &sender.acked,
+                    [&sender] { return sender.acked == sender.total; });
+}
+
+// Sends payloads of |size| bytes for the benchmark, capped by --messages and
+// --bytes, and returns the rate in payloads per second.
+zx_status_t bench_size(const typed::Handle& channel, const uint8_t* payload,
+                       uint64_t size, uint64_t vmo_threshold,
+                       const options_t& options, double* payloads_per_sec) {
+    uint64_t count = options.bytes / size;
+    if (count > options.messages) {
+        count = options.messages;
+    }
+    if (count == 0) {
+        count = 1;
+    }
+
+    zx_time_t start = zx_clock_get_monotonic();
+    zx_status_t st = bench_run(channel, payload, size, count, vmo_threshold);
+    zx_time_t end = zx_clock_get_monotonic();
+    if (st != ZX_OK) {
+        ERR("benchmark failed at %" PRIu64 " bytes, st = %d\n", size, st);
+        return st;
+    }
+    *payloads_per_sec = count / (static_cast<double>(end - start) / ZX_SEC(1));
+    return ZX_OK;
+}
+
+// Message throughput for every message size from 16 B up to 64 KiB. Payloads
+// over --vmo-threshold go in a VMO; with the default threshold every one of
+// them is copied through the channel.
+zx_status_t bench(const typed::Handle& channel, const options_t& options) {
+    std::unique_ptr<uint8_t[]> payload(new uint8_t[kMaxPayload]);
+    for (size_t i = 0; i < kMaxPayload; i++) {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+
+    // 16 B is a header and 8 bytes of payload; 64 KiB fills the channel's
+    // largest message.
+    for (uint32_t size = 16; size <= ZX_CHANNEL_MAX_MSG_BYTES; size *= 4) {
+        double rate;
+        zx_status_t st = bench_size(channel, payload.get(),
+                                    size - sizeof(message_header_t),
+                                    options.vmo_threshold, options, &rate);
+        if (st != ZX_OK) {
+            return st;
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "channel-one-way.%u.throughput", size);
+        histogram::PrintValue(stdout, name, "MiB/s", rate * size / (1 << 20),
+                              options.format);
+        snprintf(name, sizeof(name), "channel-one-way.%u.messages", size);
+        histogram::PrintValue(stdout, name, "msg/s", rate, options.format);
+    }
+    return ZX_OK;
+}
+
+// Payload sizes the crossover benchmark compares; the largest needs 65
+// messages inline, since 4 MiB is just over 64 kMaxPayload payloads.
+constexpr uint64_t kMinCrossoverSize = 1 << 10;
+constexpr uint64_t kMaxCrossoverSize = 4 << 20;
+
+// Sends every payload size both inline and in a VMO and reports the smallest
+// size from which the VMO stays ahead.
+zx_status_t crossover(const typed::Handle& channel, const options_t& options) {
+    std::unique_ptr<uint8_t[]> payload(new uint8_t[kMaxCrossoverSize]);
+    for (size_t i = 0; i < kMaxCrossoverSize; i++) {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+
+    uint64_t crossover = 0;
+    for (uint64_t size = kMinCrossoverSize; size <= kMaxCrossoverSize; size *= 2) {
+        double inline_rate;
+        double vmo_rate;
+        zx_status_t st = bench_size(channel, payload.get(), size, UINT64_MAX,
+                                    options, &inline_rate);
+        if (st != ZX_OK) {
+            return st;
+        }
+        st = bench_size(channel, payload.get(), size, 0, options, &vmo_rate);
+        if (st != ZX_OK) {
+            return st;
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "channel-one-way.crossover.%" PRIu64 ".inline", size);
+        histogram::PrintValue(stdout, name, "MiB/s",
+                              inline_rate * size / (1 << 20), options.format);
+        snprintf(name, sizeof(name), "channel-one-way.crossover.%" PRIu64 ".vmo", size);
+        histogram::PrintValue(stdout, name, "MiB/s",
+                              vmo_rate * size / (1 << 20), options.format);
+
+        if (vmo_rate <= inline_rate) {
+            crossover = 0;
+        } else if (crossover == 0) {
+            crossover = size;
+        }
+    }
+
+    // 0 means inline copies won at the largest size too.
+    histogram::PrintValue(stdout, "channel-one-way.crossover", "bytes",
+                          static_cast<double>(crossover), options.format);
+    return ZX_OK;
+}
+
+} // namespace
+
+zx_status_t parent(zx_handle_t handle, const options_t& options) {
+    // The channel closes when |channel| goes out of scope.
+    typed::Handle channel(handle);
+
+    if (options.crossover) {
+        return crossover(channel, options);
+    } else if (options.bench) {
+        return bench(channel, options);
+    }
 
     for (uint i = 0; i < kNumMessages; i++) {
-        // Format a message for the client to print into this buffer.
-        char message[kMessageLength];
-        memset(message, 0, kMessageLength);
-        snprintf(message, sizeof(message), "Hello World %d of %d!",
-                 i + 1, kNumMessages);
+        // Format the payload for the client to print. Only the characters
+        // are sent; the child learns the length from the message size.
+        char text[64];
+        int length = snprintf(text, sizeof(text), "Hello World %d of %d!",
+                              i + 1, kNumMessages);
 
         // Print a message to stdout telling the user what we're about to do.
-        LOG("Sending Message '%s'\n", message);
-        zx_nanosleep(zx_deadline_after(ZX_MSEC(kMessageTimeoutMs)));
+        LOG("Sending Message '%s'\n", text);
 
         // Wait for the channel to become writeable or for the remote process
         // to close the handle.
         zx_signals_t signals;
-        zx_status_t st = zx_object_wait_one(
-            channel, ZX_CHANNEL_WRITABLE | ZX_CHANNEL_PEER_CLOSED,
+        zx_status_t st = trace::object_wait_one(
+            channel.get(), ZX_CHANNEL_WRITABLE | ZX_CHANNEL_PEER_CLOSED,
             ZX_TIME_INFINITE, &signals);
 
         if (st != ZX_OK) {
@@ -52,25 +343,28 @@ zx_status_t parent(zx_handle_t channel) {
             return ZX_CHANNEL_PEER_CLOSED;
         }
 
-        // Write our message into the channel.
-        st = zx_channel_write(
-            channel,
-            0,                        // Options, must be zero for now.
-            message, sizeof(message), // Buffer of data to send
-            nullptr, 0                // Don't transfer any handles
-            );
+        // Write the header and the text as one message, or hand the text
+        // over in a VMO if it is over the threshold.
+        message_header_t header = {i, 0};
+        if (static_cast<uint64_t>(length) > options.vmo_threshold) {
+            typed::Handle vmo;
+            st = make_payload_vmo(text, length, &vmo);
+            if (st == ZX_OK) {
+                st = write_vmo_message(channel, header, length, &vmo);
+            }
+        } else {
+            st = write_message(channel, header, text,
+                               static_cast<uint32_t>(length));
+        }
 
         if (st != ZX_OK) {
             ERR("zx_channel_write failed with st = %d\n", st);
             return st;
         }
-
-        zx_nanosleep(zx_deadline_after(ZX_MSEC(kMessageTimeoutMs)));
     }
 
-    // Channel will close automatically because of the fbl::AutoCall above.
+    // Channel will close automatically when |channel| goes out of scope.
     LOG("Closing channel...\n");
-    zx_nanosleep(zx_deadline_after(ZX_MSEC(500)));
 
     return ZX_OK;
 }
@@ -14,7 +14,15 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/parent.cpp	\
     $(LOCAL_DIR)/child.cpp
 
-MODULE_STATIC_LIBS := system/ulib/pretty system/ulib/fbl
+MODULE_STATIC_LIBS := system/ulib/pretty system/ulib/fbl \
+    $(dir $(LOCAL_DIR))ulib/histogram \
+    $(dir $(LOCAL_DIR))ulib/logger \
+    $(dir $(LOCAL_DIR))ulib/msgpool \
+    $(dir $(LOCAL_DIR))ulib/spawn \
+    $(dir $(LOCAL_DIR))ulib/trace
+
+# Header-only.
+MODULE_COMPILEFLAGS += -I$(dir $(LOCAL_DIR))ulib/typed/include
 
 MODULE_LIBS := system/ulib/fdio system/ulib/c  system/ulib/zircon
 
@@ -4,70 +4,597 @@
 #include <string.h>
 
 #include <fbl/auto_call.h>
+#include <msgpool/msgpool.h>
+#include <mux/mux.h>
+#include <procpool/procpool.h>
+#include <spinwait/spinwait.h>
 #include <sys/types.h>
+#include <trace/syscalls.h>
 #include <zircon/syscalls.h>
 
+#include <memory>
+
 constexpr uint kNumRequests = 10;
 
-zx_status_t child(zx_handle_t channel) {
-    // Close this end of the channel if we exit.
-    auto channel_cleanup = fbl::MakeAutoCall([channel]() {
-        zx_handle_close(channel);
+// Pipelined txids are (sequence << kSlotBits) | slot, where slot indexes the
+// request's entry in the in-flight table.
+constexpr uint32_t kSlotBits = 12;
+constexpr uint32_t kSlotMask = (1u << kSlotBits) - 1;
+static_assert(kMaxWindow <= (1u << kSlotBits), "window too large for txid");
+
+// A request that has been sent but not yet answered.
+typedef struct pending_request {
+    add_request_t request;
+    zx_time_t sent;
+    bool in_flight;
+} pending_request_t;
+
+// Send one request to the server and get its response with a single
+// zx_channel_call. The call replaces the request's txid with its own, which
+// the server copies into the response like any other.
+static zx_status_t add_call(AddClient* channel, const add_request_t& request,
+                            add_response_t* response) {
+    zx_status_t st = channel->Call(request, response, ZX_TIME_INFINITE);
+    if (st != ZX_OK) {
+        ERR("zx_channel_call failed with st = %d\n", st);
+    }
+    return st;
+}
+
+// Send one request to the server and wait for its response.
+static zx_status_t add(AddClient* channel, const add_request_t& request,
+                       add_response_t* response, spinwait::Waiter* waiter,
+                       const options_t& options) {
+    if (options.call) {
+        return add_call(channel, request, response);
+    }
+
+    zx_status_t st = send_message(channel, request, options.write_first,
+                                  nullptr);
+    if (st == ZX_ERR_PEER_CLOSED) {
+        ERR("server closed channel unexpectedly\n");
+        return st;
+    } else if (st != ZX_OK) {
+        ERR("failed to send request, st = %d\n", st);
+        return st;
+    }
+
+    // The response usually comes back quickly, so this is where spinning
+    // pays off.
+    zx_signals_t signals;
+    trace::Span span(trace::Op::kObjectWait);
+    st = waiter->Wait(channel->handle().get(),
+                      ZX_CHANNEL_PEER_CLOSED | ZX_CHANNEL_READABLE, &signals);
+    span.End(st, signals);
+
+    if (st != ZX_OK) {
+        ERR("zx_object_wait_one failed with st = %d\n", st);
+        return st;
+    }
+
+    st = channel->Read(response);
+    if (st != ZX_OK) {
+        ERR("zx_channel_read failed with st = %d\n", st);
+        return st;
+    }
+
+    return ZX_OK;
+}
+
+// Send |count| requests keeping up to |window| of them in flight, and call
+// |on_response(request, response, latency)| as each response arrives, in
+// whatever order the server answers.
+template <typename Callback>
+static zx_status_t pipeline(AddClient* channel, uint32_t window,
+                            uint64_t count, spinwait::Waiter* waiter,
+                            Callback on_response) {
+    pending_request_t* slots = new pending_request_t[window];
+    uint32_t* free_slots = new uint32_t[window];
+    auto slots_cleanup = fbl::MakeAutoCall([slots, free_slots]() {
+        delete[] slots;
+        delete[] free_slots;
     });
 
-    for (uint i = 0; i < kNumRequests; i++) {
-        add_request_t request = {.a = i, .b = i + 1};
-        add_response_t response;
+    uint32_t num_free = window;
+    for (uint32_t i = 0; i < window; i++) {
+        slots[i].in_flight = false;
+        free_slots[i] = window - 1 - i;
+    }
+
+    uint32_t sequence = 0;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    bool write_blocked = false;
+
+    while (received < count) {
+        // Top up the window.
+        while (!write_blocked && sent < count && num_free > 0) {
+            uint32_t slot = free_slots[num_free - 1];
+            sequence = (sequence + 1) & (UINT32_MAX >> kSlotBits);
+            if (sequence == 0) {
+                sequence = 1;
+            }
+
+            pending_request_t* pending = &slots[slot];
+            pending->request.txid = (sequence << kSlotBits) | slot;
+            pending->request.a = static_cast<uint32_t>(sent);
+            pending->request.b = static_cast<uint32_t>(sent + 1);
+            pending->sent = zx_clock_get_monotonic();
+
+            zx_status_t st = channel->Write(pending->request);
+            if (st == ZX_ERR_SHOULD_WAIT) {
+                write_blocked = true;
+                break;
+            } else if (st != ZX_OK) {
+                ERR("zx_channel_write failed with st = %d\n", st);
+                return st;
+            }
+
+            pending->in_flight = true;
+            num_free--;
+            sent++;
+        }
+
+        // Collect every response that is already here.
+        while (true) {
+            add_response_t response;
+            zx_status_t st = channel->Read(&response);
+            if (st == ZX_ERR_SHOULD_WAIT) {
+                break;
+            } else if (st != ZX_OK) {
+                ERR("zx_channel_read failed with st = %d\n", st);
+                return st;
+            }
 
-        zx_signals_t signals;
-        zx_status_t st = zx_object_wait_one(
-            channel, ZX_CHANNEL_PEER_CLOSED | ZX_CHANNEL_WRITABLE,
-            ZX_TIME_INFINITE, &signals);
+            zx_time_t now = zx_clock_get_monotonic();
+            uint32_t slot = response.txid & kSlotMask;
+            if (slot >= window || !slots[slot].in_flight ||
+                slots[slot].request.txid != response.txid) {
+                ERR("response with unknown txid %u\n", response.txid);
+                return ZX_ERR_INTERNAL;
+            }
 
+            on_response(slots[slot].request, response, now - slots[slot].sent);
+            slots[slot].in_flight = false;
+            free_slots[num_free++] = slot;
+            received++;
+        }
+
+        if (received == count) {
+            break;
+        }
+        if (!write_blocked && sent < count && num_free > 0) {
+            continue;
+        }
+
+        // Nothing more to send for now; sleep until a response arrives (or
+        // the channel drains, if a write was refused).
+        zx_signals_t wait_for = ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED;
+        if (write_blocked) {
+            wait_for |= ZX_CHANNEL_WRITABLE;
+        }
+        zx_signals_t signals = 0;
+        trace::Span span(trace::Op::kObjectWait);
+        zx_status_t st = waiter->Wait(channel->handle().get(), wait_for,
+                                      &signals);
+        span.End(st, signals);
         if (st != ZX_OK) {
             ERR("zx_object_wait_one failed with st = %d\n", st);
             return st;
         }
-
-        if (signals & ZX_CHANNEL_PEER_CLOSED) {
+        if ((signals & ZX_CHANNEL_PEER_CLOSED) &&
+            !(signals & ZX_CHANNEL_READABLE)) {
             ERR("server closed channel unexpectedly\n");
             return ZX_ERR_PEER_CLOSED;
         }
+        if (signals & ZX_CHANNEL_WRITABLE) {
+            write_blocked = false;
+        }
+    }
+
+    return ZX_OK;
+}
+
+// Time |options.iterations| round trips and print their latency distribution.
+// With a window above 1 the requests are pipelined and the aggregate request
+// rate is reported as well.
+static zx_status_t bench(AddClient* channel, const options_t& options) {
+    // Too big for the stack.
+    histogram::Histogram* latency = new histogram::Histogram();
+    auto latency_cleanup = fbl::MakeAutoCall([latency]() {
+        delete latency;
+    });
+
+    bool bad_response = false;
+    auto check = [&bad_response](const add_request_t& request,
+                                 const add_response_t& response) {
+        if (response.result != request.a + request.b) {
+            ERR("bad response %u + %u = %u\n", request.a, request.b,
+                response.result);
+            bad_response = true;
+        }
+    };
+
+    spinwait::Waiter waiter(options.spin);
+    zx_status_t st;
+    zx_time_t start = 0;
+    zx_time_t end = 0;
+    trace::counts_t before = {};
+    trace::counts_t after = {};
+
+    if (options.window == 1) {
+        uint64_t total = options.warmup + options.iterations;
+        for (uint64_t i = 0; i < total; i++) {
+            if (i == options.warmup) {
+                before = trace::ThreadCounts();
+                start = zx_clock_get_monotonic();
+            }
 
-        st = zx_channel_write(
-            channel,
-            0,
-            &request, sizeof(request),
-            nullptr, 0);
+            add_request_t request = {.txid = 1, .a = static_cast<uint32_t>(i), .b = 1};
+            add_response_t response;
 
+            zx_time_t sent = zx_clock_get_monotonic();
+            st = add(channel, request, &response, &waiter, options);
+            zx_time_t received = zx_clock_get_monotonic();
+
+            if (st != ZX_OK) {
+                return st;
+            }
+            check(request, response);
+            if (i >= options.warmup) {
+                latency->Record(static_cast<uint64_t>(received - sent));
+            }
+        }
+        end = zx_clock_get_monotonic();
+        after = trace::ThreadCounts();
+    } else {
+        st = pipeline(channel, options.window, options.warmup, &waiter,
+                      [&](const add_request_t& request,
+                          const add_response_t& response, zx_duration_t) {
+                          check(request, response);
+                      });
+        if (st != ZX_OK) {
+            return st;
+        }
+
+        before = trace::ThreadCounts();
+        start = zx_clock_get_monotonic();
+        st = pipeline(channel, options.window, options.iterations, &waiter,
+                      [&](const add_request_t& request,
+                          const add_response_t& response,
+                          zx_duration_t elapsed) {
+                          check(request, response);
+                          latency->Record(static_cast<uint64_t>(elapsed));
+                      });
+        end = zx_clock_get_monotonic();
+        after = trace::ThreadCounts();
         if (st != ZX_OK) {
-            ERR("zx_channel_write failed with st = %d\n", st);
             return st;
         }
+    }
+
+    if (bad_response) {
+        return ZX_ERR_INTERNAL;
+    }
+
+    char name[96];
+    snprintf(name, sizeof(name), "%s.round_trip", options.prefix);
+    latency->Print(stdout, name, "ns", options.format);
+
+    double seconds = static_cast<double>(end - start) / ZX_SEC(1);
+    double rate = seconds > 0 ? options.iterations / seconds : 0;
+    snprintf(name, sizeof(name), "%s.throughput", options.prefix);
+    histogram::PrintValue(stdout, name, "req/s", rate, options.format);
+    snprintf(name, sizeof(name), "%s.client.syscalls_per_round_trip",
+             options.prefix);
+    print_syscalls(name, before, after, options.iterations, options.format);
+    if (options.spin > 0) {
+        snprintf(name, sizeof(name), "%s.client.wait", options.prefix);
+        waiter.PrintCounters(stdout, name, options.format);
+    }
+
+    // The server prints its own counters once we hang up; make sure our
+    // report is out first.
+    fflush(stdout);
+    return ZX_OK;
+}
+
+// Per-connection state of the multi-client load generator.
+typedef struct connection {
+    zx_handle_t channel;
+    add_request_t request;
+    uint64_t remaining;
+} connection_t;
+
+static zx_status_t send_request(connection_t* conn, zx_handle_t port,
+                                uint64_t key) {
+    conn->request.a = static_cast<uint32_t>(conn->remaining);
+    conn->request.b = static_cast<uint32_t>(key);
+    zx_status_t st = trace::channel_write(conn->channel, 0, &conn->request,
+                                          sizeof(conn->request), nullptr, 0);
+    if (st != ZX_OK) {
+        ERR("zx_channel_write failed with st = %d\n", st);
+        return st;
+    }
+    st = zx_object_wait_async(conn->channel, port, key,
+                              ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                              ZX_WAIT_ASYNC_ONCE);
+    if (st != ZX_OK) {
+        ERR("zx_object_wait_async failed with st = %d\n", st);
+    }
+    return st;
+}
 
-        st = zx_object_wait_one(channel,
-                                ZX_CHANNEL_PEER_CLOSED | ZX_CHANNEL_READABLE,
-                                ZX_TIME_INFINITE, &signals);
+// Sends the next request on |stream|: the number of requests it has left plus
+// the stream id, tagged with the stream id.
+static zx_status_t send_stream_request(mux::Mux* mux, uint32_t stream,
+                                       uint64_t remaining) {
+    add_request_t request = {.txid = stream,
+                             .a = static_cast<uint32_t>(remaining),
+                             .b = stream};
+    zx_status_t st = mux->Send(stream, &request, sizeof(request));
+    if (st != ZX_OK) {
+        ERR("can't send on stream %u, st = %d\n", stream, st);
+    }
+    return st;
+}
 
+// The --mux load generator. Take the one channel the parent sends after
+// |header| and drive every stream on it in lockstep until they have all sent
+// their requests.
+static zx_status_t mux_clients(zx_handle_t bootstrap,
+                               const connections_header_t& header) {
+    msgpool::Message message;
+    zx_status_t st;
+    while ((st = message.Read(bootstrap)) == ZX_ERR_SHOULD_WAIT) {
+        st = trace::object_wait_one(
+            bootstrap, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+            ZX_TIME_INFINITE, nullptr);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+    if (st != ZX_OK || message.num_handles() != 1) {
+        ERR("failed to read the mux channel, st = %d\n", st);
+        return st != ZX_OK ? st : ZX_ERR_IO_DATA_INTEGRITY;
+    }
+
+    std::unique_ptr<mux::Mux> mux;
+    st = mux::Mux::Create(message.TakeHandle(0), header.count, kMuxWindow,
+                          &mux);
+    if (st != ZX_OK) {
+        ERR("can't create a mux of %u streams, st = %d\n", header.count, st);
+        return st;
+    }
+
+    std::unique_ptr<uint64_t[]> remaining(new uint64_t[header.count]);
+    for (uint32_t i = 0; i < header.count; i++) {
+        remaining[i] = header.requests_per_connection;
+        st = send_stream_request(mux.get(), i, remaining[i]);
         if (st != ZX_OK) {
-            ERR("zx_object_wait_one failed with st = %d\n", st);
             return st;
         }
+    }
 
-        uint32_t actual_bytes, actual_handles;
-        st = zx_channel_read(
-            channel,
-            0,
-            &response,
-            nullptr,
-            sizeof(response),
-            0,
-            &actual_bytes, &actual_handles);
+    uint32_t live = header.count;
+    while (live > 0) {
+        st = mux->Flush();
+        if (st != ZX_OK && st != ZX_ERR_SHOULD_WAIT) {
+            ERR("failed to flush, st = %d\n", st);
+            return st;
+        }
+        st = mux->Pump();
+        if (st != ZX_OK) {
+            ERR("failed to read responses, st = %d\n", st);
+            return st;
+        }
 
+        bool answered = false;
+        uint32_t stream;
+        while (mux->NextReadable(&stream)) {
+            add_response_t response;
+            uint32_t actual_bytes;
+            st = mux->Receive(stream, &response, sizeof(response),
+                              &actual_bytes);
+            if (st != ZX_OK || actual_bytes != sizeof(response) ||
+                response.txid != stream ||
+                response.result != remaining[stream] + stream) {
+                ERR("bad response on stream %u\n", stream);
+                return ZX_ERR_INTERNAL;
+            }
+            answered = true;
+
+            if (--remaining[stream] == 0) {
+                live--;
+                continue;
+            }
+            st = send_stream_request(mux.get(), stream, remaining[stream]);
+            if (st != ZX_OK) {
+                return st;
+            }
+        }
+
+        // Only block once there is nothing left to do without the parent.
+        if (!answered && live > 0) {
+            st = mux->Wait(ZX_TIME_INFINITE, nullptr);
+            if (st != ZX_OK) {
+                return st;
+            }
+        }
+    }
+    return ZX_OK;
+}
+
+// Multi-client load generator. Receive our share of the connections from the
+// parent, then drive each of them in lockstep from a single port until they
+// have all sent their requests. The parent does the reporting.
+static zx_status_t clients(zx_handle_t bootstrap) {
+    zx_status_t st = trace::object_wait_one(
+        bootstrap, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+        ZX_TIME_INFINITE, nullptr);
+    if (st != ZX_OK) {
+        return st;
+    }
+    connections_header_t header;
+    st = trace::channel_read(bootstrap, 0, &header, nullptr, sizeof(header), 0,
+                             nullptr, nullptr);
+    if (st != ZX_OK) {
+        ERR("failed to read connection header, st = %d\n", st);
+        return st;
+    }
+    if (header.mux) {
+        return mux_clients(bootstrap, header);
+    }
+
+    std::unique_ptr<connection_t[]> conns(new connection_t[header.count]);
+    uint32_t received = 0;
+    auto conns_cleanup = fbl::MakeAutoCall([&conns, &received]() {
+        for (uint32_t i = 0; i < received; i++) {
+            if (conns[i].channel != ZX_HANDLE_INVALID) {
+                zx_handle_close(conns[i].channel);
+            }
+        }
+    });
+
+    // The batches of client ends come in through a pooled message.
+    msgpool::Message batch;
+    while (received < header.count) {
+        st = batch.Read(bootstrap);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            st = trace::object_wait_one(
+                bootstrap, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                ZX_TIME_INFINITE, nullptr);
+            if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        } else if (st != ZX_OK) {
+            ERR("failed to read connections, st = %d\n", st);
+            return st;
+        }
+        for (uint32_t i = 0; i < batch.num_handles() && received < header.count;
+             i++) {
+            conns[received].channel = batch.TakeHandle(i);
+            conns[received].request.txid = received;
+            conns[received].remaining = header.requests_per_connection;
+            received++;
+        }
+    }
+
+    typed::Handle port;
+    st = zx_port_create(0, port.reset_and_get_address());
+    if (st != ZX_OK) {
+        ERR("zx_port_create failed with st = %d\n", st);
+        return st;
+    }
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        st = send_request(&conns[i], port.get(), i);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+
+    uint32_t live = header.count;
+    while (live > 0) {
+        zx_port_packet_t packet;
+        st = trace::port_wait(port.get(), ZX_TIME_INFINITE, &packet);
+        if (st != ZX_OK) {
+            ERR("zx_port_wait failed with st = %d\n", st);
+            return st;
+        }
+
+        connection_t* conn = &conns[packet.key];
+        add_response_t response;
+        st = trace::channel_read(conn->channel, 0, &response, nullptr,
+                                 sizeof(response), 0, nullptr, nullptr);
         if (st != ZX_OK) {
             ERR("zx_channel_read failed with st = %d\n", st);
             return st;
         }
+        if (response.txid != conn->request.txid ||
+            response.result != conn->request.a + conn->request.b) {
+            ERR("bad response on connection %lu\n", packet.key);
+            return ZX_ERR_INTERNAL;
+        }
+
+        if (--conn->remaining == 0) {
+            zx_handle_close(conn->channel);
+            conn->channel = ZX_HANDLE_INVALID;
+            live--;
+            continue;
+        }
+        st = send_request(conn, port.get(), packet.key);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+    return ZX_OK;
+}
+
+zx_status_t child(zx_handle_t handle, const options_t& options) {
+    // This end of the channel closes when |channel| goes out of scope.
+    AddClient channel{typed::Handle(handle)};
+
+    // Started only to be timed; go away once the parent is done with us.
+    if (options.spawn_bench) {
+        return zx_object_wait_one(handle, ZX_CHANNEL_PEER_CLOSED,
+                                  ZX_TIME_INFINITE, nullptr);
+    }
+
+    // Pooled: run jobs until the parent is done with us.
+    if (options.num_client_counts > 0 || options.pool_bench) {
+        return procpool::Serve(
+            handle, [](uint32_t kind, const uint8_t* payload,
+                        uint32_t payload_size, const zx_handle_t* handles,
+                        uint32_t num_handles) {
+                auto handles_cleanup = fbl::MakeAutoCall([handles, num_handles]() {
+                    for (uint32_t i = 0; i < num_handles; i++) {
+                        zx_handle_close(handles[i]);
+                    }
+                });
+                if (kind == kJobClients) {
+                    if (num_handles != 1) {
+                        return ZX_ERR_INVALID_ARGS;
+                    }
+                    return clients(handles[0]);
+                } else if (kind == kJobNoop) {
+                    return ZX_OK;
+                }
+                ERR("unknown job kind %u\n", kind);
+                return ZX_ERR_NOT_SUPPORTED;
+            });
+    }
+
+    if (options.bench) {
+        return bench(&channel, options);
+    }
+
+    if (options.window > 1) {
+        spinwait::Waiter waiter(options.spin);
+        zx_status_t st = pipeline(
+            &channel, options.window, kNumRequests, &waiter,
+            [](const add_request_t& request, const add_response_t& response,
+               zx_duration_t) {
+                LOG("%d + %d = %d (txid %u)\n", request.a, request.b,
+                    response.result, response.txid);
+            });
+        if (st != ZX_OK) {
+            return st;
+        }
+        LOG("All done, closing connection\n");
+        return ZX_OK;
+    }
+
+    spinwait::Waiter waiter(options.spin);
+    for (uint i = 0; i < kNumRequests; i++) {
+        add_request_t request = {.txid = 1, .a = i, .b = i + 1};
+        add_response_t response;
+
+        zx_status_t st = add(&channel, request, &response, &waiter, options);
+        if (st != ZX_OK) {
+            return st;
+        }
 
         LOG("%d + %d = %d\n", request.a, request.b, response.result);
     }
@@ -75,4 +602,4 @@ zx_status_t child(zx_handle_t channel) {
     LOG("All done, closing connection\n");
 
     return 0;
-}
\ No newline at end of file
+}
@@ -3,17 +3,227 @@
 #include <stdio.h>
 #include <zircon/types.h>
 
-zx_status_t parent(zx_handle_t channel);
-zx_status_t child(zx_handle_t channel);
+#include <histogram/histogram.h>
+#include <logger/logger.h>
+#include <placement/placement.h>
+#include <trace/trace.h>
+#include <typed/channel.h>
 
-#define ERR(fmt, ...) fprintf(stderr, LOG_PREFIX " " fmt, ##__VA_ARGS__);
-#define LOG(fmt, ...) fprintf(stdout, LOG_PREFIX " " fmt, ##__VA_ARGS__);
+// Options shared by the parent and the child. The parent forwards its command
+// line to the child, so both sides always agree on the mode.
+typedef struct options {
+    // Time round trips instead of running the demo.
+    bool bench;
+    // Number of timed round trips in benchmark mode.
+    uint64_t iterations;
+    // Untimed round trips run first to warm up caches and the scheduler.
+    uint64_t warmup;
+    // How the benchmark reports its results.
+    histogram::Format format;
+    // Requests the child keeps in flight. 1 means strict lockstep.
+    uint32_t window;
+    // Requests the server collects before answering them, newest first.
+    // Values above 1 make the server answer out of order.
+    uint32_t reorder;
+    // Serve requests in batches: drain everything queued per wakeup and
+    // write the responses back in one burst.
+    bool batch;
+    // Multi-client mode: one run per entry, each serving that many
+    // connections from a single port-based server. Empty for the single
+    // channel modes above.
+    uint32_t client_counts[8];
+    uint32_t num_client_counts;
+    // Load generator processes the connections are spread across.
+    uint32_t children;
+    // Threads serving the connections in multi-client mode, each waiting on
+    // its own port and stealing ready connections from the others when
+    // idle. 0 serves everything from the main thread.
+    uint32_t workers;
+    // Serve the multi-client connections with one coroutine each, all on
+    // the main thread, instead of a hand-written port loop.
+    bool coro;
+    // Carry the multi-client connections as streams of one mux::Mux channel
+    // per child instead of a channel each.
+    bool mux;
+    // Longest a client or lockstep server wait spins before blocking; the
+    // actual budget adapts to recent arrival times. 0 always blocks.
+    zx_duration_t spin;
+    // Time cold spawns against jobs handed to a warm process pool instead of
+    // running the demo.
+    bool pool_bench;
+    // Time how long it takes to start children, one at a time and fanned out
+    // over several threads, instead of running the demo.
+    bool spawn_bench;
+    // Write first and only wait for WRITABLE if the channel is full, instead
+    // of waiting for WRITABLE before every write.
+    bool write_first;
+    // The lockstep client sends each request and gets its response with one
+    // zx_channel_call.
+    bool call;
+    // Check every add kernel this CPU supports against the scalar one and
+    // time them instead of running the demo.
+    bool kernel_bench;
+    // Write every traced IPC call to <trace>.<process id>.json as a Chrome
+    // trace when the process exits. nullptr disables the dump; events are
+    // recorded either way.
+    const char* trace;
+    // CPUs the parent and the child pin their main thread to, or
+    // placement::kAnyCpu, and the scheduling profile both apply.
+    int32_t parent_cpu;
+    int32_t child_cpu;
+    placement::Profile profile;
+    // Run the lockstep benchmark once for every parent/child topology the
+    // machine has instead of running the demo.
+    bool placements;
+    // Prefix of the lockstep benchmark's result names: channel-two-way, or
+    // channel-two-way.<topology> when both sides are pinned.
+    char prefix[48];
+} options_t;
 
+// Bounds for options_t::window, options_t::reorder, options_t::children and
+// options_t::workers.
+constexpr uint32_t kMaxWindow = 4096;
+constexpr uint32_t kMaxReorder = 64;
+constexpr uint32_t kMaxChildren = 256;
+constexpr uint32_t kMaxWorkers = 256;
+
+// In multi-client mode the parent hands each child its connections over the
+// bootstrap channel: first a connections_header_t, then the client ends of
+// the connections, up to ZX_CHANNEL_MAX_MSG_HANDLES per message. With |mux|
+// set the connections are streams 0 to count - 1 of a mux::Mux, and the one
+// channel carrying them follows instead.
+typedef struct connections_header {
+    uint32_t count;
+    bool mux;
+    uint64_t requests_per_connection;
+} connections_header_t;
+
+// Credits per stream in --mux mode. The clients run in lockstep, so one is
+// all they ever use.
+constexpr uint32_t kMuxWindow = 1;
+
+// Kinds of jobs the parent hands to pooled children. A kJobClients job
+// carries the channel the parent then sends the child's connections over, as
+// a bootstrap channel would. A kJobNoop job just closes its handles.
+enum JobKind : uint32_t {
+    kJobClients = 1,
+    kJobNoop = 2,
+};
+
+// Times cold spawns, pool warm-up and job dispatch. |args| is what the
+// children are started with.
+zx_status_t parent_pool_bench(const char* path, const char* const* args,
+                              const options_t& options);
+
+// Times starting batches of children until all of them are ready.
+zx_status_t parent_spawn_bench(const char* path, const char* const* args,
+                               const options_t& options);
+
+// Reports the private memory one multi-client connection costs the server:
+// the growth over a few thousand connections, less that of an empty run.
+zx_status_t parent_memory_probe(const options_t& options);
+
+// Serves |num_clients| connections handed out to |num_children| children over
+// their bootstrap channels, and reports throughput and handle count.
+zx_status_t parent_clients(const zx_handle_t* children, uint32_t num_children,
+                           uint32_t num_clients, const options_t& options);
+
+// Answer everything queued on one multi-client connection, adding to
+// |requests|. Returns ZX_ERR_PEER_CLOSED once the client has hung up and
+// there is nothing left to read.
+zx_status_t serve_connection(zx_handle_t channel, uint64_t* requests);
+
+// Serves |channels| with |num_workers| threads until every client hangs up,
+// then reports throughput and per-worker utilization. Connection i must be
+// armed on ports[i % num_workers] with key i.
+zx_status_t serve_workers(zx_handle_t* channels, uint32_t num_channels,
+                          const zx_handle_t* ports, uint32_t num_workers,
+                          const options_t& options);
+
+// Serves |channels| with a coroutine per connection on this thread until
+// every client hangs up, then reports throughput. Takes ownership of the
+// channels and sets their entries to ZX_HANDLE_INVALID.
+zx_status_t serve_coro(zx_handle_t* channels, uint32_t num_channels,
+                       const options_t& options);
+
+// Prints the traced calls this thread made between |before| and |after|,
+// divided by |messages|: the total as <name> and each kind of call as
+// <name>.<syscall>.
+void print_syscalls(const char* name, const trace::counts_t& before,
+                    const trace::counts_t& after, uint64_t messages,
+                    histogram::Format format);
+
+zx_status_t parent(zx_handle_t channel, const options_t& options);
+zx_status_t child(zx_handle_t channel, const options_t& options);
+
+// Every request carries a transaction id which the server copies into the
+// matching response, so that a client with several requests in flight can
+// tell the responses apart. Zero is never used as a txid.
 typedef struct add_request {
+    uint32_t txid;
     uint32_t a;
     uint32_t b;
 } add_request_t;
 
 typedef struct add_response {
+    uint32_t txid;
     uint32_t result;
-} add_response_t;
\ No newline at end of file
+} add_response_t;
+
+// The bootstrap channel in the lockstep and pipelined modes: the child writes
+// requests and reads responses, the parent the other way round.
+using AddClient = typed::Channel<add_request_t, add_response_t>;
+using AddServer = AddClient::peer_type;
+
+// Writes one message. In write-first mode the write goes out straight away
+// and we only wait if the channel is full; otherwise we wait for WRITABLE
+// before every write. Returns ZX_ERR_PEER_CLOSED if the peer is gone. Adds
+// the waits to |waits| unless it is nullptr.
+template <typename Out, typename In>
+zx_status_t send_message(typed::Channel<Out, In>* channel, const Out& message,
+                         bool write_first, uint64_t* waits) {
+    zx_status_t st;
+    if (write_first) {
+        st = channel->Write(message);
+        if (st != ZX_ERR_SHOULD_WAIT) {
+            return st;
+        }
+    }
+    while (true) {
+        zx_signals_t signals;
+        st = channel->wait_one(ZX_CHANNEL_PEER_CLOSED | ZX_CHANNEL_WRITABLE,
+                               ZX_TIME_INFINITE, &signals);
+        if (waits != nullptr) {
+            (*waits)++;
+        }
+        if (st != ZX_OK) {
+            return st;
+        }
+        if (signals & ZX_CHANNEL_PEER_CLOSED) {
+            return ZX_ERR_PEER_CLOSED;
+        }
+        st = channel->Write(message);
+        if (st != ZX_ERR_SHOULD_WAIT) {
+            return st;
+        }
+    }
+}
+
+// Most requests the batching server reads per wakeup.
+constexpr uint32_t kMaxBatch = 256;
+
+// Answers |count| requests at once, with the fastest kernel this CPU
+// supports unless set_add_kernel picked another.
+typedef void (*add_kernel_t)(const add_request_t* requests,
+                             add_response_t* responses, size_t count);
+void add_batch(const add_request_t* requests, add_response_t* responses,
+               size_t count);
+
+// Makes add_batch use the kernel called |name|: avx512, avx2, sse4.1, neon,
+// scalar, or auto for the fastest. Returns false if there is no such kernel
+// or this CPU can't run it.
+bool set_add_kernel(const char* name);
+
+// Checks every add kernel this CPU supports against the scalar one, then
+// times each over |options.iterations| batches of kMaxBatch requests.
+zx_status_t parent_kernel_bench(const options_t& options);
@@ -0,0 +1,71 @@
+#define LOG_PREFIX "[PARNT]"
+#include "common.h"
+
+#include <coro/coro.h>
+#include <zircon/syscalls.h>
+
+#include <memory>
+
+// One connection's conversation: answer requests until the client hangs up.
+static coro::Task serve_one(coro::Executor* executor, zx_handle_t handle,
+                            uint64_t* requests) {
+    coro::Channel channel(executor, handle);
+    while (true) {
+        add_request_t request;
+        uint32_t actual;
+        zx_status_t st = co_await channel.Read(&request, sizeof(request), &actual);
+        if (st == ZX_ERR_PEER_CLOSED) {
+            co_return ZX_OK;
+        } else if (st != ZX_OK) {
+            ERR("zx_channel_read failed with st = %d\n", st);
+            co_return st;
+        }
+
+        add_response_t response;
+        response.txid = request.txid;
+        response.result = request.a + request.b;
+        st = co_await channel.Write(&response, sizeof(response));
+        if (st != ZX_OK) {
+            ERR("zx_channel_write failed with st = %d\n", st);
+            co_return st;
+        }
+        (*requests)++;
+    }
+}
+
+zx_status_t serve_coro(zx_handle_t* channels, uint32_t num_channels,
+                       const options_t& options) {
+    std::unique_ptr<coro::Executor> executor;
+    zx_status_t st = coro::Executor::Create(&executor);
+    if (st != ZX_OK) {
+        ERR("zx_port_create failed with st = %d\n", st);
+        return st;
+    }
+
+    uint64_t requests = 0;
+    zx_time_t start = zx_clock_get_monotonic();
+    for (uint32_t i = 0; i < num_channels; i++) {
+        executor->Spawn(serve_one(executor.get(), channels[i], &requests));
+        channels[i] = ZX_HANDLE_INVALID;
+    }
+    st = executor->Run();
+    zx_time_t end = zx_clock_get_monotonic();
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    char name[64];
+    double seconds = static_cast<double>(end - start) / ZX_SEC(1);
+    snprintf(name, sizeof(name), "channel-two-way.clients.%u.throughput",
+             num_channels);
+    histogram::PrintValue(stdout, name, "req/s",
+                          seconds > 0 ? requests / seconds : 0, options.format);
+    snprintf(name, sizeof(name), "channel-two-way.clients.%u.requests_per_wakeup",
+             num_channels);
+    histogram::PrintValue(stdout, name, "req/wakeup",
+                          executor->wakeups()
+                              ? static_cast<double>(requests) / executor->wakeups()
+                              : 0,
+                          options.format);
+    return ZX_OK;
+}
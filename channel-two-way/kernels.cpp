@@ -0,0 +1,335 @@
+#define LOG_PREFIX "[PARNT]"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zircon/syscalls.h>
+
+#include <memory>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Batch kernels for the add server. Every vector kernel handles as many whole
+// vectors of requests as the batch holds and leaves the rest to the scalar
+// loop. Requests are 12 bytes and responses 8, so a vector kernel loads its
+// requests as three registers of interleaved txid, a and b fields (AoS),
+// pulls each field into a register of its own (SoA), adds, and interleaves
+// the txids with the sums on the way back out.
+//
+// Each x86 kernel is compiled for its own instruction set with a target
+// attribute, so the rest of the program keeps running on any x86-64; the
+// dispatcher only picks one the CPU supports. A new kernel needs an entry in
+// kAddKernels, and --kernel-bench checks it against the scalar one.
+
+static void add_scalar(const add_request_t* requests, add_response_t* responses,
+                       size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        responses[i].txid = requests[i].txid;
+        responses[i].result = requests[i].a + requests[i].b;
+    }
+}
+
+static_assert(sizeof(add_request_t) == 3 * sizeof(uint32_t) &&
+                  sizeof(add_response_t) == 2 * sizeof(uint32_t),
+              "the vector kernels assume packed 32-bit fields");
+
+#if defined(__x86_64__)
+
+// The three fields of request j sit at words 3j, 3j + 1 and 3j + 2 of the
+// loaded registers. As 3 is coprime with the number of words per register,
+// each field lands in a distinct word of the register it is in, so a blend
+// of the three registers followed by a permute gathers one field in request
+// order. The blend masks and permutes below are that mapping written out for
+// each field.
+
+__attribute__((target("sse4.1")))
+static void add_sse41(const add_request_t* requests, add_response_t* responses,
+                      size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i* in = reinterpret_cast<const __m128i*>(requests + i);
+        __m128i v0 = _mm_loadu_si128(in);
+        __m128i v1 = _mm_loadu_si128(in + 1);
+        __m128i v2 = _mm_loadu_si128(in + 2);
+
+        // _mm_blend_epi16 masks have two bits per 32-bit word.
+        __m128i txid = _mm_shuffle_epi32(
+            _mm_blend_epi16(_mm_blend_epi16(v0, v1, 0x30), v2, 0x0c),
+            _MM_SHUFFLE(1, 2, 3, 0));
+        __m128i a = _mm_shuffle_epi32(
+            _mm_blend_epi16(_mm_blend_epi16(v0, v1, 0xc3), v2, 0x30),
+            _MM_SHUFFLE(2, 3, 0, 1));
+        __m128i b = _mm_shuffle_epi32(
+            _mm_blend_epi16(_mm_blend_epi16(v0, v1, 0x0c), v2, 0xc3),
+            _MM_SHUFFLE(3, 0, 1, 2));
+        __m128i sum = _mm_add_epi32(a, b);
+
+        __m128i* out = reinterpret_cast<__m128i*>(responses + i);
+        _mm_storeu_si128(out, _mm_unpacklo_epi32(txid, sum));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(txid, sum));
+    }
+    add_scalar(requests + i, responses + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void add_avx2(const add_request_t* requests, add_response_t* responses,
+                     size_t count) {
+    const __m256i txid_order = _mm256_setr_epi32(0, 3, 6, 1, 4, 7, 2, 5);
+    const __m256i a_order = _mm256_setr_epi32(1, 4, 7, 2, 5, 0, 3, 6);
+    const __m256i b_order = _mm256_setr_epi32(2, 5, 0, 3, 6, 1, 4, 7);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i* in = reinterpret_cast<const __m256i*>(requests + i);
+        __m256i v0 = _mm256_loadu_si256(in);
+        __m256i v1 = _mm256_loadu_si256(in + 1);
+        __m256i v2 = _mm256_loadu_si256(in + 2);
+
+        __m256i txid = _mm256_permutevar8x32_epi32(
+            _mm256_blend_epi32(_mm256_blend_epi32(v0, v1, 0x92), v2, 0x24),
+            txid_order);
+        __m256i a = _mm256_permutevar8x32_epi32(
+            _mm256_blend_epi32(_mm256_blend_epi32(v0, v1, 0x24), v2, 0x49),
+            a_order);
+        __m256i b = _mm256_permutevar8x32_epi32(
+            _mm256_blend_epi32(_mm256_blend_epi32(v0, v1, 0x49), v2, 0x92),
+            b_order);
+        __m256i sum = _mm256_add_epi32(a, b);
+
+        // Unpacking works within 128-bit lanes: |low| holds responses 0, 1,
+        // 4 and 5, |high| 2, 3, 6 and 7.
+        __m256i low = _mm256_unpacklo_epi32(txid, sum);
+        __m256i high = _mm256_unpackhi_epi32(txid, sum);
+        __m256i* out = reinterpret_cast<__m256i*>(responses + i);
+        _mm256_storeu_si256(out, _mm256_permute2x128_si256(low, high, 0x20));
+        _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(low, high, 0x31));
+    }
+    add_scalar(requests + i, responses + i, count - i);
+}
+
+// AVX-512 has two-register permutes, so each field takes two of them instead
+// of blends: the first picks the words it can from v0 and v1, the second
+// fills in the rest from v2.
+__attribute__((target("avx512f")))
+static void add_avx512(const add_request_t* requests, add_response_t* responses,
+                       size_t count) {
+    // Word w of the concatenation of two registers is index w; 16 and up
+    // come from the second.
+    alignas(64) static const uint32_t kFirst[3][16] = {
+        {0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 0, 0, 0, 0, 0},
+        {1, 4, 7, 10, 13, 16, 19, 22, 25, 28, 31, 0, 0, 0, 0, 0},
+        {2, 5, 8, 11, 14, 17, 20, 23, 26, 29, 0, 0, 0, 0, 0, 0},
+    };
+    alignas(64) static const uint32_t kSecond[3][16] = {
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 17, 20, 23, 26, 29},
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 18, 21, 24, 27, 30},
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 16, 19, 22, 25, 28, 31},
+    };
+    alignas(64) static const uint32_t kInterleave[2][16] = {
+        {0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23},
+        {8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31},
+    };
+    __m512i first[3];
+    __m512i second[3];
+    for (int k = 0; k < 3; k++) {
+        first[k] = _mm512_load_si512(kFirst[k]);
+        second[k] = _mm512_load_si512(kSecond[k]);
+    }
+    __m512i interleave_low = _mm512_load_si512(kInterleave[0]);
+    __m512i interleave_high = _mm512_load_si512(kInterleave[1]);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const uint32_t* in = reinterpret_cast<const uint32_t*>(requests + i);
+        __m512i v0 = _mm512_loadu_si512(in);
+        __m512i v1 = _mm512_loadu_si512(in + 16);
+        __m512i v2 = _mm512_loadu_si512(in + 32);
+
+        __m512i field[3];
+        for (int k = 0; k < 3; k++) {
+            field[k] = _mm512_permutex2var_epi32(
+                _mm512_permutex2var_epi32(v0, first[k], v1), second[k], v2);
+        }
+        __m512i sum = _mm512_add_epi32(field[1], field[2]);
+
+        uint32_t* out = reinterpret_cast<uint32_t*>(responses + i);
+        _mm512_storeu_si512(out, _mm512_permutex2var_epi32(
+                                     field[0], interleave_low, sum));
+        _mm512_storeu_si512(out + 16, _mm512_permutex2var_epi32(
+                                          field[0], interleave_high, sum));
+    }
+    add_scalar(requests + i, responses + i, count - i);
+}
+
+#elif defined(__aarch64__)
+
+// NEON loads and stores interleaved structures directly.
+static void add_neon(const add_request_t* requests, add_response_t* responses,
+                     size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint32x4x3_t in = vld3q_u32(reinterpret_cast<const uint32_t*>(requests + i));
+        uint32x4x2_t out;
+        out.val[0] = in.val[0];
+        out.val[1] = vaddq_u32(in.val[1], in.val[2]);
+        vst2q_u32(reinterpret_cast<uint32_t*>(responses + i), out);
+    }
+    add_scalar(requests + i, responses + i, count - i);
+}
+
+#endif
+
+namespace {
+
+struct add_kernel_entry {
+    const char* name;
+    add_kernel_t kernel;
+    // Whether this CPU can run |kernel|.
+    bool (*supported)();
+};
+
+bool always() {
+    return true;
+}
+
+#if defined(__x86_64__)
+bool has_sse41() {
+    return __builtin_cpu_supports("sse4.1");
+}
+bool has_avx2() {
+    return __builtin_cpu_supports("avx2");
+}
+bool has_avx512() {
+    return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+// Fastest first; the scalar kernel is last and always runs.
+const add_kernel_entry kAddKernels[] = {
+#if defined(__x86_64__)
+    {"avx512", add_avx512, has_avx512},
+    {"avx2", add_avx2, has_avx2},
+    {"sse4.1", add_sse41, has_sse41},
+#elif defined(__aarch64__)
+    {"neon", add_neon, always},
+#endif
+    {"scalar", add_scalar, always},
+};
+
+// The kernel add_batch runs. Picked on first use unless set_add_kernel
+// picked one before.
+add_kernel_t g_add_kernel = nullptr;
+
+add_kernel_t best_add_kernel() {
+    for (const add_kernel_entry& entry : kAddKernels) {
+        if (entry.supported()) {
+            return entry.kernel;
+        }
+    }
+    return add_scalar;
+}
+
+} // namespace
+
+void add_batch(const add_request_t* requests, add_response_t* responses,
+               size_t count) {
+    if (g_add_kernel == nullptr) {
+        g_add_kernel = best_add_kernel();
+    }
+    g_add_kernel(requests, responses, count);
+}
+
+bool set_add_kernel(const char* name) {
+    if (!strcmp(name, "auto")) {
+        g_add_kernel = best_add_kernel();
+        return true;
+    }
+    for (const add_kernel_entry& entry : kAddKernels) {
+        if (!strcmp(name, entry.name) && entry.supported()) {
+            g_add_kernel = entry.kernel;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Requests per call in the kernel benchmark, as the batching server drains
+// at most this many per wakeup.
+constexpr size_t kBenchBatch = kMaxBatch;
+
+// Random batches every kernel is checked against the scalar one with, of
+// every size up to kBenchBatch.
+constexpr uint32_t kCheckRounds = 64;
+
+// Runs |kernel| over random batches of every size from 0 to kBenchBatch and
+// compares its responses with the scalar kernel's. The operands span the
+// whole 32-bit range, so sums wrap as often as not. Sentinels past the end of
+// the batch catch writes beyond |count|.
+static bool check_add_kernel(add_kernel_t kernel) {
+    add_request_t requests[kBenchBatch];
+    add_response_t expected[kBenchBatch + 1];
+    add_response_t actual[kBenchBatch + 1];
+    for (uint32_t round = 0; round < kCheckRounds; round++) {
+        for (size_t count = 0; count <= kBenchBatch; count++) {
+            for (size_t i = 0; i < count; i++) {
+                requests[i].txid = static_cast<uint32_t>(random());
+                requests[i].a = static_cast<uint32_t>(random()) << 1;
+                requests[i].b = static_cast<uint32_t>(random()) << 1 | (i & 1);
+            }
+            memset(expected, 0xa5, sizeof(expected));
+            memset(actual, 0xa5, sizeof(actual));
+            add_scalar(requests, expected, count);
+            kernel(requests, actual, count);
+            if (memcmp(expected, actual, sizeof(actual)) != 0) {
+                ERR("kernel differs from scalar on a batch of %zu\n", count);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+zx_status_t parent_kernel_bench(const options_t& options) {
+    std::unique_ptr<add_request_t[]> requests(new add_request_t[kBenchBatch]);
+    std::unique_ptr<add_response_t[]> responses(new add_response_t[kBenchBatch]);
+    for (size_t i = 0; i < kBenchBatch; i++) {
+        requests[i] = {static_cast<uint32_t>(i + 1), static_cast<uint32_t>(i),
+                       static_cast<uint32_t>(random())};
+    }
+
+    for (const add_kernel_entry& entry : kAddKernels) {
+        if (!entry.supported()) {
+            continue;
+        }
+        if (!check_add_kernel(entry.kernel)) {
+            ERR("%s kernel is wrong\n", entry.name);
+            return ZX_ERR_INTERNAL;
+        }
+
+        // Every timed call reads the previous call's output, so the calls
+        // can't be folded together.
+        uint64_t total = options.warmup + options.iterations;
+        zx_time_t start = 0;
+        for (uint64_t n = 0; n < total; n++) {
+            if (n == options.warmup) {
+                start = zx_clock_get_monotonic();
+            }
+            entry.kernel(requests.get(), responses.get(), kBenchBatch);
+            requests[n % kBenchBatch].a = responses[n % kBenchBatch].result;
+        }
+        zx_time_t end = zx_clock_get_monotonic();
+
+        char name[96];
+        snprintf(name, sizeof(name), "channel-two-way.kernel.%s.throughput",
+                 entry.name);
+        double seconds = static_cast<double>(end - start) / ZX_SEC(1);
+        double rate = seconds > 0 ? options.iterations * kBenchBatch / seconds : 0;
+        histogram::PrintValue(stdout, name, "ops/s", rate, options.format);
+    }
+    return ZX_OK;
+}
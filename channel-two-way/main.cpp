@@ -1,98 +1,430 @@
 // This program creates a child process and hands it one end of a channel.
 // Then it sends periodic messages to the child process which prints them out
 // on stdout.
+//
+// Usage: channel-two-way [--bench] [--iterations=N] [--warmup=N]
+//                        [--format=text|csv|json] [--window=N] [--reorder=N]
+//                        [--batch] [--clients=N[,N...]] [--children=N]
+//                        [--workers=N|auto] [--spin=USEC] [--trace=PREFIX]
+//                        [--pool-bench] [--spawn-bench] [--coro]
+//                        [--parent-cpu=N] [--child-cpu=N] [--placements]
+//                        [--profile=default|high|realtime|deadline:C/P]
+//                        [--kernel=NAME] [--kernel-bench]
+//                        [--write-first] [--call] [--mux]
+//
+// --bench times N add round trips and reports their latency distribution
+// instead of running the demo.
+// --window=N keeps up to N requests in flight instead of waiting for each
+// response before sending the next request.
+// --reorder=N makes the server collect up to N queued requests and answer
+// them newest first.
+// --batch makes the server read every queued request per wakeup, answer
+// them in one burst, and drain the channel before shutting down.
+// --clients=N serves N connections from a single port-based server, with the
+// client ends spread across --children load generator processes. A list runs
+// one scaling point per entry, e.g. --clients=1,10,100,1000,10000. The
+// children are spawned once, as a process pool, and reused for every entry.
+// --workers=N serves the connections from N threads that steal ready
+// connections from each other; auto uses one thread per core.
+// --coro serves the --clients connections with a coroutine each, all from
+// the main thread.
+// --mux carries the --clients connections as streams of a mux::Mux, one
+// channel per child instead of one per connection, and reports the results
+// as channel-two-way.mux.clients.N so the two can be compared.
+// --spin=USEC lets the client and the single-channel server poll for up to
+// USEC microseconds before blocking on a wait.
+// --trace=PREFIX writes each process's IPC calls to PREFIX.<pid>.json as a
+// Chrome trace when it exits.
+// --pool-bench times spawning a child for a single job against handing jobs
+// to a pool of --children children spawned up front, and how long that pool
+// takes to start.
+// --spawn-bench times how long it takes to start 1, 8, 64 and 256 children
+// and have all of them ready, spawning one at a time and from several threads.
+// --parent-cpu=N and --child-cpu=N pin the main thread of the parent and of
+// the child to CPU N. With both set, the lockstep benchmark results are named
+// after how the two CPUs share hardware, e.g. channel-two-way.smt.round_trip;
+// see placement::TopologyName.
+// --placements runs the lockstep benchmark once for every topology this
+// machine has: same CPU, SMT siblings, two cores of a package and two
+// packages, with a fresh child each time.
+// --profile gives both main threads a scheduling profile: a raised
+// priority, a fixed real-time priority, or C microseconds of CPU every P
+// microseconds. All but the default usually need privileges.
+// --write-first writes straight away and only waits for the channel to
+// become writable if a write comes back with ZX_ERR_SHOULD_WAIT, instead of
+// waiting for WRITABLE before every request and response.
+// --call makes the lockstep client send each request and collect its
+// response with one zx_channel_call. The benchmark reports the calls each
+// side makes per round trip, so the modes can be compared.
+// --kernel=NAME makes the --batch server compute its responses with the
+// avx512, avx2, sse4.1, neon or scalar add kernel instead of the fastest one
+// this CPU supports.
+// --kernel-bench checks every add kernel this CPU supports against the scalar
+// one on random batches, then reports how many requests per second each
+// answers over --iterations batches of 256.
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include <fbl/auto_call.h>
-#include <lib/fdio/spawn.h>
+#include <limits.h>
+
+#include <placement/placement.h>
+#include <procpool/procpool.h>
+#include <spawn/spawn.h>
+#include <trace/trace.h>
 
-#include <zircon/process.h>
-#include <zircon/processargs.h>
 #include <zircon/syscalls.h>
 #include <zircon/types.h>
 
-#include "common.h"
+#include <memory>
+#include <thread>
 
-// Pass this as a command line argument to start as a child, otherwise start
-// as a parent.
-const char* kCmdLineChild = "child";
+#include "common.h"
 
-// Create a channel, spawn a child process and give it one end of the channel
-// we just created.
-zx_status_t spawn_child(const char* path, zx_handle_t* out) {
-    zx_status_t st;
+// Names the lockstep benchmark results after the topology of the two CPUs
+// the parent and the child are pinned to.
+static void set_prefix(options_t* options) {
+    placement::Topology topology =
+        placement::Relate(options->parent_cpu, options->child_cpu);
+    if (topology == placement::Topology::kUnpinned) {
+        snprintf(options->prefix, sizeof(options->prefix), "channel-two-way");
+    } else {
+        snprintf(options->prefix, sizeof(options->prefix), "channel-two-way.%s",
+                 placement::TopologyName(topology));
+    }
+}
 
-    const uint32_t kFlags = FDIO_SPAWN_CLONE_ALL;
-    const char* kChildProcessArgs[] = {kCmdLineChild, nullptr};
-    char error_bufffer[FDIO_SPAWN_ERR_MSG_MAX_LENGTH];
+// Parses the options shared by the parent and the child. Returns false if an
+// argument is malformed.
+bool parse_options(int argc, const char* argv[], options_t* options) {
+    options->bench = false;
+    options->iterations = 1000000;
+    options->warmup = 10000;
+    options->format = histogram::Format::kText;
+    options->pool_bench = false;
+    options->spawn_bench = false;
+    options->kernel_bench = false;
+    options->write_first = false;
+    options->call = false;
+    options->coro = false;
+    options->mux = false;
+    options->trace = nullptr;
+    options->window = 1;
+    options->reorder = 1;
+    options->batch = false;
+    options->num_client_counts = 0;
+    options->children = 1;
+    options->workers = 0;
+    options->spin = 0;
+    options->parent_cpu = placement::kAnyCpu;
+    options->child_cpu = placement::kAnyCpu;
+    options->profile = placement::Profile();
+    options->placements = false;
 
-    // Create a channel.
-    zx_handle_t mine = ZX_HANDLE_INVALID;
-    zx_handle_t other = ZX_HANDLE_INVALID;
-    st = zx_channel_create(0, &mine, &other);
-    if (st != ZX_OK) {
-        fprintf(stderr, "[PARENT]: Failed to create channel, st = %d\n", st);
-        return st;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (!strcmp(arg, spawn::kChildArg)) {
+            continue;
+        } else if (!strcmp(arg, "--bench")) {
+            options->bench = true;
+        } else if (!strcmp(arg, "--batch")) {
+            options->batch = true;
+        } else if (!strncmp(arg, "--iterations=", 13)) {
+            options->iterations = strtoull(arg + 13, nullptr, 0);
+        } else if (!strncmp(arg, "--warmup=", 9)) {
+            options->warmup = strtoull(arg + 9, nullptr, 0);
+        } else if (!strncmp(arg, "--trace=", 8)) {
+            options->trace = arg + 8;
+        } else if (!strncmp(arg, "--format=", 9)) {
+            if (!histogram::ParseFormat(arg + 9, &options->format)) {
+                fprintf(stderr, "unknown format '%s'\n", arg + 9);
+                return false;
+            }
+        } else if (!strncmp(arg, "--window=", 9)) {
+            options->window = static_cast<uint32_t>(strtoul(arg + 9, nullptr, 0));
+            if (options->window == 0 || options->window > kMaxWindow) {
+                fprintf(stderr, "window must be in [1, %u]\n", kMaxWindow);
+                return false;
+            }
+        } else if (!strncmp(arg, "--reorder=", 10)) {
+            options->reorder = static_cast<uint32_t>(strtoul(arg + 10, nullptr, 0));
+            if (options->reorder == 0 || options->reorder > kMaxReorder) {
+                fprintf(stderr, "reorder must be in [1, %u]\n", kMaxReorder);
+                return false;
+            }
+        } else if (!strncmp(arg, "--clients=", 10)) {
+            const char* p = arg + 10;
+            while (*p != '\0') {
+                if (options->num_client_counts == countof(options->client_counts)) {
+                    fprintf(stderr, "too many client counts\n");
+                    return false;
+                }
+                char* end;
+                uint32_t count = static_cast<uint32_t>(strtoul(p, &end, 0));
+                if (count == 0 || (*end != ',' && *end != '\0')) {
+                    fprintf(stderr, "bad client count list '%s'\n", arg + 10);
+                    return false;
+                }
+                options->client_counts[options->num_client_counts++] = count;
+                p = (*end == ',') ? end + 1 : end;
+            }
+        } else if (!strncmp(arg, "--children=", 11)) {
+            options->children = static_cast<uint32_t>(strtoul(arg + 11, nullptr, 0));
+            if (options->children == 0 || options->children > kMaxChildren) {
+                fprintf(stderr, "children must be in [1, %u]\n", kMaxChildren);
+                return false;
+            }
+        } else if (!strcmp(arg, "--workers=auto")) {
+            options->workers = std::thread::hardware_concurrency();
+            if (options->workers == 0) {
+                options->workers = 1;
+            } else if (options->workers > kMaxWorkers) {
+                options->workers = kMaxWorkers;
+            }
+        } else if (!strncmp(arg, "--workers=", 10)) {
+            options->workers = static_cast<uint32_t>(strtoul(arg + 10, nullptr, 0));
+            if (options->workers > kMaxWorkers) {
+                fprintf(stderr, "workers must be at most %u\n", kMaxWorkers);
+                return false;
+            }
+        } else if (!strcmp(arg, "--pool-bench")) {
+            options->pool_bench = true;
+        } else if (!strcmp(arg, "--coro")) {
+            options->coro = true;
+        } else if (!strcmp(arg, "--mux")) {
+            options->mux = true;
+        } else if (!strcmp(arg, "--spawn-bench")) {
+            options->spawn_bench = true;
+        } else if (!strncmp(arg, "--spin=", 7)) {
+            options->spin = ZX_USEC(strtoull(arg + 7, nullptr, 0));
+        } else if (!strncmp(arg, "--parent-cpu=", 13)) {
+            if (!placement::ParseCpu(arg + 13, &options->parent_cpu)) {
+                fprintf(stderr, "parent cpu must be below %u\n",
+                        placement::NumCpus());
+                return false;
+            }
+        } else if (!strncmp(arg, "--child-cpu=", 12)) {
+            if (!placement::ParseCpu(arg + 12, &options->child_cpu)) {
+                fprintf(stderr, "child cpu must be below %u\n",
+                        placement::NumCpus());
+                return false;
+            }
+        } else if (!strncmp(arg, "--profile=", 10)) {
+            if (!placement::ParseProfile(arg + 10, &options->profile)) {
+                fprintf(stderr, "unknown profile '%s'\n", arg + 10);
+                return false;
+            }
+        } else if (!strncmp(arg, "--kernel=", 9)) {
+            if (!set_add_kernel(arg + 9)) {
+                fprintf(stderr, "no '%s' kernel on this CPU\n", arg + 9);
+                return false;
+            }
+        } else if (!strcmp(arg, "--write-first")) {
+            options->write_first = true;
+        } else if (!strcmp(arg, "--call")) {
+            options->call = true;
+        } else if (!strcmp(arg, "--kernel-bench")) {
+            options->kernel_bench = true;
+        } else if (!strcmp(arg, "--placements")) {
+            options->placements = true;
+            options->bench = true;
+        } else {
+            fprintf(stderr, "unknown argument '%s'\n", arg);
+            return false;
+        }
+    }
+    if (options->call && options->window > 1) {
+        fprintf(stderr, "--call keeps one request in flight; drop --window\n");
+        return false;
     }
-    *out = mine;
-
-    // Cleanup the channels we just created if something goes wrong below.
-    auto cleanup_on_failure = fbl::MakeAutoCall([mine, other]() {
-        zx_handle_close(mine);
-        zx_handle_close(other);
-    });
-
-    // This struct is a list of things that we're going to pass to the child
-    // process.
-    const fdio_spawn_action_t actions[] = {
-        {.action = FDIO_SPAWN_ACTION_SET_NAME, .name = {.data = "child"}},
-        {.action = FDIO_SPAWN_ACTION_ADD_HANDLE, .h = {.id = PA_USER0, .handle = other}},
-    };
-
-    // Start the child process.
-    st = fdio_spawn_etc(
-        ZX_HANDLE_INVALID, // Job handle, invalid uses default job
-        kFlags,
-        path,
-        kChildProcessArgs, // child process arguments.
-        nullptr,           // environment, not needed for us.
-        countof(actions),
-        actions,
-        nullptr, // process out handle, ignored for now.
-        error_bufffer);
+    if (options->mux && (options->workers > 0 || options->coro)) {
+        fprintf(stderr, "--mux is served from one thread; drop --workers and --coro\n");
+        return false;
+    }
+    set_prefix(options);
+    return true;
+}
 
+// Pins the calling thread to |cpu| and gives it the profile from |options|.
+static zx_status_t place(int32_t cpu, const options_t& options,
+                         const char* who) {
+    zx_status_t st = placement::Apply(cpu, options.profile);
     if (st != ZX_OK) {
-        fprintf(stderr, "could not spawn child process, st = %d\n", st);
-        fprintf(stderr, "reason: %s\n", error_bufffer);
-        return st;
+        fprintf(stderr, "[%s]: Can't run on cpu %d with that profile, st = %d\n",
+                who, cpu, st);
     }
+    return st;
+}
+
+// Runs the lockstep benchmark once per topology, with the parent on the
+// first CPU of each representative pair and a fresh child on the second.
+// The child learns its CPU from two extra arguments, which override any
+// --parent-cpu and --child-cpu we were given.
+static zx_status_t parent_placements(const char* path, const char* const* args,
+                                     const options_t& options) {
+    placement::CpuPair pairs[8];
+    size_t num_pairs = placement::Representatives(pairs, countof(pairs));
+    for (size_t i = 0; i < num_pairs; i++) {
+        char parent_arg[32];
+        char child_arg[32];
+        snprintf(parent_arg, sizeof(parent_arg), "--parent-cpu=%d",
+                 pairs[i].first);
+        snprintf(child_arg, sizeof(child_arg), "--child-cpu=%d",
+                 pairs[i].second);
+        const char* placed_args[spawn::kMaxArgs + 4];
+        size_t count = 0;
+        for (; args[count] != nullptr; count++) {
+            placed_args[count] = args[count];
+        }
+        placed_args[count++] = parent_arg;
+        placed_args[count++] = child_arg;
+        placed_args[count] = nullptr;
 
-    cleanup_on_failure.cancel();
+        options_t placed = options;
+        placed.parent_cpu = pairs[i].first;
+        placed.child_cpu = pairs[i].second;
+        set_prefix(&placed);
+
+        spawn::child_t to_child = {};
+        zx_status_t st = spawn::Spawn(path, placed_args, &to_child, 1);
+        if (st != ZX_OK) {
+            return st;
+        }
+        st = place(placed.parent_cpu, placed, "PARENT");
+        if (st != ZX_OK) {
+            zx_handle_close(to_child.channel);
+            return st;
+        }
+        st = parent(to_child.channel, placed);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
     return ZX_OK;
 }
 
 int main(int argc, const char* argv[]) {
-    bool is_child = false;
+    bool is_child = spawn::IsChild(argc, argv);
 
-    for (int i = 0; i < argc; i++) {
-        if (!strcmp(kCmdLineChild, argv[i])) {
-            is_child = true;
-        }
+    options_t options;
+    if (!parse_options(argc, argv, &options)) {
+        return -1;
+    }
+    if (options.trace != nullptr) {
+        trace::Start(options.trace, is_child ? "child" : "parent");
     }
 
     if (is_child) {
-        zx_handle_t to_parent = zx_take_startup_handle(PA_HND(PA_USER0, 0));
-        return child(to_parent);
+        zx_status_t st = place(options.child_cpu, options, "CHILD");
+        if (st != ZX_OK) {
+            return st;
+        }
+        zx_handle_t to_parent;
+        st = spawn::TakeBootstrap(&to_parent);
+        if (st != ZX_OK) {
+            fprintf(stderr, "[CHILD]: Failed to take bootstrap channel, st = %d\n", st);
+            return st;
+        }
+        return child(to_parent, options);
     } else {
-        zx_handle_t to_child;
-        char path[64];
-        snprintf(path, sizeof(path), "/boot/bin/%s", argv[0]);
-        spawn_child(path, &to_child);
-        return parent(to_child);
+        char path[PATH_MAX];
+        const char* args[spawn::kMaxArgs + 2];
+        zx_status_t st = spawn::SelfPath(argv[0], path, sizeof(path));
+        if (st == ZX_OK) {
+            st = spawn::ChildArgs(argc, argv, args);
+        }
+        if (st != ZX_OK) {
+            fprintf(stderr, "[PARENT]: Can't build child command line, st = %d\n", st);
+            return st;
+        }
+        if (options.kernel_bench) {
+            return parent_kernel_bench(options);
+        }
+        if (options.pool_bench) {
+            return parent_pool_bench(path, args, options);
+        }
+        if (options.spawn_bench) {
+            return parent_spawn_bench(path, args, options);
+        }
+        if (options.placements) {
+            return parent_placements(path, args, options);
+        }
+
+        // Multi-client mode: the children are spawned once and each client
+        // count hands them a job with a fresh channel to send their
+        // connections over.
+        if (options.num_client_counts > 0) {
+            uint32_t most_clients = 0;
+            for (uint32_t i = 0; i < options.num_client_counts; i++) {
+                if (options.client_counts[i] > most_clients) {
+                    most_clients = options.client_counts[i];
+                }
+            }
+            std::unique_ptr<procpool::Pool> pool;
+            st = procpool::Pool::Create(
+                path, args,
+                options.children < most_clients ? options.children : most_clients,
+                &pool);
+            if (st != ZX_OK) {
+                fprintf(stderr, "[PARENT]: Failed to start children, st = %d\n", st);
+                return st;
+            }
+            st = place(options.parent_cpu, options, "PARENT");
+            if (st != ZX_OK) {
+                return st;
+            }
+            // A connection costs the same at every client count, and a
+            // single run's memory growth is mostly page-granularity noise,
+            // so it is measured once, over many.
+            st = parent_memory_probe(options);
+            if (st != ZX_OK) {
+                return st;
+            }
+
+            for (uint32_t i = 0; i < options.num_client_counts; i++) {
+                uint32_t clients = options.client_counts[i];
+                uint32_t children = pool->size() < clients ? pool->size() : clients;
+                zx_handle_t to_children[kMaxChildren];
+                for (uint32_t c = 0; c < children; c++) {
+                    zx_handle_t theirs;
+                    st = zx_channel_create(0, &to_children[c], &theirs);
+                    if (st == ZX_OK) {
+                        st = pool->Dispatch(kJobClients, nullptr, 0, &theirs, 1);
+                    }
+                    if (st != ZX_OK) {
+                        fprintf(stderr, "[PARENT]: Failed to start clients, st = %d\n", st);
+                        return st;
+                    }
+                }
+                st = parent_clients(to_children, children, clients, options);
+                if (st != ZX_OK) {
+                    return st;
+                }
+                st = pool->WaitIdle();
+                if (st != ZX_OK) {
+                    fprintf(stderr, "[PARENT]: Clients failed, st = %d\n", st);
+                    return st;
+                }
+            }
+            return 0;
+        }
+
+        spawn::child_t to_child = {};
+        st = spawn::Spawn(path, args, &to_child, 1);
+        if (st != ZX_OK) {
+            return st;
+        }
+        // Pin only once the child is running, so that it doesn't inherit
+        // our placement on the host backend.
+        st = place(options.parent_cpu, options, "PARENT");
+        if (st != ZX_OK) {
+            zx_handle_close(to_child.channel);
+            return st;
+        }
+        return parent(to_child.channel, options);
     }
 
     // Shouldn't get here.
     return -1;
-}
\ No newline at end of file
+}
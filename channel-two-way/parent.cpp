@@ -4,30 +4,184 @@
 #include <string.h>
 
 #include <fbl/auto_call.h>
+#include <msgpool/msgpool.h>
+#include <mux/mux.h>
+#include <spinwait/spinwait.h>
 #include <sys/types.h>
+#include <trace/syscalls.h>
+#include <zircon/process.h>
 #include <zircon/syscalls.h>
 
+#include <memory>
+
 // Send this many messages before quitting.
 constexpr uint kNumMessages = 10;
 
-// Put some delays between actions so it's easier to follow the output of
-// stdout. Also, since both processes share stdout, these delays prevent
-// interleaving.
-constexpr uint kMessageTimeoutMs = 500;
+// Counters the server reports in benchmark mode.
+typedef struct server_stats {
+    // Requests answered (or, after the peer closed, drained).
+    uint64_t requests;
+    // Calls to zx_object_wait_one, for any signal.
+    uint64_t waits;
+    // Waits for READABLE, i.e. times the server went idle.
+    uint64_t wakeups;
+    // Requests read after the client had already closed its end.
+    uint64_t drained;
+} server_stats_t;
 
-zx_status_t parent(zx_handle_t channel) {
-    // Close the channel when we exit this scope.
-    auto channel_cleanup = fbl::MakeAutoCall([channel]() {
-        zx_handle_close(channel);
-    });
+static void print_stats(const server_stats_t& stats, const options_t& options) {
+    double requests = stats.requests ? static_cast<double>(stats.requests) : 1;
+    double wakeups = stats.wakeups ? static_cast<double>(stats.wakeups) : 1;
+    char name[96];
+    snprintf(name, sizeof(name), "%s.server.requests", options.prefix);
+    histogram::PrintValue(stdout, name, "req",
+                          static_cast<double>(stats.requests), options.format);
+    snprintf(name, sizeof(name), "%s.server.waits_per_request", options.prefix);
+    histogram::PrintValue(stdout, name, "waits/req", stats.waits / requests,
+                          options.format);
+    snprintf(name, sizeof(name), "%s.server.requests_per_wakeup",
+             options.prefix);
+    histogram::PrintValue(stdout, name, "req/wakeup", stats.requests / wakeups,
+                          options.format);
+}
+
+// Compute the answer to |request| and send it back to the client.
+static zx_status_t respond(AddServer* channel, const add_request_t& request,
+                           const options_t& options, server_stats_t* stats) {
+    add_response_t response;
+    response.txid = request.txid;
+    response.result = request.a + request.b;
+    if (!options.bench) {
+        LOG("child asked what is '%d + %d' respond with %d (txid %u)\n",
+            request.a, request.b, response.result, request.txid);
+    }
+
+    zx_status_t st = send_message(channel, response, options.write_first,
+                                  &stats->waits);
+    if (st == ZX_ERR_PEER_CLOSED) {
+        ERR("peer closed before response could be delivered\n");
+        return st;
+    } else if (st != ZX_OK) {
+        ERR("failed to send response, st = %d\n", st);
+        return st;
+    }
+
+    stats->requests++;
+    return ZX_OK;
+}
+
+// Serve requests in batches. Every wakeup drains the channel (up to
+// kMaxBatch requests at a time), computes all the results and then writes the
+// responses back to back, only waiting if the channel refuses a write. When
+// the client goes away everything it queued is still read and processed
+// before we shut down.
+static zx_status_t serve_batched(AddServer* channel, const options_t& options,
+                                 spinwait::Waiter* waiter,
+                                 server_stats_t* stats) {
+    add_request_t requests[kMaxBatch];
+    add_response_t responses[kMaxBatch];
+    bool peer_closed = false;
+
+    while (true) {
+        // Read until the channel is empty.
+        uint32_t count = 0;
+        while (count < kMaxBatch) {
+            zx_status_t st = channel->Read(&requests[count]);
+            if (st == ZX_ERR_SHOULD_WAIT) {
+                break;
+            } else if (st == ZX_ERR_PEER_CLOSED) {
+                // Only reported once every queued message has been read.
+                peer_closed = true;
+                break;
+            } else if (st != ZX_OK) {
+                ERR("zx_channel_read failed with st = %d\n", st);
+                return st;
+            }
+            count++;
+        }
+
+        add_batch(requests, responses, count);
+        for (uint32_t i = 0; i < count && !options.bench; i++) {
+            LOG("child asked what is '%d + %d' respond with %d (txid %u)\n",
+                requests[i].a, requests[i].b, responses[i].result,
+                requests[i].txid);
+        }
+        stats->requests += count;
+        if (peer_closed) {
+            stats->drained += count;
+        }
+
+        // Write the whole burst. Once the peer is gone there is nobody to
+        // answer, but the requests above were still processed.
+        for (uint32_t i = 0; i < count && !peer_closed;) {
+            zx_status_t st = channel->Write(responses[i]);
+            if (st == ZX_OK) {
+                i++;
+                continue;
+            } else if (st == ZX_ERR_PEER_CLOSED) {
+                peer_closed = true;
+                break;
+            } else if (st != ZX_ERR_SHOULD_WAIT) {
+                ERR("zx_channel_write failed with st = %d\n", st);
+                return st;
+            }
+
+            zx_signals_t signals;
+            st = channel->wait_one(ZX_CHANNEL_WRITABLE | ZX_CHANNEL_PEER_CLOSED,
+                                   ZX_TIME_INFINITE, &signals);
+            stats->waits++;
+            if (st != ZX_OK) {
+                ERR("zx_object_wait_one failed with st = %d\n", st);
+                return st;
+            }
+            if (!(signals & ZX_CHANNEL_WRITABLE)) {
+                peer_closed = true;
+            }
+        }
+
+        if (count == kMaxBatch) {
+            // There may be more queued behind this batch.
+            continue;
+        }
+        if (peer_closed) {
+            // The read loop above ran dry after the peer closed, so there
+            // is nothing left in the channel.
+            if (!options.bench) {
+                LOG("peer went away, drained %lu queued requests, shutting down\n",
+                    stats->drained);
+            }
+            return ZX_OK;
+        }
 
+        // Unlike the lockstep loop, PEER_CLOSED doesn't end things here: the
+        // next pass drains whatever the client left behind.
+        trace::Span span(trace::Op::kObjectWait);
+        zx_status_t st = waiter->Wait(channel->handle().get(),
+                                      ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                      nullptr);
+        span.End(st);
+        stats->waits++;
+        stats->wakeups++;
+        if (st != ZX_OK) {
+            ERR("zx_object_wait_one failed with st = %d\n", st);
+            return st;
+        }
+    }
+}
+
+// Serve one request per wakeup, in lockstep with the client.
+static zx_status_t serve(AddServer* channel, const options_t& options,
+                         spinwait::Waiter* waiter, server_stats_t* stats) {
     // Serve requests until the peer closes.
     while (true) {
-        zx_signals_t signals;
-        zx_status_t st = zx_object_wait_one(
-            channel,
-            ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
-            ZX_TIME_INFINITE, &signals);
+        zx_signals_t signals = 0;
+        trace::Span span(trace::Op::kObjectWait);
+        zx_status_t st = waiter->Wait(channel->handle().get(),
+                                      ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                      &signals);
+        span.End(st, signals);
+        stats->waits++;
+        stats->wakeups++;
 
         if (st != ZX_OK) {
             ERR("zx_object_wait_one failed with st = %d\n", st);
@@ -39,59 +193,550 @@ zx_status_t parent(zx_handle_t channel) {
         // If we wanted to drain the channel and read all the messages pending
         // inside we would omit the following block of code.
         if (signals & ZX_CHANNEL_PEER_CLOSED) {
-            LOG("peer went away, shutting down\n");
+            // Keep quiet in benchmark mode, the child owns stdout.
+            if (!options.bench) {
+                LOG("peer went away, shutting down\n");
+            }
             return ZX_OK;
         }
 
-        add_request_t request;
-        add_response_t response;
-        st = zx_channel_read(
-            channel,
-            0, // Options
-            &request,
-            nullptr, // Handles
-            sizeof(request),
-            0,       // Num handles
-            nullptr, // Actual bytes transferred.
-            nullptr  // Actual handles transferred.
-            );
+        // Collect up to |options.reorder| requests that are already queued.
+        // The first read can't come up empty since the channel is readable.
+        add_request_t requests[kMaxReorder];
+        uint32_t count = 0;
+        while (count < options.reorder) {
+            st = channel->Read(&requests[count]);
+            if (st == ZX_ERR_SHOULD_WAIT && count > 0) {
+                break;
+            } else if (st != ZX_OK) {
+                ERR("zx_channel_read failed with st = %d\n", st);
+                return st;
+            }
+            count++;
+        }
 
+        // Answer the newest request first. The client matches responses to
+        // requests by txid, so the order doesn't matter to it.
+        while (count > 0) {
+            st = respond(channel, requests[--count], options, stats);
+            if (st != ZX_OK) {
+                return st;
+            }
+        }
+    }
+}
+
+zx_status_t parent(zx_handle_t handle, const options_t& options) {
+    // The channel closes when |channel| goes out of scope.
+    AddServer channel{typed::Handle(handle)};
+
+    server_stats_t stats = {};
+    spinwait::Waiter waiter(options.spin);
+    trace::counts_t before = trace::ThreadCounts();
+    zx_status_t st = options.batch
+                         ? serve_batched(&channel, options, &waiter, &stats)
+                         : serve(&channel, options, &waiter, &stats);
+    trace::counts_t after = trace::ThreadCounts();
+    if (st == ZX_OK && options.bench) {
+        print_stats(stats, options);
+        char name[96];
+        snprintf(name, sizeof(name), "%s.server.syscalls_per_request",
+                 options.prefix);
+        print_syscalls(name, before, after, stats.requests, options.format);
+        if (options.spin > 0) {
+            snprintf(name, sizeof(name), "%s.server.wait", options.prefix);
+            waiter.PrintCounters(stdout, name, options.format);
+        }
+    }
+
+    return st;
+}
+
+// Private memory of this process, in bytes.
+static size_t private_bytes() {
+    zx_info_task_stats_t info;
+    zx_status_t st = zx_object_get_info(zx_process_self(), ZX_INFO_TASK_STATS,
+                                        &info, sizeof(info), nullptr, nullptr);
+    return st == ZX_OK ? info.mem_private_bytes : 0;
+}
+
+// Connections the memory probe opens: enough that page granularity and
+// allocator slack are small next to what they cost, and few enough to stay
+// within the host backend's descriptor limit.
+constexpr uint32_t kMemoryProbeConnections = 8192;
+
+// Opens |count| connections the way parent_clients does, each armed on a
+// port, keeps only our ends, and returns how much our private memory grew.
+// In --mux mode that is one channel carrying |count| streams.
+static zx_status_t probe_connections(uint32_t count, const options_t& options,
+                                     size_t* growth) {
+    typed::Handle port;
+    zx_status_t st = zx_port_create(0, port.reset_and_get_address());
+    if (st != ZX_OK) {
+        return st;
+    }
+    std::unique_ptr<zx_handle_t[]> channels;
+    uint32_t created = 0;
+    auto channels_cleanup = fbl::MakeAutoCall([&channels, &created]() {
+        for (uint32_t i = 0; i < created; i++) {
+            zx_handle_close(channels[i]);
+        }
+    });
+    std::unique_ptr<mux::Mux> mux;
+
+    size_t before = private_bytes();
+    if (options.mux && count > 0) {
+        zx_handle_t ours;
+        zx_handle_t theirs;
+        st = zx_channel_create(0, &ours, &theirs);
         if (st != ZX_OK) {
-            ERR("zx_channel_read failed with st = %d\n", st);
             return st;
         }
+        zx_handle_close(theirs);
+        st = mux::Mux::Create(ours, count, kMuxWindow, &mux);
+        if (st == ZX_OK) {
+            st = zx_object_wait_async(ours, port.get(), 0, mux->signals(),
+                                      ZX_WAIT_ASYNC_ONCE);
+        }
+    } else if (!options.mux) {
+        channels.reset(new zx_handle_t[count]);
+        for (; created < count; created++) {
+            zx_handle_t theirs;
+            st = zx_channel_create(0, &channels[created], &theirs);
+            if (st != ZX_OK) {
+                break;
+            }
+            zx_handle_close(theirs);
+            st = zx_object_wait_async(channels[created], port.get(), created,
+                                      ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                      ZX_WAIT_ASYNC_ONCE);
+            if (st != ZX_OK) {
+                created++;
+                break;
+            }
+        }
+    }
+    size_t after = private_bytes();
+    *growth = after > before ? after - before : 0;
+    return st;
+}
 
-        response.result = request.a + request.b;
-        LOG("child asked what is '%d + %d' respond with %d\n",
-            request.a, request.b, response.result);
+zx_status_t parent_memory_probe(const options_t& options) {
+    // The empty run counts what the probe itself costs.
+    size_t empty;
+    size_t full;
+    zx_status_t st = probe_connections(0, options, &empty);
+    if (st == ZX_OK) {
+        st = probe_connections(kMemoryProbeConnections, options, &full);
+    }
+    if (st != ZX_OK) {
+        ERR("memory probe failed, st = %d\n", st);
+        return st;
+    }
+    double growth = full > empty ? static_cast<double>(full - empty) : 0;
+    char name[64];
+    snprintf(name, sizeof(name), "%s.memory_per_connection",
+             options.mux ? "channel-two-way.mux" : "channel-two-way");
+    histogram::PrintValue(stdout, name, "bytes",
+                          growth / kMemoryProbeConnections, options.format);
+    return ZX_OK;
+}
 
-        st = zx_object_wait_one(channel,
-                                ZX_CHANNEL_PEER_CLOSED | ZX_CHANNEL_WRITABLE,
-                                ZX_TIME_INFINITE, &signals);
+// Write a bootstrap message to a child, waiting if its channel is full.
+static zx_status_t send_to_child(zx_handle_t child, const void* bytes,
+                                 uint32_t num_bytes, const zx_handle_t* handles,
+                                 uint32_t num_handles) {
+    while (true) {
+        zx_status_t st = trace::channel_write(child, 0, bytes, num_bytes,
+                                              handles, num_handles);
+        if (st != ZX_ERR_SHOULD_WAIT) {
+            return st;
+        }
+        st = trace::object_wait_one(
+            child, ZX_CHANNEL_WRITABLE | ZX_CHANNEL_PEER_CLOSED,
+            ZX_TIME_INFINITE, nullptr);
         if (st != ZX_OK) {
-            ERR("zx_object_wait_one failed with st = %d\n", st);
             return st;
         }
+    }
+}
 
-        if (signals & ZX_CHANNEL_PEER_CLOSED) {
-            ERR("peer closed before response could be delivered\n");
-            return ZX_ERR_PEER_CLOSED;
+zx_status_t serve_connection(zx_handle_t channel, uint64_t* requests) {
+    // Requests are read into, and responses written from, pooled buffers
+    // borrowed from this thread's free lists for the wakeup.
+    msgpool::Message message;
+    msgpool::Buffer buffer;
+    zx_status_t st = msgpool::Allocate(sizeof(add_response_t), &buffer);
+    if (st != ZX_OK) {
+        return st;
+    }
+    add_response_t* response = buffer.as<add_response_t>();
+
+    while (true) {
+        st = message.Read(channel);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            return ZX_OK;
+        } else if (st != ZX_OK) {
+            return st;
+        } else if (message.num_bytes() != sizeof(add_request_t)) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+
+        const add_request_t* request =
+            static_cast<const add_request_t*>(message.bytes());
+        response->txid = request->txid;
+        response->result = request->a + request->b;
+
+        // Clients run in lockstep, so there is never more than one response
+        // queued and the write can't come back with SHOULD_WAIT.
+        st = trace::channel_write(channel, 0, response, sizeof(*response),
+                                  nullptr, 0);
+        if (st != ZX_OK) {
+            return st;
+        }
+        (*requests)++;
+    }
+}
+
+// Serves |channels| from this thread until every client hangs up, then
+// reports throughput. Connection i must be armed on |port| with key i.
+static zx_status_t serve_port(zx_handle_t* channels, uint32_t num_clients,
+                              zx_handle_t port, const options_t& options) {
+    uint32_t live = num_clients;
+    uint64_t requests = 0;
+    uint64_t wakeups = 0;
+    zx_time_t start = 0;
+    while (live > 0) {
+        zx_port_packet_t packet;
+        zx_status_t st = trace::port_wait(port, ZX_TIME_INFINITE, &packet);
+        if (st != ZX_OK) {
+            ERR("zx_port_wait failed with st = %d\n", st);
+            return st;
         }
+        if (start == 0) {
+            start = zx_clock_get_monotonic();
+        }
+        wakeups++;
 
-        st = zx_channel_write(
-            channel,
-            0,
-            &response, sizeof(response),
-            nullptr, 0);
+        uint64_t index = packet.key;
+        st = serve_connection(channels[index], &requests);
+        if (st == ZX_ERR_PEER_CLOSED) {
+            zx_handle_close(channels[index]);
+            channels[index] = ZX_HANDLE_INVALID;
+            live--;
+            continue;
+        } else if (st != ZX_OK) {
+            ERR("connection %lu failed with st = %d\n", index, st);
+            return st;
+        }
 
+        st = zx_object_wait_async(channels[index], port, index,
+                                  ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                  ZX_WAIT_ASYNC_ONCE);
         if (st != ZX_OK) {
-            ERR("zx_channel_write failed with st = %d\n", st);
+            ERR("zx_object_wait_async failed with st = %d\n", st);
             return st;
         }
     }
+    zx_time_t end = zx_clock_get_monotonic();
+
+    char name[64];
+    double seconds = static_cast<double>(end - start) / ZX_SEC(1);
+    snprintf(name, sizeof(name), "channel-two-way.clients.%u.throughput",
+             num_clients);
+    histogram::PrintValue(stdout, name, "req/s",
+                          seconds > 0 ? requests / seconds : 0, options.format);
+    snprintf(name, sizeof(name), "channel-two-way.clients.%u.requests_per_wakeup",
+             num_clients);
+    histogram::PrintValue(stdout, name, "req/wakeup",
+                          wakeups ? static_cast<double>(requests) / wakeups : 0,
+                          options.format);
+    return ZX_OK;
+}
+
+// Hands |child| one channel carrying |count| streams, the first |count|
+// connections' worth, and arms our end of it on |port| with key |index|.
+static zx_status_t connect_mux(zx_handle_t child, uint32_t count,
+                               zx_handle_t port, uint64_t index,
+                               std::unique_ptr<mux::Mux>* out) {
+    zx_handle_t ours;
+    zx_handle_t theirs;
+    zx_status_t st = zx_channel_create(0, &ours, &theirs);
+    if (st != ZX_OK) {
+        ERR("zx_channel_create failed with st = %d\n", st);
+        return st;
+    }
+    st = mux::Mux::Create(ours, count, kMuxWindow, out);
+    if (st == ZX_OK) {
+        st = zx_object_wait_async(ours, port, index, (*out)->signals(),
+                                  ZX_WAIT_ASYNC_ONCE);
+    }
+    if (st == ZX_OK) {
+        st = send_to_child(child, nullptr, 0, &theirs, 1);
+    }
+    if (st != ZX_OK) {
+        // On the host backend a failed write leaves the handle with us.
+        zx_handle_close(theirs);
+        ERR("failed to hand out a mux channel, st = %d\n", st);
+    }
+    return st;
+}
+
+// Serves every stream of |muxes| from this thread until every child hangs
+// up, then reports throughput. Mux i must be armed on |port| with key i.
+static zx_status_t serve_mux(std::unique_ptr<mux::Mux>* muxes,
+                             uint32_t num_muxes, uint32_t num_clients,
+                             zx_handle_t port, const options_t& options) {
+    uint32_t live = num_muxes;
+    uint64_t requests = 0;
+    uint64_t wakeups = 0;
+    uint64_t messages = 0;
+    zx_time_t start = 0;
+    while (live > 0) {
+        zx_port_packet_t packet;
+        zx_status_t st = trace::port_wait(port, ZX_TIME_INFINITE, &packet);
+        if (st != ZX_OK) {
+            ERR("zx_port_wait failed with st = %d\n", st);
+            return st;
+        }
+        if (start == 0) {
+            start = zx_clock_get_monotonic();
+        }
+        wakeups++;
+
+        uint64_t index = packet.key;
+        mux::Mux* mux = muxes[index].get();
+        zx_status_t pumped = mux->Pump();
+        if (pumped != ZX_OK && pumped != ZX_ERR_PEER_CLOSED) {
+            ERR("mux %lu failed with st = %d\n", index, pumped);
+            return pumped;
+        }
 
-    // Channel will close automatically because of the fbl::AutoCall above.
-    LOG("Closing channel...\n");
+        uint32_t stream;
+        while (mux->NextReadable(&stream)) {
+            add_request_t request;
+            uint32_t actual_bytes;
+            st = mux->Receive(stream, &request, sizeof(request), &actual_bytes);
+            if (st != ZX_OK || actual_bytes != sizeof(request)) {
+                ERR("bad request on stream %u of mux %lu\n", stream, index);
+                return ZX_ERR_IO_DATA_INTEGRITY;
+            }
+            add_response_t response = {.txid = request.txid,
+                                       .result = request.a + request.b};
+            // Receiving the request freed the credit the response needs.
+            st = mux->Send(stream, &response, sizeof(response));
+            if (st != ZX_OK) {
+                ERR("can't answer stream %u of mux %lu, st = %d\n", stream,
+                    index, st);
+                return st;
+            }
+            requests++;
+        }
 
+        st = pumped == ZX_OK ? mux->Flush() : ZX_ERR_PEER_CLOSED;
+        if (st == ZX_ERR_PEER_CLOSED) {
+            const mux::Stats& stats = mux->stats();
+            messages += stats.reads + stats.writes;
+            muxes[index].reset();
+            live--;
+            continue;
+        } else if (st != ZX_OK && st != ZX_ERR_SHOULD_WAIT) {
+            ERR("mux %lu failed to flush, st = %d\n", index, st);
+            return st;
+        }
+
+        st = zx_object_wait_async(mux->channel(), port, index, mux->signals(),
+                                  ZX_WAIT_ASYNC_ONCE);
+        if (st != ZX_OK) {
+            ERR("zx_object_wait_async failed with st = %d\n", st);
+            return st;
+        }
+    }
+    zx_time_t end = zx_clock_get_monotonic();
+
+    char name[64];
+    double seconds = static_cast<double>(end - start) / ZX_SEC(1);
+    snprintf(name, sizeof(name), "channel-two-way.mux.clients.%u.throughput",
+             num_clients);
+    histogram::PrintValue(stdout, name, "req/s",
+                          seconds > 0 ? requests / seconds : 0, options.format);
+    snprintf(name, sizeof(name),
+             "channel-two-way.mux.clients.%u.requests_per_wakeup", num_clients);
+    histogram::PrintValue(stdout, name, "req/wakeup",
+                          wakeups ? static_cast<double>(requests) / wakeups : 0,
+                          options.format);
+    snprintf(name, sizeof(name),
+             "channel-two-way.mux.clients.%u.messages_per_request", num_clients);
+    histogram::PrintValue(stdout, name, "msg/req",
+                          requests ? static_cast<double>(messages) / requests : 0,
+                          options.format);
     return ZX_OK;
 }
+
+zx_status_t parent_clients(const zx_handle_t* children, uint32_t num_children,
+                           uint32_t num_clients, const options_t& options) {
+    // Close the bootstrap channels when we exit this scope; that is also
+    // what tells any child still waiting for connections to give up.
+    auto children_cleanup = fbl::MakeAutoCall([children, num_children]() {
+        for (uint32_t i = 0; i < num_children; i++) {
+            zx_handle_close(children[i]);
+        }
+    });
+
+    std::unique_ptr<zx_handle_t[]> channels(new zx_handle_t[num_clients]);
+    for (uint32_t i = 0; i < num_clients; i++) {
+        channels[i] = ZX_HANDLE_INVALID;
+    }
+    auto channels_cleanup = fbl::MakeAutoCall([&channels, num_clients]() {
+        for (uint32_t i = 0; i < num_clients; i++) {
+            if (channels[i] != ZX_HANDLE_INVALID) {
+                zx_handle_close(channels[i]);
+            }
+        }
+    });
+
+    // --mux carries the connections as streams, one channel per child.
+    std::unique_ptr<std::unique_ptr<mux::Mux>[]> muxes(
+        new std::unique_ptr<mux::Mux>[num_children]);
+    const char* mode = options.mux ? "channel-two-way.mux" : "channel-two-way";
+
+    char name[64];
+
+    // One port per worker thread, or a single port served from this thread.
+    uint32_t num_ports = options.workers > 0 ? options.workers : 1;
+    zx_handle_t ports[kMaxWorkers];
+    uint32_t ports_created = 0;
+    auto ports_cleanup = fbl::MakeAutoCall([&ports, &ports_created]() {
+        for (uint32_t i = 0; i < ports_created; i++) {
+            zx_handle_close(ports[i]);
+        }
+    });
+    zx_status_t st;
+    for (; ports_created < num_ports; ports_created++) {
+        st = zx_port_create(0, &ports[ports_created]);
+        if (st != ZX_OK) {
+            ERR("zx_port_create failed with st = %d\n", st);
+            return st;
+        }
+    }
+
+    uint64_t per_connection = options.iterations / num_clients;
+    if (per_connection == 0) {
+        per_connection = 1;
+    }
+
+    // The client ends go out in batches from a pooled handle array.
+    msgpool::Buffer batch_buffer;
+    st = msgpool::Allocate(ZX_CHANNEL_MAX_MSG_HANDLES * sizeof(zx_handle_t),
+                           &batch_buffer);
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    // Hand the connections out in contiguous ranges, one range per child.
+    // Client ends are sent as soon as a batch is full so we never hold both
+    // ends of every connection at once.
+    for (uint32_t c = 0; c < num_children; c++) {
+        uint32_t first = static_cast<uint32_t>(
+            static_cast<uint64_t>(num_clients) * c / num_children);
+        uint32_t last = static_cast<uint32_t>(
+            static_cast<uint64_t>(num_clients) * (c + 1) / num_children);
+
+        connections_header_t header = {.count = last - first,
+                                       .mux = options.mux,
+                                       .requests_per_connection = per_connection};
+        st = send_to_child(children[c], &header, sizeof(header), nullptr, 0);
+        if (st != ZX_OK) {
+            ERR("failed to send connection header, st = %d\n", st);
+            return st;
+        }
+        if (options.mux) {
+            st = connect_mux(children[c], header.count, ports[0], c, &muxes[c]);
+            if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        }
+
+        zx_handle_t* batch = batch_buffer.as<zx_handle_t>();
+        uint32_t batched = 0;
+        for (uint32_t i = first; i < last; i++) {
+            st = zx_channel_create(0, &channels[i], &batch[batched]);
+            if (st != ZX_OK) {
+                ERR("zx_channel_create failed with st = %d\n", st);
+                break;
+            }
+            batched++;
+
+            // The key is the connection's index in |channels|, and the
+            // index also picks the port it is served from. Coroutines
+            // register their own waits.
+            if (!options.coro) {
+                st = zx_object_wait_async(channels[i], ports[i % num_ports], i,
+                                          ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                          ZX_WAIT_ASYNC_ONCE);
+                if (st != ZX_OK) {
+                    ERR("zx_object_wait_async failed with st = %d\n", st);
+                    break;
+                }
+            }
+
+            if (batched == ZX_CHANNEL_MAX_MSG_HANDLES || i + 1 == last) {
+                st = send_to_child(children[c], nullptr, 0, batch, batched);
+                if (st != ZX_OK) {
+                    ERR("failed to send connections, st = %d\n", st);
+                    break;
+                }
+                batched = 0;
+            }
+        }
+        if (st != ZX_OK) {
+            for (uint32_t i = 0; i < batched; i++) {
+                zx_handle_close(batch[i]);
+            }
+            return st;
+        }
+    }
+
+    // Both ends of every channel count.
+    snprintf(name, sizeof(name), "%s.clients.%u.handles", mode, num_clients);
+    histogram::PrintValue(stdout, name, "handles",
+                          2.0 * (options.mux ? num_children : num_clients),
+                          options.format);
+
+    // Every serving thread's first wakeup takes a batch of buffers from the
+    // pool; set them aside now so that the run itself never has to go to the
+    // heap, and count anything that does. A mux also packs its frames into
+    // full-sized channel messages.
+    st = msgpool::Reserve(sizeof(add_request_t), num_ports);
+    if (st == ZX_OK && options.mux) {
+        st = msgpool::Reserve(ZX_CHANNEL_MAX_MSG_BYTES, num_ports);
+    }
+    if (st != ZX_OK) {
+        ERR("failed to reserve message buffers, st = %d\n", st);
+        return st;
+    }
+    uint64_t heap_allocs = msgpool::GetStats().heap_allocs;
+
+    if (options.mux) {
+        st = serve_mux(muxes.get(), num_children, num_clients, ports[0],
+                       options);
+    } else if (options.coro) {
+        st = serve_coro(channels.get(), num_clients, options);
+    } else if (options.workers > 0) {
+        st = serve_workers(channels.get(), num_clients, ports, options.workers,
+                           options);
+    } else {
+        st = serve_port(channels.get(), num_clients, ports[0], options);
+    }
+    if (st == ZX_OK) {
+        snprintf(name, sizeof(name), "%s.clients.%u.heap_allocs", mode,
+                 num_clients);
+        histogram::PrintValue(
+            stdout, name, "allocs",
+            static_cast<double>(msgpool::GetStats().heap_allocs - heap_allocs),
+            options.format);
+    }
+    fflush(stdout);
+    return st;
+}
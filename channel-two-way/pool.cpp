@@ -0,0 +1,133 @@
+#define LOG_PREFIX "[PARNT]"
+#include "common.h"
+
+#include <procpool/procpool.h>
+#include <spawn/spawn.h>
+#include <zircon/syscalls.h>
+
+#include <memory>
+
+// Cold spawns are slow, so only time a few of them.
+constexpr uint32_t kColdJobs = 32;
+
+// Jobs handed to the warm pool.
+constexpr uint32_t kWarmJobs = 10000;
+
+// Hands |pool| one kJobNoop job carrying a fresh channel end, as a real job
+// would carry its bootstrap channel, and waits for it to finish.
+static zx_status_t noop_job(procpool::Pool* pool) {
+    typed::Handle mine;
+    zx_handle_t theirs;
+    zx_status_t st = zx_channel_create(0, mine.reset_and_get_address(), &theirs);
+    if (st != ZX_OK) {
+        return st;
+    }
+    st = pool->Dispatch(kJobNoop, nullptr, 0, &theirs, 1);
+    if (st != ZX_OK) {
+        return st;
+    }
+    return pool->WaitIdle();
+}
+
+zx_status_t parent_pool_bench(const char* path, const char* const* args,
+                              const options_t& options) {
+    // Too big for the stack.
+    std::unique_ptr<histogram::Histogram> cold(new histogram::Histogram());
+    std::unique_ptr<histogram::Histogram> warm(new histogram::Histogram());
+
+    // Cold: every job gets a process of its own, spawned for it.
+    for (uint32_t i = 0; i < kColdJobs; i++) {
+        zx_time_t start = zx_clock_get_monotonic();
+        std::unique_ptr<procpool::Pool> pool;
+        zx_status_t st = procpool::Pool::Create(path, args, 1, &pool);
+        if (st == ZX_OK) {
+            st = noop_job(pool.get());
+        }
+        if (st != ZX_OK) {
+            ERR("cold job failed, st = %d\n", st);
+            return st;
+        }
+        cold->Record(static_cast<uint64_t>(zx_clock_get_monotonic() - start));
+    }
+
+    // Warm-up: what it costs to get the whole pool going.
+    zx_time_t start = zx_clock_get_monotonic();
+    std::unique_ptr<procpool::Pool> pool;
+    zx_status_t st = procpool::Pool::Create(path, args, options.children, &pool);
+    if (st != ZX_OK) {
+        ERR("failed to start the pool, st = %d\n", st);
+        return st;
+    }
+    double warmup = static_cast<double>(zx_clock_get_monotonic() - start);
+
+    // Warm: the same jobs handed to processes that are already running.
+    for (uint32_t i = 0; i < kWarmJobs; i++) {
+        start = zx_clock_get_monotonic();
+        st = noop_job(pool.get());
+        if (st != ZX_OK) {
+            ERR("warm job failed, st = %d\n", st);
+            return st;
+        }
+        warm->Record(static_cast<uint64_t>(zx_clock_get_monotonic() - start));
+    }
+
+    cold->Print(stdout, "channel-two-way.pool.cold_job", "ns", options.format);
+    warm->Print(stdout, "channel-two-way.pool.dispatch", "ns", options.format);
+    histogram::PrintValue(stdout, "channel-two-way.pool.warmup", "ms",
+                          warmup / ZX_MSEC(1), options.format);
+    histogram::PrintValue(stdout, "channel-two-way.pool.warmup_per_child", "ms",
+                          warmup / ZX_MSEC(1) / options.children,
+                          options.format);
+    return ZX_OK;
+}
+
+// Children per batch in the startup benchmark.
+constexpr uint32_t kSpawnBatches[] = {1, 8, 64, 256};
+
+// Threads the parallel startup fans out to.
+constexpr uint32_t kSpawnThreads = 8;
+
+// Times starting |count| children with |threads| threads, |runs| times.
+static zx_status_t time_spawn(const char* path, const char* const* args,
+                              uint32_t count, uint32_t threads, uint32_t runs,
+                              histogram::Histogram* startup) {
+    std::unique_ptr<spawn::child_t[]> children(new spawn::child_t[count]());
+    for (uint32_t run = 0; run < runs; run++) {
+        zx_time_t start = zx_clock_get_monotonic();
+        zx_status_t st = spawn::Spawn(path, args, children.get(), count, threads);
+        zx_time_t end = zx_clock_get_monotonic();
+        if (st != ZX_OK) {
+            ERR("failed to start %u children, st = %d\n", count, st);
+            return st;
+        }
+        startup->Record(static_cast<uint64_t>(end - start));
+        for (uint32_t i = 0; i < count; i++) {
+            zx_handle_close(children[i].channel);
+        }
+    }
+    return ZX_OK;
+}
+
+zx_status_t parent_spawn_bench(const char* path, const char* const* args,
+                               const options_t& options) {
+    for (uint32_t count : kSpawnBatches) {
+        // Big batches take a while; a few runs are enough to see a trend.
+        uint32_t runs = count < 64 ? 20 : 3;
+        const uint32_t threads[] = {1, kSpawnThreads};
+        const char* const modes[] = {"serial", "parallel"};
+        for (size_t m = 0; m < countof(threads); m++) {
+            std::unique_ptr<histogram::Histogram> startup(
+                new histogram::Histogram());
+            zx_status_t st = time_spawn(path, args, count, threads[m], runs,
+                                        startup.get());
+            if (st != ZX_OK) {
+                return st;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "channel-two-way.spawn.%u.%s", count,
+                     modes[m]);
+            startup->Print(stdout, name, "ns", options.format);
+        }
+    }
+    return ZX_OK;
+}
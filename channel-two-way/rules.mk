@@ -12,9 +12,30 @@ MODULE_GROUP := core
 MODULE_SRCS += \
     $(LOCAL_DIR)/main.cpp	\
     $(LOCAL_DIR)/parent.cpp	\
-    $(LOCAL_DIR)/child.cpp
+    $(LOCAL_DIR)/child.cpp	\
+    $(LOCAL_DIR)/workers.cpp	\
+    $(LOCAL_DIR)/pool.cpp	\
+    $(LOCAL_DIR)/kernels.cpp	\
+    $(LOCAL_DIR)/syscalls.cpp	\
+    $(LOCAL_DIR)/coroutines.cpp
 
-MODULE_STATIC_LIBS := system/ulib/pretty system/ulib/fbl
+MODULE_STATIC_LIBS := system/ulib/pretty system/ulib/fbl \
+    $(dir $(LOCAL_DIR))ulib/coro \
+    $(dir $(LOCAL_DIR))ulib/histogram \
+    $(dir $(LOCAL_DIR))ulib/logger \
+    $(dir $(LOCAL_DIR))ulib/msgpool \
+    $(dir $(LOCAL_DIR))ulib/mux \
+    $(dir $(LOCAL_DIR))ulib/placement \
+    $(dir $(LOCAL_DIR))ulib/procpool \
+    $(dir $(LOCAL_DIR))ulib/spawn \
+    $(dir $(LOCAL_DIR))ulib/spinwait \
+    $(dir $(LOCAL_DIR))ulib/trace
+
+# <coro/coro.h> needs C++20.
+MODULE_CPPFLAGS += -std=c++20
+
+# Header-only.
+MODULE_COMPILEFLAGS += -I$(dir $(LOCAL_DIR))ulib/typed/include
 
 MODULE_LIBS := system/ulib/fdio system/ulib/c  system/ulib/zircon
 
@@ -0,0 +1,22 @@
+#include "common.h"
+
+#include <zircon/syscalls.h>
+
+void print_syscalls(const char* name, const trace::counts_t& before,
+                    const trace::counts_t& after, uint64_t messages,
+                    histogram::Format format) {
+    double per = messages ? static_cast<double>(messages) : 1;
+    histogram::PrintValue(stdout, name, "calls/msg",
+                          (after.total() - before.total()) / per, format);
+    for (size_t i = 0; i < static_cast<size_t>(trace::Op::kCount); i++) {
+        uint64_t calls = after.calls[i] - before.calls[i];
+        if (calls == 0) {
+            continue;
+        }
+        char op_name[128];
+        snprintf(op_name, sizeof(op_name), "%s.%s", name,
+                 trace::OpName(static_cast<trace::Op>(i)));
+        histogram::PrintValue(stdout, op_name, "calls/msg", calls / per,
+                              format);
+    }
+}
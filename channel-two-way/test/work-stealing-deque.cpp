@@ -0,0 +1,120 @@
+// WorkStealingDeque: owner order, thief order, bounds, and every item taken
+// exactly once under contention.
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <unittest/unittest.h>
+
+#include "../work_stealing_deque.h"
+
+static bool owner_is_lifo_thieves_fifo() {
+    BEGIN_TEST;
+    WorkStealingDeque<8> deque;
+    uint64_t item;
+    EXPECT_FALSE(deque.Pop(&item), "empty");
+    EXPECT_FALSE(deque.Steal(&item), "empty");
+
+    for (uint64_t i = 1; i <= 4; i++) {
+        ASSERT_TRUE(deque.Push(i));
+    }
+    ASSERT_TRUE(deque.Pop(&item));
+    EXPECT_EQ(item, 4u, "the owner takes what it pushed last");
+    ASSERT_TRUE(deque.Steal(&item));
+    EXPECT_EQ(item, 1u, "a thief takes the oldest");
+    ASSERT_TRUE(deque.Steal(&item));
+    EXPECT_EQ(item, 2u);
+    ASSERT_TRUE(deque.Pop(&item));
+    EXPECT_EQ(item, 3u);
+    EXPECT_FALSE(deque.Pop(&item));
+    EXPECT_FALSE(deque.Steal(&item));
+    END_TEST;
+}
+
+static bool bounded() {
+    BEGIN_TEST;
+    WorkStealingDeque<4> deque;
+    for (uint64_t i = 0; i < 4; i++) {
+        ASSERT_TRUE(deque.Push(i));
+    }
+    EXPECT_FALSE(deque.Push(4), "full");
+    uint64_t item;
+    ASSERT_TRUE(deque.Steal(&item));
+    EXPECT_TRUE(deque.Push(4), "a steal makes room");
+
+    // Go round the ring several times.
+    for (uint64_t i = 5; i < 100; i++) {
+        ASSERT_TRUE(deque.Steal(&item));
+        EXPECT_EQ(item, i - 4);
+        ASSERT_TRUE(deque.Push(i));
+    }
+    END_TEST;
+}
+
+// The owner pushes and pops while thieves steal; every item must come out
+// exactly once.
+static bool contended() {
+    BEGIN_TEST;
+    constexpr uint64_t kItems = 1 << 20;
+    constexpr int kThieves = 3;
+    WorkStealingDeque<64> deque;
+    std::unique_ptr<std::atomic<uint32_t>[]> taken(
+        new std::atomic<uint32_t>[kItems]());
+    std::atomic<bool> done{false};
+
+    std::thread thieves[kThieves];
+    for (auto& thief : thieves) {
+        thief = std::thread([&] {
+            uint64_t item;
+            while (!done.load(std::memory_order_acquire)) {
+                if (deque.Steal(&item)) {
+                    taken[item].fetch_add(1);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    uint64_t item;
+    for (uint64_t next = 0; next < kItems;) {
+        bool pushed = deque.Push(next);
+        if (pushed) {
+            next++;
+        }
+        // Pop about one in three, so the deque keeps going empty and the
+        // owner races the thieves for the last item; and pop when full
+        // rather than wait for a thief to be scheduled.
+        if ((!pushed || next % 3 == 0) && deque.Pop(&item)) {
+            taken[item].fetch_add(1);
+        }
+    }
+    while (deque.Pop(&item)) {
+        taken[item].fetch_add(1);
+    }
+    done.store(true, std::memory_order_release);
+    for (auto& thief : thieves) {
+        thief.join();
+    }
+    while (deque.Steal(&item)) {
+        taken[item].fetch_add(1);
+    }
+
+    uint64_t wrong = 0;
+    for (uint64_t i = 0; i < kItems; i++) {
+        wrong += taken[i].load() != 1;
+    }
+    EXPECT_EQ(wrong, 0u, "items lost or taken twice");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(work_stealing_deque_tests)
+RUN_TEST(owner_is_lifo_thieves_fifo)
+RUN_TEST(bounded)
+RUN_TEST(contended)
+END_TEST_CASE(work_stealing_deque_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// A bounded Chase-Lev work-stealing deque of 64-bit work items.
+//
+// The owning thread pushes and pops at the bottom (LIFO, so it keeps working
+// on what it touched last); any other thread may steal from the top (FIFO,
+// so thieves take the oldest work). The memory orderings follow Lê et al.,
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP '13).
+template <size_t Capacity>
+class WorkStealingDeque {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+
+public:
+    WorkStealingDeque() = default;
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only. Returns false if the deque is full.
+    bool Push(uint64_t item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t >= static_cast<int64_t>(Capacity)) {
+            return false;
+        }
+        items_[b & kMask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Owner only. Returns false if the deque is empty or a thief took the
+    // last item first.
+    bool Pop(uint64_t* item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            // Empty.
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        *item = items_[b & kMask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Last item; race the thieves for it.
+            bool won = top_.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread. Returns false if the deque is empty or the race for the
+    // top item was lost.
+    bool Steal(uint64_t* item) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+
+        uint64_t value = items_[t & kMask].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return false;
+        }
+        *item = value;
+        return true;
+    }
+
+private:
+    static constexpr int64_t kMask = static_cast<int64_t>(Capacity) - 1;
+
+    // Thieves hammer top_ while the owner mostly touches bottom_; keep them
+    // on separate cache lines.
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    std::atomic<uint64_t> items_[Capacity] = {};
+};
@@ -0,0 +1,207 @@
+#define LOG_PREFIX "[PARNT]"
+#include "common.h"
+
+#include <trace/syscalls.h>
+#include <zircon/syscalls.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "work_stealing_deque.h"
+
+// Most ready connections a worker pulls off its port per wakeup. Whatever it
+// can't get to right away is up for grabs by idle workers.
+constexpr uint32_t kMaxHarvest = 64;
+
+// Port key of the packet that tells a worker to exit.
+constexpr uint64_t kExitKey = UINT64_MAX;
+
+namespace {
+
+// One per thread, on its own cache lines so the counters don't bounce.
+struct alignas(64) worker {
+    std::thread thread;
+    WorkStealingDeque<kMaxHarvest> ready;
+    // Requests answered by this worker, including stolen connections.
+    uint64_t requests = 0;
+    // Connections this worker took from another worker's deque.
+    uint64_t steals = 0;
+    // Time spent blocked on the port.
+    zx_duration_t idle = 0;
+    zx_status_t status = ZX_OK;
+};
+
+class WorkerPool {
+public:
+    WorkerPool(zx_handle_t* channels, uint32_t num_channels,
+               const zx_handle_t* ports, uint32_t num_workers)
+        : channels_(channels), ports_(ports), num_workers_(num_workers),
+          workers_(new worker[num_workers]), live_(num_channels) {}
+
+    // Runs the workers until every connection has closed.
+    zx_status_t Run();
+
+    const worker& worker_at(uint32_t index) const { return workers_[index]; }
+
+private:
+    void WorkerLoop(uint32_t self);
+    bool Steal(uint32_t self, uint64_t* index);
+    zx_status_t Serve(uint32_t self, uint64_t index);
+    void Shutdown();
+
+    zx_handle_t* const channels_;
+    const zx_handle_t* const ports_;
+    const uint32_t num_workers_;
+    std::unique_ptr<worker[]> workers_;
+    std::atomic<uint32_t> live_;
+};
+
+zx_status_t WorkerPool::Run() {
+    for (uint32_t i = 0; i < num_workers_; i++) {
+        workers_[i].thread = std::thread(&WorkerPool::WorkerLoop, this, i);
+    }
+    zx_status_t st = ZX_OK;
+    for (uint32_t i = 0; i < num_workers_; i++) {
+        workers_[i].thread.join();
+        if (st == ZX_OK) {
+            st = workers_[i].status;
+        }
+    }
+    return st;
+}
+
+// Wake every worker up so it notices there is nothing left to serve.
+void WorkerPool::Shutdown() {
+    live_.store(0);
+    zx_port_packet_t packet = {};
+    packet.key = kExitKey;
+    packet.type = ZX_PKT_TYPE_USER;
+    for (uint32_t i = 0; i < num_workers_; i++) {
+        zx_port_queue(ports_[i], &packet);
+    }
+}
+
+bool WorkerPool::Steal(uint32_t self, uint64_t* index) {
+    for (uint32_t i = 1; i < num_workers_; i++) {
+        if (workers_[(self + i) % num_workers_].ready.Steal(index)) {
+            workers_[self].steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Answer everything queued on connection |index| and re-arm its wait on its
+// home port, or close it if the client is gone. Only the worker holding the
+// connection's index touches it, since the wait is one-shot.
+zx_status_t WorkerPool::Serve(uint32_t self, uint64_t index) {
+    zx_status_t st = serve_connection(channels_[index], &workers_[self].requests);
+    if (st == ZX_ERR_PEER_CLOSED) {
+        zx_handle_close(channels_[index]);
+        channels_[index] = ZX_HANDLE_INVALID;
+        if (live_.fetch_sub(1) == 1) {
+            Shutdown();
+        }
+        return ZX_OK;
+    } else if (st != ZX_OK) {
+        ERR("connection %lu failed with st = %d\n", index, st);
+        return st;
+    }
+
+    st = zx_object_wait_async(channels_[index], ports_[index % num_workers_],
+                              index, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                              ZX_WAIT_ASYNC_ONCE);
+    if (st != ZX_OK) {
+        ERR("zx_object_wait_async failed with st = %d\n", st);
+    }
+    return st;
+}
+
+void WorkerPool::WorkerLoop(uint32_t self) {
+    worker& me = workers_[self];
+    zx_handle_t port = ports_[self];
+
+    while (live_.load() > 0) {
+        // Our own backlog first, newest first; then somebody else's.
+        uint64_t index;
+        if (me.ready.Pop(&index) || Steal(self, &index)) {
+            zx_status_t st = Serve(self, index);
+            if (st != ZX_OK) {
+                me.status = st;
+                Shutdown();
+                return;
+            }
+            continue;
+        }
+
+        // Nothing to do anywhere: block for the next ready connection, then
+        // pick up whatever else became ready meanwhile without blocking.
+        zx_port_packet_t packet;
+        zx_time_t idle_start = zx_clock_get_monotonic();
+        zx_status_t st = trace::port_wait(port, ZX_TIME_INFINITE, &packet);
+        me.idle += zx_clock_get_monotonic() - idle_start;
+
+        for (uint32_t harvested = 0; st == ZX_OK; harvested++) {
+            if (packet.key == kExitKey) {
+                break;
+            }
+            me.ready.Push(packet.key);
+            if (harvested + 1 == kMaxHarvest) {
+                break;
+            }
+            st = trace::port_wait(port, 0, &packet);
+        }
+        if (st != ZX_OK && st != ZX_ERR_TIMED_OUT) {
+            ERR("zx_port_wait failed with st = %d\n", st);
+            me.status = st;
+            Shutdown();
+            return;
+        }
+    }
+}
+
+} // namespace
+
+zx_status_t serve_workers(zx_handle_t* channels, uint32_t num_channels,
+                          const zx_handle_t* ports, uint32_t num_workers,
+                          const options_t& options) {
+    WorkerPool pool(channels, num_channels, ports, num_workers);
+
+    zx_time_t start = zx_clock_get_monotonic();
+    zx_status_t st = pool.Run();
+    zx_time_t end = zx_clock_get_monotonic();
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    char name[96];
+    uint64_t requests = 0;
+    for (uint32_t i = 0; i < num_workers; i++) {
+        const worker& w = pool.worker_at(i);
+        requests += w.requests;
+
+        double busy = 1.0 - static_cast<double>(w.idle) / (end - start);
+        snprintf(name, sizeof(name),
+                 "channel-two-way.clients.%u.worker.%u.utilization",
+                 num_channels, i);
+        histogram::PrintValue(stdout, name, "%", 100.0 * busy, options.format);
+        snprintf(name, sizeof(name),
+                 "channel-two-way.clients.%u.worker.%u.requests",
+                 num_channels, i);
+        histogram::PrintValue(stdout, name, "req",
+                              static_cast<double>(w.requests), options.format);
+        snprintf(name, sizeof(name),
+                 "channel-two-way.clients.%u.worker.%u.steals",
+                 num_channels, i);
+        histogram::PrintValue(stdout, name, "steals",
+                              static_cast<double>(w.steals), options.format);
+    }
+
+    double seconds = static_cast<double>(end - start) / ZX_SEC(1);
+    snprintf(name, sizeof(name), "channel-two-way.clients.%u.throughput",
+             num_channels);
+    histogram::PrintValue(stdout, name, "req/s",
+                          seconds > 0 ? requests / seconds : 0, options.format);
+    return ZX_OK;
+}
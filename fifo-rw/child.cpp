@@ -1,35 +1,35 @@
 #define LOG_PREFIX "[CHILD]"
 #include "common.h"
+#include "ring.h"
 
 #include <string.h>
 
-#include <fbl/auto_call.h>
+#include <spinwait/spinwait.h>
 #include <sys/types.h>
+#include <trace/syscalls.h>
+#include <zircon/process.h>
+#include <zircon/processargs.h>
 #include <zircon/syscalls.h>
 
-constexpr uint kNumRequests = 32;
+#include <utility>
 
-zx_status_t fifo_send(zx_handle_t fifo) {
-    auto channel_cleanup = fbl::MakeAutoCall([fifo]() {
-        zx_handle_close(fifo);
-    });
+constexpr uint kNumRequests = 32;
 
-    // Construct a buffer containing the fibonacci sequence.
-    uint64_t fibo[kNumRequests];
-    uint64_t* fibo_head = fibo;
+zx_status_t fifo_send(DemoFifo fifo) {
+    // Generate the fibonacci sequence a fifo's worth at a time, into a buffer
+    // we reuse for every write. |batch.items[head, batch.count)| is what we
+    // generated but haven't written yet.
+    Fibonacci fibo;
+    DemoFifo::batch_type batch;
+    size_t head = 0;
     size_t requests_remaining = kNumRequests;
-    fibo[0] = 1;
-    fibo[1] = 1;
-    for (uint i = 2; i < kNumRequests; i++) {
-        fibo[i] = fibo[i - 1] + fibo[i - 2];
-    }
 
     while (requests_remaining) {
         // Wait until we can write into the fifo.
         zx_signals_t signals;
-        zx_status_t st = zx_object_wait_one(
-            fifo, ZX_FIFO_WRITABLE | ZX_FIFO_PEER_CLOSED, ZX_TIME_INFINITE,
-            &signals);
+        zx_status_t st = trace::object_wait_one(
+            fifo.handle().get(), ZX_FIFO_WRITABLE | ZX_FIFO_PEER_CLOSED,
+            ZX_TIME_INFINITE, &signals);
 
         if (st != ZX_OK) {
             ERR("zx_object_wait_one failed with st = %d\n", st);
@@ -41,17 +41,25 @@ zx_status_t fifo_send(zx_handle_t fifo) {
             return ZX_ERR_PEER_CLOSED;
         }
 
-        // Write as many messages as possible into the fifo.
-        size_t actual_count;
-        st = zx_fifo_write(fifo, kFifoMessageSize, fibo_head,
-                           requests_remaining, &actual_count);
+        if (head == batch.count) {
+            batch.count = requests_remaining < DemoFifo::kDepth
+                              ? requests_remaining
+                              : DemoFifo::kDepth;
+            for (size_t i = 0; i < batch.count; i++) {
+                batch.items[i] = fibo.Next();
+            }
+            head = 0;
+        }
 
+        // Write as many messages as possible into the fifo.
+        size_t actual_count = 0;
+        st = fifo.Write(batch.items + head, batch.count - head, &actual_count);
         if (st != ZX_OK) {
             ERR("zx_fifo_write failed with st = %d\n", st);
             return st;
         }
 
-        fibo_head += actual_count;
+        head += actual_count;
         requests_remaining -= actual_count;
 
         LOG("Wrote %lu %s, %lu remaining\n",
@@ -64,48 +72,356 @@ zx_status_t fifo_send(zx_handle_t fifo) {
     return ZX_OK;
 }
 
-zx_status_t child(zx_handle_t channel) {
-    // Close this end of the channel if we exit.
-    auto channel_cleanup = fbl::MakeAutoCall([channel]() {
-        zx_handle_close(channel);
-    });
+// Benchmark producer: write 0, 1, 2, ... up to |options.elements| into
+// |fifo|, as many per call as fit, then close it.
+template <typename Fifo>
+static zx_status_t fifo_stream(Fifo fifo, const options_t& options) {
+    // Elements generated but not yet written.
+    typename Fifo::batch_type pending;
+    spinwait::Waiter waiter(options.spin);
+    uint64_t next = 0;
+
+    while (next < options.elements || !pending.empty()) {
+        while (pending.count < Fifo::kDepth && next < options.elements) {
+            pending.items[pending.count++] = next++;
+        }
+
+        size_t actual;
+        zx_status_t st = fifo.Write(pending.items, pending.count, &actual);
+        if (st == ZX_OK) {
+            memmove(pending.items, pending.items + actual,
+                    (pending.count - actual) * sizeof(pending.items[0]));
+            pending.count -= actual;
+            continue;
+        } else if (st != ZX_ERR_SHOULD_WAIT) {
+            ERR("zx_fifo_write failed with st = %d\n", st);
+            return st;
+        }
+
+        trace::Span span(trace::Op::kObjectWait);
+        st = waiter.Wait(fifo.handle().get(),
+                         ZX_FIFO_WRITABLE | ZX_FIFO_PEER_CLOSED, nullptr);
+        span.End(st);
+        if (st != ZX_OK) {
+            ERR("zx_object_wait_one failed with st = %d\n", st);
+            return st;
+        }
+    }
+    return ZX_OK;
+}
+
+// Streaming producer: write the Fibonacci sequence into |fifo| until
+// |options.duration| has passed, or |options.elements| elements have gone out
+// if no duration is set, then report the rate and how much of the time we
+// were blocked on a full fifo.
+template <typename Fifo>
+static zx_status_t fifo_stream_fibonacci(Fifo fifo, const options_t& options) {
+    // Elements are generated a fifo's worth at a time into this batch;
+    // |batch.items[head, batch.count)| is what hasn't been written yet.
+    typename Fifo::batch_type batch;
+    size_t head = 0;
+    Fibonacci fibo;
+    spinwait::Waiter waiter(options.spin);
+    uint64_t limit = options.duration > 0 ? UINT64_MAX : options.elements;
+    uint64_t generated = 0;
+    uint64_t written = 0;
+    zx_duration_t blocked = 0;
+
+    zx_time_t start = zx_clock_get_monotonic();
+    zx_time_t deadline = options.duration > 0 ? start + options.duration
+                                              : ZX_TIME_INFINITE;
+    while (true) {
+        if (head == batch.count) {
+            // Only look at the clock once per batch.
+            if (generated == limit || zx_clock_get_monotonic() >= deadline) {
+                break;
+            }
+            uint64_t left = limit - generated;
+            batch.count = left < Fifo::kDepth ? left : Fifo::kDepth;
+            for (uint64_t& element : batch) {
+                element = fibo.Next();
+            }
+            generated += batch.count;
+            head = 0;
+        }
+
+        size_t actual;
+        zx_status_t st = fifo.Write(batch.items + head, batch.count - head,
+                                    &actual);
+        if (st == ZX_OK) {
+            head += actual;
+            written += actual;
+            continue;
+        } else if (st != ZX_ERR_SHOULD_WAIT) {
+            ERR("zx_fifo_write failed with st = %d\n", st);
+            return st;
+        }
+
+        // Backpressure: the consumer is behind, wait for it to make room.
+        zx_time_t wait_start = zx_clock_get_monotonic();
+        trace::Span span(trace::Op::kObjectWait);
+        st = waiter.Wait(fifo.handle().get(),
+                         ZX_FIFO_WRITABLE | ZX_FIFO_PEER_CLOSED, nullptr);
+        span.End(st);
+        blocked += zx_clock_get_monotonic() - wait_start;
+        if (st != ZX_OK) {
+            ERR("zx_object_wait_one failed with st = %d\n", st);
+            return st;
+        }
+    }
+    zx_duration_t elapsed = zx_clock_get_monotonic() - start;
+
+    double seconds = static_cast<double>(elapsed) / ZX_SEC(1);
+    histogram::PrintValue(stdout, "fifo-rw.stream.throughput", "elem/s",
+                          seconds > 0 ? written / seconds : 0, options.format);
+    histogram::PrintValue(stdout, "fifo-rw.stream.blocked", "%",
+                          elapsed > 0 ? 100.0 * blocked / elapsed : 0,
+                          options.format);
+    if (options.spin > 0) {
+        waiter.PrintCounters(stdout, "fifo-rw.stream.wait", options.format);
+    }
+
+    // The parent reports once we close the fifo; make sure our report is
+    // out first.
+    fflush(stdout);
+    return ZX_OK;
+}
+
+// Map the ring the parent sent us and run |produce| on it.
+template <typename Produce>
+static zx_status_t with_ring(Doorbell doorbell, typed::Handle vmo,
+                             const options_t& options, Produce produce) {
+    ring_t ring;
+    zx_status_t st = ring_map(vmo.get(), options.ring_size, std::move(doorbell),
+                              &ring);
+    vmo.reset();
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    st = produce(&ring);
+
+    // Closing the doorbell is what tells the consumer we are done.
+    ring_unmap(&ring);
+    return st;
+}
+
+// Benchmark producer for the ring transport: stream 0, 1, 2, ... as 64-bit
+// words.
+static zx_status_t ring_stream(ring_t* ring, const options_t& options) {
+    uint64_t next = 0;
+    return ring_produce(ring, options.bytes, options.chunk,
+                        [&next](uint8_t* dst, size_t len) {
+                            uint64_t* words = reinterpret_cast<uint64_t*>(dst);
+                            for (size_t i = 0; i < len / sizeof(uint64_t); i++) {
+                                words[i] = next++;
+                            }
+                        });
+}
 
+// Wait for the parent to send us a transport: either a fifo, or a doorbell
+// fifo followed by a ring VMO. Returns ZX_ERR_PEER_CLOSED if the parent hung
+// up instead.
+static zx_status_t receive_transport(zx_handle_t channel, zx_handle_t* handles,
+                                     uint32_t* actual_handles) {
     // Wait until our channel to the other process is readable.
-    zx_signals_t signals;
-    zx_status_t st = zx_object_wait_one(
+    zx_status_t st = trace::object_wait_one(
         channel, ZX_CHANNEL_PEER_CLOSED | ZX_CHANNEL_READABLE,
-        ZX_TIME_INFINITE, &signals);
+        ZX_TIME_INFINITE, nullptr);
 
     if (st != ZX_OK) {
         ERR("zx_object_wait_one failed with st = %d\n", st);
         return st;
     }
 
-    if (signals & ZX_CHANNEL_PEER_CLOSED) {
-        ERR("peer closed before sending fifo handle\n");
-        return ZX_ERR_PEER_CLOSED;
-    }
-
     // The remote process should have sent us a handle to a fifo.
     // Read that handle out of the channel.
-    zx_handle_t fifo;
-    uint32_t actual_bytes, actual_handles;
-    st = zx_channel_read(channel,
-                         0,
-                         nullptr, &fifo,
-                         0, 1,
-                         &actual_bytes, &actual_handles);
+    uint32_t actual_bytes;
+    st = trace::channel_read(channel,
+                             0,
+                             nullptr, handles,
+                             0, 2,
+                             &actual_bytes, actual_handles);
 
-    if (st != ZX_OK) {
+    if (st == ZX_ERR_PEER_CLOSED) {
+        return st;
+    } else if (st != ZX_OK) {
         ERR("zx_channel_read failed with st = %d\n", st);
         return st;
     }
 
-    if (fifo == ZX_HANDLE_INVALID || actual_handles == 0) {
+    if (*actual_handles == 0 || handles[0] == ZX_HANDLE_INVALID) {
         ERR("failed to get fifo handle from remote process\n");
         return ZX_ERR_INTERNAL;
     }
+    return ZX_OK;
+}
+
+// Benchmark mode: the parent sends a fresh transport for every run and hangs
+// up when it is done.
+static zx_status_t bench(zx_handle_t channel, const options_t& options) {
+    while (true) {
+        zx_handle_t handles[2];
+        uint32_t actual_handles;
+        zx_status_t st = receive_transport(channel, handles, &actual_handles);
+        if (st == ZX_ERR_PEER_CLOSED) {
+            return ZX_OK;
+        } else if (st != ZX_OK) {
+            return st;
+        }
+
+        typed::Handle fifo(handles[0]);
+        typed::Handle vmo(actual_handles == 2 ? handles[1] : ZX_HANDLE_INVALID);
+        if (options.stream) {
+            st = WithDepth(options.depth, [&](auto depth) {
+                using Fifo = BenchFifo<decltype(depth)::value>;
+                return fifo_stream_fibonacci(Fifo(std::move(fifo)), options);
+            });
+        } else if (vmo) {
+            st = with_ring(Doorbell(std::move(fifo)), std::move(vmo), options,
+                           [&options](ring_t* ring) {
+                               return ring_stream(ring, options);
+                           });
+        } else {
+            st = WithDepth(options.depth, [&](auto depth) {
+                using Fifo = BenchFifo<decltype(depth)::value>;
+                return fifo_stream(Fifo(std::move(fifo)), options);
+            });
+        }
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+}
+
+// Number of Collatz steps it takes |n| to reach 1. The cost varies a lot from
+// input to input, which is what makes balancing the farm interesting.
+static uint64_t collatz_steps(uint64_t n) {
+    uint64_t steps = 0;
+    while (n > 1) {
+        n = (n & 1) ? 3 * n + 1 : n / 2;
+        steps++;
+    }
+    return steps;
+}
+
+static void farm_compute(const farm_request_t& request,
+                         farm_completion_t* completion) {
+    *completion = {request.first, request.count, 0, 0, 0};
+    for (uint64_t n = request.first; n < request.first + request.count; n++) {
+        // Input n stands for the number n + 1, so that 0 is a valid input.
+        uint64_t steps = collatz_steps(n + 1);
+        completion->steps += steps;
+        if (steps > completion->max_steps) {
+            completion->max_steps = steps;
+            completion->argmax = n;
+        }
+    }
+}
+
+// Compute farm worker: answer every request on our request fifo on the
+// completion fifo, until the parent closes the request fifo.
+static zx_status_t farm_worker(const options_t& options) {
+    FarmRequestFifo requests(
+        typed::Handle(zx_take_startup_handle(PA_HND(PA_USER1, 0))));
+    FarmCompletionFifo completions(
+        typed::Handle(zx_take_startup_handle(PA_HND(PA_USER2, 0))));
+    if (!requests.handle() || !completions.handle()) {
+        ERR("started without farm fifos\n");
+        return ZX_ERR_BAD_HANDLE;
+    }
+
+    FarmRequestFifo::batch_type batch;
+    farm_completion_t done[kFarmInFlight];
+    spinwait::Waiter waiter(options.spin);
+    while (true) {
+        zx_status_t st = requests.Read(&batch);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            trace::Span wait_span(trace::Op::kObjectWait);
+            st = waiter.Wait(requests.handle().get(),
+                             ZX_FIFO_READABLE | ZX_FIFO_PEER_CLOSED, nullptr);
+            wait_span.End(st);
+            if (st != ZX_OK) {
+                ERR("zx_object_wait_one failed with st = %d\n", st);
+                return st;
+            }
+            continue;
+        } else if (st == ZX_ERR_PEER_CLOSED) {
+            return ZX_OK;
+        } else if (st != ZX_OK) {
+            ERR("zx_fifo_read failed with st = %d\n", st);
+            return st;
+        }
+
+        for (size_t i = 0; i < batch.count; i++) {
+            farm_compute(batch.items[i], &done[i]);
+        }
+
+        // The parent never has more requests out than the completion fifo
+        // holds, so this only waits if it is slow to collect them.
+        size_t written = 0;
+        while (written < batch.count) {
+            size_t actual;
+            st = completions.Write(done + written, batch.count - written,
+                                   &actual);
+            if (st == ZX_OK) {
+                written += actual;
+                continue;
+            } else if (st != ZX_ERR_SHOULD_WAIT) {
+                ERR("zx_fifo_write failed with st = %d\n", st);
+                return st;
+            }
+            st = completions.wait_one(ZX_FIFO_WRITABLE | ZX_FIFO_PEER_CLOSED,
+                                      ZX_TIME_INFINITE, nullptr);
+            if (st != ZX_OK) {
+                ERR("zx_object_wait_one failed with st = %d\n", st);
+                return st;
+            }
+        }
+    }
+}
+
+zx_status_t child(zx_handle_t handle, const options_t& options) {
+    // This end of the channel closes when |channel| goes out of scope.
+    typed::Handle channel(handle);
+
+    if (options.farm > 0) {
+        return farm_worker(options);
+    }
+    if (options.bench || options.stream) {
+        return bench(channel.get(), options);
+    }
+
+    zx_handle_t handles[2];
+    uint32_t actual_handles;
+    zx_status_t st = receive_transport(channel.get(), handles, &actual_handles);
+    if (st == ZX_ERR_PEER_CLOSED) {
+        ERR("peer closed before sending fifo handle\n");
+        return st;
+    } else if (st != ZX_OK) {
+        return st;
+    }
+
+    if (actual_handles == 2) {
+        // Send the same sequence through the ring instead.
+        return with_ring(Doorbell(typed::Handle(handles[0])),
+                         typed::Handle(handles[1]), options, [](ring_t* ring) {
+            uint64_t fibo[2] = {1, 1};
+            zx_status_t st = ring_produce(
+                ring, kNumRequests * kFifoMessageSize, kFifoMessageSize,
+                [&fibo](uint8_t* dst, size_t len) {
+                    memcpy(dst, &fibo[0], len);
+                    uint64_t next = fibo[0] + fibo[1];
+                    fibo[0] = fibo[1];
+                    fibo[1] = next;
+                });
+            if (st == ZX_OK) {
+                LOG("Closing ring, goodbye!\n");
+            }
+            return st;
+        });
+    }
 
     // Start sending messages over the fifo.
-    return fifo_send(fifo);
+    return fifo_send(DemoFifo(typed::Handle(handles[0])));
 }
\ No newline at end of file
@@ -1,13 +1,148 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdio.h>
 #include <zircon/types.h>
 
-zx_status_t parent(zx_handle_t channel);
-zx_status_t child(zx_handle_t channel);
+#include <type_traits>
 
-#define ERR(fmt, ...) fprintf(stderr, LOG_PREFIX " " fmt, ##__VA_ARGS__);
-#define LOG(fmt, ...) fprintf(stdout, LOG_PREFIX " " fmt, ##__VA_ARGS__);
+#include <histogram/histogram.h>
+#include <logger/logger.h>
+#include <typed/fifo.h>
+
+// Options shared by the parent and the child. The parent forwards its command
+// line to the child, so both sides always agree on the mode.
+typedef struct options {
+    // Measure consumer throughput instead of running the demo.
+    bool bench;
+    // Stream an endless sequence from the child for |duration|, or for
+    // |elements| elements if no duration is set, and report how much of the
+    // time the producer spent blocked on a full fifo.
+    bool stream;
+    zx_duration_t duration;
+    // Elements the producer sends per benchmark run.
+    uint64_t elements;
+    // Capacity of the fifo, in elements.
+    uint32_t depth;
+    // Most elements the consumer takes per zx_fifo_read. 1 is the
+    // single-element path.
+    uint32_t batch;
+    // How the benchmark reports its results.
+    histogram::Format format;
+    // Move the payload through a shared VMO ring and use the fifo only as a
+    // doorbell.
+    bool ring;
+    // Size of the ring's data area, in bytes. A power of two.
+    size_t ring_size;
+    // Bytes the producer streams through the ring per benchmark run.
+    uint64_t bytes;
+    // Most bytes the producer publishes at once.
+    size_t chunk;
+    // Compute farm mode: shard |inputs| across up to this many worker
+    // children, doubling the count from 1. 0 disables the farm.
+    uint32_t farm;
+    // Size of the farm's input range.
+    uint64_t inputs;
+    // Inputs per chunk of farm work.
+    uint64_t farm_chunk;
+    // Run the benchmark consumer as a coroutine on an executor instead of a
+    // hand-written wait loop. Ignores |spin|.
+    bool coro;
+    // Longest a fifo wait spins before blocking; the actual budget adapts to
+    // recent arrival times. 0 always blocks.
+    zx_duration_t spin;
+    // Write every traced IPC call to <trace>.<process id>.json as a Chrome
+    // trace when the process exits. nullptr disables the dump; events are
+    // recorded either way.
+    const char* trace;
+} options_t;
+
+zx_status_t parent(zx_handle_t channel, const options_t& options);
+zx_status_t child(zx_handle_t channel, const options_t& options);
+
+// Most worker children the compute farm runs.
+constexpr uint32_t kMaxFarmWorkers = 64;
+
+// Each farm worker gets two fifos as extra startup handles, PA_USER1 for
+// requests and PA_USER2 for completions. A request asks for the inputs
+// [first, first + count); the completion for it carries the same range and
+// its part of the result.
+typedef struct farm_request {
+    uint64_t first;
+    uint64_t count;
+} farm_request_t;
+
+typedef struct farm_completion {
+    uint64_t first;
+    uint64_t count;
+    // Sum of the Collatz stopping times of the inputs.
+    uint64_t steps;
+    // The longest stopping time and the smallest input that has it.
+    uint64_t max_steps;
+    uint64_t argmax;
+} farm_completion_t;
+
+// Chunks the parent keeps queued at each worker, so that a worker has its
+// next chunk at hand when it finishes one. Both fifos hold that many, so
+// neither side ever finds its fifo full.
+constexpr size_t kFarmInFlight = 4;
+using FarmRequestFifo = typed::Fifo<farm_request_t, kFarmInFlight>;
+using FarmCompletionFifo = typed::Fifo<farm_completion_t, kFarmInFlight>;
+
+// Runs the farm with 1, 2, 4, ... up to |options.farm| workers started from
+// |path| with |args|, and reports each run's throughput and scaling
+// efficiency.
+zx_status_t parent_farm(const char* path, const char* const* args,
+                        const options_t& options);
 
 constexpr size_t kFifoMessageSize = sizeof(uint64_t);
-constexpr size_t kFifoDepth = 8;
\ No newline at end of file
+constexpr size_t kFifoDepth = 8;
+
+// The demo's fifo. The benchmarks use a BenchFifo of --depth elements.
+using DemoFifo = typed::Fifo<uint64_t, kFifoDepth>;
+static_assert(sizeof(DemoFifo::element_type) == kFifoMessageSize,
+              "demo fifo elements must match kFifoMessageSize");
+
+// The Fibonacci sequence 1, 1, 2, 3, 5, ..., starting over from 1, 1 once
+// the next sum would overflow 64 bits, so that it never runs out.
+class Fibonacci {
+public:
+    uint64_t Next() {
+        uint64_t value = a_;
+        if (b_ > UINT64_MAX - a_) {
+            a_ = 1;
+            b_ = 1;
+        } else {
+            uint64_t next = a_ + b_;
+            a_ = b_;
+            b_ = next;
+        }
+        return value;
+    }
+
+private:
+    uint64_t a_ = 1;
+    uint64_t b_ = 1;
+};
+
+// Largest fifo Zircon allows for our element size.
+constexpr size_t kMaxFifoDepth = ZX_FIFO_MAX_SIZE_BYTES / kFifoMessageSize;
+
+// The benchmarks' fifos. --depth only arrives at run time, so WithDepth
+// picks the instantiation.
+template <size_t Depth>
+using BenchFifo = typed::Fifo<uint64_t, Depth>;
+
+// Returns |run(std::integral_constant<size_t, depth>())|, or
+// ZX_ERR_INVALID_ARGS unless |depth| is a power of two up to kMaxFifoDepth.
+template <size_t Depth = 1, typename Run>
+zx_status_t WithDepth(size_t depth, Run run) {
+    if constexpr (Depth > kMaxFifoDepth) {
+        return ZX_ERR_INVALID_ARGS;
+    } else {
+        if (depth == Depth) {
+            return run(std::integral_constant<size_t, Depth>());
+        }
+        return WithDepth<Depth * 2>(depth, run);
+    }
+}
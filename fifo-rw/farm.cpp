@@ -0,0 +1,250 @@
+#define LOG_PREFIX "[PARNT]"
+#include "common.h"
+
+#include <spawn/spawn.h>
+#include <trace/syscalls.h>
+#include <zircon/processargs.h>
+#include <zircon/syscalls.h>
+
+#include <memory>
+
+// The parent's side of one farm worker.
+typedef struct farm_worker {
+    FarmRequestFifo requests;
+    FarmCompletionFifo completions;
+    // Kept open for as long as the worker should live.
+    typed::Handle channel;
+    // Requests sent and not yet completed.
+    size_t in_flight;
+    // Chunks completed during the current run.
+    uint64_t chunks;
+} farm_worker_t;
+
+// The merged answer of a run.
+typedef struct farm_result {
+    uint64_t inputs;
+    uint64_t steps;
+    uint64_t max_steps;
+    uint64_t argmax;
+} farm_result_t;
+
+static void merge(const farm_completion_t& completion, farm_result_t* result) {
+    result->inputs += completion.count;
+    result->steps += completion.steps;
+    if (completion.max_steps > result->max_steps ||
+        (completion.max_steps == result->max_steps &&
+         completion.argmax < result->argmax)) {
+        result->max_steps = completion.max_steps;
+        result->argmax = completion.argmax;
+    }
+}
+
+// Creates both fifos of |worker| and fills |handles| with the ends that go
+// to the child.
+static zx_status_t create_fifos(farm_worker_t* worker,
+                                spawn::startup_handle_t (&handles)[2]) {
+    FarmRequestFifo requests;
+    FarmCompletionFifo completions;
+    zx_status_t st = FarmRequestFifo::Create(&worker->requests, &requests);
+    if (st == ZX_OK) {
+        st = FarmCompletionFifo::Create(&worker->completions, &completions);
+    }
+    if (st != ZX_OK) {
+        ERR("zx_fifo_create failed with st = %d\n", st);
+        return st;
+    }
+    handles[0] = {PA_HND(PA_USER1, 0), requests.TakeHandle().release()};
+    handles[1] = {PA_HND(PA_USER2, 0), completions.TakeHandle().release()};
+    return ZX_OK;
+}
+
+// Queue chunks at |worker| until it has kFarmInFlight of them or the inputs
+// run out, and make sure |port| hears about its completions.
+static zx_status_t top_up(farm_worker_t* worker, uint64_t key, zx_handle_t port,
+                          const options_t& options, uint64_t* next) {
+    farm_request_t batch[kFarmInFlight];
+    size_t count = 0;
+    while (worker->in_flight + count < kFarmInFlight && *next < options.inputs) {
+        uint64_t left = options.inputs - *next;
+        batch[count].first = *next;
+        batch[count].count = left < options.farm_chunk ? left : options.farm_chunk;
+        *next += batch[count].count;
+        count++;
+    }
+
+    if (count > 0) {
+        // There is room for the whole batch: the fifo holds kFarmInFlight.
+        size_t actual;
+        zx_status_t st = worker->requests.Write(batch, count, &actual);
+        if (st != ZX_OK || actual != count) {
+            ERR("zx_fifo_write failed with st = %d\n", st);
+            return st != ZX_OK ? st : ZX_ERR_INTERNAL;
+        }
+        worker->in_flight += count;
+    }
+
+    if (worker->in_flight == 0) {
+        return ZX_OK;
+    }
+    zx_status_t st = zx_object_wait_async(
+        worker->completions.handle().get(), port, key,
+        ZX_FIFO_READABLE | ZX_FIFO_PEER_CLOSED, ZX_WAIT_ASYNC_ONCE);
+    if (st != ZX_OK) {
+        ERR("zx_object_wait_async failed with st = %d\n", st);
+    }
+    return st;
+}
+
+// Farm out every input over the first |count| workers and merge what comes
+// back. A worker gets its next chunk as soon as it finishes one, so fast
+// workers end up doing more of the chunks than slow ones.
+static zx_status_t farm_run(farm_worker_t* workers, uint32_t count,
+                            zx_handle_t port, const options_t& options,
+                            farm_result_t* result) {
+    *result = {};
+    uint64_t next = 0;
+    size_t in_flight = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        workers[i].chunks = 0;
+        zx_status_t st = top_up(&workers[i], i, port, options, &next);
+        if (st != ZX_OK) {
+            return st;
+        }
+        in_flight += workers[i].in_flight;
+    }
+
+    FarmCompletionFifo::batch_type done;
+    while (in_flight > 0) {
+        zx_port_packet_t packet;
+        zx_status_t st = trace::port_wait(port, ZX_TIME_INFINITE, &packet);
+        if (st != ZX_OK) {
+            ERR("zx_port_wait failed with st = %d\n", st);
+            return st;
+        }
+
+        farm_worker_t* worker = &workers[packet.key];
+        st = worker->completions.Read(&done);
+        if (st == ZX_ERR_PEER_CLOSED) {
+            ERR("worker %lu went away with %zu chunks left\n", packet.key,
+                worker->in_flight);
+            return st;
+        } else if (st != ZX_OK && st != ZX_ERR_SHOULD_WAIT) {
+            ERR("zx_fifo_read failed with st = %d\n", st);
+            return st;
+        }
+        for (const farm_completion_t& completion : done) {
+            merge(completion, result);
+        }
+        worker->in_flight -= done.count;
+        worker->chunks += done.count;
+        in_flight -= done.count;
+
+        size_t before = worker->in_flight;
+        st = top_up(worker, packet.key, port, options, &next);
+        if (st != ZX_OK) {
+            return st;
+        }
+        in_flight += worker->in_flight - before;
+    }
+
+    if (result->inputs != options.inputs) {
+        ERR("farm computed %lu of %lu inputs\n", result->inputs, options.inputs);
+        return ZX_ERR_INTERNAL;
+    }
+    return ZX_OK;
+}
+
+zx_status_t parent_farm(const char* path, const char* const* args,
+                        const options_t& options) {
+    uint32_t size = options.farm;
+    std::unique_ptr<farm_worker_t[]> workers(new farm_worker_t[size]());
+    spawn::startup_handle_t handles[kMaxFarmWorkers][2];
+    spawn::child_t children[kMaxFarmWorkers];
+    for (uint32_t i = 0; i < size; i++) {
+        zx_status_t st = create_fifos(&workers[i], handles[i]);
+        if (st != ZX_OK) {
+            for (uint32_t j = 0; j < i; j++) {
+                zx_handle_close(handles[j][0].handle);
+                zx_handle_close(handles[j][1].handle);
+            }
+            return st;
+        }
+        children[i] = {handles[i], countof(handles[i]), ZX_HANDLE_INVALID};
+    }
+    zx_status_t st = spawn::Spawn(path, args, children, size);
+    if (st != ZX_OK) {
+        ERR("failed to start the workers, st = %d\n", st);
+        return st;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        workers[i].channel.reset(children[i].channel);
+    }
+
+    typed::Handle port;
+    st = zx_port_create(0, port.reset_and_get_address());
+    if (st != ZX_OK) {
+        ERR("zx_port_create failed with st = %d\n", st);
+        return st;
+    }
+
+    // Every run computes the same answer; the single worker one is the
+    // reference for the rest.
+    farm_result_t reference = {};
+    double reference_seconds = 0;
+    bool first = true;
+    for (uint32_t count = 1; count <= size;
+         count = count < size && count * 2 > size ? size : count * 2) {
+        farm_result_t result;
+        zx_time_t start = zx_clock_get_monotonic();
+        st = farm_run(workers.get(), count, port.get(), options, &result);
+        zx_time_t end = zx_clock_get_monotonic();
+        if (st != ZX_OK) {
+            return st;
+        }
+        double seconds = static_cast<double>(end - start) / ZX_SEC(1);
+        if (first) {
+            reference = result;
+            reference_seconds = seconds;
+            first = false;
+        } else if (result.steps != reference.steps ||
+                   result.max_steps != reference.max_steps ||
+                   result.argmax != reference.argmax) {
+            ERR("%u workers disagree with 1 worker\n", count);
+            return ZX_ERR_INTERNAL;
+        }
+
+        // How evenly the dynamic balancing spread the chunks: the busiest
+        // worker's share over the average share.
+        uint64_t most = 0;
+        uint64_t chunks = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            most = workers[i].chunks > most ? workers[i].chunks : most;
+            chunks += workers[i].chunks;
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "fifo-rw.farm.%u.throughput", count);
+        histogram::PrintValue(stdout, name, "inputs/s",
+                              seconds > 0 ? options.inputs / seconds : 0,
+                              options.format);
+        snprintf(name, sizeof(name), "fifo-rw.farm.%u.efficiency", count);
+        histogram::PrintValue(stdout, name, "%",
+                              seconds > 0 ? 100 * reference_seconds /
+                                                (count * seconds)
+                                          : 0,
+                              options.format);
+        snprintf(name, sizeof(name), "fifo-rw.farm.%u.imbalance", count);
+        histogram::PrintValue(stdout, name, "max/mean",
+                              chunks ? most * count / static_cast<double>(chunks)
+                                     : 0,
+                              options.format);
+    }
+
+    // The log shares stdout with the report, so keep it out of CSV and JSON.
+    if (options.format == histogram::Format::kText) {
+        LOG("%lu inputs, %lu steps in all, longest chain %lu steps from %lu\n",
+            reference.inputs, reference.steps, reference.max_steps,
+            reference.argmax + 1);
+    }
+    return ZX_OK;
+}
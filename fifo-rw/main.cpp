@@ -1,96 +1,204 @@
 // This program creates a child process and hands it one end of a channel.
 // Then it sends periodic messages to the child process which prints them out
 // on stdout.
-
+//
+// Usage: fifo-rw [--bench] [--stream] [--duration=MSEC] [--elements=N]
+//                [--depth=N] [--batch=N]
+//                [--format=text|csv|json] [--transport=fifo|ring]
+//                [--ring-size=N] [--bytes=N] [--chunk=N] [--spin=USEC]
+//                [--trace=PREFIX] [--coro] [--farm=M] [--inputs=N] [--farm-chunk=N]
+//
+// --bench streams N elements through the fifo and reports how fast the parent
+// consumes them, once as the original consumer did, waiting for the fifo and
+// then reading one element, and once reading up to --batch elements per call
+// and only waiting when the fifo is empty.
+// --stream makes the child produce the Fibonacci sequence (starting over
+// before it overflows) for --duration milliseconds, or --elements elements
+// without a duration, as fast as the parent takes it. The child reports the
+// sustained rate and the share of the time it was blocked on a full fifo.
+// --depth=N sizes the fifo to N elements (a power of two).
+// --batch=N caps how many elements the consumer reads per call; it defaults
+// to the fifo depth. The demo always uses a kFifoDepth fifo and reads whole
+// batches.
+// --transport=ring moves the data through a VMO ring shared by both processes
+// instead, and only uses the fifo to wake up a side that is waiting for data
+// or space. --ring-size sizes the ring (a power of two), --bytes is how much
+// the benchmark streams through it and --chunk is the most the producer
+// publishes at once.
+// --coro runs the benchmark consumer as a coroutine that co_awaits its reads.
+// Its reads always come first, so its one-element run doesn't wait per
+// element.
+// --spin=USEC lets the fifo producer and consumer poll for up to USEC
+// microseconds before blocking on a wait.
+// --trace=PREFIX writes each process's IPC calls to PREFIX.<pid>.json as a
+// Chrome trace when it exits.
+// --farm=M starts M worker children and computes the Collatz stopping times
+// of --inputs numbers across 1, 2, 4, ... M of them, handing out --farm-chunk
+// inputs at a time over per-worker request and completion fifos. It reports
+// each run's throughput and scaling efficiency against a single worker.
+
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include <fbl/auto_call.h>
-#include <lib/fdio/spawn.h>
+#include <spawn/spawn.h>
+#include <trace/trace.h>
 
-#include <zircon/process.h>
-#include <zircon/processargs.h>
 #include <zircon/syscalls.h>
 #include <zircon/types.h>
 
 #include "common.h"
 
-// Pass this as a command line argument to start as a child, otherwise start
-// as a parent.
-const char* kCmdLineChild = "child";
-
-// Create a channel, spawn a child process and give it one end of the channel
-// we just created.
-zx_status_t spawn_child(const char* path, zx_handle_t* out) {
-    zx_status_t st;
-
-    const uint32_t kFlags = FDIO_SPAWN_CLONE_ALL;
-    const char* kChildProcessArgs[] = {kCmdLineChild, nullptr};
-    char error_bufffer[FDIO_SPAWN_ERR_MSG_MAX_LENGTH];
-
-    // Create a channel.
-    zx_handle_t mine = ZX_HANDLE_INVALID;
-    zx_handle_t other = ZX_HANDLE_INVALID;
-    st = zx_channel_create(0, &mine, &other);
-    if (st != ZX_OK) {
-        fprintf(stderr, "[PARENT]: Failed to create channel, st = %d\n", st);
-        return st;
+// Parses the options shared by the parent and the child. Returns false if an
+// argument is malformed.
+bool parse_options(int argc, const char* argv[], options_t* options) {
+    options->bench = false;
+    options->stream = false;
+    options->duration = 0;
+    options->elements = 10000000;
+    options->depth = kFifoDepth;
+    options->batch = 0;
+    options->format = histogram::Format::kText;
+    options->trace = nullptr;
+    options->ring = false;
+    options->ring_size = 4 << 20;
+    options->bytes = 1ull << 30;
+    options->chunk = 64 << 10;
+    options->spin = 0;
+    options->coro = false;
+    options->farm = 0;
+    options->inputs = 1 << 22;
+    options->farm_chunk = 4096;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (!strcmp(arg, spawn::kChildArg)) {
+            continue;
+        } else if (!strcmp(arg, "--bench")) {
+            options->bench = true;
+        } else if (!strcmp(arg, "--stream")) {
+            options->stream = true;
+        } else if (!strncmp(arg, "--duration=", 11)) {
+            options->duration = ZX_MSEC(strtoull(arg + 11, nullptr, 0));
+        } else if (!strncmp(arg, "--elements=", 11)) {
+            options->elements = strtoull(arg + 11, nullptr, 0);
+        } else if (!strncmp(arg, "--depth=", 8)) {
+            options->depth = static_cast<uint32_t>(strtoul(arg + 8, nullptr, 0));
+            if (options->depth == 0 || options->depth > kMaxFifoDepth ||
+                (options->depth & (options->depth - 1)) != 0) {
+                fprintf(stderr, "depth must be a power of two in [1, %zu]\n",
+                        kMaxFifoDepth);
+                return false;
+            }
+        } else if (!strncmp(arg, "--batch=", 8)) {
+            options->batch = static_cast<uint32_t>(strtoul(arg + 8, nullptr, 0));
+            if (options->batch == 0 || options->batch > kMaxFifoDepth) {
+                fprintf(stderr, "batch must be in [1, %zu]\n", kMaxFifoDepth);
+                return false;
+            }
+        } else if (!strncmp(arg, "--trace=", 8)) {
+            options->trace = arg + 8;
+        } else if (!strncmp(arg, "--format=", 9)) {
+            if (!histogram::ParseFormat(arg + 9, &options->format)) {
+                fprintf(stderr, "unknown format '%s'\n", arg + 9);
+                return false;
+            }
+        } else if (!strcmp(arg, "--transport=fifo")) {
+            options->ring = false;
+        } else if (!strcmp(arg, "--transport=ring")) {
+            options->ring = true;
+        } else if (!strncmp(arg, "--ring-size=", 12)) {
+            options->ring_size = strtoull(arg + 12, nullptr, 0);
+            if (options->ring_size < kFifoMessageSize ||
+                (options->ring_size & (options->ring_size - 1)) != 0) {
+                fprintf(stderr, "ring size must be a power of two of at least %zu\n",
+                        kFifoMessageSize);
+                return false;
+            }
+        } else if (!strncmp(arg, "--bytes=", 8)) {
+            options->bytes = strtoull(arg + 8, nullptr, 0);
+        } else if (!strncmp(arg, "--chunk=", 8)) {
+            options->chunk = strtoull(arg + 8, nullptr, 0);
+        } else if (!strcmp(arg, "--coro")) {
+            options->coro = true;
+        } else if (!strncmp(arg, "--farm=", 7)) {
+            options->farm = static_cast<uint32_t>(strtoul(arg + 7, nullptr, 0));
+            if (options->farm == 0 || options->farm > kMaxFarmWorkers) {
+                fprintf(stderr, "farm must be in [1, %u]\n", kMaxFarmWorkers);
+                return false;
+            }
+        } else if (!strncmp(arg, "--inputs=", 9)) {
+            options->inputs = strtoull(arg + 9, nullptr, 0);
+        } else if (!strncmp(arg, "--farm-chunk=", 13)) {
+            options->farm_chunk = strtoull(arg + 13, nullptr, 0);
+            if (options->farm_chunk == 0) {
+                fprintf(stderr, "farm chunk must be at least 1\n");
+                return false;
+            }
+        } else if (!strncmp(arg, "--spin=", 7)) {
+            options->spin = ZX_USEC(strtoull(arg + 7, nullptr, 0));
+        } else {
+            fprintf(stderr, "unknown argument '%s'\n", arg);
+            return false;
+        }
     }
-    *out = mine;
-
-    // Cleanup the channels we just created if something goes wrong below.
-    auto cleanup_on_failure = fbl::MakeAutoCall([mine, other]() {
-        zx_handle_close(mine);
-        zx_handle_close(other);
-    });
-
-    // This struct is a list of things that we're going to pass to the child
-    // process.
-    const fdio_spawn_action_t actions[] = {
-        {.action = FDIO_SPAWN_ACTION_SET_NAME, .name = {.data = "child"}},
-        {.action = FDIO_SPAWN_ACTION_ADD_HANDLE, .h = {.id = PA_USER0, .handle = other}},
-    };
-
-    // Start the child process.
-    st = fdio_spawn_etc(
-        ZX_HANDLE_INVALID, // Job handle, invalid uses default job
-        kFlags,
-        path,
-        kChildProcessArgs, // child process arguments.
-        nullptr,           // environment, not needed for us.
-        countof(actions),
-        actions,
-        nullptr, // process out handle, ignored for now.
-        error_bufffer);
 
-    if (st != ZX_OK) {
-        fprintf(stderr, "could not spawn child process, st = %d\n", st);
-        fprintf(stderr, "reason: %s\n", error_bufffer);
-        return st;
+    // Reading more than the fifo holds can't return more.
+    if (options->batch == 0 || options->batch > options->depth) {
+        options->batch = options->depth;
     }
 
-    cleanup_on_failure.cancel();
-    return ZX_OK;
+    // The ring carries whole elements, so everything is a multiple of the
+    // element size.
+    options->bytes -= options->bytes % kFifoMessageSize;
+    options->chunk -= options->chunk % kFifoMessageSize;
+    if (options->chunk == 0) {
+        fprintf(stderr, "chunk must be at least %zu\n", kFifoMessageSize);
+        return false;
+    }
+    return true;
 }
 
 int main(int argc, const char* argv[]) {
-    bool is_child = false;
+    bool is_child = spawn::IsChild(argc, argv);
 
-    for (int i = 0; i < argc; i++) {
-        if (!strcmp(kCmdLineChild, argv[i])) {
-            is_child = true;
-        }
+    options_t options;
+    if (!parse_options(argc, argv, &options)) {
+        return -1;
+    }
+    if (options.trace != nullptr) {
+        trace::Start(options.trace, is_child ? "child" : "parent");
     }
 
     if (is_child) {
-        zx_handle_t to_parent = zx_take_startup_handle(PA_HND(PA_USER0, 0));
-        return child(to_parent);
+        zx_handle_t to_parent;
+        zx_status_t st = spawn::TakeBootstrap(&to_parent);
+        if (st != ZX_OK) {
+            fprintf(stderr, "[CHILD]: Failed to take bootstrap channel, st = %d\n", st);
+            return st;
+        }
+        return child(to_parent, options);
     } else {
-        zx_handle_t to_child;
-        char path[64];
-        snprintf(path, sizeof(path), "/boot/bin/%s", argv[0]);
-        spawn_child(path, &to_child);
-        return parent(to_child);
+        char path[PATH_MAX];
+        const char* args[spawn::kMaxArgs + 2];
+        zx_status_t st = spawn::SelfPath(argv[0], path, sizeof(path));
+        if (st == ZX_OK) {
+            st = spawn::ChildArgs(argc, argv, args);
+        }
+        if (st != ZX_OK) {
+            fprintf(stderr, "[PARENT]: Can't build child command line, st = %d\n", st);
+            return st;
+        }
+        if (options.farm > 0) {
+            return parent_farm(path, args, options);
+        }
+        spawn::child_t to_child = {};
+        st = spawn::Spawn(path, args, &to_child, 1);
+        if (st != ZX_OK) {
+            return st;
+        }
+        return parent(to_child.channel, options);
     }
 
     // Shouldn't get here.
@@ -1,35 +1,141 @@
 #define LOG_PREFIX "[PARNT]"
 #include "common.h"
+#include "ring.h"
 
 #include <string.h>
 
+#include <coro/coro.h>
 #include <fbl/auto_call.h>
+#include <spinwait/spinwait.h>
 #include <sys/types.h>
+#include <trace/syscalls.h>
 #include <zircon/syscalls.h>
 
-zx_status_t fifo_recv(zx_handle_t fifo) {
-    auto channel_cleanup = fbl::MakeAutoCall([fifo]() {
-        zx_handle_close(fifo);
-    });
-
-    while (true) {
-        // Pretend like this is a costly operation and slowly process items from
-        // the fifo.
-        zx_nanosleep(zx_deadline_after(ZX_MSEC(50)));
+#include <memory>
+#include <utility>
 
-        zx_status_t st = zx_object_wait_one(
-            fifo, ZX_FIFO_READABLE | ZX_FIFO_PEER_CLOSED,
-            ZX_TIME_INFINITE, nullptr);
+// What the consumer did during one run.
+typedef struct consumer_stats {
+    // Elements read.
+    uint64_t elements;
+    // zx_fifo_read calls that returned elements.
+    uint64_t reads;
+    // Times the fifo was empty and we had to wait for the producer.
+    uint64_t waits;
+} consumer_stats_t;
 
+// Read from |fifo| until the producer closes it, taking up to |limit|
+// elements per zx_fifo_read and handing each batch to |process|. With a limit
+// of one this is the original consumer, which waits before every read.
+// Larger limits only wait when a read comes back empty, so a full fifo is
+// drained with a single syscall instead of a wait and a read per element.
+template <typename Fifo, typename Callback>
+static zx_status_t fifo_consume(Fifo* fifo, size_t limit,
+                                spinwait::Waiter* waiter,
+                                consumer_stats_t* stats, Callback process) {
+    auto wait = [fifo, waiter, stats]() {
+        trace::Span span(trace::Op::kObjectWait);
+        zx_status_t st = waiter->Wait(fifo->handle().get(),
+                                      ZX_FIFO_READABLE | ZX_FIFO_PEER_CLOSED,
+                                      nullptr);
+        span.End(st);
+        stats->waits++;
         if (st != ZX_OK) {
             ERR("zx_object_wait_one failed with st = %d\n", st);
+        }
+        return st;
+    };
+    const bool wait_first = limit == 1;
+    typename Fifo::batch_type batch;
+
+    while (true) {
+        zx_status_t st;
+        if (wait_first && (st = wait()) != ZX_OK) {
             return st;
         }
 
-        uint64_t element;
-        size_t actual;
-        st = zx_fifo_read(fifo, kFifoMessageSize, &element, 1, &actual);
+        st = fifo->Read(&batch, limit);
+        if (st == ZX_OK) {
+            stats->elements += batch.count;
+            stats->reads++;
+            process(batch);
+            continue;
+        } else if (st == ZX_ERR_PEER_CLOSED) {
+            // Only reported once the fifo is empty.
+            return ZX_OK;
+        } else if (st != ZX_ERR_SHOULD_WAIT) {
+            ERR("zx_fifo_read failed with st = %d\n", st);
+            return st;
+        }
+
+        if (!wait_first && (st = wait()) != ZX_OK) {
+            return st;
+        }
+    }
+}
+
+// fifo_consume as a coroutine: the executor does the waiting. Each wakeup
+// the executor takes counts as a wait.
+template <typename Batch, typename Callback>
+static coro::Task fifo_consume_coro(coro::Fifo<uint64_t>* fifo, Batch* batch,
+                                    size_t limit, consumer_stats_t* stats,
+                                    Callback process) {
+    if (limit > countof(batch->items)) {
+        limit = countof(batch->items);
+    }
+    while (true) {
+        zx_status_t st = co_await fifo->Read(batch->items, limit, &batch->count);
         if (st == ZX_ERR_PEER_CLOSED) {
+            co_return ZX_OK;
+        } else if (st != ZX_OK) {
+            ERR("zx_fifo_read failed with st = %d\n", st);
+            co_return st;
+        }
+        stats->elements += batch->count;
+        stats->reads++;
+        process(*batch);
+    }
+}
+
+// Runs fifo_consume_coro on |fifo|, which the executor takes over, from a
+// fresh executor.
+template <typename Fifo, typename Callback>
+static zx_status_t fifo_consume_on_executor(Fifo fifo, size_t limit,
+                                            consumer_stats_t* stats,
+                                            Callback process) {
+    std::unique_ptr<coro::Executor> executor;
+    zx_status_t st = coro::Executor::Create(&executor);
+    if (st != ZX_OK) {
+        ERR("zx_port_create failed with st = %d\n", st);
+        return st;
+    }
+    typename Fifo::batch_type batch;
+    coro::Fifo<uint64_t> coro_fifo(executor.get(), fifo.TakeHandle().release());
+    executor->Spawn(fifo_consume_coro(&coro_fifo, &batch, limit, stats, process));
+    st = executor->Run();
+    stats->waits = executor->wakeups();
+    return st;
+}
+
+// Demo consumer. Every read takes whatever is queued, up to the whole fifo,
+// into a batch that lives on the stack.
+zx_status_t fifo_recv(DemoFifo fifo, const options_t& options) {
+    DemoFifo::batch_type batch;
+    spinwait::Waiter waiter(options.spin);
+
+    while (true) {
+        zx_status_t st = fifo.Read(&batch);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            trace::Span wait_span(trace::Op::kObjectWait);
+            st = waiter.Wait(fifo.handle().get(),
+                             ZX_FIFO_READABLE | ZX_FIFO_PEER_CLOSED, nullptr);
+            wait_span.End(st);
+            if (st != ZX_OK) {
+                ERR("zx_object_wait_one failed with st = %d\n", st);
+                return st;
+            }
+            continue;
+        } else if (st == ZX_ERR_PEER_CLOSED) {
             LOG("No more data to process, goodbye!\n");
             return ZX_OK;
         } else if (st != ZX_OK) {
@@ -37,50 +143,286 @@ zx_status_t fifo_recv(zx_handle_t fifo) {
             return st;
         }
 
-        // Wait a little bit to prevent stdout interleaving.
+        // Pretend like this is a costly operation and slowly process items
+        // from the fifo.
         zx_nanosleep(zx_deadline_after(ZX_MSEC(50)));
 
         // Print what out peer sent us to stdout.
-        LOG("Fifo Read Returned %lu\n", element);
+        for (uint64_t element : batch) {
+            LOG("Fifo Read Returned %lu\n", element);
+        }
+    }
+}
+
+// Send |handles| to the child. They are consumed either way.
+static zx_status_t send_handles(zx_handle_t channel, zx_handle_t* handles,
+                                uint32_t count) {
+    zx_signals_t signals;
+    zx_status_t st = trace::object_wait_one(
+        channel, ZX_CHANNEL_PEER_CLOSED | ZX_CHANNEL_WRITABLE,
+        ZX_TIME_INFINITE, &signals);
+
+    if (st == ZX_OK && (signals & ZX_CHANNEL_PEER_CLOSED)) {
+        ERR("Peer closed, quitting!\n");
+        st = ZX_ERR_PEER_CLOSED;
+    } else if (st != ZX_OK) {
+        ERR("zx_object_wait_one failed with st = %d\n", st);
+    } else {
+        st = trace::channel_write(channel, 0, nullptr, 0, handles, count);
+        if (st == ZX_OK) {
+            return ZX_OK;
+        }
+        ERR("zx_channel_write failed with st = %d\n", st);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        zx_handle_close(handles[i]);
     }
+    return st;
+}
 
+// Create a fifo, keep one end in |mine| and send the other to the child.
+template <typename Fifo>
+static zx_status_t send_fifo(zx_handle_t channel, Fifo* mine) {
+    Fifo theirs;
+    zx_status_t st = Fifo::Create(mine, &theirs);
+    if (st != ZX_OK) {
+        ERR("zx_fifo_create failed with st = %d\n", st);
+        return st;
+    }
+
+    zx_handle_t handle = theirs.TakeHandle().release();
+    return send_handles(channel, &handle, 1);
+}
+
+// Create a ring, map it, and send the VMO and one end of its doorbell fifo to
+// the child. The ring owns our end of the doorbell.
+static zx_status_t send_ring(zx_handle_t channel, const options_t& options,
+                             ring_t* out) {
+    typed::Handle vmo;
+    zx_status_t st = zx_vmo_create(ring_vmo_size(options.ring_size), 0,
+                                   vmo.reset_and_get_address());
+    if (st != ZX_OK) {
+        ERR("zx_vmo_create failed with st = %d\n", st);
+        return st;
+    }
+
+    Doorbell mine, theirs;
+    st = Doorbell::Create(&mine, &theirs);
+    if (st != ZX_OK) {
+        ERR("zx_fifo_create failed with st = %d\n", st);
+        return st;
+    }
+
+    // The mapping outlives the VMO handle, which goes to the child.
+    st = ring_map(vmo.get(), options.ring_size, std::move(mine), out);
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    zx_handle_t handles[] = {theirs.TakeHandle().release(), vmo.release()};
+    st = send_handles(channel, handles, countof(handles));
+    if (st != ZX_OK) {
+        ring_unmap(out);
+        return st;
+    }
     return ZX_OK;
 }
 
-zx_status_t parent(zx_handle_t channel) {
-    // Close the channel when we exit this scope.
-    auto channel_cleanup = fbl::MakeAutoCall([channel]() {
-        zx_handle_close(channel);
+// Demo consumer for the ring transport.
+static zx_status_t ring_recv(ring_t* ring) {
+    zx_status_t st = ring_consume(ring, [](const uint8_t* data, size_t len) {
+        const uint64_t* elements = reinterpret_cast<const uint64_t*>(data);
+        for (size_t i = 0; i < len / kFifoMessageSize; i++) {
+            LOG("Ring Read Returned %lu\n", elements[i]);
+        }
     });
+    if (st != ZX_OK) {
+        return st;
+    }
 
-    zx_handle_t mine, theirs;
-    zx_status_t st = zx_fifo_create(kFifoDepth, kFifoMessageSize, 0,
-                                    &mine, &theirs);
+    LOG("No more data to process, goodbye!\n");
+    return ZX_OK;
+}
+
+// Stream |options.bytes| through a ring and report the consumer's throughput.
+static zx_status_t bench_ring(zx_handle_t channel, const options_t& options) {
+    ring_t ring;
+    zx_status_t st = send_ring(channel, options, &ring);
     if (st != ZX_OK) {
-        ERR("zx_fifo_create failed with st = %d\n", st);
         return st;
     }
+    auto ring_cleanup = fbl::MakeAutoCall([&ring]() {
+        ring_unmap(&ring);
+    });
 
-    zx_signals_t signals;
-    st = zx_object_wait_one(channel,
-                            ZX_CHANNEL_PEER_CLOSED | ZX_CHANNEL_WRITABLE,
-                            ZX_TIME_INFINITE, &signals);
+    // The producer fills the stream with 0, 1, 2, ... as 64-bit words.
+    uint64_t expected = 0;
+    bool corrupt = false;
 
+    zx_time_t start = zx_clock_get_monotonic();
+    st = ring_consume(&ring, [&expected, &corrupt](const uint8_t* data,
+                                                   size_t len) {
+        const uint64_t* words = reinterpret_cast<const uint64_t*>(data);
+        for (size_t i = 0; i < len / sizeof(uint64_t); i++) {
+            corrupt |= words[i] != expected++;
+        }
+    });
+    zx_time_t end = zx_clock_get_monotonic();
     if (st != ZX_OK) {
-        ERR("zx_object_wait_one failed with st = %d\n", st);
         return st;
     }
+    if (corrupt || expected * sizeof(uint64_t) != options.bytes) {
+        ERR("ring delivered %lu bytes out of order or incomplete\n",
+            expected * sizeof(uint64_t));
+        return ZX_ERR_INTERNAL;
+    }
 
-    if (signals & ZX_CHANNEL_PEER_CLOSED) {
-        ERR("Peer closed, quitting!\n");
-        return ZX_ERR_PEER_CLOSED;
+    double seconds = static_cast<double>(end - start) / ZX_SEC(1);
+    double mib = static_cast<double>(options.bytes) / (1 << 20);
+    histogram::PrintValue(stdout, "fifo-rw.ring.throughput", "MiB/s",
+                          seconds > 0 ? mib / seconds : 0, options.format);
+    histogram::PrintValue(stdout, "fifo-rw.ring.consumer_waits_per_mib",
+                          "waits/MiB", mib > 0 ? ring.waits / mib : 0,
+                          options.format);
+    histogram::PrintValue(stdout, "fifo-rw.ring.consumer_doorbells_per_mib",
+                          "rings/MiB", mib > 0 ? ring.rings / mib : 0,
+                          options.format);
+    return ZX_OK;
+}
+
+// Stream |options.elements| elements through a fresh fifo, reading up to
+// |batch| per call, and report the consumer's throughput.
+template <typename Fifo>
+static zx_status_t bench_run(zx_handle_t channel, size_t batch,
+                             const options_t& options) {
+    Fifo fifo;
+    zx_status_t st = send_fifo(channel, &fifo);
+    if (st != ZX_OK) {
+        return st;
     }
 
-    st = zx_channel_write(channel, 0, nullptr, 0, &theirs, 1);
+    // The producer sends 0, 1, 2, ...; check nothing was lost or reordered.
+    uint64_t expected = 0;
+    bool corrupt = false;
+    auto check = [&expected, &corrupt](const auto& elements) {
+        for (uint64_t element : elements) {
+            corrupt |= element != expected++;
+        }
+    };
+    consumer_stats_t stats = {};
+    spinwait::Waiter waiter(options.spin);
+
+    zx_time_t start = zx_clock_get_monotonic();
+    if (options.coro) {
+        st = fifo_consume_on_executor(std::move(fifo), batch, &stats, check);
+    } else {
+        st = fifo_consume(&fifo, batch, &waiter, &stats, check);
+    }
+    zx_time_t end = zx_clock_get_monotonic();
     if (st != ZX_OK) {
-        ERR("zx_channel_write failed with st = %d\n", st);
+        return st;
+    }
+    if (corrupt || stats.elements != options.elements) {
+        ERR("fifo delivered %lu elements out of order or incomplete\n",
+            stats.elements);
+        return ZX_ERR_INTERNAL;
+    }
+
+    char name[64];
+    double seconds = static_cast<double>(end - start) / ZX_SEC(1);
+    double elements = stats.elements ? static_cast<double>(stats.elements) : 1;
+    snprintf(name, sizeof(name), "fifo-rw.batch.%zu.throughput", batch);
+    histogram::PrintValue(stdout, name, "elem/s",
+                          seconds > 0 ? stats.elements / seconds : 0,
+                          options.format);
+    snprintf(name, sizeof(name), "fifo-rw.batch.%zu.elements_per_read", batch);
+    histogram::PrintValue(stdout, name, "elem/read",
+                          stats.reads ? stats.elements /
+                                            static_cast<double>(stats.reads)
+                                      : 0,
+                          options.format);
+    snprintf(name, sizeof(name), "fifo-rw.batch.%zu.waits_per_element", batch);
+    histogram::PrintValue(stdout, name, "waits/elem", stats.waits / elements,
+                          options.format);
+    if (options.spin > 0) {
+        snprintf(name, sizeof(name), "fifo-rw.batch.%zu.wait", batch);
+        waiter.PrintCounters(stdout, name, options.format);
+    }
+    return ZX_OK;
+}
+
+// Take everything the streaming producer sends, up to |options.batch|
+// elements per read, and check that it is the Fibonacci sequence. The
+// producer does the reporting.
+template <typename Fifo>
+static zx_status_t stream_run(zx_handle_t channel, const options_t& options) {
+    Fifo fifo;
+    zx_status_t st = send_fifo(channel, &fifo);
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    Fibonacci expected;
+    bool corrupt = false;
+    consumer_stats_t stats = {};
+    spinwait::Waiter waiter(options.spin);
+    st = fifo_consume(&fifo, options.batch, &waiter, &stats,
+                      [&expected, &corrupt](const auto& elements) {
+                          for (uint64_t element : elements) {
+                              corrupt |= element != expected.Next();
+                          }
+                      });
+    if (st != ZX_OK) {
+        return st;
+    }
+    if (corrupt ||
+        (options.duration == 0 && stats.elements != options.elements)) {
+        ERR("fifo delivered %lu elements out of order or incomplete\n",
+            stats.elements);
+        return ZX_ERR_INTERNAL;
+    }
+    return ZX_OK;
+}
+
+zx_status_t parent(zx_handle_t handle, const options_t& options) {
+    // The channel closes when |channel| goes out of scope.
+    typed::Handle channel(handle);
+
+    if (options.stream) {
+        return WithDepth(options.depth, [&](auto depth) {
+            using Fifo = BenchFifo<decltype(depth)::value>;
+            return stream_run<Fifo>(channel.get(), options);
+        });
+    } else if (options.bench && options.ring) {
+        return bench_ring(channel.get(), options);
+    } else if (options.bench) {
+        return WithDepth(options.depth, [&](auto depth) {
+            using Fifo = BenchFifo<decltype(depth)::value>;
+            // The single-element path first, as the baseline.
+            zx_status_t st = bench_run<Fifo>(channel.get(), 1, options);
+            if (st == ZX_OK && options.batch > 1) {
+                st = bench_run<Fifo>(channel.get(), options.batch, options);
+            }
+            return st;
+        });
+    }
+
+    if (options.ring) {
+        ring_t ring;
+        zx_status_t st = send_ring(channel.get(), options, &ring);
+        if (st != ZX_OK) {
+            return st;
+        }
+        st = ring_recv(&ring);
+        ring_unmap(&ring);
         return st;
     }
 
-    return fifo_recv(mine);
+    DemoFifo fifo;
+    zx_status_t st = send_fifo(channel.get(), &fifo);
+    if (st != ZX_OK) {
+        return st;
+    }
+    return fifo_recv(std::move(fifo), options);
 }
@@ -0,0 +1,76 @@
+#define LOG_PREFIX "[RING]"
+#include "common.h"
+#include "ring.h"
+
+#include <zircon/process.h>
+
+#include <utility>
+
+zx_status_t ring_map(zx_handle_t vmo, size_t size, Doorbell doorbell,
+                     ring_t* out) {
+    if (size == 0 || (size & (size - 1)) != 0) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+
+    zx_vaddr_t addr;
+    zx_status_t st = zx_vmar_map(zx_vmar_root_self(),
+                                 ZX_VM_PERM_READ | ZX_VM_PERM_WRITE, 0, vmo, 0,
+                                 ring_vmo_size(size), &addr);
+    if (st != ZX_OK) {
+        ERR("zx_vmar_map failed with st = %d\n", st);
+        return st;
+    }
+
+    out->header = reinterpret_cast<ring_header_t*>(addr);
+    out->data = reinterpret_cast<uint8_t*>(addr) + kRingHeaderSize;
+    out->size = size;
+    out->doorbell = std::move(doorbell);
+    out->waits = 0;
+    out->rings = 0;
+    return ZX_OK;
+}
+
+void ring_unmap(ring_t* ring) {
+    zx_vmar_unmap(zx_vmar_root_self(), reinterpret_cast<zx_vaddr_t>(ring->header),
+                  ring_vmo_size(ring->size));
+    ring->header = nullptr;
+    ring->data = nullptr;
+    ring->doorbell = Doorbell();
+}
+
+zx_status_t ring_wait(ring_t* ring) {
+    zx_signals_t signals;
+    zx_status_t st = ring->doorbell.wait_one(
+        ZX_FIFO_READABLE | ZX_FIFO_PEER_CLOSED, ZX_TIME_INFINITE, &signals);
+    ring->waits++;
+    if (st != ZX_OK) {
+        ERR("zx_object_wait_one failed with st = %d\n", st);
+        return st;
+    }
+
+    // Drain the doorbells so the next wait blocks again.
+    Doorbell::batch_type rings;
+    while (true) {
+        st = ring->doorbell.Read(&rings);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            return ZX_OK;
+        } else if (st == ZX_ERR_PEER_CLOSED) {
+            return st;
+        } else if (st != ZX_OK) {
+            ERR("zx_fifo_read failed with st = %d\n", st);
+            return st;
+        }
+    }
+}
+
+void ring_notify(ring_t* ring, std::atomic<uint32_t>* waiting, uint64_t index) {
+    if (!waiting->load(std::memory_order_seq_cst) ||
+        !waiting->exchange(0, std::memory_order_seq_cst)) {
+        return;
+    }
+    // A full fifo already holds a wakeup the other side hasn't consumed, and
+    // a closed one means nobody is listening; either way there is nothing
+    // more to do.
+    ring->doorbell.Write(index);
+    ring->rings++;
+}
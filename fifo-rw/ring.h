@@ -0,0 +1,169 @@
+#pragma once
+
+// A single-producer/single-consumer byte ring in a VMO shared by two
+// processes.
+//
+// The payload never goes through the kernel: the producer writes straight
+// into the mapping and the consumer reads straight out of it. The fifo that
+// came with the VMO is only used as a doorbell, and only when the other side
+// may be asleep: a side that finds the ring empty (or full) raises its
+// |waiting| flag, checks the ring once more and then blocks on the fifo. The
+// other side rings the doorbell after publishing new data (or space) if it
+// sees the flag. Both the flag and the ring index use sequentially consistent
+// accesses, so one of the two sides always sees the other's update.
+//
+// A producer that closes its fifo handle ends the stream; the consumer sees
+// PEER_CLOSED once it has read everything.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+#include <typed/fifo.h>
+#include <zircon/syscalls.h>
+#include <zircon/types.h>
+
+// Lives at the start of the VMO; the ring data follows on the next page.
+typedef struct ring_header {
+    // Total bytes ever written. Stored only by the producer.
+    alignas(64) std::atomic<uint64_t> head;
+    // Total bytes ever consumed. Stored only by the consumer.
+    alignas(64) std::atomic<uint64_t> tail;
+    // Set by a side that is about to block on the doorbell.
+    alignas(64) std::atomic<uint32_t> consumer_waiting;
+    alignas(64) std::atomic<uint32_t> producer_waiting;
+} ring_header_t;
+
+constexpr size_t kRingHeaderSize = 4096;
+static_assert(sizeof(ring_header_t) <= kRingHeaderSize, "ring header too big");
+
+// Doorbell fifo elements carry the index that changed, which is only useful
+// for debugging; the ring header is the source of truth. A doorbell that is
+// already full holds a wakeup the other side hasn't taken yet, so a few
+// elements are plenty.
+using Doorbell = typed::Fifo<uint64_t, 8>;
+
+typedef struct ring {
+    ring_header_t* header;
+    uint8_t* data;
+    // Size of the data area; a power of two.
+    size_t size;
+    Doorbell doorbell;
+    // Times this side blocked on the doorbell, and times it rang the other
+    // side's.
+    uint64_t waits;
+    uint64_t rings;
+} ring_t;
+
+// Total VMO size for a ring with |size| bytes of data.
+inline size_t ring_vmo_size(size_t size) {
+    return kRingHeaderSize + size;
+}
+
+// Map |vmo|, which must be ring_vmo_size(|size|) bytes, as a ring that uses
+// |doorbell| for wakeups. The ring owns the doorbell; the VMO handle stays
+// the caller's.
+zx_status_t ring_map(zx_handle_t vmo, size_t size, Doorbell doorbell,
+                     ring_t* out);
+
+// Unmaps the ring and closes its doorbell, which ends the stream for the
+// other side.
+void ring_unmap(ring_t* ring);
+
+// Blocks until the other side rings the doorbell or goes away. Returns
+// ZX_ERR_PEER_CLOSED in the latter case.
+zx_status_t ring_wait(ring_t* ring);
+
+// Wakes the other side up if its |waiting| flag is raised.
+void ring_notify(ring_t* ring, std::atomic<uint32_t>* waiting, uint64_t index);
+
+// Producer: write |total| bytes into the ring, at most |chunk| bytes at a time.
+// |fill(dst, len)| must write exactly |len| bytes to |dst|; it is called
+// directly on the shared mapping, so there is no intermediate copy.
+template <typename Fill>
+zx_status_t ring_produce(ring_t* ring, uint64_t total, size_t chunk,
+                         Fill fill) {
+    ring_header_t* header = ring->header;
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    uint64_t end = head + total;
+
+    while (head < end) {
+        uint64_t tail = header->tail.load(std::memory_order_acquire);
+        size_t space = ring->size - static_cast<size_t>(head - tail);
+        if (space == 0) {
+            header->producer_waiting.store(1, std::memory_order_seq_cst);
+            if (header->tail.load(std::memory_order_seq_cst) != tail) {
+                header->producer_waiting.store(0, std::memory_order_relaxed);
+                continue;
+            }
+            zx_status_t st = ring_wait(ring);
+            if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        }
+
+        // Stop at the end of the data area; the next pass wraps around.
+        size_t offset = static_cast<size_t>(head) & (ring->size - 1);
+        size_t len = space;
+        if (len > ring->size - offset) {
+            len = ring->size - offset;
+        }
+        if (len > chunk) {
+            len = chunk;
+        }
+        if (len > end - head) {
+            len = static_cast<size_t>(end - head);
+        }
+
+        fill(ring->data + offset, len);
+        head += len;
+        header->head.store(head, std::memory_order_seq_cst);
+        ring_notify(ring, &header->consumer_waiting, head);
+    }
+    return ZX_OK;
+}
+
+// Consumer: hand every contiguous run of bytes to |process(src, len)| until
+// the producer closes its end of the doorbell and the ring is empty.
+template <typename Process>
+zx_status_t ring_consume(ring_t* ring, Process process) {
+    ring_header_t* header = ring->header;
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    bool producer_gone = false;
+
+    while (true) {
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        if (head == tail) {
+            if (producer_gone) {
+                return ZX_OK;
+            }
+            header->consumer_waiting.store(1, std::memory_order_seq_cst);
+            if (header->head.load(std::memory_order_seq_cst) != head) {
+                header->consumer_waiting.store(0, std::memory_order_relaxed);
+                continue;
+            }
+            zx_status_t st = ring_wait(ring);
+            if (st == ZX_ERR_PEER_CLOSED) {
+                // Everything the producer wrote was published before it
+                // closed; one more pass picks up the rest.
+                producer_gone = true;
+            } else if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        }
+
+        size_t offset = static_cast<size_t>(tail) & (ring->size - 1);
+        size_t len = static_cast<size_t>(head - tail);
+        if (len > ring->size - offset) {
+            len = ring->size - offset;
+        }
+
+        process(ring->data + offset, len);
+        tail += len;
+        header->tail.store(tail, std::memory_order_seq_cst);
+        ring_notify(ring, &header->producer_waiting, tail);
+    }
+}
@@ -12,9 +12,23 @@ MODULE_GROUP := core
 MODULE_SRCS += \
     $(LOCAL_DIR)/main.cpp	\
     $(LOCAL_DIR)/parent.cpp	\
-    $(LOCAL_DIR)/child.cpp
+    $(LOCAL_DIR)/child.cpp	\
+    $(LOCAL_DIR)/ring.cpp	\
+    $(LOCAL_DIR)/farm.cpp
 
-MODULE_STATIC_LIBS := system/ulib/pretty system/ulib/fbl
+MODULE_STATIC_LIBS := system/ulib/pretty system/ulib/fbl \
+    $(dir $(LOCAL_DIR))ulib/coro \
+    $(dir $(LOCAL_DIR))ulib/histogram \
+    $(dir $(LOCAL_DIR))ulib/logger \
+    $(dir $(LOCAL_DIR))ulib/spawn \
+    $(dir $(LOCAL_DIR))ulib/spinwait \
+    $(dir $(LOCAL_DIR))ulib/trace
+
+# <coro/coro.h> needs C++20.
+MODULE_CPPFLAGS += -std=c++20
+
+# Header-only.
+MODULE_COMPILEFLAGS += -I$(dir $(LOCAL_DIR))ulib/typed/include
 
 MODULE_LIBS := system/ulib/fdio system/ulib/c  system/ulib/zircon
 
@@ -0,0 +1,534 @@
+// Channels on the host backend.
+//
+// A channel is an AF_UNIX SOCK_SEQPACKET socket pair, which preserves message
+// boundaries and can carry file descriptors. Each message on the wire is
+//
+//   [message_header][payload bytes][one wire tag per handle]
+//
+// with the handles' descriptors attached as SCM_RIGHTS ancillary data.
+//
+// Differences from Zircon worth knowing about:
+//  - The kernel bounds each socket's queue (net.unix.max_dgram_qlen, usually
+//    10 messages), so zx_channel_write can return ZX_ERR_SHOULD_WAIT. The
+//    handles passed to such a write are left untouched so the caller can
+//    retry once the channel is WRITABLE.
+//  - zx_object_wait_one only reports the signals that were asked for (plus
+//    PEER_CLOSED).
+//  - ZX_CHANNEL_WRITE_USE_IOVEC accepts at most kMaxIovecs (64) fragments
+//    rather than ZX_CHANNEL_MAX_MSG_IOVEC; more return ZX_ERR_NOT_SUPPORTED.
+//    The fragments go to sendmsg as they are, without being gathered first.
+//  - zx_channel_call can't set other messages aside while it waits for its
+//    reply. If anything else reaches the front of the queue first, the call
+//    fails with ZX_ERR_NOT_SUPPORTED and leaves that message queued, so only
+//    use it on channels that carry nothing but calls from one thread.
+
+#include "object.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <vector>
+
+#include <zircon/syscalls.h>
+
+namespace zxhost {
+namespace {
+
+struct message_header {
+    uint32_t num_bytes;
+    uint32_t num_handles;
+};
+
+constexpr size_t kMaxMessageFds = ZX_CHANNEL_MAX_MSG_HANDLES * kMaxObjectFds;
+constexpr size_t kMaxIovecs = 64;
+constexpr size_t kOverflowSize =
+    ZX_CHANNEL_MAX_MSG_BYTES + ZX_CHANNEL_MAX_MSG_HANDLES;
+
+// Catches whatever part of a message does not fit in the caller's buffer.
+uint8_t* overflow_buffer() {
+    static thread_local uint8_t* buffer = nullptr;
+    if (buffer == nullptr) {
+        buffer = static_cast<uint8_t*>(malloc(kOverflowSize));
+    }
+    return buffer;
+}
+
+void close_fds(const int* fds, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        close(fds[i]);
+    }
+}
+
+class Channel final : public Object {
+public:
+    explicit Channel(int fd)
+        : fd_(fd) {}
+
+    ~Channel() override {
+        close_fds(pending_fds_.data(), pending_fds_.size());
+        close(fd_);
+    }
+
+    WireTag export_fds(int* fds, size_t* num_fds) const override {
+        fds[0] = fd_;
+        *num_fds = 1;
+        return kTagChannel;
+    }
+
+    int wait_fd() const override { return fd_; }
+
+    short poll_events(zx_signals_t signals) const override {
+        short events = 0;
+        if (signals & ZX_CHANNEL_READABLE) {
+            events |= POLLIN;
+        }
+        if (signals & ZX_CHANNEL_WRITABLE) {
+            events |= POLLOUT;
+        }
+        return events;
+    }
+
+    bool quick_signals(zx_signals_t* out) override {
+        if (!has_pending_) {
+            return false;
+        }
+        *out = ZX_CHANNEL_READABLE;
+        return true;
+    }
+
+    zx_signals_t observed_signals(short revents) override {
+        zx_signals_t observed = 0;
+        if (revents & (POLLHUP | POLLERR)) {
+            observed |= ZX_CHANNEL_PEER_CLOSED;
+        }
+        if (has_pending_) {
+            observed |= ZX_CHANNEL_READABLE;
+        } else if (revents & POLLIN) {
+            // A closed peer also makes the socket readable (at EOF), so only
+            // report READABLE if a message is actually queued.
+            if (!(observed & ZX_CHANNEL_PEER_CLOSED) || has_queued_message()) {
+                observed |= ZX_CHANNEL_READABLE;
+            }
+        }
+        if ((revents & POLLOUT) && !(observed & ZX_CHANNEL_PEER_CLOSED)) {
+            observed |= ZX_CHANNEL_WRITABLE;
+        }
+        return observed;
+    }
+
+    zx_status_t read(uint32_t options, void* bytes, zx_handle_t* handles,
+                     uint32_t num_bytes, uint32_t num_handles,
+                     uint32_t* actual_bytes, uint32_t* actual_handles);
+
+    // Sends the concatenation of |fragments| as one message.
+    zx_status_t write(const struct iovec* fragments, size_t num_fragments,
+                      const zx_handle_t* handles, uint32_t num_handles);
+
+    // Reads the transaction id of the next message without dequeuing it.
+    // Messages shorter than an id have id 0.
+    zx_status_t peek_txid(zx_txid_t* txid);
+
+private:
+    bool has_queued_message() const {
+        uint8_t byte;
+        return recv(fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+    }
+
+    zx_status_t read_pending(void* bytes, zx_handle_t* handles,
+                             uint32_t num_bytes, uint32_t num_handles,
+                             uint32_t* actual_bytes, uint32_t* actual_handles);
+
+    zx_status_t install_handles(const uint8_t* tags, uint32_t count,
+                                const int* fds, size_t num_fds,
+                                zx_handle_t* handles);
+
+    int fd_;
+
+    // A message that was dequeued from the socket but did not fit in the
+    // caller's buffers. It is handed out by the next successful read.
+    bool has_pending_ = false;
+    std::vector<uint8_t> pending_bytes_;
+    std::vector<uint8_t> pending_tags_;
+    std::vector<int> pending_fds_;
+};
+
+zx_status_t Channel::install_handles(const uint8_t* tags, uint32_t count,
+                                     const int* fds, size_t num_fds,
+                                     zx_handle_t* handles) {
+    size_t fd_index = 0;
+    zx_status_t status = ZX_OK;
+    uint32_t installed = 0;
+
+    for (; installed < count; installed++) {
+        size_t n = fds_for_tag(tags[installed]);
+        if (n == 0 || fd_index + n > num_fds) {
+            status = ZX_ERR_INTERNAL;
+            break;
+        }
+        Object* object;
+        status = import_object(static_cast<WireTag>(tags[installed]),
+                               &fds[fd_index], n, &object);
+        fd_index += n;
+        if (status != ZX_OK) {
+            break;
+        }
+        handles[installed] = handle_alloc(object);
+    }
+
+    if (status != ZX_OK) {
+        for (uint32_t i = 0; i < installed; i++) {
+            zx_handle_close(handles[i]);
+        }
+        if (fd_index < num_fds) {
+            close_fds(&fds[fd_index], num_fds - fd_index);
+        }
+    }
+    return status;
+}
+
+zx_status_t Channel::read_pending(void* bytes, zx_handle_t* handles,
+                                  uint32_t num_bytes, uint32_t num_handles,
+                                  uint32_t* actual_bytes,
+                                  uint32_t* actual_handles) {
+    uint32_t message_bytes = static_cast<uint32_t>(pending_bytes_.size());
+    uint32_t message_handles = static_cast<uint32_t>(pending_tags_.size());
+    if (actual_bytes) {
+        *actual_bytes = message_bytes;
+    }
+    if (actual_handles) {
+        *actual_handles = message_handles;
+    }
+    if (message_bytes > num_bytes || message_handles > num_handles) {
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    }
+
+    memcpy(bytes, pending_bytes_.data(), message_bytes);
+    zx_status_t st = install_handles(pending_tags_.data(), message_handles,
+                                     pending_fds_.data(), pending_fds_.size(),
+                                     handles);
+    pending_fds_.clear();
+    pending_bytes_.clear();
+    pending_tags_.clear();
+    has_pending_ = false;
+    return st;
+}
+
+zx_status_t Channel::read(uint32_t options, void* bytes, zx_handle_t* handles,
+                          uint32_t num_bytes, uint32_t num_handles,
+                          uint32_t* actual_bytes, uint32_t* actual_handles) {
+    if (options != 0) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    if (has_pending_) {
+        return read_pending(bytes, handles, num_bytes, num_handles,
+                            actual_bytes, actual_handles);
+    }
+
+    uint8_t* overflow = overflow_buffer();
+    if (overflow == nullptr) {
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    message_header header;
+    struct iovec iov[3] = {
+        {&header, sizeof(header)},
+        {bytes, num_bytes},
+        {overflow, kOverflowSize},
+    };
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxMessageFds)];
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = countof(iov);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n = recvmsg(fd_, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (n < 0) {
+        return status_from_errno(errno);
+    }
+    if (n == 0) {
+        return ZX_ERR_PEER_CLOSED;
+    }
+
+    int fds[kMaxMessageFds];
+    size_t num_fds = 0;
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c != nullptr;
+         c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(&fds[num_fds], CMSG_DATA(c), count * sizeof(int));
+            num_fds += count;
+        }
+    }
+
+    size_t received = static_cast<size_t>(n);
+    if (received < sizeof(header) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+        received != sizeof(header) + header.num_bytes + header.num_handles) {
+        close_fds(fds, num_fds);
+        return ZX_ERR_INTERNAL;
+    }
+
+    // The payload and the tags that follow it are laid out across the
+    // caller's buffer and the overflow buffer.
+    auto stream_at = [&](size_t offset) -> uint8_t* {
+        if (offset < num_bytes) {
+            return static_cast<uint8_t*>(bytes) + offset;
+        }
+        return overflow + (offset - num_bytes);
+    };
+    uint8_t tags[ZX_CHANNEL_MAX_MSG_HANDLES];
+    for (uint32_t i = 0; i < header.num_handles; i++) {
+        tags[i] = *stream_at(header.num_bytes + i);
+    }
+
+    if (actual_bytes) {
+        *actual_bytes = header.num_bytes;
+    }
+    if (actual_handles) {
+        *actual_handles = header.num_handles;
+    }
+
+    if (header.num_bytes > num_bytes || header.num_handles > num_handles) {
+        // Keep the message around for a retry with larger buffers, which is
+        // what Zircon does when a read fails with BUFFER_TOO_SMALL.
+        pending_bytes_.resize(header.num_bytes);
+        for (uint32_t i = 0; i < header.num_bytes; i++) {
+            pending_bytes_[i] = *stream_at(i);
+        }
+        pending_tags_.assign(tags, tags + header.num_handles);
+        pending_fds_.assign(fds, fds + num_fds);
+        has_pending_ = true;
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    }
+
+    return install_handles(tags, header.num_handles, fds, num_fds, handles);
+}
+
+zx_status_t Channel::peek_txid(zx_txid_t* txid) {
+    *txid = 0;
+    if (has_pending_) {
+        if (pending_bytes_.size() >= sizeof(*txid)) {
+            memcpy(txid, pending_bytes_.data(), sizeof(*txid));
+        }
+        return ZX_OK;
+    }
+
+    struct {
+        message_header header;
+        zx_txid_t txid;
+    } peeked;
+    ssize_t n = recv(fd_, &peeked, sizeof(peeked), MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0) {
+        return status_from_errno(errno);
+    }
+    if (n == 0) {
+        return ZX_ERR_PEER_CLOSED;
+    }
+    if (static_cast<size_t>(n) >= sizeof(peeked) &&
+        peeked.header.num_bytes >= sizeof(*txid)) {
+        *txid = peeked.txid;
+    }
+    return ZX_OK;
+}
+
+zx_status_t Channel::write(const struct iovec* fragments, size_t num_fragments,
+                           const zx_handle_t* handles, uint32_t num_handles) {
+    size_t num_bytes = 0;
+    for (size_t i = 0; i < num_fragments; i++) {
+        num_bytes += fragments[i].iov_len;
+    }
+    if (num_fragments > kMaxIovecs || num_bytes > ZX_CHANNEL_MAX_MSG_BYTES ||
+        num_handles > ZX_CHANNEL_MAX_MSG_HANDLES) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+
+    uint8_t tags[ZX_CHANNEL_MAX_MSG_HANDLES];
+    int fds[kMaxMessageFds];
+    size_t num_fds = 0;
+    for (uint32_t i = 0; i < num_handles; i++) {
+        Ref<Object> object = handle_get(handles[i]);
+        if (!object) {
+            return ZX_ERR_BAD_HANDLE;
+        }
+        if (object.get() == this) {
+            return ZX_ERR_NOT_SUPPORTED;
+        }
+        size_t n;
+        tags[i] = object->export_fds(&fds[num_fds], &n);
+        if (tags[i] == kTagNone) {
+            return ZX_ERR_ACCESS_DENIED;
+        }
+        num_fds += n;
+    }
+
+    message_header header = {static_cast<uint32_t>(num_bytes), num_handles};
+    struct iovec iov[kMaxIovecs + 2];
+    iov[0] = {&header, sizeof(header)};
+    memcpy(&iov[1], fragments, num_fragments * sizeof(struct iovec));
+    iov[num_fragments + 1] = {tags, num_handles};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxMessageFds)];
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = num_fragments + 2;
+    if (num_fds > 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+        struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+        memcpy(CMSG_DATA(c), fds, sizeof(int) * num_fds);
+    }
+
+    if (sendmsg(fd_, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        return status_from_errno(errno);
+    }
+
+    // The handles now live in the peer; drop our references without
+    // signalling their peers that they were closed.
+    for (uint32_t i = 0; i < num_handles; i++) {
+        handle_take(handles[i]);
+    }
+    return ZX_OK;
+}
+
+} // namespace
+
+Object* make_channel(int fd) {
+    return new Channel(fd);
+}
+
+} // namespace zxhost
+
+using zxhost::Channel;
+
+zx_status_t zx_channel_create(uint32_t options, zx_handle_t* out0,
+                              zx_handle_t* out1) {
+    if (options != 0) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        return zxhost::status_from_errno(errno);
+    }
+    *out0 = zxhost::handle_alloc(zxhost::make_channel(fds[0]));
+    *out1 = zxhost::handle_alloc(zxhost::make_channel(fds[1]));
+    return ZX_OK;
+}
+
+zx_status_t zx_channel_read(zx_handle_t handle, uint32_t options, void* bytes,
+                            zx_handle_t* handles, uint32_t num_bytes,
+                            uint32_t num_handles, uint32_t* actual_bytes,
+                            uint32_t* actual_handles) {
+    zxhost::Ref<Channel> channel;
+    zx_status_t st = zxhost::handle_get_typed(handle, &channel);
+    if (st != ZX_OK) {
+        return st;
+    }
+    return channel->read(options, bytes, handles, num_bytes, num_handles,
+                         actual_bytes, actual_handles);
+}
+
+zx_status_t zx_channel_write(zx_handle_t handle, uint32_t options,
+                             const void* bytes, uint32_t num_bytes,
+                             const zx_handle_t* handles, uint32_t num_handles) {
+    if ((options & ~ZX_CHANNEL_WRITE_USE_IOVEC) != 0) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    zxhost::Ref<Channel> channel;
+    zx_status_t st = zxhost::handle_get_typed(handle, &channel);
+    if (st != ZX_OK) {
+        return st;
+    }
+    if (!(options & ZX_CHANNEL_WRITE_USE_IOVEC)) {
+        struct iovec fragment = {const_cast<void*>(bytes), num_bytes};
+        return channel->write(&fragment, 1, handles, num_handles);
+    }
+
+    if (num_bytes > ZX_CHANNEL_MAX_MSG_IOVEC) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    if (num_bytes > zxhost::kMaxIovecs) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+    const zx_channel_iovec_t* vec = static_cast<const zx_channel_iovec_t*>(bytes);
+    struct iovec fragments[zxhost::kMaxIovecs];
+    for (uint32_t i = 0; i < num_bytes; i++) {
+        if (vec[i].reserved != 0) {
+            return ZX_ERR_INVALID_ARGS;
+        }
+        fragments[i] = {const_cast<void*>(vec[i].buffer), vec[i].capacity};
+    }
+    return channel->write(fragments, num_bytes, handles, num_handles);
+}
+
+zx_status_t zx_channel_call(zx_handle_t handle, uint32_t options,
+                            zx_time_t deadline,
+                            const zx_channel_call_args_t* args,
+                            uint32_t* actual_bytes, uint32_t* actual_handles) {
+    if (options != 0 || args->wr_num_bytes < sizeof(zx_txid_t)) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    zxhost::Ref<Channel> channel;
+    zx_status_t st = zxhost::handle_get_typed(handle, &channel);
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    // Like the kernel's, our transaction ids have the high bit set so they
+    // never collide with ids the caller picks for plain writes.
+    static std::atomic<zx_txid_t> next_txid(0);
+    zx_txid_t txid = 0x80000000u |
+                     next_txid.fetch_add(1, std::memory_order_relaxed);
+    const uint8_t* bytes = static_cast<const uint8_t*>(args->wr_bytes);
+    struct iovec fragments[2] = {
+        {&txid, sizeof(txid)},
+        {const_cast<uint8_t*>(bytes) + sizeof(txid),
+         args->wr_num_bytes - sizeof(txid)},
+    };
+
+    // The write only waits on the host backend, whose queues are short.
+    while ((st = channel->write(fragments, countof(fragments), args->wr_handles,
+                                args->wr_num_handles)) == ZX_ERR_SHOULD_WAIT) {
+        zx_signals_t observed;
+        st = zx_object_wait_one(handle,
+                                ZX_CHANNEL_WRITABLE | ZX_CHANNEL_PEER_CLOSED,
+                                deadline, &observed);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    while (true) {
+        zx_txid_t reply;
+        st = channel->peek_txid(&reply);
+        if (st == ZX_OK) {
+            if (reply != txid) {
+                return ZX_ERR_NOT_SUPPORTED;
+            }
+            return channel->read(0, args->rd_bytes, args->rd_handles,
+                                 args->rd_num_bytes, args->rd_num_handles,
+                                 actual_bytes, actual_handles);
+        } else if (st != ZX_ERR_SHOULD_WAIT) {
+            return st;
+        }
+        zx_signals_t observed;
+        st = zx_object_wait_one(handle,
+                                ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                deadline, &observed);
+        if (st != ZX_OK) {
+            return st;
+        }
+        if (!(observed & ZX_CHANNEL_READABLE)) {
+            return ZX_ERR_PEER_CLOSED;
+        }
+    }
+}
@@ -0,0 +1,343 @@
+// Fifos on the host backend.
+//
+// Elements live in a pair of single-producer/single-consumer rings in a
+// shared memfd mapping, one ring per direction, so reads and writes never
+// enter the kernel. Each endpoint also owns one end of a SOCK_SEQPACKET socket
+// pair that is used as a doorbell: a writer rings it when the reader may be
+// asleep on an empty ring, and a reader rings it when the writer may be asleep
+// on a full one. Closing (or exiting) drops the socket, which wakes the peer
+// with POLLHUP.
+
+#include "object.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include <zircon/syscalls.h>
+
+namespace zxhost {
+namespace {
+
+struct alignas(64) fifo_ring {
+    // Total number of elements ever written into / read out of this ring.
+    // Only the writer stores |head|, only the reader stores |tail|.
+    std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+};
+
+struct fifo_shared {
+    uint32_t elem_count;
+    uint32_t elem_size;
+    // Set by an endpoint when its last handle is closed.
+    std::atomic<uint32_t> closed[2];
+    // rings[i] carries elements written by endpoint i.
+    fifo_ring rings[2];
+};
+
+size_t fifo_mapping_size(size_t elem_count, size_t elem_size) {
+    size_t size = sizeof(fifo_shared) + 2 * elem_count * elem_size;
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (size + page - 1) & ~(page - 1);
+}
+
+class Fifo final : public Object {
+public:
+    Fifo(int side, int sock_fd, int mem_fd, fifo_shared* shared, size_t size)
+        : side_(side), sock_fd_(sock_fd), mem_fd_(mem_fd), shared_(shared),
+          mapping_size_(size), elem_size_(shared->elem_size),
+          elem_count_(shared->elem_count) {
+        uint8_t* data = reinterpret_cast<uint8_t*>(shared + 1);
+        out_ = &shared->rings[side];
+        in_ = &shared->rings[1 - side];
+        out_data_ = data + side * elem_count_ * elem_size_;
+        in_data_ = data + (1 - side) * elem_count_ * elem_size_;
+    }
+
+    ~Fifo() override {
+        munmap(shared_, mapping_size_);
+        close(mem_fd_);
+        close(sock_fd_);
+    }
+
+    void on_close() override {
+        shared_->closed[side_].store(1, std::memory_order_release);
+    }
+
+    WireTag export_fds(int* fds, size_t* num_fds) const override {
+        fds[0] = sock_fd_;
+        fds[1] = mem_fd_;
+        *num_fds = 2;
+        return side_ == 0 ? kTagFifo0 : kTagFifo1;
+    }
+
+    int wait_fd() const override { return sock_fd_; }
+
+    short poll_events(zx_signals_t signals) const override {
+        // Every state change is announced through the doorbell.
+        (void)signals;
+        return POLLIN;
+    }
+
+    bool quick_signals(zx_signals_t* out) override {
+        *out = current_signals();
+        return true;
+    }
+
+    zx_signals_t observed_signals(short revents) override {
+        if (revents & (POLLHUP | POLLERR)) {
+            peer_gone_ = true;
+        } else if (revents & POLLIN) {
+            drain_doorbell();
+        }
+        return current_signals();
+    }
+
+    zx_status_t read(size_t elem_size, void* data, size_t count,
+                     size_t* actual_count);
+    zx_status_t write(size_t elem_size, const void* data, size_t count,
+                      size_t* actual_count);
+
+private:
+    bool peer_closed() const {
+        return peer_gone_ ||
+               shared_->closed[1 - side_].load(std::memory_order_acquire);
+    }
+
+    zx_signals_t current_signals() const {
+        zx_signals_t signals = 0;
+        // These loads pair with the seq_cst store + load in read() and
+        // write() so that a waiter never sleeps through a doorbell.
+        uint64_t in_head = in_->head.load(std::memory_order_seq_cst);
+        uint64_t in_tail = in_->tail.load(std::memory_order_relaxed);
+        if (in_head != in_tail) {
+            signals |= ZX_FIFO_READABLE;
+        }
+        if (peer_closed()) {
+            signals |= ZX_FIFO_PEER_CLOSED;
+        } else {
+            uint64_t out_head = out_->head.load(std::memory_order_relaxed);
+            uint64_t out_tail = out_->tail.load(std::memory_order_seq_cst);
+            if (out_head - out_tail < elem_count_) {
+                signals |= ZX_FIFO_WRITABLE;
+            }
+        }
+        return signals;
+    }
+
+    void ring_doorbell() {
+        // If the send fails because the socket is full, a wakeup is already
+        // pending, which is all the peer needs.
+        uint8_t byte = 0;
+        send(sock_fd_, &byte, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+
+    void drain_doorbell() {
+        uint8_t bytes[64];
+        while (recv(sock_fd_, bytes, sizeof(bytes), MSG_DONTWAIT) > 0) {
+        }
+    }
+
+    const int side_;
+    const int sock_fd_;
+    const int mem_fd_;
+    fifo_shared* const shared_;
+    const size_t mapping_size_;
+    const size_t elem_size_;
+    const size_t elem_count_;
+
+    fifo_ring* out_;
+    fifo_ring* in_;
+    uint8_t* out_data_;
+    uint8_t* in_data_;
+
+    bool peer_gone_ = false;
+};
+
+zx_status_t Fifo::write(size_t elem_size, const void* data, size_t count,
+                        size_t* actual_count) {
+    if (elem_size != elem_size_) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    if (count == 0) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    if (peer_closed()) {
+        return ZX_ERR_PEER_CLOSED;
+    }
+
+    uint64_t head = out_->head.load(std::memory_order_relaxed);
+    uint64_t tail = out_->tail.load(std::memory_order_acquire);
+    size_t space = elem_count_ - static_cast<size_t>(head - tail);
+    if (space == 0) {
+        return ZX_ERR_SHOULD_WAIT;
+    }
+    size_t n = count < space ? count : space;
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    size_t start = static_cast<size_t>(head % elem_count_);
+    size_t first = n < elem_count_ - start ? n : elem_count_ - start;
+    memcpy(out_data_ + start * elem_size_, src, first * elem_size_);
+    memcpy(out_data_, src + first * elem_size_, (n - first) * elem_size_);
+
+    out_->head.store(head + n, std::memory_order_seq_cst);
+
+    // If the reader has consumed everything up to our write it may have seen
+    // an empty ring and gone to sleep.
+    if (out_->tail.load(std::memory_order_seq_cst) == head) {
+        ring_doorbell();
+    }
+
+    if (actual_count) {
+        *actual_count = n;
+    }
+    return ZX_OK;
+}
+
+zx_status_t Fifo::read(size_t elem_size, void* data, size_t count,
+                       size_t* actual_count) {
+    if (elem_size != elem_size_) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    if (count == 0) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+
+    uint64_t tail = in_->tail.load(std::memory_order_relaxed);
+    uint64_t head = in_->head.load(std::memory_order_acquire);
+    size_t available = static_cast<size_t>(head - tail);
+    if (available == 0) {
+        return peer_closed() ? ZX_ERR_PEER_CLOSED : ZX_ERR_SHOULD_WAIT;
+    }
+    size_t n = count < available ? count : available;
+
+    uint8_t* dst = static_cast<uint8_t*>(data);
+    size_t start = static_cast<size_t>(tail % elem_count_);
+    size_t first = n < elem_count_ - start ? n : elem_count_ - start;
+    memcpy(dst, in_data_ + start * elem_size_, first * elem_size_);
+    memcpy(dst + first * elem_size_, in_data_, (n - first) * elem_size_);
+
+    in_->tail.store(tail + n, std::memory_order_seq_cst);
+
+    // If the ring was full relative to our old tail the writer may be asleep
+    // waiting for space.
+    if (in_->head.load(std::memory_order_seq_cst) - tail >= elem_count_) {
+        ring_doorbell();
+    }
+
+    if (actual_count) {
+        *actual_count = n;
+    }
+    return ZX_OK;
+}
+
+} // namespace
+
+zx_status_t make_fifo(int side, int sock_fd, int mem_fd, Object** out) {
+    fifo_shared header;
+    if (pread(mem_fd, &header, sizeof(header.elem_count) + sizeof(header.elem_size), 0) !=
+        static_cast<ssize_t>(sizeof(header.elem_count) + sizeof(header.elem_size))) {
+        close(sock_fd);
+        close(mem_fd);
+        return ZX_ERR_INTERNAL;
+    }
+
+    size_t size = fifo_mapping_size(header.elem_count, header.elem_size);
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         mem_fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(sock_fd);
+        close(mem_fd);
+        return status_from_errno(errno);
+    }
+
+    *out = new Fifo(side, sock_fd, mem_fd, static_cast<fifo_shared*>(mapping),
+                    size);
+    return ZX_OK;
+}
+
+} // namespace zxhost
+
+using zxhost::Fifo;
+
+zx_status_t zx_fifo_create(size_t elem_count, size_t elem_size,
+                           uint32_t options, zx_handle_t* out0,
+                           zx_handle_t* out1) {
+    if (options != 0 || elem_count == 0 || elem_size == 0 ||
+        (elem_count & (elem_count - 1)) != 0 ||
+        elem_count * elem_size > ZX_FIFO_MAX_SIZE_BYTES) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+
+    int mem_fd = memfd_create("zx-fifo", MFD_CLOEXEC);
+    if (mem_fd < 0) {
+        return zxhost::status_from_errno(errno);
+    }
+    size_t size = zxhost::fifo_mapping_size(elem_count, elem_size);
+    if (ftruncate(mem_fd, static_cast<off_t>(size)) < 0) {
+        close(mem_fd);
+        return zxhost::status_from_errno(errno);
+    }
+    zxhost::fifo_shared header = {};
+    header.elem_count = static_cast<uint32_t>(elem_count);
+    header.elem_size = static_cast<uint32_t>(elem_size);
+    if (pwrite(mem_fd, &header, sizeof(header), 0) != sizeof(header)) {
+        close(mem_fd);
+        return ZX_ERR_INTERNAL;
+    }
+
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) < 0) {
+        close(mem_fd);
+        return zxhost::status_from_errno(errno);
+    }
+    int mem_fd1 = fcntl(mem_fd, F_DUPFD_CLOEXEC, 0);
+    if (mem_fd1 < 0) {
+        close(mem_fd);
+        close(socks[0]);
+        close(socks[1]);
+        return zxhost::status_from_errno(errno);
+    }
+
+    zxhost::Object* ends[2];
+    zx_status_t st = zxhost::make_fifo(0, socks[0], mem_fd, &ends[0]);
+    if (st != ZX_OK) {
+        close(socks[1]);
+        close(mem_fd1);
+        return st;
+    }
+    st = zxhost::make_fifo(1, socks[1], mem_fd1, &ends[1]);
+    if (st != ZX_OK) {
+        delete ends[0];
+        return st;
+    }
+    *out0 = zxhost::handle_alloc(ends[0]);
+    *out1 = zxhost::handle_alloc(ends[1]);
+    return ZX_OK;
+}
+
+zx_status_t zx_fifo_read(zx_handle_t handle, size_t elem_size, void* data,
+                         size_t count, size_t* actual_count) {
+    zxhost::Ref<Fifo> fifo;
+    zx_status_t st = zxhost::handle_get_typed(handle, &fifo);
+    if (st != ZX_OK) {
+        return st;
+    }
+    return fifo->read(elem_size, data, count, actual_count);
+}
+
+zx_status_t zx_fifo_write(zx_handle_t handle, size_t elem_size,
+                          const void* data, size_t count,
+                          size_t* actual_count) {
+    zxhost::Ref<Fifo> fifo;
+    zx_status_t st = zxhost::handle_get_typed(handle, &fifo);
+    if (st != ZX_OK) {
+        return st;
+    }
+    return fifo->write(elem_size, data, count, actual_count);
+}
@@ -0,0 +1,227 @@
+// Handle table for the host backend.
+//
+// Lookups happen on every syscall and must not take a lock, so the table is a
+// fixed two level array of atomic pointers. Chunks are allocated on demand and
+// never freed. Allocation and free go through a mutex protected free list.
+//
+// A lookup has to take its reference before the handle can be closed and the
+// table's reference dropped. Each slot counts the lookups in progress on it;
+// a lookup announces itself there before loading the pointer, and a close
+// empties the slot and then waits for the count to drain before it lets go
+// of the object. Either the lookup sees the empty slot, or the close sees
+// the lookup and waits for it to take its reference.
+
+#include "object.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <zircon/syscalls.h>
+
+namespace zxhost {
+namespace {
+
+constexpr size_t kChunkBits = 10;
+constexpr size_t kChunkSize = 1u << kChunkBits;
+constexpr size_t kNumChunks = 1024;
+
+// Zircon handle values always have their two low bits set; keep the same
+// shape so that ZX_HANDLE_INVALID (0) can never be a valid handle.
+constexpr zx_handle_t kHandleFixedBits = 0x3;
+
+struct Slot {
+    std::atomic<Object*> object;
+    // Lookups between loading |object| and taking their reference.
+    std::atomic<uint32_t> readers;
+};
+
+struct Chunk {
+    Slot slots[kChunkSize];
+};
+
+std::atomic<Chunk*> g_chunks[kNumChunks];
+std::mutex g_lock;
+std::vector<uint32_t> g_free;
+uint32_t g_next_index = 0;
+
+Slot* slot_for(uint32_t index) {
+    size_t chunk = index >> kChunkBits;
+    if (chunk >= kNumChunks) {
+        return nullptr;
+    }
+    Chunk* c = g_chunks[chunk].load(std::memory_order_acquire);
+    if (c == nullptr) {
+        return nullptr;
+    }
+    return &c->slots[index & (kChunkSize - 1)];
+}
+
+bool index_from_handle(zx_handle_t handle, uint32_t* index) {
+    if ((handle & kHandleFixedBits) != kHandleFixedBits) {
+        return false;
+    }
+    *index = handle >> 2;
+    return true;
+}
+
+} // namespace
+
+zx_handle_t handle_alloc(Object* object) {
+    std::lock_guard<std::mutex> guard(g_lock);
+
+    uint32_t index;
+    if (!g_free.empty()) {
+        index = g_free.back();
+        g_free.pop_back();
+    } else {
+        index = g_next_index;
+        size_t chunk = index >> kChunkBits;
+        if (chunk >= kNumChunks) {
+            return ZX_HANDLE_INVALID;
+        }
+        if (g_chunks[chunk].load(std::memory_order_relaxed) == nullptr) {
+            g_chunks[chunk].store(new Chunk(), std::memory_order_release);
+        }
+        g_next_index++;
+    }
+
+    slot_for(index)->object.store(object, std::memory_order_release);
+    return (index << 2) | kHandleFixedBits;
+}
+
+// The reader count and the slot pointer are accessed sequentially
+// consistently, which is what makes the handshake described at the top work.
+Ref<Object> handle_get(zx_handle_t handle) {
+    uint32_t index;
+    if (!index_from_handle(handle, &index)) {
+        return Ref<Object>();
+    }
+    Slot* slot = slot_for(index);
+    if (slot == nullptr) {
+        return Ref<Object>();
+    }
+    slot->readers.fetch_add(1);
+    Object* object = slot->object.load();
+    if (object != nullptr) {
+        object->AddRef();
+    }
+    slot->readers.fetch_sub(1, std::memory_order_release);
+    return Ref<Object>(object);
+}
+
+Ref<Object> handle_take(zx_handle_t handle) {
+    uint32_t index;
+    if (!index_from_handle(handle, &index)) {
+        return Ref<Object>();
+    }
+    Slot* slot = slot_for(index);
+    if (slot == nullptr) {
+        return Ref<Object>();
+    }
+    Object* object = slot->object.exchange(nullptr);
+    if (object == nullptr) {
+        return Ref<Object>();
+    }
+    // Only a lookup that was already past its load can still be counted,
+    // and it is a few instructions away from its AddRef.
+    while (slot->readers.load() != 0) {
+        std::this_thread::yield();
+    }
+    cancel_waits(handle, object);
+
+    {
+        std::lock_guard<std::mutex> guard(g_lock);
+        g_free.push_back(index);
+    }
+    return Ref<Object>(object);
+}
+
+size_t fds_for_tag(uint8_t tag) {
+    switch (tag) {
+    case kTagChannel:
+    case kTagVmo:
+        return 1;
+    case kTagFifo0:
+    case kTagFifo1:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+zx_status_t import_object(WireTag tag, const int* fds, size_t num_fds,
+                          Object** out) {
+    if (fds_for_tag(tag) != num_fds) {
+        for (size_t i = 0; i < num_fds; i++) {
+            close(fds[i]);
+        }
+        return ZX_ERR_INVALID_ARGS;
+    }
+
+    switch (tag) {
+    case kTagChannel:
+        *out = make_channel(fds[0]);
+        return ZX_OK;
+    case kTagFifo0:
+    case kTagFifo1:
+        return make_fifo(tag == kTagFifo0 ? 0 : 1, fds[0], fds[1], out);
+    case kTagVmo:
+        *out = make_vmo(fds[0]);
+        return ZX_OK;
+    default:
+        break;
+    }
+    return ZX_ERR_INVALID_ARGS;
+}
+
+zx_status_t status_from_errno(int error) {
+    switch (error) {
+    case EAGAIN:
+        return ZX_ERR_SHOULD_WAIT;
+    case EPIPE:
+    case ECONNRESET:
+    case ENOTCONN:
+        return ZX_ERR_PEER_CLOSED;
+    case EBADF:
+        return ZX_ERR_BAD_HANDLE;
+    case EINVAL:
+        return ZX_ERR_INVALID_ARGS;
+    case EMSGSIZE:
+        return ZX_ERR_OUT_OF_RANGE;
+    case ENOMEM:
+    case ENOBUFS:
+        return ZX_ERR_NO_MEMORY;
+    case EMFILE:
+    case ENFILE:
+        return ZX_ERR_NO_RESOURCES;
+    case ETIMEDOUT:
+        return ZX_ERR_TIMED_OUT;
+    case EACCES:
+    case EPERM:
+        return ZX_ERR_ACCESS_DENIED;
+    default:
+        return ZX_ERR_IO;
+    }
+}
+
+} // namespace zxhost
+
+zx_status_t zx_handle_close(zx_handle_t handle) {
+    if (handle == ZX_HANDLE_INVALID) {
+        return ZX_OK;
+    }
+    zxhost::Ref<zxhost::Object> object = zxhost::handle_take(handle);
+    if (!object) {
+        return ZX_ERR_BAD_HANDLE;
+    }
+    // Lookups still running on other threads keep the object alive; it is
+    // destroyed when the last of them is done.
+    object->on_close();
+    return ZX_OK;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// Host stand-in for <fbl/auto_call.h>.
+
+#include <utility>
+
+namespace fbl {
+
+// Calls the given callable when this object goes out of scope, unless
+// cancel() was called first.
+template <typename T>
+class AutoCall {
+public:
+    constexpr explicit AutoCall(T c)
+        : call_(std::move(c)) {}
+    ~AutoCall() { call(); }
+
+    AutoCall(AutoCall&& c)
+        : call_(std::move(c.call_)), active_(c.active_) {
+        c.cancel();
+    }
+
+    AutoCall(const AutoCall&) = delete;
+    AutoCall& operator=(const AutoCall&) = delete;
+    AutoCall& operator=(AutoCall&&) = delete;
+
+    // Run the callable now and disarm.
+    void call() {
+        bool active = active_;
+        cancel();
+        if (active) {
+            call_();
+        }
+    }
+
+    // Disarm without running the callable.
+    void cancel() { active_ = false; }
+
+private:
+    T call_;
+    bool active_ = true;
+};
+
+template <typename T>
+inline AutoCall<T> MakeAutoCall(T c) {
+    return AutoCall<T>(std::move(c));
+}
+
+} // namespace fbl
@@ -0,0 +1,55 @@
+#pragma once
+
+// Host stand-in for the subset of <lib/fdio/spawn.h> used by the samples.
+// fdio_spawn_etc is implemented with posix_spawn; handles passed with
+// FDIO_SPAWN_ACTION_ADD_HANDLE are inherited by the child and picked up with
+// zx_take_startup_handle.
+
+#include <zircon/types.h>
+
+__BEGIN_CDECLS
+
+#define FDIO_SPAWN_CLONE_JOB ((uint32_t)0x0001u)
+#define FDIO_SPAWN_CLONE_LDSVC ((uint32_t)0x0002u)
+#define FDIO_SPAWN_CLONE_NAMESPACE ((uint32_t)0x0004u)
+#define FDIO_SPAWN_CLONE_STDIO ((uint32_t)0x0008u)
+#define FDIO_SPAWN_CLONE_ENVIRON ((uint32_t)0x0010u)
+#define FDIO_SPAWN_CLONE_ALL ((uint32_t)0xFFFFu)
+
+#define FDIO_SPAWN_ACTION_CLONE_FD ((uint32_t)0x0001u)
+#define FDIO_SPAWN_ACTION_TRANSFER_FD ((uint32_t)0x0002u)
+#define FDIO_SPAWN_ACTION_ADD_NS_ENTRY ((uint32_t)0x0003u)
+#define FDIO_SPAWN_ACTION_ADD_HANDLE ((uint32_t)0x0004u)
+#define FDIO_SPAWN_ACTION_SET_NAME ((uint32_t)0x0005u)
+
+#define FDIO_SPAWN_ERR_MSG_MAX_LENGTH ((size_t)1024u)
+
+typedef struct fdio_spawn_action fdio_spawn_action_t;
+struct fdio_spawn_action {
+    uint32_t action;
+    union {
+        struct {
+            int local_fd;
+            int target_fd;
+        } fd;
+        struct {
+            const char* prefix;
+            zx_handle_t handle;
+        } ns;
+        struct {
+            uint32_t id;
+            zx_handle_t handle;
+        } h;
+        struct {
+            const char* data;
+        } name;
+    };
+};
+
+zx_status_t fdio_spawn_etc(zx_handle_t job, uint32_t flags, const char* path,
+                           const char* const* argv, const char* const* environ,
+                           size_t action_count,
+                           const fdio_spawn_action_t* actions,
+                           zx_handle_t* process_out, char* err_msg_out);
+
+__END_CDECLS
@@ -0,0 +1,114 @@
+#pragma once
+
+// Host stand-in for Zircon's <unittest/unittest.h>: the subset of its macros
+// the tests in this tree use, with the same shape, so that the tests build
+// unchanged against either.
+//
+//   bool my_test() {
+//       BEGIN_TEST;
+//       EXPECT_EQ(ZX_OK, zx_foo(), "foo should succeed");
+//       END_TEST;
+//   }
+//
+//   BEGIN_TEST_CASE(my_tests)
+//   RUN_TEST(my_test)
+//   END_TEST_CASE(my_tests)
+//
+//   int main(int argc, char** argv) {
+//       return unittest_run_all_tests(argc, argv) ? 0 : -1;
+//   }
+//
+// The message argument is optional and must be a string literal.
+
+#include <stdio.h>
+
+namespace unittest {
+
+typedef bool (*test_case_fn)();
+
+struct test_case {
+    const char* name;
+    test_case_fn run;
+    test_case* next;
+};
+
+inline test_case* g_test_cases = nullptr;
+
+struct registrar {
+    registrar(test_case* tc) {
+        // Keep the cases in the order they appear in the file.
+        test_case** at = &g_test_cases;
+        while (*at != nullptr) {
+            at = &(*at)->next;
+        }
+        *at = tc;
+    }
+};
+
+inline void fail(const char* file, int line, const char* expr,
+                 const char* msg) {
+    fprintf(stderr, "    FAILED at %s:%d: %s%s%s\n", file, line, expr,
+            *msg ? ": " : "", msg);
+}
+
+inline bool run_test(const char* name, bool (*test)()) {
+    fprintf(stderr, "    %-50s", name);
+    bool ok = test();
+    fprintf(stderr, "%s\n", ok ? "[PASSED]" : "[FAILED]");
+    return ok;
+}
+
+} // namespace unittest
+
+#define BEGIN_TEST bool all_ok = true
+#define END_TEST return all_ok
+
+#define UNITTEST_CHECK(cond, expr, on_fail, ...)                            \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "\n");                                          \
+            unittest::fail(__FILE__, __LINE__, expr, "" __VA_ARGS__);       \
+            all_ok = false;                                                 \
+            on_fail;                                                        \
+        }                                                                   \
+    } while (0)
+
+#define EXPECT_TRUE(a, ...) UNITTEST_CHECK((a), #a, (void)0, __VA_ARGS__)
+#define EXPECT_FALSE(a, ...) UNITTEST_CHECK(!(a), "!(" #a ")", (void)0, __VA_ARGS__)
+#define EXPECT_EQ(a, b, ...) \
+    UNITTEST_CHECK((a) == (b), #a " == " #b, (void)0, __VA_ARGS__)
+#define EXPECT_NE(a, b, ...) \
+    UNITTEST_CHECK((a) != (b), #a " != " #b, (void)0, __VA_ARGS__)
+#define EXPECT_LE(a, b, ...) \
+    UNITTEST_CHECK((a) <= (b), #a " <= " #b, (void)0, __VA_ARGS__)
+
+#define ASSERT_TRUE(a, ...) UNITTEST_CHECK((a), #a, return false, __VA_ARGS__)
+#define ASSERT_FALSE(a, ...) \
+    UNITTEST_CHECK(!(a), "!(" #a ")", return false, __VA_ARGS__)
+#define ASSERT_EQ(a, b, ...) \
+    UNITTEST_CHECK((a) == (b), #a " == " #b, return false, __VA_ARGS__)
+#define ASSERT_NE(a, b, ...) \
+    UNITTEST_CHECK((a) != (b), #a " != " #b, return false, __VA_ARGS__)
+
+#define BEGIN_TEST_CASE(name)                  \
+    static bool name##_run() {                 \
+        fprintf(stderr, "CASE %s\n", #name);   \
+        bool all_ok = true;
+#define RUN_TEST(test) all_ok = unittest::run_test(#test, test) && all_ok;
+#define END_TEST_CASE(name)                                            \
+        return all_ok;                                                 \
+    }                                                                  \
+    static unittest::test_case name##_case = {#name, name##_run, nullptr}; \
+    static unittest::registrar name##_registrar(&name##_case);
+
+inline bool unittest_run_all_tests(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    bool ok = true;
+    for (unittest::test_case* tc = unittest::g_test_cases; tc != nullptr;
+         tc = tc->next) {
+        ok = tc->run() && ok;
+    }
+    fprintf(stderr, "%s\n", ok ? "ALL PASSED" : "SOME TESTS FAILED");
+    return ok;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// Host stand-in for the subset of <zircon/process.h> used by the samples.
+
+#include <zircon/types.h>
+
+__BEGIN_CDECLS
+
+// Returns the startup handle tagged |hnd_info| (see PA_HND) and forgets about
+// it, or ZX_HANDLE_INVALID if the parent did not pass one.
+zx_handle_t zx_take_startup_handle(uint32_t hnd_info);
+
+// Returns a handle to the calling process. Do not close it.
+zx_handle_t zx_process_self(void);
+
+// Returns a handle to the calling process's root VMAR. Do not close it.
+zx_handle_t zx_vmar_root_self(void);
+
+__END_CDECLS
@@ -0,0 +1,12 @@
+#pragma once
+
+// Host stand-in for the subset of <zircon/processargs.h> used by the samples.
+
+#define PA_HND(type, arg) (((type)&0xFF) | (((arg)&0xFFFF) << 16))
+#define PA_HND_TYPE(n) ((n)&0xFF)
+#define PA_HND_ARG(n) (((n) >> 16) & 0xFFFF)
+
+// Handle types the application is free to use.
+#define PA_USER0 0xF0u
+#define PA_USER1 0xF1u
+#define PA_USER2 0xF2u
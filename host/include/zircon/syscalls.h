@@ -0,0 +1,75 @@
+#pragma once
+
+// Host stand-in for <zircon/syscalls.h>. Only the syscalls used by the samples
+// are provided; see host/README.md for how each object is emulated.
+
+#include <zircon/types.h>
+
+__BEGIN_CDECLS
+
+// Handles.
+zx_status_t zx_handle_close(zx_handle_t handle);
+
+// Channels.
+zx_status_t zx_channel_create(uint32_t options, zx_handle_t* out0,
+                              zx_handle_t* out1);
+zx_status_t zx_channel_read(zx_handle_t handle, uint32_t options, void* bytes,
+                            zx_handle_t* handles, uint32_t num_bytes,
+                            uint32_t num_handles, uint32_t* actual_bytes,
+                            uint32_t* actual_handles);
+zx_status_t zx_channel_write(zx_handle_t handle, uint32_t options,
+                             const void* bytes, uint32_t num_bytes,
+                             const zx_handle_t* handles, uint32_t num_handles);
+zx_status_t zx_channel_call(zx_handle_t handle, uint32_t options,
+                            zx_time_t deadline,
+                            const zx_channel_call_args_t* args,
+                            uint32_t* actual_bytes, uint32_t* actual_handles);
+
+// Fifos.
+zx_status_t zx_fifo_create(size_t elem_count, size_t elem_size,
+                           uint32_t options, zx_handle_t* out0,
+                           zx_handle_t* out1);
+zx_status_t zx_fifo_read(zx_handle_t handle, size_t elem_size, void* data,
+                         size_t count, size_t* actual_count);
+zx_status_t zx_fifo_write(zx_handle_t handle, size_t elem_size,
+                          const void* data, size_t count, size_t* actual_count);
+
+// VMOs and mappings.
+zx_status_t zx_vmo_create(uint64_t size, uint32_t options, zx_handle_t* out);
+zx_status_t zx_vmo_get_size(zx_handle_t handle, uint64_t* size);
+zx_status_t zx_vmo_read(zx_handle_t handle, void* buffer, uint64_t offset,
+                        size_t buffer_size);
+zx_status_t zx_vmo_write(zx_handle_t handle, const void* buffer,
+                         uint64_t offset, size_t buffer_size);
+zx_status_t zx_vmar_map(zx_handle_t vmar, zx_vm_option_t options,
+                        size_t vmar_offset, zx_handle_t vmo,
+                        uint64_t vmo_offset, size_t len,
+                        zx_vaddr_t* mapped_addr);
+zx_status_t zx_vmar_unmap(zx_handle_t vmar, zx_vaddr_t addr, size_t len);
+
+// Waiting.
+zx_status_t zx_object_wait_one(zx_handle_t handle, zx_signals_t signals,
+                               zx_time_t deadline, zx_signals_t* observed);
+
+// Ports.
+zx_status_t zx_port_create(uint32_t options, zx_handle_t* out);
+zx_status_t zx_port_queue(zx_handle_t handle, const zx_port_packet_t* packet);
+zx_status_t zx_port_wait(zx_handle_t handle, zx_time_t deadline,
+                         zx_port_packet_t* packet);
+zx_status_t zx_object_wait_async(zx_handle_t handle, zx_handle_t port,
+                                 uint64_t key, zx_signals_t signals,
+                                 uint32_t options);
+
+// Object info.
+zx_status_t zx_object_get_info(zx_handle_t handle, uint32_t topic,
+                               void* buffer, size_t buffer_size,
+                               size_t* actual, size_t* avail);
+
+// Time.
+zx_time_t zx_clock_get_monotonic(void);
+zx_time_t zx_deadline_after(zx_duration_t nanoseconds);
+zx_status_t zx_nanosleep(zx_time_t deadline);
+zx_ticks_t zx_ticks_get(void);
+zx_ticks_t zx_ticks_per_second(void);
+
+__END_CDECLS
@@ -0,0 +1,121 @@
+#pragma once
+
+// Host stand-in for the subset of <zircon/types.h> used by the samples.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zircon/compiler.h>
+#include <zircon/errors.h>
+
+typedef int32_t zx_status_t;
+typedef uint32_t zx_handle_t;
+typedef uint32_t zx_signals_t;
+typedef int64_t zx_time_t;
+typedef int64_t zx_duration_t;
+typedef int64_t zx_ticks_t;
+typedef uintptr_t zx_vaddr_t;
+typedef uint32_t zx_vm_option_t;
+
+#define ZX_HANDLE_INVALID ((zx_handle_t)0)
+
+#define ZX_TIME_INFINITE INT64_MAX
+
+#define ZX_NSEC(n) ((zx_duration_t)(1LL * (n)))
+#define ZX_USEC(n) ((zx_duration_t)(1000LL * (n)))
+#define ZX_MSEC(n) ((zx_duration_t)(1000000LL * (n)))
+#define ZX_SEC(n) ((zx_duration_t)(1000000000LL * (n)))
+
+// Signals.
+#define ZX_SIGNAL_NONE ((zx_signals_t)0u)
+
+#define __ZX_OBJECT_READABLE ((zx_signals_t)1u << 0)
+#define __ZX_OBJECT_WRITABLE ((zx_signals_t)1u << 1)
+#define __ZX_OBJECT_PEER_CLOSED ((zx_signals_t)1u << 2)
+
+#define ZX_CHANNEL_READABLE __ZX_OBJECT_READABLE
+#define ZX_CHANNEL_WRITABLE __ZX_OBJECT_WRITABLE
+#define ZX_CHANNEL_PEER_CLOSED __ZX_OBJECT_PEER_CLOSED
+
+#define ZX_FIFO_READABLE __ZX_OBJECT_READABLE
+#define ZX_FIFO_WRITABLE __ZX_OBJECT_WRITABLE
+#define ZX_FIFO_PEER_CLOSED __ZX_OBJECT_PEER_CLOSED
+
+// Ports.
+#define ZX_WAIT_ASYNC_ONCE ((uint32_t)0u)
+
+#define ZX_PKT_TYPE_USER ((uint8_t)0x00u)
+#define ZX_PKT_TYPE_SIGNAL_ONE ((uint8_t)0x01u)
+
+typedef struct zx_packet_user {
+    uint64_t u64[4];
+} zx_packet_user_t;
+
+typedef struct zx_packet_signal {
+    zx_signals_t trigger;
+    zx_signals_t observed;
+    uint64_t count;
+    uint64_t reserved0;
+    uint64_t reserved1;
+} zx_packet_signal_t;
+
+typedef struct zx_port_packet {
+    uint64_t key;
+    uint32_t type;
+    zx_status_t status;
+    union {
+        zx_packet_user_t user;
+        zx_packet_signal_t signal;
+    };
+} zx_port_packet_t;
+
+// Object info.
+typedef uint32_t zx_object_info_topic_t;
+
+#define ZX_INFO_TASK_STATS ((zx_object_info_topic_t)12u)
+
+typedef struct zx_info_task_stats {
+    size_t mem_mapped_bytes;
+    size_t mem_private_bytes;
+    size_t mem_shared_bytes;
+    size_t mem_scaled_shared_bytes;
+} zx_info_task_stats_t;
+
+// Mapping options.
+#define ZX_VM_PERM_READ ((zx_vm_option_t)1u << 0)
+#define ZX_VM_PERM_WRITE ((zx_vm_option_t)1u << 1)
+
+// Channel limits.
+#define ZX_CHANNEL_MAX_MSG_BYTES ((uint32_t)65536u)
+#define ZX_CHANNEL_MAX_MSG_HANDLES ((uint32_t)64u)
+#define ZX_CHANNEL_MAX_MSG_IOVEC ((uint32_t)8192u)
+
+// Channel write options.
+#define ZX_CHANNEL_WRITE_USE_IOVEC ((uint32_t)1u << 1)
+
+// With ZX_CHANNEL_WRITE_USE_IOVEC, zx_channel_write's |bytes| is an array of
+// these and |num_bytes| is its length. The fragments are concatenated.
+typedef struct zx_channel_iovec {
+    const void* buffer;
+    uint32_t capacity;
+    uint32_t reserved;
+} zx_channel_iovec_t;
+
+// zx_channel_call writes a message whose first four bytes are a transaction
+// id, which it replaces with one of its own, and returns the reply that
+// carries the same id.
+typedef uint32_t zx_txid_t;
+
+typedef struct zx_channel_call_args {
+    const void* wr_bytes;
+    const zx_handle_t* wr_handles;
+    void* rd_bytes;
+    zx_handle_t* rd_handles;
+    uint32_t wr_num_bytes;
+    uint32_t wr_num_handles;
+    uint32_t rd_num_bytes;
+    uint32_t rd_num_handles;
+} zx_channel_call_args_t;
+
+// Fifo limits.
+#define ZX_FIFO_MAX_SIZE_BYTES ((size_t)4096u)
@@ -0,0 +1,166 @@
+#pragma once
+
+// Internal object model for the host backend.
+//
+// Every Zircon object is represented by an Object that owns one or more file
+// descriptors. Handles are process-local indices into a table of Objects.
+// Objects are transferred to other processes (over channels or at spawn time)
+// by sending their file descriptors together with a one byte wire tag that
+// tells the receiver how to rebuild the Object around them.
+//
+// Objects are reference counted. The handle table holds one reference per
+// handle and every lookup takes another for as long as the syscall needs the
+// object, so closing a handle on one thread never frees an object another
+// thread is still using.
+
+#include <poll.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <utility>
+
+#include <zircon/types.h>
+
+namespace zxhost {
+
+// Largest number of file descriptors a single object exports.
+constexpr size_t kMaxObjectFds = 2;
+
+enum WireTag : uint8_t {
+    kTagNone = 0, // Not transferable.
+    kTagChannel = 1,
+    kTagFifo0 = 2, // Fifo endpoint 0.
+    kTagFifo1 = 3, // Fifo endpoint 1.
+    kTagVmo = 4,
+};
+
+class Object {
+public:
+    virtual ~Object() = default;
+
+    // A new object starts with one reference, owned by whoever created it.
+    void AddRef() { refs_.fetch_add(1, std::memory_order_relaxed); }
+    void Release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    // Called when the last handle to this object is closed (but not when the
+    // object is transferred to another process).
+    virtual void on_close() {}
+
+    // Fills |fds| with the descriptors needed to recreate this object and
+    // returns the wire tag that describes them, or returns kTagNone if the
+    // object can't leave this process.
+    virtual WireTag export_fds(int* fds, size_t* num_fds) const = 0;
+
+    // Descriptor that becomes ready when this object's signals may have
+    // changed, and the poll events to arm for |signals|.
+    virtual int wait_fd() const = 0;
+    virtual short poll_events(zx_signals_t signals) const = 0;
+
+    // If the current signal state can be computed without a syscall, stores
+    // it in |out| and returns true.
+    virtual bool quick_signals(zx_signals_t* out) {
+        (void)out;
+        return false;
+    }
+
+    // Converts the result of polling wait_fd() into the set of asserted
+    // signals. May consume wakeup notifications.
+    virtual zx_signals_t observed_signals(short revents) = 0;
+
+private:
+    std::atomic<uint32_t> refs_{1};
+};
+
+// A counted reference to an object; releases it when it goes away.
+template <typename T>
+class Ref {
+public:
+    Ref() = default;
+    // Adopts a reference the caller already holds.
+    explicit Ref(T* object) : object_(object) {}
+    ~Ref() { reset(); }
+
+    Ref(Ref&& other) : object_(std::exchange(other.object_, nullptr)) {}
+    Ref& operator=(Ref&& other) {
+        if (this != &other) {
+            reset();
+            object_ = std::exchange(other.object_, nullptr);
+        }
+        return *this;
+    }
+
+    Ref(const Ref&) = delete;
+    Ref& operator=(const Ref&) = delete;
+
+    T* get() const { return object_; }
+    T* operator->() const { return object_; }
+    explicit operator bool() const { return object_ != nullptr; }
+
+    void reset() {
+        if (object_ != nullptr) {
+            std::exchange(object_, nullptr)->Release();
+        }
+    }
+
+    // Hands the reference over to the caller.
+    T* take() { return std::exchange(object_, nullptr); }
+
+private:
+    T* object_ = nullptr;
+};
+
+// Constructors used when importing objects. They take ownership of the
+// descriptors they are given, on success and on failure.
+Object* make_channel(int fd);
+zx_status_t make_fifo(int side, int sock_fd, int mem_fd, Object** out);
+Object* make_vmo(int fd);
+
+// Rebuilds an object received from another process. Takes ownership of |fds|
+// on success and on failure.
+zx_status_t import_object(WireTag tag, const int* fds, size_t num_fds,
+                          Object** out);
+
+// Number of descriptors an object with |tag| exports, or 0 if |tag| is not a
+// valid wire tag.
+size_t fds_for_tag(uint8_t tag);
+
+// Handle table. handle_alloc takes over the reference the caller holds on
+// |object|.
+zx_handle_t handle_alloc(Object* object);
+Ref<Object> handle_get(zx_handle_t handle);
+// Removes |handle| from the table, cancels any async waits armed on it, and
+// returns the table's reference to the object without closing it.
+Ref<Object> handle_take(zx_handle_t handle);
+
+template <typename T>
+zx_status_t handle_get_typed(zx_handle_t handle, Ref<T>* out) {
+    Ref<Object> object = handle_get(handle);
+    if (!object) {
+        return ZX_ERR_BAD_HANDLE;
+    }
+    T* typed = dynamic_cast<T*>(object.get());
+    if (typed == nullptr) {
+        return ZX_ERR_WRONG_TYPE;
+    }
+    object.take();
+    *out = Ref<T>(typed);
+    return ZX_OK;
+}
+
+// Drops every async wait armed on |handle|, whose object is |object|, from
+// every port. Called when the handle leaves the table.
+void cancel_waits(zx_handle_t handle, Object* object);
+
+// Maps errno to the closest zx_status_t.
+zx_status_t status_from_errno(int error);
+
+// Converts an absolute monotonic deadline into a relative timeout. Returns
+// false if the deadline has already passed.
+bool timeout_from_deadline(zx_time_t deadline, struct timespec* out);
+
+} // namespace zxhost
@@ -0,0 +1,355 @@
+// Ports on the host backend.
+//
+// A port is an epoll instance. zx_object_wait_async arms the object's wait_fd
+// with EPOLLONESHOT, which gives the same "deliver one packet, then disarm"
+// behaviour as ZX_WAIT_ASYNC_ONCE. Packets that are ready without a kernel
+// wakeup (user packets, and waits that are already satisfied when they are
+// armed) go through a queue guarded by a mutex, with an eventfd registered in
+// the epoll set to wake up waiters.
+//
+// Each registration gets an id that is never reused, and that id is what
+// epoll hands back. Closing a handle drops its registrations from every port,
+// so an event that was already on its way for it finds no registration and is
+// dropped, and a descriptor number that gets reused starts afresh.
+//
+// Any number of threads may wait on a port at once.
+
+#include "object.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <zircon/syscalls.h>
+
+namespace zxhost {
+namespace {
+
+// An armed (or previously armed) async wait.
+struct registration {
+    zx_handle_t handle;
+    int fd;
+    uint64_t key;
+    zx_signals_t signals;
+};
+
+// The epoll data of the queue's eventfd; registration ids start above it.
+constexpr uint64_t kQueueId = 0;
+
+class Port;
+
+// Every live port, so that closing a handle can find its registrations.
+std::mutex g_ports_lock;
+std::vector<Port*> g_ports;
+
+class Port final : public Object {
+public:
+    Port(int epoll_fd, int event_fd)
+        : epoll_fd_(epoll_fd), event_fd_(event_fd) {}
+
+    ~Port() override {
+        {
+            // A port whose init failed was never listed.
+            std::lock_guard<std::mutex> guard(g_ports_lock);
+            auto it = std::find(g_ports.begin(), g_ports.end(), this);
+            if (it != g_ports.end()) {
+                g_ports.erase(it);
+            }
+        }
+        close(event_fd_);
+        close(epoll_fd_);
+    }
+
+    WireTag export_fds(int*, size_t* num_fds) const override {
+        *num_fds = 0;
+        return kTagNone;
+    }
+
+    int wait_fd() const override { return epoll_fd_; }
+
+    short poll_events(zx_signals_t) const override { return POLLIN; }
+
+    zx_signals_t observed_signals(short revents) override {
+        return (revents & POLLIN) ? __ZX_OBJECT_READABLE : 0;
+    }
+
+    zx_status_t init() {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = kQueueId;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &event) < 0) {
+            return status_from_errno(errno);
+        }
+        std::lock_guard<std::mutex> guard(g_ports_lock);
+        g_ports.push_back(this);
+        return ZX_OK;
+    }
+
+    void queue(const zx_port_packet_t& packet) {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            queue_.push_back(packet);
+        }
+        uint64_t one = 1;
+        ssize_t r = write(event_fd_, &one, sizeof(one));
+        (void)r;
+    }
+
+    zx_status_t wait_async(zx_handle_t handle, Object* object, uint64_t key,
+                           zx_signals_t signals);
+    zx_status_t wait(zx_time_t deadline, zx_port_packet_t* packet);
+
+    // Drops the wait armed on |fd| if it was armed through |handle|.
+    void cancel(zx_handle_t handle, int fd);
+
+private:
+    bool pop(zx_port_packet_t* packet) {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (queue_.empty()) {
+            return false;
+        }
+        *packet = queue_.front();
+        queue_.pop_front();
+        return true;
+    }
+
+    // Called with |lock_| held.
+    zx_status_t arm(int fd, uint64_t id, short events, bool is_new);
+
+    const int epoll_fd_;
+    const int event_fd_;
+
+    std::mutex lock_;
+    std::deque<zx_port_packet_t> queue_;
+    // Registrations by id, and the id armed on each descriptor, since epoll
+    // allows one registration per descriptor.
+    std::unordered_map<uint64_t, registration> registrations_;
+    std::unordered_map<int, uint64_t> ids_;
+    uint64_t next_id_ = kQueueId + 1;
+};
+
+zx_status_t Port::arm(int fd, uint64_t id, short events, bool is_new) {
+    struct epoll_event event = {};
+    event.events = static_cast<uint32_t>(events) | EPOLLONESHOT;
+    event.data.u64 = id;
+    if (!is_new && epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) == 0) {
+        return ZX_OK;
+    }
+    // A descriptor that was closed and reused falls out of the epoll set, so
+    // a failed MOD turns into an ADD.
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+        return status_from_errno(errno);
+    }
+    return ZX_OK;
+}
+
+zx_status_t Port::wait_async(zx_handle_t handle, Object* object, uint64_t key,
+                             zx_signals_t signals) {
+    zx_signals_t current;
+    if (object->quick_signals(&current) && (current & signals)) {
+        zx_port_packet_t packet = {};
+        packet.key = key;
+        packet.type = ZX_PKT_TYPE_SIGNAL_ONE;
+        packet.status = ZX_OK;
+        packet.signal.trigger = signals;
+        packet.signal.observed = current;
+        packet.signal.count = 1;
+        queue(packet);
+        return ZX_OK;
+    }
+
+    int fd = object->wait_fd();
+    std::lock_guard<std::mutex> guard(lock_);
+    uint64_t id;
+    auto it = ids_.find(fd);
+    bool is_new = it == ids_.end();
+    if (is_new) {
+        id = next_id_++;
+        ids_[fd] = id;
+    } else {
+        id = it->second;
+    }
+    registrations_[id] = {handle, fd, key, signals};
+    zx_status_t st = arm(fd, id, object->poll_events(signals), is_new);
+    if (st != ZX_OK) {
+        ids_.erase(fd);
+        registrations_.erase(id);
+    }
+    return st;
+}
+
+void Port::cancel(zx_handle_t handle, int fd) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = ids_.find(fd);
+    if (it == ids_.end()) {
+        return;
+    }
+    auto reg = registrations_.find(it->second);
+    if (reg->second.handle != handle) {
+        return;
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    registrations_.erase(reg);
+    ids_.erase(it);
+}
+
+zx_status_t Port::wait(zx_time_t deadline, zx_port_packet_t* packet) {
+    while (true) {
+        if (pop(packet)) {
+            return ZX_OK;
+        }
+
+        struct timespec timeout;
+        struct timespec* timeout_ptr = nullptr;
+        if (deadline != ZX_TIME_INFINITE) {
+            if (!timeout_from_deadline(deadline, &timeout)) {
+                timeout = {0, 0};
+            }
+            timeout_ptr = &timeout;
+        }
+
+        struct epoll_event event;
+        int r = epoll_pwait2(epoll_fd_, &event, 1, timeout_ptr, nullptr);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return status_from_errno(errno);
+        }
+        if (r == 0) {
+            return pop(packet) ? ZX_OK : ZX_ERR_TIMED_OUT;
+        }
+
+        uint64_t id = event.data.u64;
+        if (id == kQueueId) {
+            uint64_t count;
+            ssize_t n = read(event_fd_, &count, sizeof(count));
+            (void)n;
+            continue;
+        }
+
+        registration reg;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            auto it = registrations_.find(id);
+            if (it == registrations_.end()) {
+                // The handle was closed while the wait was armed; Zircon
+                // cancels the wait in that case.
+                continue;
+            }
+            reg = it->second;
+        }
+        Ref<Object> object = handle_get(reg.handle);
+        if (!object) {
+            // Closed since, and about to be cancelled.
+            continue;
+        }
+        zx_signals_t observed =
+            object->observed_signals(static_cast<short>(event.events));
+        if (!(observed & reg.signals)) {
+            // Woken up for a signal nobody asked for (e.g. a fifo doorbell
+            // for the other direction); re-arm and keep waiting, unless the
+            // wait was cancelled or re-armed in the meantime.
+            std::lock_guard<std::mutex> guard(lock_);
+            auto it = ids_.find(reg.fd);
+            if (it != ids_.end() && it->second == id) {
+                arm(reg.fd, id, object->poll_events(reg.signals), false);
+            }
+            continue;
+        }
+
+        *packet = {};
+        packet->key = reg.key;
+        packet->type = ZX_PKT_TYPE_SIGNAL_ONE;
+        packet->status = ZX_OK;
+        packet->signal.trigger = reg.signals;
+        packet->signal.observed = observed;
+        packet->signal.count = 1;
+        return ZX_OK;
+    }
+}
+
+} // namespace
+
+void cancel_waits(zx_handle_t handle, Object* object) {
+    int fd = object->wait_fd();
+    std::lock_guard<std::mutex> guard(g_ports_lock);
+    for (Port* port : g_ports) {
+        port->cancel(handle, fd);
+    }
+}
+
+} // namespace zxhost
+
+using zxhost::Port;
+
+zx_status_t zx_port_create(uint32_t options, zx_handle_t* out) {
+    if (options != 0) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        return zxhost::status_from_errno(errno);
+    }
+    int event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (event_fd < 0) {
+        close(epoll_fd);
+        return zxhost::status_from_errno(errno);
+    }
+    Port* port = new Port(epoll_fd, event_fd);
+    zx_status_t st = port->init();
+    if (st != ZX_OK) {
+        delete port;
+        return st;
+    }
+    *out = zxhost::handle_alloc(port);
+    return ZX_OK;
+}
+
+zx_status_t zx_port_queue(zx_handle_t handle, const zx_port_packet_t* packet) {
+    zxhost::Ref<Port> port;
+    zx_status_t st = zxhost::handle_get_typed(handle, &port);
+    if (st != ZX_OK) {
+        return st;
+    }
+    if (packet->type != ZX_PKT_TYPE_USER) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    port->queue(*packet);
+    return ZX_OK;
+}
+
+zx_status_t zx_port_wait(zx_handle_t handle, zx_time_t deadline,
+                         zx_port_packet_t* packet) {
+    zxhost::Ref<Port> port;
+    zx_status_t st = zxhost::handle_get_typed(handle, &port);
+    if (st != ZX_OK) {
+        return st;
+    }
+    return port->wait(deadline, packet);
+}
+
+zx_status_t zx_object_wait_async(zx_handle_t handle, zx_handle_t port_handle,
+                                 uint64_t key, zx_signals_t signals,
+                                 uint32_t options) {
+    if (options != ZX_WAIT_ASYNC_ONCE) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+    zxhost::Ref<Port> port;
+    zx_status_t st = zxhost::handle_get_typed(port_handle, &port);
+    if (st != ZX_OK) {
+        return st;
+    }
+    zxhost::Ref<zxhost::Object> object = zxhost::handle_get(handle);
+    if (!object) {
+        return ZX_ERR_BAD_HANDLE;
+    }
+    return port->wait_async(handle, object.get(), key, signals);
+}
@@ -0,0 +1,89 @@
+// The process object on the host backend.
+
+#include "object.h"
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <zircon/process.h>
+#include <zircon/syscalls.h>
+
+namespace zxhost {
+namespace {
+
+class Process final : public Object {
+public:
+    WireTag export_fds(int*, size_t* num_fds) const override {
+        *num_fds = 0;
+        return kTagNone;
+    }
+
+    int wait_fd() const override { return -1; }
+    short poll_events(zx_signals_t) const override { return 0; }
+    zx_signals_t observed_signals(short) override { return 0; }
+
+    zx_status_t get_task_stats(zx_info_task_stats_t* stats) {
+        FILE* statm = fopen("/proc/self/statm", "r");
+        if (statm == nullptr) {
+            return ZX_ERR_IO;
+        }
+        unsigned long size, resident, shared;
+        int n = fscanf(statm, "%lu %lu %lu", &size, &resident, &shared);
+        fclose(statm);
+        if (n != 3) {
+            return ZX_ERR_IO;
+        }
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        stats->mem_mapped_bytes = size * page;
+        stats->mem_private_bytes = (resident - shared) * page;
+        stats->mem_shared_bytes = shared * page;
+        stats->mem_scaled_shared_bytes = shared * page;
+        return ZX_OK;
+    }
+};
+
+// Zircon processes can hold far more handles than the default soft limit on
+// descriptors allows, and every host handle is at least one descriptor.
+__attribute__((constructor)) void raise_descriptor_limit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+} // namespace
+} // namespace zxhost
+
+zx_handle_t zx_process_self(void) {
+    static zx_handle_t self = zxhost::handle_alloc(new zxhost::Process());
+    return self;
+}
+
+zx_status_t zx_object_get_info(zx_handle_t handle, uint32_t topic,
+                               void* buffer, size_t buffer_size,
+                               size_t* actual, size_t* avail) {
+    zxhost::Ref<zxhost::Process> process;
+    zx_status_t st = zxhost::handle_get_typed(handle, &process);
+    if (st != ZX_OK) {
+        return st;
+    }
+    if (topic != ZX_INFO_TASK_STATS) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+    if (buffer_size < sizeof(zx_info_task_stats_t)) {
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    }
+    st = process->get_task_stats(static_cast<zx_info_task_stats_t*>(buffer));
+    if (st != ZX_OK) {
+        return st;
+    }
+    if (actual) {
+        *actual = 1;
+    }
+    if (avail) {
+        *avail = 1;
+    }
+    return ZX_OK;
+}
@@ -0,0 +1,234 @@
+// Process creation and startup handles on the host backend.
+//
+// fdio_spawn_etc is built on posix_spawn. The descriptors behind each
+// FDIO_SPAWN_ACTION_ADD_HANDLE handle are inherited by the child, and their
+// ids and wire tags are passed in the ZX_HOST_STARTUP_HANDLES environment
+// variable as a comma separated list of "id:tag:fd[.fd]" entries. The child's
+// zx_take_startup_handle rebuilds the objects from that list.
+
+#include "object.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <lib/fdio/spawn.h>
+#include <zircon/process.h>
+#include <zircon/syscalls.h>
+
+extern char** environ;
+
+namespace {
+
+constexpr char kStartupHandlesEnv[] = "ZX_HOST_STARTUP_HANDLES";
+
+struct startup_handle {
+    uint32_t id;
+    uint8_t tag;
+    int fds[zxhost::kMaxObjectFds];
+    size_t num_fds;
+    bool taken;
+};
+
+std::once_flag g_startup_once;
+std::mutex g_startup_lock;
+std::vector<startup_handle> g_startup_handles;
+
+void parse_startup_handles() {
+    const char* value = getenv(kStartupHandlesEnv);
+    if (value == nullptr) {
+        return;
+    }
+
+    const char* p = value;
+    while (*p != '\0') {
+        startup_handle entry = {};
+        char* end;
+        entry.id = static_cast<uint32_t>(strtoul(p, &end, 0));
+        if (*end != ':') {
+            break;
+        }
+        entry.tag = static_cast<uint8_t>(strtoul(end + 1, &end, 0));
+        if (*end != ':') {
+            break;
+        }
+        p = end + 1;
+        while (entry.num_fds < zxhost::kMaxObjectFds) {
+            entry.fds[entry.num_fds++] = static_cast<int>(strtol(p, &end, 10));
+            p = end;
+            if (*p != '.') {
+                break;
+            }
+            p++;
+        }
+        g_startup_handles.push_back(entry);
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+
+    // Our own children get a fresh list from fdio_spawn_etc.
+    unsetenv(kStartupHandlesEnv);
+}
+
+void set_error(char* err_msg_out, const char* fmt, const char* detail) {
+    if (err_msg_out != nullptr) {
+        snprintf(err_msg_out, FDIO_SPAWN_ERR_MSG_MAX_LENGTH, fmt, detail);
+    }
+}
+
+} // namespace
+
+zx_handle_t zx_take_startup_handle(uint32_t hnd_info) {
+    std::call_once(g_startup_once, parse_startup_handles);
+
+    std::lock_guard<std::mutex> guard(g_startup_lock);
+    for (startup_handle& entry : g_startup_handles) {
+        if (entry.id != hnd_info || entry.taken) {
+            continue;
+        }
+        entry.taken = true;
+        for (size_t i = 0; i < entry.num_fds; i++) {
+            fcntl(entry.fds[i], F_SETFD, FD_CLOEXEC);
+        }
+        zxhost::Object* object;
+        if (zxhost::import_object(static_cast<zxhost::WireTag>(entry.tag),
+                                  entry.fds, entry.num_fds, &object) != ZX_OK) {
+            return ZX_HANDLE_INVALID;
+        }
+        return zxhost::handle_alloc(object);
+    }
+    return ZX_HANDLE_INVALID;
+}
+
+zx_status_t fdio_spawn_etc(zx_handle_t job, uint32_t flags, const char* path,
+                           const char* const* argv, const char* const* env,
+                           size_t action_count,
+                           const fdio_spawn_action_t* actions,
+                           zx_handle_t* process_out, char* err_msg_out) {
+    (void)job;
+
+    if (process_out != nullptr) {
+        *process_out = ZX_HANDLE_INVALID;
+    }
+
+    // Handles passed to fdio_spawn_etc are consumed whether or not the spawn
+    // succeeds.
+    auto consume_handles = [actions, action_count](bool transferred) {
+        for (size_t i = 0; i < action_count; i++) {
+            if (actions[i].action != FDIO_SPAWN_ACTION_ADD_HANDLE) {
+                continue;
+            }
+            if (transferred) {
+                zxhost::handle_take(actions[i].h.handle);
+            } else {
+                zx_handle_close(actions[i].h.handle);
+            }
+        }
+    };
+
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+
+    std::string handles_env = std::string(kStartupHandlesEnv) + "=";
+    bool first = true;
+    for (size_t i = 0; i < action_count; i++) {
+        const fdio_spawn_action_t& action = actions[i];
+        switch (action.action) {
+        case FDIO_SPAWN_ACTION_ADD_HANDLE: {
+            zxhost::Ref<zxhost::Object> object =
+                zxhost::handle_get(action.h.handle);
+            if (!object) {
+                posix_spawn_file_actions_destroy(&file_actions);
+                consume_handles(false);
+                set_error(err_msg_out, "invalid handle in action%s", "");
+                return ZX_ERR_BAD_HANDLE;
+            }
+            int fds[zxhost::kMaxObjectFds];
+            size_t num_fds;
+            zxhost::WireTag tag = object->export_fds(fds, &num_fds);
+            if (tag == zxhost::kTagNone) {
+                posix_spawn_file_actions_destroy(&file_actions);
+                consume_handles(false);
+                set_error(err_msg_out, "handle can't be transferred%s", "");
+                return ZX_ERR_ACCESS_DENIED;
+            }
+
+            char entry[64];
+            snprintf(entry, sizeof(entry), "%s%u:%u:", first ? "" : ",",
+                     action.h.id, tag);
+            handles_env += entry;
+            for (size_t j = 0; j < num_fds; j++) {
+                // dup2 onto the same descriptor clears FD_CLOEXEC in the
+                // child only.
+                posix_spawn_file_actions_adddup2(&file_actions, fds[j], fds[j]);
+                snprintf(entry, sizeof(entry), "%s%d", j ? "." : "", fds[j]);
+                handles_env += entry;
+            }
+            first = false;
+            break;
+        }
+        case FDIO_SPAWN_ACTION_CLONE_FD:
+            posix_spawn_file_actions_adddup2(&file_actions, action.fd.local_fd,
+                                             action.fd.target_fd);
+            break;
+        case FDIO_SPAWN_ACTION_TRANSFER_FD:
+            posix_spawn_file_actions_adddup2(&file_actions, action.fd.local_fd,
+                                             action.fd.target_fd);
+            break;
+        case FDIO_SPAWN_ACTION_SET_NAME:
+            // The host has no separate process name; argv[0] serves instead.
+            break;
+        default:
+            posix_spawn_file_actions_destroy(&file_actions);
+            consume_handles(false);
+            set_error(err_msg_out, "unsupported spawn action%s", "");
+            return ZX_ERR_NOT_SUPPORTED;
+        }
+    }
+
+    // Build the child's environment, replacing any inherited handle list.
+    std::vector<char*> envp;
+    const char* const* source = env;
+    if (source == nullptr && (flags & FDIO_SPAWN_CLONE_ENVIRON)) {
+        source = environ;
+    }
+    size_t prefix_len = strlen(kStartupHandlesEnv);
+    for (size_t i = 0; source != nullptr && source[i] != nullptr; i++) {
+        if (strncmp(source[i], kStartupHandlesEnv, prefix_len) == 0 &&
+            source[i][prefix_len] == '=') {
+            continue;
+        }
+        envp.push_back(const_cast<char*>(source[i]));
+    }
+    envp.push_back(const_cast<char*>(handles_env.c_str()));
+    envp.push_back(nullptr);
+
+    pid_t pid;
+    int error = posix_spawn(&pid, path, &file_actions, nullptr,
+                            const_cast<char* const*>(argv), envp.data());
+    posix_spawn_file_actions_destroy(&file_actions);
+
+    if (error != 0) {
+        consume_handles(false);
+        set_error(err_msg_out, "posix_spawn failed: %s", strerror(error));
+        return zxhost::status_from_errno(error);
+    }
+
+    for (size_t i = 0; i < action_count; i++) {
+        if (actions[i].action == FDIO_SPAWN_ACTION_TRANSFER_FD) {
+            close(actions[i].fd.local_fd);
+        }
+    }
+    consume_handles(true);
+    return ZX_OK;
+}
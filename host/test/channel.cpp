@@ -0,0 +1,140 @@
+// Channel reads and writes on the host backend.
+
+#include <string.h>
+
+#include <unittest/unittest.h>
+#include <zircon/syscalls.h>
+
+static bool read_write() {
+    BEGIN_TEST;
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_channel_create(0, &a, &b), ZX_OK);
+
+    uint32_t actual_bytes;
+    uint32_t actual_handles;
+    char buffer[16];
+    EXPECT_EQ(zx_channel_read(a, 0, buffer, nullptr, sizeof(buffer), 0,
+                              &actual_bytes, &actual_handles),
+              ZX_ERR_SHOULD_WAIT, "nothing to read yet");
+
+    EXPECT_EQ(zx_channel_write(b, 0, "hello", 5, nullptr, 0), ZX_OK);
+    EXPECT_EQ(zx_channel_write(b, 0, "world!", 6, nullptr, 0), ZX_OK);
+    ASSERT_EQ(zx_channel_read(a, 0, buffer, nullptr, sizeof(buffer), 0,
+                              &actual_bytes, &actual_handles),
+              ZX_OK);
+    EXPECT_EQ(actual_bytes, 5u);
+    EXPECT_EQ(actual_handles, 0u);
+    EXPECT_EQ(memcmp(buffer, "hello", 5), 0, "messages keep their order");
+    ASSERT_EQ(zx_channel_read(a, 0, buffer, nullptr, sizeof(buffer), 0,
+                              &actual_bytes, &actual_handles),
+              ZX_OK);
+    EXPECT_EQ(actual_bytes, 6u);
+    EXPECT_EQ(memcmp(buffer, "world!", 6), 0);
+
+    EXPECT_EQ(zx_handle_close(a), ZX_OK);
+    EXPECT_EQ(zx_handle_close(b), ZX_OK);
+    END_TEST;
+}
+
+static bool buffer_too_small_retry() {
+    BEGIN_TEST;
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_channel_create(0, &a, &b), ZX_OK);
+    zx_handle_t c, d;
+    ASSERT_EQ(zx_channel_create(0, &c, &d), ZX_OK);
+
+    char payload[100];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = static_cast<char>(i);
+    }
+    ASSERT_EQ(zx_channel_write(b, 0, payload, sizeof(payload), &d, 1), ZX_OK);
+    ASSERT_EQ(zx_channel_write(b, 0, "next", 4, nullptr, 0), ZX_OK);
+
+    // Too few bytes, then too few handles: both leave the message queued
+    // and report what it needs.
+    char small[10];
+    uint32_t actual_bytes = 0;
+    uint32_t actual_handles = 0;
+    zx_handle_t handle = ZX_HANDLE_INVALID;
+    EXPECT_EQ(zx_channel_read(a, 0, small, &handle, sizeof(small), 1,
+                              &actual_bytes, &actual_handles),
+              ZX_ERR_BUFFER_TOO_SMALL);
+    EXPECT_EQ(actual_bytes, sizeof(payload));
+    EXPECT_EQ(actual_handles, 1u);
+
+    char buffer[128];
+    EXPECT_EQ(zx_channel_read(a, 0, buffer, nullptr, sizeof(buffer), 0,
+                              &actual_bytes, &actual_handles),
+              ZX_ERR_BUFFER_TOO_SMALL);
+    EXPECT_EQ(actual_handles, 1u);
+
+    ASSERT_EQ(zx_channel_read(a, 0, buffer, &handle, sizeof(buffer), 1,
+                              &actual_bytes, &actual_handles),
+              ZX_OK, "the retry gets the same message");
+    EXPECT_EQ(actual_bytes, sizeof(payload));
+    EXPECT_EQ(memcmp(buffer, payload, sizeof(payload)), 0);
+    ASSERT_EQ(actual_handles, 1u);
+
+    // The handle that came across works.
+    EXPECT_EQ(zx_channel_write(c, 0, "x", 1, nullptr, 0), ZX_OK);
+    EXPECT_EQ(zx_channel_read(handle, 0, buffer, nullptr, sizeof(buffer), 0,
+                              &actual_bytes, nullptr),
+              ZX_OK);
+
+    ASSERT_EQ(zx_channel_read(a, 0, buffer, nullptr, sizeof(buffer), 0,
+                              &actual_bytes, nullptr),
+              ZX_OK);
+    EXPECT_EQ(actual_bytes, 4u);
+    EXPECT_EQ(memcmp(buffer, "next", 4), 0);
+
+    zx_handle_close(handle);
+    zx_handle_close(c);
+    zx_handle_close(a);
+    zx_handle_close(b);
+    END_TEST;
+}
+
+static bool sent_handles_leave_the_table() {
+    BEGIN_TEST;
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_channel_create(0, &a, &b), ZX_OK);
+    zx_handle_t c, d;
+    ASSERT_EQ(zx_channel_create(0, &c, &d), ZX_OK);
+
+    EXPECT_EQ(zx_channel_write(a, 0, nullptr, 0, &a, 1), ZX_ERR_NOT_SUPPORTED,
+              "a channel can't carry its own handle");
+    ASSERT_EQ(zx_channel_write(a, 0, nullptr, 0, &c, 1), ZX_OK);
+    EXPECT_EQ(zx_handle_close(c), ZX_ERR_BAD_HANDLE, "c went with the message");
+
+    zx_handle_close(a);
+    zx_handle_close(b);
+    zx_handle_close(d);
+    END_TEST;
+}
+
+static bool peer_closed_after_drain() {
+    BEGIN_TEST;
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_channel_create(0, &a, &b), ZX_OK);
+    ASSERT_EQ(zx_channel_write(b, 0, "last", 4, nullptr, 0), ZX_OK);
+    ASSERT_EQ(zx_handle_close(b), ZX_OK);
+
+    EXPECT_EQ(zx_channel_write(a, 0, "x", 1, nullptr, 0), ZX_ERR_PEER_CLOSED);
+    char buffer[8];
+    uint32_t actual_bytes;
+    EXPECT_EQ(zx_channel_read(a, 0, buffer, nullptr, sizeof(buffer), 0,
+                              &actual_bytes, nullptr),
+              ZX_OK, "what was sent before the close is still there");
+    EXPECT_EQ(zx_channel_read(a, 0, buffer, nullptr, sizeof(buffer), 0,
+                              &actual_bytes, nullptr),
+              ZX_ERR_PEER_CLOSED);
+    zx_handle_close(a);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(channel_tests)
+RUN_TEST(read_write)
+RUN_TEST(buffer_too_small_retry)
+RUN_TEST(sent_handles_leave_the_table)
+RUN_TEST(peer_closed_after_drain)
+END_TEST_CASE(channel_tests)
@@ -0,0 +1,97 @@
+// Fifos on the host backend.
+
+#include <string.h>
+
+#include <unittest/unittest.h>
+#include <zircon/syscalls.h>
+
+static bool full_and_empty() {
+    BEGIN_TEST;
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_fifo_create(4, sizeof(uint64_t), 0, &a, &b), ZX_OK);
+
+    uint64_t elements[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    size_t actual;
+    EXPECT_EQ(zx_fifo_read(b, sizeof(uint64_t), elements, 1, &actual),
+              ZX_ERR_SHOULD_WAIT);
+    ASSERT_EQ(zx_fifo_write(a, sizeof(uint64_t), elements, 8, &actual), ZX_OK);
+    EXPECT_EQ(actual, 4u, "a write stops at the fifo's depth");
+    EXPECT_EQ(zx_fifo_write(a, sizeof(uint64_t), elements, 1, &actual),
+              ZX_ERR_SHOULD_WAIT);
+    EXPECT_EQ(zx_fifo_write(a, 3, elements, 1, &actual), ZX_ERR_OUT_OF_RANGE,
+              "the element size is fixed");
+
+    uint64_t out[8];
+    ASSERT_EQ(zx_fifo_read(b, sizeof(uint64_t), out, 8, &actual), ZX_OK);
+    EXPECT_EQ(actual, 4u);
+    EXPECT_EQ(memcmp(out, elements, 4 * sizeof(uint64_t)), 0);
+
+    zx_handle_close(a);
+    zx_handle_close(b);
+    END_TEST;
+}
+
+// Writes and reads in chunks that don't divide the depth, so the ring wraps
+// at every offset.
+static bool wraparound() {
+    BEGIN_TEST;
+    constexpr size_t kDepth = 8;
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_fifo_create(kDepth, sizeof(uint64_t), 0, &a, &b), ZX_OK);
+
+    uint64_t next_write = 0;
+    uint64_t next_read = 0;
+    for (size_t round = 0; round < 1000; round++) {
+        uint64_t chunk[kDepth];
+        size_t count = 1 + round % 5;
+        for (size_t i = 0; i < count; i++) {
+            chunk[i] = next_write + i;
+        }
+        size_t actual;
+        zx_status_t st = zx_fifo_write(a, sizeof(uint64_t), chunk, count, &actual);
+        if (st == ZX_OK) {
+            next_write += actual;
+        } else {
+            ASSERT_EQ(st, ZX_ERR_SHOULD_WAIT);
+        }
+
+        size_t want = 1 + round % 3;
+        st = zx_fifo_read(b, sizeof(uint64_t), chunk, want, &actual);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            continue;
+        }
+        ASSERT_EQ(st, ZX_OK);
+        for (size_t i = 0; i < actual; i++) {
+            ASSERT_EQ(chunk[i], next_read + i, "elements come out in order");
+        }
+        next_read += actual;
+        ASSERT_TRUE(next_write - next_read <= kDepth);
+    }
+    EXPECT_TRUE(next_write > 10 * kDepth, "the ring went round many times");
+
+    zx_handle_close(a);
+    zx_handle_close(b);
+    END_TEST;
+}
+
+static bool peer_closed() {
+    BEGIN_TEST;
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_fifo_create(4, sizeof(uint32_t), 0, &a, &b), ZX_OK);
+    ASSERT_EQ(zx_handle_close(b), ZX_OK);
+    uint32_t element = 1;
+    size_t actual;
+    EXPECT_EQ(zx_fifo_write(a, sizeof(element), &element, 1, &actual),
+              ZX_ERR_PEER_CLOSED);
+    zx_signals_t observed;
+    EXPECT_EQ(zx_object_wait_one(a, ZX_FIFO_PEER_CLOSED, 0, &observed), ZX_OK);
+    EXPECT_TRUE(observed & ZX_FIFO_PEER_CLOSED);
+    zx_handle_close(a);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(fifo_tests)
+RUN_TEST(full_and_empty)
+RUN_TEST(wraparound)
+RUN_TEST(peer_closed)
+END_TEST_CASE(fifo_tests)
@@ -0,0 +1,67 @@
+// The handle table on the host backend.
+
+#include <atomic>
+#include <thread>
+
+#include <unittest/unittest.h>
+#include <zircon/syscalls.h>
+
+static bool close_twice() {
+    BEGIN_TEST;
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_channel_create(0, &a, &b), ZX_OK);
+    EXPECT_EQ(zx_handle_close(a), ZX_OK);
+    EXPECT_EQ(zx_handle_close(a), ZX_ERR_BAD_HANDLE);
+    EXPECT_EQ(zx_handle_close(ZX_HANDLE_INVALID), ZX_OK);
+    EXPECT_EQ(zx_handle_close(b), ZX_OK);
+    END_TEST;
+}
+
+// One thread keeps using a handle while another closes it and creates new
+// objects, which reuse its slot. Every call must either work on a live object
+// or fail with BAD_HANDLE or WRONG_TYPE; under ASan a use after free shows up
+// here.
+static bool close_races_use() {
+    BEGIN_TEST;
+    constexpr int kRounds = 2000;
+    std::atomic<zx_handle_t> shared{ZX_HANDLE_INVALID};
+    std::atomic<bool> done{false};
+    std::atomic<int> bad_status{0};
+
+    std::thread user([&] {
+        while (!done.load()) {
+            zx_handle_t handle = shared.load();
+            char byte = 0;
+            zx_status_t st = zx_channel_write(handle, 0, &byte, 1, nullptr, 0);
+            if (st != ZX_OK && st != ZX_ERR_BAD_HANDLE &&
+                st != ZX_ERR_WRONG_TYPE && st != ZX_ERR_SHOULD_WAIT &&
+                st != ZX_ERR_PEER_CLOSED) {
+                bad_status.store(st);
+            }
+            zx_signals_t observed;
+            zx_object_wait_one(handle, ZX_CHANNEL_WRITABLE, 0, &observed);
+        }
+    });
+
+    for (int i = 0; i < kRounds; i++) {
+        zx_handle_t a, b;
+        ASSERT_EQ(zx_channel_create(0, &a, &b), ZX_OK);
+        shared.store(a);
+        std::this_thread::yield();
+        EXPECT_EQ(zx_handle_close(a), ZX_OK);
+        EXPECT_EQ(zx_handle_close(b), ZX_OK);
+        // Something else in the freed slots.
+        zx_handle_t port;
+        ASSERT_EQ(zx_port_create(0, &port), ZX_OK);
+        EXPECT_EQ(zx_handle_close(port), ZX_OK);
+    }
+    done.store(true);
+    user.join();
+    EXPECT_EQ(bad_status.load(), 0);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(handle_tests)
+RUN_TEST(close_twice)
+RUN_TEST(close_races_use)
+END_TEST_CASE(handle_tests)
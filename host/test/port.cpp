@@ -0,0 +1,123 @@
+// Ports on the host backend.
+
+#include <unittest/unittest.h>
+#include <zircon/syscalls.h>
+
+static bool one_shot() {
+    BEGIN_TEST;
+    zx_handle_t port;
+    ASSERT_EQ(zx_port_create(0, &port), ZX_OK);
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_channel_create(0, &a, &b), ZX_OK);
+
+    ASSERT_EQ(zx_object_wait_async(a, port, 42, ZX_CHANNEL_READABLE,
+                                   ZX_WAIT_ASYNC_ONCE),
+              ZX_OK);
+    zx_port_packet_t packet;
+    EXPECT_EQ(zx_port_wait(port, zx_deadline_after(ZX_MSEC(10)), &packet),
+              ZX_ERR_TIMED_OUT, "nothing to read yet");
+
+    ASSERT_EQ(zx_channel_write(b, 0, "x", 1, nullptr, 0), ZX_OK);
+    ASSERT_EQ(zx_port_wait(port, ZX_TIME_INFINITE, &packet), ZX_OK);
+    EXPECT_EQ(packet.key, 42u);
+    EXPECT_EQ(packet.type, static_cast<uint32_t>(ZX_PKT_TYPE_SIGNAL_ONE));
+    EXPECT_TRUE(packet.signal.observed & ZX_CHANNEL_READABLE);
+
+    // Still readable, but the wait fired once and is disarmed.
+    EXPECT_EQ(zx_port_wait(port, zx_deadline_after(ZX_MSEC(10)), &packet),
+              ZX_ERR_TIMED_OUT, "a one-shot wait delivers one packet");
+
+    // Re-arming on a signal that is already up delivers straight away.
+    ASSERT_EQ(zx_object_wait_async(a, port, 43, ZX_CHANNEL_READABLE,
+                                   ZX_WAIT_ASYNC_ONCE),
+              ZX_OK);
+    ASSERT_EQ(zx_port_wait(port, zx_deadline_after(ZX_SEC(1)), &packet), ZX_OK);
+    EXPECT_EQ(packet.key, 43u);
+
+    zx_handle_close(a);
+    zx_handle_close(b);
+    zx_handle_close(port);
+    END_TEST;
+}
+
+static bool user_packets() {
+    BEGIN_TEST;
+    zx_handle_t port;
+    ASSERT_EQ(zx_port_create(0, &port), ZX_OK);
+    zx_port_packet_t packet = {};
+    packet.key = 7;
+    packet.type = ZX_PKT_TYPE_USER;
+    ASSERT_EQ(zx_port_queue(port, &packet), ZX_OK);
+    packet.key = 8;
+    ASSERT_EQ(zx_port_queue(port, &packet), ZX_OK);
+
+    ASSERT_EQ(zx_port_wait(port, 0, &packet), ZX_OK);
+    EXPECT_EQ(packet.key, 7u, "user packets come out in order");
+    ASSERT_EQ(zx_port_wait(port, 0, &packet), ZX_OK);
+    EXPECT_EQ(packet.key, 8u);
+    EXPECT_EQ(zx_port_wait(port, 0, &packet), ZX_ERR_TIMED_OUT);
+    zx_handle_close(port);
+    END_TEST;
+}
+
+static bool close_cancels_wait() {
+    BEGIN_TEST;
+    zx_handle_t port;
+    ASSERT_EQ(zx_port_create(0, &port), ZX_OK);
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_channel_create(0, &a, &b), ZX_OK);
+    ASSERT_EQ(zx_object_wait_async(a, port, 1, ZX_CHANNEL_READABLE,
+                                   ZX_WAIT_ASYNC_ONCE),
+              ZX_OK);
+    ASSERT_EQ(zx_handle_close(a), ZX_OK);
+    ASSERT_EQ(zx_channel_write(b, 0, "x", 1, nullptr, 0), ZX_ERR_PEER_CLOSED);
+
+    zx_port_packet_t packet;
+    EXPECT_EQ(zx_port_wait(port, zx_deadline_after(ZX_MSEC(10)), &packet),
+              ZX_ERR_TIMED_OUT);
+    zx_handle_close(b);
+    zx_handle_close(port);
+    END_TEST;
+}
+
+// A handle sent away while its wait is armed must not fire for whatever
+// object takes over its handle value.
+static bool transfer_cancels_wait() {
+    BEGIN_TEST;
+    zx_handle_t port;
+    ASSERT_EQ(zx_port_create(0, &port), ZX_OK);
+    zx_handle_t carrier0, carrier1;
+    ASSERT_EQ(zx_channel_create(0, &carrier0, &carrier1), ZX_OK);
+    zx_handle_t a, b;
+    ASSERT_EQ(zx_channel_create(0, &a, &b), ZX_OK);
+
+    ASSERT_EQ(zx_object_wait_async(a, port, 1, ZX_CHANNEL_READABLE,
+                                   ZX_WAIT_ASYNC_ONCE),
+              ZX_OK);
+    ASSERT_EQ(zx_channel_write(carrier0, 0, nullptr, 0, &a, 1), ZX_OK);
+
+    // Takes over a's slot in the handle table.
+    zx_handle_t c, d;
+    ASSERT_EQ(zx_channel_create(0, &c, &d), ZX_OK);
+
+    // a, now queued in the carrier, becomes readable.
+    ASSERT_EQ(zx_channel_write(b, 0, "x", 1, nullptr, 0), ZX_OK);
+    zx_port_packet_t packet;
+    EXPECT_EQ(zx_port_wait(port, zx_deadline_after(ZX_MSEC(20)), &packet),
+              ZX_ERR_TIMED_OUT, "the wait left with the handle");
+
+    zx_handle_close(c);
+    zx_handle_close(d);
+    zx_handle_close(b);
+    zx_handle_close(carrier0);
+    zx_handle_close(carrier1);
+    zx_handle_close(port);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(port_tests)
+RUN_TEST(one_shot)
+RUN_TEST(user_packets)
+RUN_TEST(close_cancels_wait)
+RUN_TEST(transfer_cancels_wait)
+END_TEST_CASE(port_tests)
@@ -0,0 +1,227 @@
+// VMOs and address space mappings on the host backend.
+//
+// A VMO is a memfd, so it can be handed to another process like any other
+// descriptor and mapped shared on both sides. There is a single address space
+// per process, represented by the root VMAR handle; mappings are plain mmap
+// calls that let the kernel pick the address.
+
+#include "object.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zircon/process.h>
+#include <zircon/syscalls.h>
+
+namespace zxhost {
+namespace {
+
+class Vmo final : public Object {
+public:
+    explicit Vmo(int fd) : fd_(fd) {}
+    ~Vmo() override { close(fd_); }
+
+    WireTag export_fds(int* fds, size_t* num_fds) const override {
+        fds[0] = fd_;
+        *num_fds = 1;
+        return kTagVmo;
+    }
+
+    // VMOs have no signals the samples wait on.
+    int wait_fd() const override { return -1; }
+    short poll_events(zx_signals_t) const override { return 0; }
+    zx_signals_t observed_signals(short) override { return 0; }
+
+    int fd() const { return fd_; }
+
+    zx_status_t get_size(uint64_t* size) const {
+        struct stat st;
+        if (fstat(fd_, &st) < 0) {
+            return status_from_errno(errno);
+        }
+        *size = static_cast<uint64_t>(st.st_size);
+        return ZX_OK;
+    }
+
+private:
+    const int fd_;
+};
+
+class Vmar final : public Object {
+public:
+    WireTag export_fds(int*, size_t* num_fds) const override {
+        *num_fds = 0;
+        return kTagNone;
+    }
+
+    int wait_fd() const override { return -1; }
+    short poll_events(zx_signals_t) const override { return 0; }
+    zx_signals_t observed_signals(short) override { return 0; }
+};
+
+size_t page_size() {
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+} // namespace
+
+Object* make_vmo(int fd) {
+    return new Vmo(fd);
+}
+
+} // namespace zxhost
+
+using zxhost::Vmar;
+using zxhost::Vmo;
+
+zx_handle_t zx_vmar_root_self(void) {
+    static zx_handle_t root = zxhost::handle_alloc(new Vmar());
+    return root;
+}
+
+zx_status_t zx_vmo_create(uint64_t size, uint32_t options, zx_handle_t* out) {
+    if (options != 0) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    int fd = memfd_create("zx-vmo", MFD_CLOEXEC);
+    if (fd < 0) {
+        return zxhost::status_from_errno(errno);
+    }
+    // Zircon rounds VMOs up to whole pages.
+    size_t page = zxhost::page_size();
+    size = (size + page - 1) & ~static_cast<uint64_t>(page - 1);
+    if (ftruncate(fd, static_cast<off_t>(size)) < 0) {
+        close(fd);
+        return zxhost::status_from_errno(errno);
+    }
+    *out = zxhost::handle_alloc(new Vmo(fd));
+    return ZX_OK;
+}
+
+zx_status_t zx_vmo_get_size(zx_handle_t handle, uint64_t* size) {
+    zxhost::Ref<Vmo> vmo;
+    zx_status_t st = zxhost::handle_get_typed(handle, &vmo);
+    if (st != ZX_OK) {
+        return st;
+    }
+    return vmo->get_size(size);
+}
+
+zx_status_t zx_vmo_read(zx_handle_t handle, void* buffer, uint64_t offset,
+                        size_t buffer_size) {
+    zxhost::Ref<Vmo> vmo;
+    zx_status_t st = zxhost::handle_get_typed(handle, &vmo);
+    if (st != ZX_OK) {
+        return st;
+    }
+    uint64_t size;
+    st = vmo->get_size(&size);
+    if (st != ZX_OK) {
+        return st;
+    }
+    if (offset > size || buffer_size > size - offset) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    uint8_t* bytes = static_cast<uint8_t*>(buffer);
+    while (buffer_size > 0) {
+        ssize_t n = pread(vmo->fd(), bytes, buffer_size,
+                          static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return zxhost::status_from_errno(errno);
+        }
+        bytes += n;
+        offset += static_cast<uint64_t>(n);
+        buffer_size -= static_cast<size_t>(n);
+    }
+    return ZX_OK;
+}
+
+zx_status_t zx_vmo_write(zx_handle_t handle, const void* buffer,
+                         uint64_t offset, size_t buffer_size) {
+    zxhost::Ref<Vmo> vmo;
+    zx_status_t st = zxhost::handle_get_typed(handle, &vmo);
+    if (st != ZX_OK) {
+        return st;
+    }
+    uint64_t size;
+    st = vmo->get_size(&size);
+    if (st != ZX_OK) {
+        return st;
+    }
+    if (offset > size || buffer_size > size - offset) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(buffer);
+    while (buffer_size > 0) {
+        ssize_t n = pwrite(vmo->fd(), bytes, buffer_size,
+                           static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return zxhost::status_from_errno(errno);
+        }
+        bytes += n;
+        offset += static_cast<uint64_t>(n);
+        buffer_size -= static_cast<size_t>(n);
+    }
+    return ZX_OK;
+}
+
+zx_status_t zx_vmar_map(zx_handle_t vmar_handle, zx_vm_option_t options,
+                        size_t vmar_offset, zx_handle_t vmo_handle,
+                        uint64_t vmo_offset, size_t len,
+                        zx_vaddr_t* mapped_addr) {
+    zxhost::Ref<Vmar> vmar;
+    zx_status_t st = zxhost::handle_get_typed(vmar_handle, &vmar);
+    if (st != ZX_OK) {
+        return st;
+    }
+    zxhost::Ref<Vmo> vmo;
+    st = zxhost::handle_get_typed(vmo_handle, &vmo);
+    if (st != ZX_OK) {
+        return st;
+    }
+    // Only kernel-chosen addresses are supported.
+    if (vmar_offset != 0 ||
+        (options & ~(ZX_VM_PERM_READ | ZX_VM_PERM_WRITE)) != 0) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+    size_t page = zxhost::page_size();
+    if (len == 0 || (vmo_offset & (page - 1)) != 0) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+
+    int prot = 0;
+    if (options & ZX_VM_PERM_READ) {
+        prot |= PROT_READ;
+    }
+    if (options & ZX_VM_PERM_WRITE) {
+        prot |= PROT_WRITE;
+    }
+    void* addr = mmap(nullptr, len, prot, MAP_SHARED, vmo->fd(),
+                      static_cast<off_t>(vmo_offset));
+    if (addr == MAP_FAILED) {
+        return zxhost::status_from_errno(errno);
+    }
+    *mapped_addr = reinterpret_cast<zx_vaddr_t>(addr);
+    return ZX_OK;
+}
+
+zx_status_t zx_vmar_unmap(zx_handle_t vmar_handle, zx_vaddr_t addr,
+                          size_t len) {
+    zxhost::Ref<Vmar> vmar;
+    zx_status_t st = zxhost::handle_get_typed(vmar_handle, &vmar);
+    if (st != ZX_OK) {
+        return st;
+    }
+    if (munmap(reinterpret_cast<void*>(addr), len) < 0) {
+        return zxhost::status_from_errno(errno);
+    }
+    return ZX_OK;
+}
@@ -0,0 +1,151 @@
+// Waiting and time on the host backend.
+
+#include "object.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zircon/syscalls.h>
+
+namespace zxhost {
+
+bool timeout_from_deadline(zx_time_t deadline, struct timespec* out) {
+    zx_time_t now = zx_clock_get_monotonic();
+    if (deadline <= now) {
+        return false;
+    }
+    zx_duration_t remaining = deadline - now;
+    out->tv_sec = static_cast<time_t>(remaining / ZX_SEC(1));
+    out->tv_nsec = static_cast<long>(remaining % ZX_SEC(1));
+    return true;
+}
+
+} // namespace zxhost
+
+zx_status_t zx_object_wait_one(zx_handle_t handle, zx_signals_t signals,
+                               zx_time_t deadline, zx_signals_t* observed) {
+    zxhost::Ref<zxhost::Object> object = zxhost::handle_get(handle);
+    if (!object) {
+        return ZX_ERR_BAD_HANDLE;
+    }
+
+    zx_signals_t current;
+    if (object->quick_signals(&current) && (current & signals)) {
+        if (observed) {
+            *observed = current;
+        }
+        return ZX_OK;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = object->wait_fd();
+    pfd.events = object->poll_events(signals);
+
+    while (true) {
+        struct timespec timeout;
+        struct timespec* timeout_ptr = nullptr;
+        bool expired = false;
+        if (deadline != ZX_TIME_INFINITE) {
+            if (!zxhost::timeout_from_deadline(deadline, &timeout)) {
+                timeout = {0, 0};
+                expired = true;
+            }
+            timeout_ptr = &timeout;
+        }
+
+        pfd.revents = 0;
+        int r = ppoll(&pfd, 1, timeout_ptr, nullptr);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return zxhost::status_from_errno(errno);
+        }
+
+        current = object->observed_signals(pfd.revents);
+        if (current & signals) {
+            if (observed) {
+                *observed = current;
+            }
+            return ZX_OK;
+        }
+        // A descriptor can stay ready for something nobody asked for, e.g. a
+        // hung-up peer while waiting for WRITABLE, so the deadline has to be
+        // checked here as well as by ppoll.
+        if (r == 0 || expired) {
+            if (observed) {
+                *observed = current;
+            }
+            return ZX_ERR_TIMED_OUT;
+        }
+        // A wakeup that did not change anything we care about, e.g. a fifo
+        // doorbell for the other direction. Go back to sleep.
+    }
+}
+
+zx_time_t zx_clock_get_monotonic(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ZX_SEC(ts.tv_sec) + ts.tv_nsec;
+}
+
+// Ticks are the CPU's cycle counter where it has a usable one, which is
+// cheaper to read than the monotonic clock.
+zx_ticks_t zx_ticks_get(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return static_cast<zx_ticks_t>(__builtin_ia32_rdtsc());
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return static_cast<zx_ticks_t>(ticks);
+#else
+    return zx_clock_get_monotonic();
+#endif
+}
+
+zx_ticks_t zx_ticks_per_second(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    // Linux doesn't publish the TSC rate, so measure it once against the
+    // monotonic clock. Good to a few parts in 10^4.
+    static const zx_ticks_t rate = [] {
+        zx_time_t start = zx_clock_get_monotonic();
+        zx_ticks_t start_ticks = zx_ticks_get();
+        zx_nanosleep(start + ZX_MSEC(10));
+        zx_ticks_t ticks = zx_ticks_get() - start_ticks;
+        zx_duration_t elapsed = zx_clock_get_monotonic() - start;
+        return static_cast<zx_ticks_t>(static_cast<double>(ticks) * ZX_SEC(1) /
+                                       elapsed);
+    }();
+    return rate;
+#elif defined(__aarch64__)
+    uint64_t rate;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(rate));
+    return static_cast<zx_ticks_t>(rate);
+#else
+    return ZX_SEC(1);
+#endif
+}
+
+zx_time_t zx_deadline_after(zx_duration_t nanoseconds) {
+    zx_time_t now = zx_clock_get_monotonic();
+    if (nanoseconds >= ZX_TIME_INFINITE - now) {
+        return ZX_TIME_INFINITE;
+    }
+    return now + nanoseconds;
+}
+
+zx_status_t zx_nanosleep(zx_time_t deadline) {
+    if (deadline == ZX_TIME_INFINITE) {
+        while (true) {
+            pause();
+        }
+    }
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(deadline / ZX_SEC(1));
+    ts.tv_nsec = static_cast<long>(deadline % ZX_SEC(1));
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+    return ZX_OK;
+}
@@ -0,0 +1,317 @@
+#define LOG_PREFIX "[PARNT]"
+#include "common.h"
+
+#include <memory>
+
+#include <fbl/auto_call.h>
+#include <trace/syscalls.h>
+#include <zircon/syscalls.h>
+
+// Message sizes for the one-way cases, up to the largest a channel takes.
+constexpr uint32_t kOneWaySizes[] = {
+    16, 64, 256, 1024, 4096, 16384, ZX_CHANNEL_MAX_MSG_BYTES,
+};
+
+// Most messages, and most bytes, the one-way warm-up run sends; large
+// messages stop at the byte cap first.
+constexpr uint64_t kOneWayMessages = 5000;
+constexpr uint64_t kOneWayBytes = 256 << 20;
+
+// Requests in flight for the round-trip cases.
+constexpr uint32_t kRoundTripDepths[] = {1, 2, 4, 8, 16, 32, 64};
+
+// Round trips in the warm-up run.
+constexpr uint64_t kRoundTrips = 5000;
+
+// Reads every ack the child has sent so far into |acked|. The child closes
+// its end right after the last one, so running out of acks because the peer
+// is gone is fine here; the caller notices if any are missing.
+static zx_status_t drain_acks(zx_handle_t channel, uint64_t* acked) {
+    while (true) {
+        uint64_t received;
+        uint32_t actual_bytes;
+        zx_status_t st = trace::channel_read(channel, 0, &received, nullptr,
+                                             sizeof(received), 0,
+                                             &actual_bytes, nullptr);
+        if (st == ZX_ERR_SHOULD_WAIT || st == ZX_ERR_PEER_CLOSED) {
+            return ZX_OK;
+        } else if (st != ZX_OK) {
+            return st;
+        } else if (actual_bytes != sizeof(received)) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        *acked = received;
+    }
+}
+
+// Streams |count| messages of |size| bytes to the child and returns once it
+// has acked all of them.
+static zx_status_t one_way_run(zx_handle_t bootstrap, uint32_t size,
+                               uint64_t count, const uint8_t* payload,
+                               zx_duration_t* elapsed) {
+    zx_handle_t channel;
+    zx_handle_t theirs;
+    zx_status_t st = zx_channel_create(0, &channel, &theirs);
+    if (st != ZX_OK) {
+        return st;
+    }
+    auto channel_cleanup = fbl::MakeAutoCall([channel]() {
+        zx_handle_close(channel);
+    });
+    st = start_case(bootstrap, {kCaseOneWay, size, 0, count}, theirs);
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    zx_time_t start = zx_clock_get_monotonic();
+    uint64_t sent = 0;
+    uint64_t acked = 0;
+    while (acked < count) {
+        bool in_window = sent < count && sent - acked < kMaxUnacked;
+        if (in_window) {
+            st = trace::channel_write(channel, 0, payload, size, nullptr, 0);
+            if (st == ZX_OK) {
+                sent++;
+                continue;
+            } else if (st != ZX_ERR_SHOULD_WAIT) {
+                return st;
+            }
+        }
+
+        // Out of window or out of room: wait for acks, or for room.
+        zx_signals_t observed;
+        st = trace::object_wait_one(
+            channel,
+            ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED |
+                (in_window ? ZX_CHANNEL_WRITABLE : 0),
+            ZX_TIME_INFINITE, &observed);
+        if (st != ZX_OK) {
+            return st;
+        }
+        if (observed & ZX_CHANNEL_READABLE) {
+            st = drain_acks(channel, &acked);
+            if (st != ZX_OK) {
+                return st;
+            }
+        } else if (observed & ZX_CHANNEL_PEER_CLOSED) {
+            return ZX_ERR_PEER_CLOSED;
+        }
+    }
+    *elapsed = zx_clock_get_monotonic() - start;
+    return ZX_OK;
+}
+
+zx_status_t serve_one_way(zx_handle_t channel, const bench_case_t& bench_case) {
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[ZX_CHANNEL_MAX_MSG_BYTES]);
+    uint64_t received = 0;
+    while (received < bench_case.count) {
+        zx_status_t st = trace::channel_read(channel, 0, buffer.get(), nullptr,
+                                             ZX_CHANNEL_MAX_MSG_BYTES, 0,
+                                             nullptr, nullptr);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            st = trace::object_wait_one(
+                channel, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                ZX_TIME_INFINITE, nullptr);
+            if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        } else if (st != ZX_OK) {
+            return st;
+        }
+
+        received++;
+        if (received % kAckInterval == 0 || received == bench_case.count) {
+            st = write_all(channel, &received, sizeof(received));
+            if (st != ZX_OK) {
+                return st;
+            }
+        }
+    }
+    return ZX_OK;
+}
+
+// Keeps |depth| requests in flight until |count| round trips are done, and
+// records each one's latency.
+static zx_status_t round_trip_run(zx_handle_t bootstrap, uint32_t depth,
+                                  uint64_t count, zx_time_t* sent_at,
+                                  histogram::Histogram* latency,
+                                  zx_duration_t* elapsed) {
+    zx_handle_t channel;
+    zx_handle_t theirs;
+    zx_status_t st = zx_channel_create(0, &channel, &theirs);
+    if (st != ZX_OK) {
+        return st;
+    }
+    auto channel_cleanup = fbl::MakeAutoCall([channel]() {
+        zx_handle_close(channel);
+    });
+    st = start_case(bootstrap,
+                    {kCaseRoundTrip, sizeof(echo_request_t), depth, count},
+                    theirs);
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    auto send = [channel, depth, sent_at](uint64_t sequence) {
+        echo_request_t request = {sequence};
+        sent_at[sequence % depth] = zx_clock_get_monotonic();
+        return write_all(channel, &request, sizeof(request));
+    };
+
+    zx_time_t start = zx_clock_get_monotonic();
+    uint64_t sent = 0;
+    for (; sent < depth && sent < count; sent++) {
+        st = send(sent);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+
+    // The child echoes in order, so the responses come back in sequence.
+    for (uint64_t received = 0; received < count; received++) {
+        echo_request_t response;
+        uint32_t actual_bytes;
+        while ((st = trace::channel_read(channel, 0, &response, nullptr,
+                                         sizeof(response), 0, &actual_bytes,
+                                         nullptr)) == ZX_ERR_SHOULD_WAIT) {
+            st = trace::object_wait_one(
+                channel, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                ZX_TIME_INFINITE, nullptr);
+            if (st != ZX_OK) {
+                return st;
+            }
+        }
+        if (st != ZX_OK) {
+            return st;
+        }
+        if (actual_bytes != sizeof(response) || response.sequence != received) {
+            ERR("expected response %lu\n", received);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        latency->Record(static_cast<uint64_t>(zx_clock_get_monotonic() -
+                                              sent_at[received % depth]));
+
+        if (sent < count) {
+            st = send(sent++);
+            if (st != ZX_OK) {
+                return st;
+            }
+        }
+    }
+    *elapsed = zx_clock_get_monotonic() - start;
+    return ZX_OK;
+}
+
+zx_status_t serve_round_trip(zx_handle_t channel) {
+    while (true) {
+        echo_request_t request;
+        uint32_t actual_bytes;
+        zx_status_t st = trace::channel_read(channel, 0, &request, nullptr,
+                                             sizeof(request), 0, &actual_bytes,
+                                             nullptr);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            st = trace::object_wait_one(
+                channel, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                ZX_TIME_INFINITE, nullptr);
+            if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        } else if (st == ZX_ERR_PEER_CLOSED) {
+            // The parent has all its responses.
+            return ZX_OK;
+        } else if (st != ZX_OK) {
+            return st;
+        }
+
+        st = write_all(channel, &request, actual_bytes);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+}
+
+zx_status_t bench_channels(zx_handle_t bootstrap, const options_t& options,
+                           FILE* out) {
+    std::unique_ptr<uint8_t[]> payload(new uint8_t[ZX_CHANNEL_MAX_MSG_BYTES]);
+    for (size_t i = 0; i < ZX_CHANNEL_MAX_MSG_BYTES; i++) {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+
+    char name[96];
+    for (uint32_t size : kOneWaySizes) {
+        snprintf(name, sizeof(name), "%s.channel.oneway.%u.throughput",
+                 options.prefix, size);
+        if (!selected(options, name)) {
+            continue;
+        }
+        uint64_t count = kOneWayBytes / size;
+        if (count > kOneWayMessages) {
+            count = kOneWayMessages;
+        }
+
+        zx_duration_t best = ZX_TIME_INFINITE;
+        for (uint32_t run = 0; run <= options.repeat; run++) {
+            zx_duration_t elapsed;
+            zx_status_t st = one_way_run(bootstrap, size, count, payload.get(),
+                                         &elapsed);
+            if (st != ZX_OK) {
+                ERR("one-way run at %u bytes failed, st = %d\n", size, st);
+                return st;
+            }
+            if (run == 0) {
+                count = calibrate(count, elapsed);
+            } else {
+                best = elapsed < best ? elapsed : best;
+            }
+        }
+        double seconds = static_cast<double>(best) / ZX_SEC(1);
+        histogram::PrintValue(out, name, "MiB/s",
+                              count * size / seconds / (1 << 20),
+                              options.format);
+    }
+
+    // Too big for the stack.
+    std::unique_ptr<histogram::Histogram> latency(new histogram::Histogram());
+    std::unique_ptr<zx_time_t[]> sent_at(
+        new zx_time_t[kRoundTripDepths[countof(kRoundTripDepths) - 1]]);
+    for (uint32_t depth : kRoundTripDepths) {
+        char prefix[80];
+        snprintf(prefix, sizeof(prefix), "%s.channel.roundtrip.depth%u",
+                 options.prefix, depth);
+        if (!selected(options, prefix)) {
+            continue;
+        }
+
+        uint64_t count = kRoundTrips;
+        uint64_t best_p50 = UINT64_MAX;
+        zx_duration_t best = ZX_TIME_INFINITE;
+        for (uint32_t run = 0; run <= options.repeat; run++) {
+            latency->Reset();
+            zx_duration_t elapsed;
+            zx_status_t st = round_trip_run(bootstrap, depth, count,
+                                            sent_at.get(), latency.get(),
+                                            &elapsed);
+            if (st != ZX_OK) {
+                ERR("round trips at depth %u failed, st = %d\n", depth, st);
+                return st;
+            }
+            if (run == 0) {
+                count = calibrate(count, elapsed);
+                continue;
+            }
+            uint64_t p50 = latency->ValueAtPercentile(50);
+            best_p50 = p50 < best_p50 ? p50 : best_p50;
+            best = elapsed < best ? elapsed : best;
+        }
+        snprintf(name, sizeof(name), "%s.p50", prefix);
+        histogram::PrintValue(out, name, "ns", static_cast<double>(best_p50),
+                              options.format);
+        snprintf(name, sizeof(name), "%s.throughput", prefix);
+        histogram::PrintValue(out, name, "req/s",
+                              count / (static_cast<double>(best) / ZX_SEC(1)),
+                              options.format);
+    }
+    return ZX_OK;
+}
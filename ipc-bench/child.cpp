@@ -0,0 +1,68 @@
+#define LOG_PREFIX "[CHILD]"
+#include "common.h"
+
+#include <trace/syscalls.h>
+#include <typed/handle.h>
+#include <zircon/syscalls.h>
+
+// Runs the cases the parent hands us, one at a time, until it closes the
+// bootstrap channel.
+zx_status_t child(zx_handle_t handle, const options_t& options) {
+    typed::Handle bootstrap(handle);
+
+    while (true) {
+        zx_status_t st = trace::object_wait_one(
+            bootstrap.get(), ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+            ZX_TIME_INFINITE, nullptr);
+        if (st != ZX_OK) {
+            ERR("zx_object_wait_one failed with st = %d\n", st);
+            return st;
+        }
+
+        bench_case_t bench_case;
+        typed::Handle end;
+        uint32_t actual_bytes;
+        uint32_t actual_handles;
+        st = trace::channel_read(bootstrap.get(), 0, &bench_case,
+                                 end.reset_and_get_address(),
+                                 sizeof(bench_case), 1, &actual_bytes,
+                                 &actual_handles);
+        if (st == ZX_ERR_PEER_CLOSED) {
+            // The parent is done.
+            return ZX_OK;
+        } else if (st != ZX_OK) {
+            ERR("zx_channel_read failed with st = %d\n", st);
+            return st;
+        } else if (actual_bytes != sizeof(bench_case) || actual_handles != 1) {
+            ERR("malformed case of %u bytes and %u handles\n", actual_bytes,
+                actual_handles);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+
+        st = trace::channel_write(bootstrap.get(), 0, &kReady, sizeof(kReady),
+                                  nullptr, 0);
+        if (st != ZX_OK) {
+            ERR("failed to report ready, st = %d\n", st);
+            return st;
+        }
+
+        switch (bench_case.kind) {
+        case kCaseOneWay:
+            st = serve_one_way(end.get(), bench_case);
+            break;
+        case kCaseRoundTrip:
+            st = serve_round_trip(end.get());
+            break;
+        case kCaseFifo:
+            st = serve_fifo(end.get(), bench_case);
+            break;
+        default:
+            st = ZX_ERR_NOT_SUPPORTED;
+            break;
+        }
+        if (st != ZX_OK) {
+            ERR("case %u failed with st = %d\n", bench_case.kind, st);
+            return st;
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdio.h>
+#include <zircon/types.h>
+
+#include <histogram/histogram.h>
+#include <logger/logger.h>
+#include <placement/placement.h>
+
+// Options shared by the parent and the child. The parent forwards its command
+// line to the child, so both sides always agree on the mode.
+typedef struct options {
+    // Timed runs of every case; the best one is reported, which keeps
+    // one-off scheduling hiccups out of the comparison against the baseline.
+    uint32_t repeat;
+    // Only run cases whose name starts with this. nullptr runs all of them.
+    const char* filter;
+    // Where the results go; stdout if nullptr.
+    const char* out;
+    // How the results are written. JSON is what compare.py reads.
+    histogram::Format format;
+    // CPUs the parent and the child pin their main thread to, or
+    // placement::kAnyCpu, and the scheduling profile both apply.
+    int32_t parent_cpu;
+    int32_t child_cpu;
+    placement::Profile profile;
+    // Prefix of every result name: ipc-bench, or ipc-bench.<topology> when
+    // both sides are pinned, so that placements aren't compared against an
+    // unpinned baseline by accident.
+    char prefix[48];
+} options_t;
+
+constexpr uint32_t kMaxRepeat = 100;
+
+// The parent runs one case at a time. For every run it sends the child a
+// bench_case_t on the bootstrap channel, with the child's end of a fresh
+// channel or fifo, and the child answers with a kReady message once it has
+// set up its side. The parent starts the clock after that.
+enum CaseKind : uint32_t {
+    // The parent streams messages to the child, which acks them.
+    kCaseOneWay = 1,
+    // The parent keeps requests in flight and the child echoes them.
+    kCaseRoundTrip = 2,
+    // The child fills a fifo as fast as the parent drains it.
+    kCaseFifo = 3,
+};
+
+typedef struct bench_case {
+    uint32_t kind;
+    // kCaseOneWay: message size. kCaseFifo: element size. In bytes.
+    uint32_t size;
+    // kCaseRoundTrip: requests in flight. kCaseFifo: fifo depth in elements.
+    uint32_t depth;
+    // Messages, round trips or elements in the run.
+    uint64_t count;
+} bench_case_t;
+
+constexpr uint64_t kReady = 0x7265616479; // "ready"
+
+// One-way flow control, as in channel-one-way: the child acks every
+// kAckInterval messages and the last one, and the parent never gets more than
+// kMaxUnacked ahead of it. Acks are a single uint64_t.
+constexpr uint32_t kAckInterval = 64;
+constexpr uint32_t kMaxUnacked = 4 * kAckInterval;
+
+// A round-trip request, echoed back unchanged.
+typedef struct echo_request {
+    uint64_t sequence;
+} echo_request_t;
+
+zx_status_t parent(zx_handle_t bootstrap, const options_t& options);
+zx_status_t child(zx_handle_t bootstrap, const options_t& options);
+
+// Runs every channel or fifo case that matches the filter and prints the
+// results to |out|. |bootstrap| is the channel to the child.
+zx_status_t bench_channels(zx_handle_t bootstrap, const options_t& options,
+                           FILE* out);
+zx_status_t bench_fifos(zx_handle_t bootstrap, const options_t& options,
+                        FILE* out);
+
+// Child side of one case; |handle| is the child's end.
+zx_status_t serve_one_way(zx_handle_t channel, const bench_case_t& bench_case);
+zx_status_t serve_round_trip(zx_handle_t channel);
+zx_status_t serve_fifo(zx_handle_t fifo, const bench_case_t& bench_case);
+
+// Parent side helpers shared by the suites.
+
+// Hands |bench_case| and |handle| to the child and waits until it is ready.
+// |handle| is consumed.
+zx_status_t start_case(zx_handle_t bootstrap, const bench_case_t& bench_case,
+                       zx_handle_t handle);
+
+// True if the case called |name| should run.
+bool selected(const options_t& options, const char* name);
+
+// Every case first runs once with a nominal count to warm up, and is then
+// timed with its count scaled so that one run takes about this long.
+constexpr zx_duration_t kTargetRun = ZX_MSEC(100);
+
+// Scales |count| to a run of kTargetRun, given that a run of |count| took
+// |elapsed|.
+uint64_t calibrate(uint64_t count, zx_duration_t elapsed);
+
+// Writes one message, waiting for room while the channel is full.
+zx_status_t write_all(zx_handle_t channel, const void* bytes,
+                      uint32_t num_bytes);
@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+# Copyright 2018 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+"""Compares ipc-bench results against a baseline.
+
+Every file holds what ipc-bench --format=json writes: one JSON object per line
+with a name, a unit and a value. Results in ns are better when lower, every
+other unit (MiB/s, req/s, elem/s) when higher. Lines that aren't JSON are
+skipped, so the output of a whole run can be fed in as it is.
+
+Both sides take several runs, as several files or several runs in one file,
+and every case is judged on the difference of the medians of its runs. The
+noise is estimated from the baseline alone, as the median absolute deviation
+of its runs, so a slower and noisier result can't widen its own tolerance.
+From that comes the margin: how far the two medians may drift apart by
+chance, with about 95% confidence. A case counts as slower if its median
+moved by more than both --threshold and the margin. A case whose margin is
+over --threshold can't tell a --threshold slowdown from noise; unless it is
+clearly slower it is reported as unreliable, which fails the check too, and
+the cure is a quieter machine or more runs. With --rerun, every case that
+looks slower is measured again by running the given ipc-bench command with
+--filter, and only fails if it is still slower on the fresh runs, so a
+one-off hiccup on a busy machine doesn't fail the check.
+
+Exits with 1 if any case regressed, is unreliable, or is missing from the
+results.
+"""
+
+import argparse
+import json
+import math
+import os
+import shlex
+import statistics
+import subprocess
+import sys
+
+
+def load(paths, what):
+    """Returns {name: (unit, [values])} over every run in |paths|."""
+    results = {}
+    for path in paths:
+        if not os.path.exists(path):
+            sys.exit("no %s at %s; the ipc-bench-baseline build target records "
+                     "one" % (what, path))
+        with open(path) as f:
+            parse(f, results)
+    return results
+
+
+def parse(lines, results):
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("{"):
+            continue
+        result = json.loads(line)
+        unit, values = results.setdefault(result["name"], (result["unit"], []))
+        values.append(result["value"])
+
+
+def lower_is_better(unit):
+    return unit == "ns"
+
+
+def noise(values):
+    """The spread of |values|, as a standard deviation in percent of their
+    median, estimated from the median absolute deviation so that one
+    outlying run barely moves it."""
+    median = statistics.median(values)
+    if median == 0:
+        return 0.0
+    mad = statistics.median(abs(value - median) for value in values)
+    # 1.4826 scales the MAD to the standard deviation of a normal
+    # distribution.
+    return 100.0 * 1.4826 * mad / median
+
+
+def margin(old, new):
+    """How far apart the medians of |old| and |new| may be by chance alone,
+    in percent, with about 95% confidence, assuming |new| is as noisy as
+    |old|."""
+    # The median of n runs has a standard error of about 1.253 sigma /
+    # sqrt(n); the difference of two medians adds their variances.
+    error = 1.253 * noise(old) * math.sqrt(1.0 / len(old) + 1.0 / len(new))
+    return 1.96 * error
+
+
+def judge(unit, old, new, threshold):
+    """Returns (verdict, change, tolerance) for one case."""
+    old_median = statistics.median(old)
+    new_median = statistics.median(new)
+    if old_median == 0:
+        change = 0.0
+    else:
+        change = 100.0 * (new_median - old_median) / old_median
+    worse = change if lower_is_better(unit) else -change
+    chance = margin(old, new)
+    tolerance = max(threshold, chance)
+    if worse > tolerance:
+        verdict = "REGRESSED"
+    elif -worse > tolerance:
+        verdict = "improved"
+    elif chance > threshold:
+        verdict = "UNRELIABLE"
+    else:
+        verdict = "ok"
+    return verdict, change, tolerance
+
+
+def case_of(name):
+    """The --filter that reruns the case |name| belongs to."""
+    # Round trips report a p50 and a throughput from the same case.
+    return name.rsplit(".", 1)[0]
+
+
+def rerun(command, names, runs):
+    """Measures the cases behind |names| |runs| more times."""
+    results = {}
+    for case in sorted(set(case_of(name) for name in names)):
+        for _ in range(runs):
+            output = subprocess.run(
+                shlex.split(command) + ["--format=json", "--filter=" + case],
+                check=True, stdout=subprocess.PIPE, universal_newlines=True)
+            parse(output.stdout.splitlines(), results)
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--baseline", action="append", required=True,
+                        metavar="FILE", help="baseline runs; may be repeated")
+    parser.add_argument("--results", action="append", required=True,
+                        metavar="FILE", help="runs to check; may be repeated")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="smallest slowdown that counts, in percent")
+    parser.add_argument("--rerun", metavar="COMMAND",
+                        help="ipc-bench command to measure apparent "
+                             "regressions again with")
+    parser.add_argument("--rerun-count", type=int, default=5, metavar="N",
+                        help="runs of each case to take when rerunning")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline, "baseline")
+    results = load(args.results, "results")
+
+    suspects = []
+    for name, (unit, old) in sorted(baseline.items()):
+        if name in results:
+            verdict, _, _ = judge(unit, old, results[name][1], args.threshold)
+            if verdict == "REGRESSED":
+                suspects.append(name)
+    reruns = {}
+    if suspects and args.rerun:
+        reruns = rerun(args.rerun, suspects, args.rerun_count)
+
+    failures = 0
+    for name, (unit, old) in sorted(baseline.items()):
+        if name not in results:
+            print("MISSING    %s" % name)
+            failures += 1
+            continue
+
+        new = results[name][1]
+        verdict, change, tolerance = judge(unit, old, new, args.threshold)
+        if name in suspects and name in reruns:
+            # It has to be slower again on fresh runs to count.
+            new = reruns[name][1]
+            verdict, change, tolerance = judge(unit, old, new, args.threshold)
+            if verdict in ("ok", "improved"):
+                verdict = "noise"
+        if verdict in ("REGRESSED", "UNRELIABLE"):
+            failures += 1
+        print("%-10s %-50s %12.1f -> %12.1f %-6s (%+.1f%%, tolerance %.1f%%)" %
+              (verdict, name, statistics.median(old), statistics.median(new),
+               unit, change, tolerance))
+
+    for name in sorted(set(results) - set(baseline)):
+        print("new        %s" % name)
+
+    if failures:
+        print("%d of %d results regressed, are unreliable or are missing" %
+              (failures, len(baseline)))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
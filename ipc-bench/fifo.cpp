@@ -0,0 +1,142 @@
+#define LOG_PREFIX "[PARNT]"
+#include "common.h"
+
+#include <string.h>
+
+#include <memory>
+
+#include <fbl/auto_call.h>
+#include <trace/syscalls.h>
+#include <zircon/syscalls.h>
+
+// Element sizes for the fifo cases. Every element starts with its sequence
+// number, so 8 bytes is the least.
+constexpr uint32_t kElementSizes[] = {8, 16, 32, 64};
+
+// Fifo depths are swept in powers of two over this range, up to the deepest
+// fifo ZX_FIFO_MAX_SIZE_BYTES allows for the element size.
+constexpr uint32_t kMinFifoDepth = 8;
+constexpr uint32_t kMaxFifoDepth = 4096;
+
+// Elements in the warm-up run.
+constexpr uint64_t kFifoElements = 1 << 16;
+
+// Drains |count| elements of |size| bytes that the child writes into a
+// |depth| element fifo, checking that none are lost or reordered.
+static zx_status_t fifo_run(zx_handle_t bootstrap, uint32_t size,
+                            uint32_t depth, uint64_t count, uint8_t* buffer,
+                            zx_duration_t* elapsed) {
+    zx_handle_t fifo;
+    zx_handle_t theirs;
+    zx_status_t st = zx_fifo_create(depth, size, 0, &fifo, &theirs);
+    if (st != ZX_OK) {
+        return st;
+    }
+    auto fifo_cleanup = fbl::MakeAutoCall([fifo]() {
+        zx_handle_close(fifo);
+    });
+    st = start_case(bootstrap, {kCaseFifo, size, depth, count}, theirs);
+    if (st != ZX_OK) {
+        return st;
+    }
+
+    zx_time_t start = zx_clock_get_monotonic();
+    uint64_t received = 0;
+    while (received < count) {
+        size_t actual;
+        st = trace::fifo_read(fifo, size, buffer, depth, &actual);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            st = trace::object_wait_one(
+                fifo, ZX_FIFO_READABLE | ZX_FIFO_PEER_CLOSED,
+                ZX_TIME_INFINITE, nullptr);
+            if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        } else if (st != ZX_OK) {
+            return st;
+        }
+
+        for (size_t i = 0; i < actual; i++) {
+            uint64_t sequence;
+            memcpy(&sequence, buffer + i * size, sizeof(sequence));
+            if (sequence != received + i) {
+                ERR("expected element %lu, got %lu\n", received + i, sequence);
+                return ZX_ERR_IO_DATA_INTEGRITY;
+            }
+        }
+        received += actual;
+    }
+    *elapsed = zx_clock_get_monotonic() - start;
+    return ZX_OK;
+}
+
+zx_status_t serve_fifo(zx_handle_t fifo, const bench_case_t& bench_case) {
+    uint32_t size = bench_case.size;
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[bench_case.depth * size]());
+    uint64_t written = 0;
+    while (written < bench_case.count) {
+        uint64_t left = bench_case.count - written;
+        size_t count = left < bench_case.depth ? left : bench_case.depth;
+        for (size_t i = 0; i < count; i++) {
+            uint64_t sequence = written + i;
+            memcpy(buffer.get() + i * size, &sequence, sizeof(sequence));
+        }
+
+        size_t actual;
+        zx_status_t st = trace::fifo_write(fifo, size, buffer.get(), count,
+                                           &actual);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            st = trace::object_wait_one(
+                fifo, ZX_FIFO_WRITABLE | ZX_FIFO_PEER_CLOSED,
+                ZX_TIME_INFINITE, nullptr);
+            if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        } else if (st != ZX_OK) {
+            return st;
+        }
+        written += actual;
+    }
+    return ZX_OK;
+}
+
+zx_status_t bench_fifos(zx_handle_t bootstrap, const options_t& options,
+                        FILE* out) {
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[ZX_FIFO_MAX_SIZE_BYTES]);
+    for (uint32_t size : kElementSizes) {
+        for (uint32_t depth = kMinFifoDepth;
+             depth <= kMaxFifoDepth && depth * size <= ZX_FIFO_MAX_SIZE_BYTES;
+             depth *= 2) {
+            char name[96];
+            snprintf(name, sizeof(name), "%s.fifo.elem%u.depth%u.throughput",
+                     options.prefix, size, depth);
+            if (!selected(options, name)) {
+                continue;
+            }
+
+            uint64_t count = kFifoElements;
+            zx_duration_t best = ZX_TIME_INFINITE;
+            for (uint32_t run = 0; run <= options.repeat; run++) {
+                zx_duration_t elapsed;
+                zx_status_t st = fifo_run(bootstrap, size, depth, count,
+                                          buffer.get(), &elapsed);
+                if (st != ZX_OK) {
+                    ERR("fifo run of %u x %u bytes failed, st = %d\n", depth,
+                        size, st);
+                    return st;
+                }
+                if (run == 0) {
+                    count = calibrate(count, elapsed);
+                } else {
+                    best = elapsed < best ? elapsed : best;
+                }
+            }
+            histogram::PrintValue(out, name, "elem/s",
+                                  count / (static_cast<double>(best) / ZX_SEC(1)),
+                                  options.format);
+        }
+    }
+    return ZX_OK;
+}
@@ -0,0 +1,173 @@
+// IPC benchmark suite. This program starts a child process and measures the
+// IPC primitives the samples are built on, across the parameters that matter
+// for each:
+//
+//   ipc-bench.channel.oneway.<size>.throughput
+//       one-way channel throughput for messages of 16 B to 64 KiB;
+//   ipc-bench.channel.roundtrip.depth<N>.{p50,throughput}
+//       round trips with 1 to 64 requests in flight;
+//   ipc-bench.fifo.elem<size>.depth<N>.throughput
+//       fifo throughput for 8 to 64 byte elements and depths of 8 up to
+//       4096, or as deep as ZX_FIFO_MAX_SIZE_BYTES allows for the size.
+//
+// Usage: ipc-bench [--repeat=N] [--filter=PREFIX] [--out=PATH]
+//                  [--format=text|csv|json] [--parent-cpu=N] [--child-cpu=N]
+//                  [--profile=default|high|realtime|deadline:C/P]
+//
+// --repeat=N times every case N times, after a warm-up run, and reports the
+// best run.
+// --filter=PREFIX only runs the cases whose names, topology included, start
+// with PREFIX.
+// --parent-cpu=N and --child-cpu=N pin the main thread of the parent and of
+// the child to CPU N. With both set, every result name gets how the two CPUs
+// share hardware after ipc-bench, e.g. ipc-bench.smt.channel.oneway.16.
+// --profile gives both main threads a scheduling profile, as in
+// channel-two-way.
+// --out=PATH writes the results to PATH instead of stdout.
+// --format picks the output format; JSON, the default, writes one object per
+// result, which is what compare.py reads:
+//
+//   compare.py --baseline=FILE... --results=FILE... [--threshold=PERCENT]
+//              [--rerun=COMMAND]
+//
+// judges every case on the median of its runs on each side, and exits with 1
+// if any is slower by more than both PERCENT (default 5) and what the
+// baseline runs' noise allows, and, with --rerun, still is when COMMAND
+// measures it again. A case too noisy to resolve PERCENT is reported as
+// unreliable and fails as well.
+// Baselines are only meaningful on the machine they were taken on, so none
+// is checked in: the ipc-bench-baseline build target records one, and until
+// it has run, ipc-bench-check has nothing to compare against.
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <placement/placement.h>
+#include <spawn/spawn.h>
+
+#include <zircon/syscalls.h>
+#include <zircon/types.h>
+
+#include "common.h"
+
+// Parses the options shared by the parent and the child. Returns false if an
+// argument is malformed.
+bool parse_options(int argc, const char* argv[], options_t* options) {
+    options->repeat = 5;
+    options->filter = nullptr;
+    options->out = nullptr;
+    options->format = histogram::Format::kJson;
+    options->parent_cpu = placement::kAnyCpu;
+    options->child_cpu = placement::kAnyCpu;
+    options->profile = placement::Profile();
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (!strcmp(arg, spawn::kChildArg)) {
+            continue;
+        } else if (!strncmp(arg, "--repeat=", 9)) {
+            options->repeat = static_cast<uint32_t>(strtoul(arg + 9, nullptr, 0));
+            if (options->repeat == 0 || options->repeat > kMaxRepeat) {
+                fprintf(stderr, "repeat must be in [1, %u]\n", kMaxRepeat);
+                return false;
+            }
+        } else if (!strncmp(arg, "--filter=", 9)) {
+            options->filter = arg + 9;
+        } else if (!strncmp(arg, "--out=", 6)) {
+            options->out = arg + 6;
+        } else if (!strncmp(arg, "--format=", 9)) {
+            if (!histogram::ParseFormat(arg + 9, &options->format)) {
+                fprintf(stderr, "unknown format '%s'\n", arg + 9);
+                return false;
+            }
+        } else if (!strncmp(arg, "--parent-cpu=", 13)) {
+            if (!placement::ParseCpu(arg + 13, &options->parent_cpu)) {
+                fprintf(stderr, "parent cpu must be below %u\n",
+                        placement::NumCpus());
+                return false;
+            }
+        } else if (!strncmp(arg, "--child-cpu=", 12)) {
+            if (!placement::ParseCpu(arg + 12, &options->child_cpu)) {
+                fprintf(stderr, "child cpu must be below %u\n",
+                        placement::NumCpus());
+                return false;
+            }
+        } else if (!strncmp(arg, "--profile=", 10)) {
+            if (!placement::ParseProfile(arg + 10, &options->profile)) {
+                fprintf(stderr, "unknown profile '%s'\n", arg + 10);
+                return false;
+            }
+        } else {
+            fprintf(stderr, "unknown argument '%s'\n", arg);
+            return false;
+        }
+    }
+
+    placement::Topology topology =
+        placement::Relate(options->parent_cpu, options->child_cpu);
+    if (topology == placement::Topology::kUnpinned) {
+        snprintf(options->prefix, sizeof(options->prefix), "ipc-bench");
+    } else {
+        snprintf(options->prefix, sizeof(options->prefix), "ipc-bench.%s",
+                 placement::TopologyName(topology));
+    }
+    return true;
+}
+
+// Pins the calling thread to |cpu| and gives it the profile from |options|.
+static zx_status_t place(int32_t cpu, const options_t& options,
+                         const char* who) {
+    zx_status_t st = placement::Apply(cpu, options.profile);
+    if (st != ZX_OK) {
+        fprintf(stderr, "[%s]: Can't run on cpu %d with that profile, st = %d\n",
+                who, cpu, st);
+    }
+    return st;
+}
+
+int main(int argc, const char* argv[]) {
+    options_t options;
+    if (!parse_options(argc, argv, &options)) {
+        return -1;
+    }
+
+    if (spawn::IsChild(argc, argv)) {
+        zx_status_t st = place(options.child_cpu, options, "CHILD");
+        if (st != ZX_OK) {
+            return st;
+        }
+        zx_handle_t to_parent;
+        st = spawn::TakeBootstrap(&to_parent);
+        if (st != ZX_OK) {
+            fprintf(stderr, "[CHILD]: Failed to take bootstrap channel, st = %d\n", st);
+            return st;
+        }
+        return child(to_parent, options);
+    } else {
+        char path[PATH_MAX];
+        const char* args[spawn::kMaxArgs + 2];
+        zx_status_t st = spawn::SelfPath(argv[0], path, sizeof(path));
+        if (st == ZX_OK) {
+            st = spawn::ChildArgs(argc, argv, args);
+        }
+        if (st != ZX_OK) {
+            fprintf(stderr, "[PARENT]: Can't build child command line, st = %d\n", st);
+            return st;
+        }
+        spawn::child_t to_child = {};
+        st = spawn::Spawn(path, args, &to_child, 1);
+        if (st != ZX_OK) {
+            return st;
+        }
+        // Pin only once the child is running, so that it doesn't inherit
+        // our placement on the host backend.
+        st = place(options.parent_cpu, options, "PARENT");
+        if (st != ZX_OK) {
+            zx_handle_close(to_child.channel);
+            return st;
+        }
+        return parent(to_child.channel, options);
+    }
+}
@@ -0,0 +1,93 @@
+#define LOG_PREFIX "[PARNT]"
+#include "common.h"
+
+#include <string.h>
+
+#include <trace/syscalls.h>
+#include <zircon/syscalls.h>
+
+bool selected(const options_t& options, const char* name) {
+    return options.filter == nullptr ||
+           !strncmp(name, options.filter, strlen(options.filter));
+}
+
+uint64_t calibrate(uint64_t count, zx_duration_t elapsed) {
+    if (elapsed <= 0) {
+        return count;
+    }
+    double scaled = static_cast<double>(count) * kTargetRun / elapsed;
+    return scaled < 1 ? 1 : static_cast<uint64_t>(scaled);
+}
+
+zx_status_t write_all(zx_handle_t channel, const void* bytes,
+                      uint32_t num_bytes) {
+    while (true) {
+        zx_status_t st = trace::channel_write(channel, 0, bytes, num_bytes,
+                                              nullptr, 0);
+        if (st != ZX_ERR_SHOULD_WAIT) {
+            return st;
+        }
+        st = trace::object_wait_one(
+            channel, ZX_CHANNEL_WRITABLE | ZX_CHANNEL_PEER_CLOSED,
+            ZX_TIME_INFINITE, nullptr);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+}
+
+zx_status_t start_case(zx_handle_t bootstrap, const bench_case_t& bench_case,
+                       zx_handle_t handle) {
+    zx_status_t st = trace::channel_write(bootstrap, 0, &bench_case,
+                                          sizeof(bench_case), &handle, 1);
+    if (st != ZX_OK) {
+        // On the host backend a failed write leaves the handle with us.
+        zx_handle_close(handle);
+        ERR("failed to send case %u to the child, st = %d\n", bench_case.kind,
+            st);
+        return st;
+    }
+
+    st = trace::object_wait_one(
+        bootstrap, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+        ZX_TIME_INFINITE, nullptr);
+    if (st != ZX_OK) {
+        return st;
+    }
+    uint64_t ready;
+    uint32_t actual_bytes;
+    st = trace::channel_read(bootstrap, 0, &ready, nullptr, sizeof(ready), 0,
+                             &actual_bytes, nullptr);
+    if (st != ZX_OK) {
+        ERR("child didn't take case %u, st = %d\n", bench_case.kind, st);
+        return st;
+    }
+    if (actual_bytes != sizeof(ready) || ready != kReady) {
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+    return ZX_OK;
+}
+
+zx_status_t parent(zx_handle_t bootstrap, const options_t& options) {
+    FILE* out = stdout;
+    if (options.out != nullptr) {
+        out = fopen(options.out, "w");
+        if (out == nullptr) {
+            ERR("can't open %s for writing\n", options.out);
+            zx_handle_close(bootstrap);
+            return ZX_ERR_IO;
+        }
+    }
+
+    zx_status_t st = bench_channels(bootstrap, options, out);
+    if (st == ZX_OK) {
+        st = bench_fifos(bootstrap, options, out);
+    }
+
+    // Closing the bootstrap channel tells the child to exit.
+    zx_handle_close(bootstrap);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return st;
+}
@@ -0,0 +1,99 @@
+#include <coro/coro.h>
+
+namespace coro {
+
+std::coroutine_handle<> Task::FinalAwaiter::await_suspend(
+    handle_type handle) noexcept {
+    promise_type& promise = handle.promise();
+    if (promise.continuation) {
+        return promise.continuation;
+    }
+    // A spawned task; nobody is waiting for it.
+    if (promise.executor != nullptr) {
+        promise.executor->Done(handle);
+    }
+    return std::noop_coroutine();
+}
+
+bool Operation::Arm() {
+    // The key is the operation itself; it lives in the suspended task's frame
+    // until the task resumes.
+    status_ = zx_object_wait_async(handle_, executor_->port(),
+                                   reinterpret_cast<uintptr_t>(this), signals_,
+                                   ZX_WAIT_ASYNC_ONCE);
+    return status_ == ZX_OK;
+}
+
+void Operation::OnSignal(zx_signals_t observed) {
+    observed_ = observed;
+    if (Attempt() || !Arm()) {
+        waiter_.resume();
+    }
+}
+
+zx_status_t Executor::Create(std::unique_ptr<Executor>* out) {
+    zx_handle_t port;
+    zx_status_t st = zx_port_create(0, &port);
+    if (st != ZX_OK) {
+        return st;
+    }
+    out->reset(new Executor(port));
+    return ZX_OK;
+}
+
+Executor::~Executor() {
+    while (tasks_ != nullptr) {
+        Task::promise_type* promise = tasks_;
+        tasks_ = promise->next;
+        Task::handle_type::from_promise(*promise).destroy();
+    }
+}
+
+void Executor::Spawn(Task task) {
+    Task::handle_type handle = std::exchange(task.handle_, nullptr);
+    Task::promise_type& promise = handle.promise();
+    promise.executor = this;
+    promise.next = tasks_;
+    if (tasks_ != nullptr) {
+        tasks_->prev = &promise;
+    }
+    tasks_ = &promise;
+    live_++;
+    handle.resume();
+}
+
+void Executor::Done(Task::handle_type handle) {
+    Task::promise_type& promise = handle.promise();
+    if (promise.status != ZX_OK && first_failure_ == ZX_OK) {
+        first_failure_ = promise.status;
+    }
+    if (promise.prev != nullptr) {
+        promise.prev->next = promise.next;
+    } else {
+        tasks_ = promise.next;
+    }
+    if (promise.next != nullptr) {
+        promise.next->prev = promise.prev;
+    }
+    live_--;
+    // Suspended at its final point, so it is safe to destroy it from here.
+    handle.destroy();
+}
+
+zx_status_t Executor::Run() {
+    while (live_ > 0) {
+        zx_port_packet_t packet;
+        zx_status_t st = zx_port_wait(port_.get(), ZX_TIME_INFINITE, &packet);
+        if (st != ZX_OK) {
+            return st;
+        }
+        wakeups_++;
+        reinterpret_cast<Operation*>(packet.key)->OnSignal(
+            packet.signal.observed);
+    }
+    zx_status_t st = first_failure_;
+    first_failure_ = ZX_OK;
+    return st;
+}
+
+} // namespace coro
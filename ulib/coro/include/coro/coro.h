@@ -0,0 +1,380 @@
+#pragma once
+
+// Coroutines over ports.
+//
+// A Task is a coroutine that returns a zx_status_t. Tasks are started with
+// Executor::Spawn and run on the thread that calls Executor::Run, which waits
+// on a single port (epoll on the host backend). Handlers co_await channel and
+// fifo operations; an operation that can't complete right away registers a
+// one-shot async wait on the executor's port and suspends the task, and the
+// executor retries it once the signal arrives. One thread can so serve any
+// number of peers, at the cost of a coroutine frame per conversation instead
+// of a thread.
+//
+//     coro::Task echo(coro::Channel* channel) {
+//         char buffer[64];
+//         uint32_t actual;
+//         while (co_await channel->Read(buffer, sizeof(buffer), &actual) == ZX_OK) {
+//             co_await channel->Write(buffer, actual);
+//         }
+//         co_return ZX_OK;
+//     }
+//
+// Tasks can co_await each other too; the inner task runs to completion before
+// the outer one resumes.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+
+#include <typed/handle.h>
+#include <zircon/syscalls.h>
+#include <zircon/types.h>
+
+namespace coro {
+
+class Executor;
+
+class Task {
+public:
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle_type handle) noexcept;
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type {
+        Task get_return_object() {
+            return Task(handle_type::from_promise(*this));
+        }
+        // Tasks start when they are awaited or spawned.
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(zx_status_t value) { status = value; }
+        void unhandled_exception() { std::terminate(); }
+
+        zx_status_t status = ZX_OK;
+        // Who to resume when we are done: the awaiting task, or nobody if
+        // the task was spawned.
+        std::coroutine_handle<> continuation;
+        // Set for spawned tasks, which the executor owns and keeps on a list
+        // so that it can destroy the ones still suspended.
+        Executor* executor = nullptr;
+        promise_type* prev = nullptr;
+        promise_type* next = nullptr;
+    };
+
+    Task(Task&& other) : handle_(std::exchange(other.handle_, nullptr)) {}
+    Task& operator=(Task&& other) {
+        if (handle_) {
+            handle_.destroy();
+        }
+        handle_ = std::exchange(other.handle_, nullptr);
+        return *this;
+    }
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    // co_await runs the task and returns its status.
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+    zx_status_t await_resume() { return handle_.promise().status; }
+
+private:
+    friend class Executor;
+
+    explicit Task(handle_type handle) : handle_(handle) {}
+
+    handle_type handle_;
+};
+
+// Base of everything a task can co_await on a handle. Attempt() tries the
+// operation without blocking; as long as it has to wait, the operation is
+// parked on the executor's port until one of |signals| is asserted.
+class Operation {
+public:
+    Operation(const Operation&) = delete;
+    Operation& operator=(const Operation&) = delete;
+
+    bool await_ready() { return Attempt(); }
+    bool await_suspend(std::coroutine_handle<> waiter) {
+        waiter_ = waiter;
+        return Arm();
+    }
+    zx_status_t await_resume() const { return status_; }
+
+protected:
+    Operation(Executor* executor, zx_handle_t handle, zx_signals_t signals)
+        : handle_(handle), executor_(executor), signals_(signals) {}
+
+    // Returns true once the operation is over and |status_| says how it went,
+    // or false if it has to wait for |signals_|.
+    virtual bool Attempt() = 0;
+
+    // The handle the operation is on.
+    const zx_handle_t handle_;
+    zx_status_t status_ = ZX_OK;
+    // What the last wakeup saw; 0 before the first.
+    zx_signals_t observed_ = 0;
+
+private:
+    friend class Executor;
+
+    // Registers the async wait. Returns false, so that the task carries on
+    // with the error, if that fails.
+    bool Arm();
+    // Called by the executor when the wait fires.
+    void OnSignal(zx_signals_t observed);
+
+    Executor* const executor_;
+    const zx_signals_t signals_;
+    std::coroutine_handle<> waiter_;
+};
+
+// Waits until one of |signals| is asserted on a handle, and returns what was
+// observed.
+class Wait : public Operation {
+public:
+    Wait(Executor* executor, zx_handle_t handle, zx_signals_t signals,
+         zx_signals_t* observed)
+        : Operation(executor, handle, signals), out_(observed) {}
+
+private:
+    bool Attempt() override {
+        if (observed_ == 0) {
+            return false;
+        }
+        if (out_ != nullptr) {
+            *out_ = observed_;
+        }
+        return true;
+    }
+
+    zx_signals_t* const out_;
+};
+
+class Executor {
+public:
+    static zx_status_t Create(std::unique_ptr<Executor>* out);
+
+    // Destroys any task that is still suspended.
+    ~Executor();
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // Starts |task|, which runs until it first has to wait. The executor
+    // owns it from here on.
+    void Spawn(Task task);
+
+    // Runs the spawned tasks until all of them are done. Returns the first
+    // failure any of them returned, or ZX_OK.
+    zx_status_t Run();
+
+    // Spawned tasks that haven't finished yet.
+    size_t live() const { return live_; }
+    // Times Run woke up for a signal.
+    uint64_t wakeups() const { return wakeups_; }
+
+    zx_handle_t port() const { return port_.get(); }
+
+private:
+    friend class Task::FinalAwaiter;
+
+    explicit Executor(zx_handle_t port) : port_(port) {}
+
+    // A spawned task finished; forget it.
+    void Done(Task::handle_type handle);
+
+    typed::Handle port_;
+    // Spawned tasks that haven't finished.
+    Task::promise_type* tasks_ = nullptr;
+    size_t live_ = 0;
+    uint64_t wakeups_ = 0;
+    zx_status_t first_failure_ = ZX_OK;
+};
+
+// A channel driven by an executor. It owns the handle.
+class Channel {
+public:
+    Channel(Executor* executor, zx_handle_t handle)
+        : executor_(executor), handle_(handle) {}
+
+    // Reads one message, waiting for it if none is queued. Returns
+    // ZX_ERR_PEER_CLOSED once the peer is gone and nothing is left.
+    class ReadOp : public Operation {
+    public:
+        ReadOp(Channel* channel, void* bytes, uint32_t num_bytes,
+               uint32_t* actual_bytes, zx_handle_t* handles,
+               uint32_t num_handles, uint32_t* actual_handles)
+            : Operation(channel->executor_, channel->handle_.get(),
+                        ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED),
+              bytes_(bytes),
+              num_bytes_(num_bytes), actual_bytes_(actual_bytes),
+              handles_(handles), num_handles_(num_handles),
+              actual_handles_(actual_handles) {}
+
+    private:
+        bool Attempt() override {
+            status_ = zx_channel_read(handle_, 0, bytes_, handles_, num_bytes_,
+                                      num_handles_, actual_bytes_,
+                                      actual_handles_);
+            return status_ != ZX_ERR_SHOULD_WAIT;
+        }
+
+        void* const bytes_;
+        const uint32_t num_bytes_;
+        uint32_t* const actual_bytes_;
+        zx_handle_t* const handles_;
+        const uint32_t num_handles_;
+        uint32_t* const actual_handles_;
+    };
+
+    // Writes one message, waiting for room if the peer's queue is full (host
+    // backend only). The handles are consumed either way.
+    class WriteOp : public Operation {
+    public:
+        WriteOp(Channel* channel, const void* bytes, uint32_t num_bytes,
+                const zx_handle_t* handles, uint32_t num_handles)
+            : Operation(channel->executor_, channel->handle_.get(),
+                        ZX_CHANNEL_WRITABLE | ZX_CHANNEL_PEER_CLOSED),
+              bytes_(bytes),
+              num_bytes_(num_bytes), handles_(handles),
+              num_handles_(num_handles) {}
+
+    private:
+        bool Attempt() override {
+            status_ = zx_channel_write(handle_, 0, bytes_, num_bytes_,
+                                       handles_, num_handles_);
+            if (status_ == ZX_ERR_SHOULD_WAIT) {
+                return false;
+            }
+            if (status_ != ZX_OK) {
+                for (uint32_t i = 0; i < num_handles_; i++) {
+                    zx_handle_close(handles_[i]);
+                }
+            }
+            return true;
+        }
+
+        const void* const bytes_;
+        const uint32_t num_bytes_;
+        const zx_handle_t* const handles_;
+        const uint32_t num_handles_;
+    };
+
+    ReadOp Read(void* bytes, uint32_t num_bytes, uint32_t* actual_bytes,
+                zx_handle_t* handles = nullptr, uint32_t num_handles = 0,
+                uint32_t* actual_handles = nullptr) {
+        return ReadOp(this, bytes, num_bytes, actual_bytes, handles,
+                      num_handles, actual_handles);
+    }
+
+    WriteOp Write(const void* bytes, uint32_t num_bytes,
+                  const zx_handle_t* handles = nullptr,
+                  uint32_t num_handles = 0) {
+        return WriteOp(this, bytes, num_bytes, handles, num_handles);
+    }
+
+    const typed::Handle& handle() const { return handle_; }
+
+private:
+    Executor* const executor_;
+    typed::Handle handle_;
+};
+
+// A fifo of T driven by an executor. It owns the handle.
+template <typename T>
+class Fifo {
+public:
+    Fifo(Executor* executor, zx_handle_t handle)
+        : executor_(executor), handle_(handle) {}
+
+    // Reads as many elements as are queued, up to |count|, waiting for at
+    // least one. Returns ZX_ERR_PEER_CLOSED once the peer is gone and the
+    // fifo is empty.
+    class ReadOp : public Operation {
+    public:
+        ReadOp(Fifo* fifo, T* elements, size_t count, size_t* actual)
+            : Operation(fifo->executor_, fifo->handle_.get(),
+                        ZX_FIFO_READABLE | ZX_FIFO_PEER_CLOSED),
+              elements_(elements), count_(count),
+              actual_(actual) {}
+
+    private:
+        bool Attempt() override {
+            status_ = zx_fifo_read(handle_, sizeof(T), elements_, count_, actual_);
+            return status_ != ZX_ERR_SHOULD_WAIT;
+        }
+
+        T* const elements_;
+        const size_t count_;
+        size_t* const actual_;
+    };
+
+    // Writes all |count| elements, waiting for room as often as it takes.
+    class WriteOp : public Operation {
+    public:
+        WriteOp(Fifo* fifo, const T* elements, size_t count)
+            : Operation(fifo->executor_, fifo->handle_.get(),
+                        ZX_FIFO_WRITABLE | ZX_FIFO_PEER_CLOSED),
+              elements_(elements), count_(count) {}
+
+    private:
+        bool Attempt() override {
+            while (written_ < count_) {
+                size_t actual;
+                status_ = zx_fifo_write(handle_, sizeof(T), elements_ + written_,
+                                        count_ - written_, &actual);
+                if (status_ == ZX_ERR_SHOULD_WAIT) {
+                    return false;
+                } else if (status_ != ZX_OK) {
+                    return true;
+                }
+                written_ += actual;
+            }
+            return true;
+        }
+
+        const T* const elements_;
+        const size_t count_;
+        size_t written_ = 0;
+    };
+
+    ReadOp Read(T* elements, size_t count, size_t* actual) {
+        return ReadOp(this, elements, count, actual);
+    }
+
+    WriteOp Write(const T* elements, size_t count) {
+        return WriteOp(this, elements, count);
+    }
+
+    template <size_t N>
+    WriteOp Write(const T (&elements)[N]) {
+        return WriteOp(this, elements, N);
+    }
+
+    const typed::Handle& handle() const { return handle_; }
+
+private:
+    Executor* const executor_;
+    typed::Handle handle_;
+};
+
+} // namespace coro
@@ -0,0 +1,24 @@
+# Copyright 2018 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := userlib
+
+MODULE_SRCS += \
+    $(LOCAL_DIR)/coro.cpp
+
+# Coroutines need C++20; modules that include <coro/coro.h> need it too.
+MODULE_CPPFLAGS += -std=c++20
+
+# Header-only.
+MODULE_COMPILEFLAGS += -I$(dir $(LOCAL_DIR))typed/include
+
+MODULE_LIBS := system/ulib/c system/ulib/zircon
+
+MODULE_PACKAGE := static
+
+include make/module.mk
@@ -0,0 +1,156 @@
+#include <histogram/histogram.h>
+
+#include <string.h>
+
+#include <zircon/compiler.h>
+
+namespace histogram {
+
+namespace {
+
+// Percentiles reported in every format.
+constexpr double kSummaryPercentiles[] = {50, 90, 99, 99.9};
+constexpr const char* kSummaryNames[] = {"p50", "p90", "p99", "p99.9"};
+
+// Percentiles in the text ladder: each step halves the remaining tail.
+constexpr double kLadderPercentiles[] = {
+    0, 50, 75, 87.5, 90, 93.75, 96.875, 99, 99.5, 99.9, 99.95, 99.99, 100,
+};
+
+} // namespace
+
+bool ParseFormat(const char* name, Format* out) {
+    if (!strcmp(name, "text")) {
+        *out = Format::kText;
+    } else if (!strcmp(name, "csv")) {
+        *out = Format::kCsv;
+    } else if (!strcmp(name, "json")) {
+        *out = Format::kJson;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void PrintValue(FILE* out, const char* name, const char* unit, double value,
+                Format format) {
+    switch (format) {
+    case Format::kText:
+        fprintf(out, "%s: %.1f %s\n", name, value, unit);
+        break;
+    case Format::kCsv:
+        fprintf(out, "%s,%s,%.1f\n", name, unit, value);
+        break;
+    case Format::kJson:
+        fprintf(out, "{\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.1f}\n",
+                name, unit, value);
+        break;
+    }
+}
+
+void Histogram::Reset() {
+    memset(counts_, 0, sizeof(counts_));
+    count_ = 0;
+    sum_ = 0;
+    min_ = UINT64_MAX;
+    max_ = 0;
+}
+
+void Histogram::Merge(const Histogram& other) {
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    if (other.min_ < min_) {
+        min_ = other.min_;
+    }
+    if (other.max_ > max_) {
+        max_ = other.max_;
+    }
+}
+
+uint64_t Histogram::HighestValueAt(size_t index) {
+    if (index < kSubBucketCount) {
+        return index;
+    }
+    uint32_t shift = static_cast<uint32_t>(index / kSubBucketCount) - 1;
+    uint64_t sub_bucket = index % kSubBucketCount;
+    uint64_t lowest = (kSubBucketCount + sub_bucket) << shift;
+    return lowest + ((uint64_t{1} << shift) - 1);
+}
+
+uint64_t Histogram::ValueAtPercentile(double percentile) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    if (percentile <= 0) {
+        return min_;
+    }
+    if (percentile >= 100) {
+        return max_;
+    }
+
+    uint64_t target = static_cast<uint64_t>(percentile / 100.0 * count_ + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        seen += counts_[i];
+        if (seen >= target) {
+            uint64_t value = HighestValueAt(i);
+            return value < max_ ? value : max_;
+        }
+    }
+    return max_;
+}
+
+void Histogram::Print(FILE* out, const char* name, const char* unit,
+                      Format format) const {
+    switch (format) {
+    case Format::kText:
+        fprintf(out, "%s: %lu samples, in %s\n", name, count_, unit);
+        fprintf(out, "  %12s %12s", "min", "mean");
+        for (const char* p : kSummaryNames) {
+            fprintf(out, " %12s", p);
+        }
+        fprintf(out, " %12s\n", "max");
+        fprintf(out, "  %12lu %12.1f", min(), mean());
+        for (double p : kSummaryPercentiles) {
+            fprintf(out, " %12lu", ValueAtPercentile(p));
+        }
+        fprintf(out, " %12lu\n", max());
+        fprintf(out, "  %12s %12s\n", "percentile", unit);
+        for (double p : kLadderPercentiles) {
+            fprintf(out, "  %11.3f%% %12lu\n", p, ValueAtPercentile(p));
+        }
+        break;
+
+    case Format::kCsv:
+        // One name,unit,value row per statistic, as PrintValue writes them,
+        // so histograms and single values can share one table.
+        fprintf(out, "%s.count,samples,%lu\n", name, count_);
+        fprintf(out, "%s.min,%s,%lu\n", name, unit, min());
+        fprintf(out, "%s.mean,%s,%.1f\n", name, unit, mean());
+        for (size_t i = 0; i < countof(kSummaryPercentiles); i++) {
+            fprintf(out, "%s.%s,%s,%lu\n", name, kSummaryNames[i], unit,
+                    ValueAtPercentile(kSummaryPercentiles[i]));
+        }
+        fprintf(out, "%s.max,%s,%lu\n", name, unit, max());
+        break;
+
+    case Format::kJson:
+        fprintf(out, "{\"name\": \"%s\", \"unit\": \"%s\", \"count\": %lu, "
+                     "\"min\": %lu, \"mean\": %.1f",
+                name, unit, count_, min(), mean());
+        for (size_t i = 0; i < countof(kSummaryPercentiles); i++) {
+            fprintf(out, ", \"%s\": %lu", kSummaryNames[i],
+                    ValueAtPercentile(kSummaryPercentiles[i]));
+        }
+        fprintf(out, ", \"max\": %lu}\n", max());
+        break;
+    }
+}
+
+} // namespace histogram
@@ -0,0 +1,96 @@
+#pragma once
+
+// An HDR-style (log-linear) histogram for latency measurements.
+//
+// Values below 2^kSubBucketBits are counted exactly. Above that, every power
+// of two is split into 2^kSubBucketBits linear sub-buckets, so any recorded
+// value is reported within 1 / 2^kSubBucketBits (0.8%) of its true value over
+// the whole uint64_t range. Recording is a handful of integer instructions and
+// never allocates, so it is safe to call from a timed loop.
+
+#include <stdint.h>
+#include <stdio.h>
+
+namespace histogram {
+
+// Output formats for Histogram::Print.
+enum class Format {
+    kText,
+    kCsv,
+    kJson,
+};
+
+// Parses "text", "csv" or "json". Returns false on anything else.
+bool ParseFormat(const char* name, Format* out);
+
+// Prints a single measurement, such as a throughput, in |format|. CSV rows
+// have the columns name,unit,value, with no header line, for every value
+// and histogram alike.
+void PrintValue(FILE* out, const char* name, const char* unit, double value,
+                Format format);
+
+class Histogram {
+public:
+    static constexpr uint32_t kSubBucketBits = 7;
+    static constexpr uint64_t kSubBucketCount = 1u << kSubBucketBits;
+    static constexpr size_t kNumBuckets =
+        kSubBucketCount * (64 - kSubBucketBits + 1);
+
+    Histogram() { Reset(); }
+
+    void Reset();
+
+    void Record(uint64_t value) {
+        counts_[IndexOf(value)]++;
+        count_++;
+        sum_ += value;
+        if (value < min_) {
+            min_ = value;
+        }
+        if (value > max_) {
+            max_ = value;
+        }
+    }
+
+    // Adds all of |other|'s samples to this histogram.
+    void Merge(const Histogram& other);
+
+    uint64_t count() const { return count_; }
+    uint64_t min() const { return count_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const { return count_ ? static_cast<double>(sum_) / count_ : 0; }
+
+    // Returns the smallest recorded value such that |percentile| percent of
+    // all samples are less than or equal to it (to within the histogram's
+    // precision). |percentile| is in [0, 100].
+    uint64_t ValueAtPercentile(double percentile) const;
+
+    // Prints a summary of the distribution of the samples, which are in units
+    // of |unit| (e.g. "ns"), labelled |name|. In kText the summary is followed
+    // by a percentile ladder. kCsv prints one name,unit,value row per
+    // statistic, named |name|.count, |name|.min, |name|.p50 and so on.
+    void Print(FILE* out, const char* name, const char* unit,
+               Format format) const;
+
+private:
+    static size_t IndexOf(uint64_t value) {
+        if (value < kSubBucketCount) {
+            return static_cast<size_t>(value);
+        }
+        uint32_t exponent = 63 - __builtin_clzll(value);
+        uint32_t shift = exponent - kSubBucketBits;
+        uint64_t sub_bucket = (value >> shift) - kSubBucketCount;
+        return static_cast<size_t>(kSubBucketCount * (shift + 1) + sub_bucket);
+    }
+
+    // Largest value that maps to |index|.
+    static uint64_t HighestValueAt(size_t index);
+
+    uint64_t counts_[kNumBuckets];
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
+
+} // namespace histogram
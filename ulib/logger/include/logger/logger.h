@@ -0,0 +1,224 @@
+#pragma once
+
+// Asynchronous logging for the samples.
+//
+// ERR, LOG and DBG don't format anything on the caller's thread. They claim
+// a slot in a per-process ring, without taking a lock, and copy the format
+// string's address and the arguments into it; string arguments are copied
+// by value, up to their precision if the format gives one, so the caller's
+// buffers may go away as soon as the call returns. A background thread
+// formats finished records and writes them out in order, whole records at a
+// time, so output from the processes sharing a terminal or pipe never
+// interleaves mid-line. It wakes every few milliseconds, or early for an
+// error or once the ring is half full; a full ring makes writers wait for it
+// rather than drop records.
+//
+// Every file defines LOG_PREFIX before including this header; it tags each
+// record with the side that wrote it, and the logger adds the process's
+// koid (its pid on the host, as trace::ProcessId gives it), as in
+// "[PARNT 1234] ...", which matches the name of its trace file. Calls above LOG_LEVEL (kInfo unless the build
+// says otherwise) compile to nothing, arguments included.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <type_traits>
+
+namespace logger {
+
+enum Level : int {
+    kError = 0,
+    kInfo = 1,
+    kDebug = 2,
+};
+
+// Longest record, including the prefix. Longer ones are truncated.
+constexpr size_t kMaxRecord = 240;
+
+// Most arguments one record takes, counting '*' widths and precisions.
+constexpr size_t kMaxArgs = 12;
+
+// Writes out everything queued so far before returning. Runs at exit too.
+void Flush();
+
+namespace internal {
+
+enum ArgType : uint8_t {
+    kInt,
+    kUnsigned,
+    kLong,
+    kUnsignedLong,
+    kLongLong,
+    kUnsignedLongLong,
+    kDouble,
+    kPointer,
+    kString,
+};
+
+union Arg {
+    long long i;
+    unsigned long long u;
+    double d;
+    const void* p;
+    const char* s;
+};
+
+// How much of each %s argument the format will print: kUnbounded, the
+// precision the format spells out, or kStarBound to take it from the
+// argument before.
+constexpr int32_t kUnbounded = -1;
+constexpr int32_t kStarBound = -2;
+
+struct Bounds {
+    int32_t arg[kMaxArgs] = {};
+};
+
+// Worked out from the format literal at compile time, so a call pays
+// nothing for it.
+constexpr Bounds StringBounds(const char* fmt) {
+    Bounds bounds;
+    for (size_t i = 0; i < kMaxArgs; i++) {
+        bounds.arg[i] = kUnbounded;
+    }
+    size_t index = 0;
+    while (*fmt != '\0') {
+        if (*fmt++ != '%') {
+            continue;
+        }
+        if (*fmt == '%') {
+            fmt++;
+            continue;
+        }
+        while (*fmt == '-' || *fmt == '+' || *fmt == ' ' || *fmt == '#' ||
+               *fmt == '0' || *fmt == '\'') {
+            fmt++;
+        }
+        if (*fmt == '*') {
+            fmt++;
+            index++;
+        }
+        while (*fmt >= '0' && *fmt <= '9') {
+            fmt++;
+        }
+        int32_t precision = kUnbounded;
+        if (*fmt == '.') {
+            fmt++;
+            if (*fmt == '*') {
+                fmt++;
+                index++;
+                precision = kStarBound;
+            } else {
+                precision = 0;
+                while (*fmt >= '0' && *fmt <= '9') {
+                    precision = precision * 10 + (*fmt++ - '0');
+                }
+            }
+        }
+        while (*fmt == 'h' || *fmt == 'l' || *fmt == 'L' || *fmt == 'q' ||
+               *fmt == 'j' || *fmt == 'z' || *fmt == 't') {
+            fmt++;
+        }
+        if (*fmt == '\0') {
+            break;
+        }
+        if (*fmt++ == 's' && index < kMaxArgs) {
+            bounds.arg[index] = precision;
+        }
+        index++;
+    }
+    return bounds;
+}
+
+// Records the value each argument has after the default argument
+// promotions, which is what the format's conversions read.
+template <typename T>
+inline void Capture(T value, Arg* arg, ArgType* type) {
+    if constexpr (std::is_same<T, char*>::value ||
+                  std::is_same<T, const char*>::value) {
+        arg->s = value;
+        *type = kString;
+    } else if constexpr (std::is_pointer<T>::value ||
+                         std::is_null_pointer<T>::value) {
+        arg->p = value;
+        *type = kPointer;
+    } else if constexpr (std::is_floating_point<T>::value) {
+        static_assert(!std::is_same<T, long double>::value,
+                      "long double is not supported");
+        arg->d = value;
+        *type = kDouble;
+    } else {
+        static_assert(std::is_integral<T>::value || std::is_enum<T>::value,
+                      "unsupported log argument");
+        using Promoted = decltype(+value);
+        if constexpr (std::is_same<Promoted, int>::value) {
+            arg->i = value;
+            *type = kInt;
+        } else if constexpr (std::is_same<Promoted, unsigned int>::value) {
+            arg->u = value;
+            *type = kUnsigned;
+        } else if constexpr (std::is_same<Promoted, long>::value) {
+            arg->i = value;
+            *type = kLong;
+        } else if constexpr (std::is_same<Promoted, unsigned long>::value) {
+            arg->u = value;
+            *type = kUnsignedLong;
+        } else if constexpr (std::is_same<Promoted, long long>::value) {
+            arg->i = value;
+            *type = kLongLong;
+        } else {
+            arg->u = value;
+            *type = kUnsignedLongLong;
+        }
+    }
+}
+
+// Queues one record; kError records go to stderr, the rest to stdout.
+// |prefix| and |fmt| must be literals, since they are read when the record
+// is written out.
+void Submit(Level level, const char* prefix, const char* fmt,
+            const Bounds& bounds, const Arg* args, const ArgType* types,
+            size_t num_args);
+
+template <typename... Args>
+inline void Write(Level level, const char* prefix, const char* fmt,
+                  const Bounds& bounds, Args... values) {
+    static_assert(sizeof...(Args) <= kMaxArgs, "too many log arguments");
+    if constexpr (sizeof...(Args) == 0) {
+        Submit(level, prefix, fmt, bounds, nullptr, nullptr, 0);
+    } else {
+        Arg args[sizeof...(Args)];
+        ArgType types[sizeof...(Args)];
+        size_t index = 0;
+        ((Capture(values, &args[index], &types[index]), index++), ...);
+        Submit(level, prefix, fmt, bounds, args, types, sizeof...(Args));
+    }
+}
+
+// Never called; it lets the compiler check the arguments against the
+// format.
+inline void CheckFormat(const char*, ...) __attribute__((format(printf, 1, 2)));
+inline void CheckFormat(const char*, ...) {}
+
+} // namespace internal
+} // namespace logger
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL logger::kInfo
+#endif
+
+#define LOGGER_WRITE(level, fmt, ...)                                      \
+    do {                                                                   \
+        if ((level) <= (LOG_LEVEL)) {                                      \
+            if (false) {                                                   \
+                logger::internal::CheckFormat("" fmt, ##__VA_ARGS__);     \
+            }                                                              \
+            static constexpr logger::internal::Bounds logger_bounds =      \
+                logger::internal::StringBounds(fmt);                       \
+            logger::internal::Write((level), LOG_PREFIX, fmt,              \
+                                    logger_bounds, ##__VA_ARGS__);         \
+        }                                                                  \
+    } while (0)
+
+#define ERR(fmt, ...) LOGGER_WRITE(logger::kError, fmt, ##__VA_ARGS__)
+#define LOG(fmt, ...) LOGGER_WRITE(logger::kInfo, fmt, ##__VA_ARGS__)
+#define DBG(fmt, ...) LOGGER_WRITE(logger::kDebug, fmt, ##__VA_ARGS__)
@@ -0,0 +1,398 @@
+#include <logger/logger.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <trace/trace.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace logger {
+namespace {
+
+constexpr size_t kSlots = 1024;
+
+// Longest single write. Pipes write up to PIPE_BUF bytes atomically, so a
+// batch of records can't be split by another process's output.
+constexpr size_t kMaxWrite = 4096;
+static_assert(kMaxRecord <= kMaxWrite, "a record must fit in one write");
+
+// How long the flusher sleeps when nobody wakes it. Writers only cut the
+// nap short for an error or once half the ring is waiting, so a steady
+// trickle of records costs no wakeups at all.
+constexpr auto kFlushInterval = std::chrono::milliseconds(10);
+constexpr size_t kWakeBacklog = kSlots / 2;
+
+using internal::Arg;
+using internal::ArgType;
+
+// A slot is free for the writer at position p when |sequence| == p, and
+// holds a finished record for the flusher when |sequence| == p + 1. The
+// flusher hands it back for the next lap with p + kSlots.
+struct Slot {
+    std::atomic<uint64_t> sequence;
+    Level level;
+    uint32_t num_args;
+    const char* prefix;
+    const char* fmt;
+    ArgType types[kMaxArgs];
+    // A kString argument holds the offset of its copy in |strings|.
+    Arg args[kMaxArgs];
+    // Copies of the string arguments, NUL-terminated. They share one
+    // record's worth of text, plus room for the terminators.
+    char strings[kMaxRecord + kMaxArgs];
+};
+
+// Appends to a record of at most kMaxRecord - 1 bytes, noting whether
+// anything was cut off.
+class RecordBuilder {
+public:
+    explicit RecordBuilder(char* text) : text_(text) {}
+
+    void Append(const char* bytes, size_t length) {
+        size_t room = kMaxRecord - 1 - length_;
+        if (length > room) {
+            length = room;
+            truncated_ = true;
+        }
+        memcpy(text_ + length_, bytes, length);
+        length_ += length;
+    }
+
+    template <typename T>
+    void Format(const char* spec, T value) {
+        size_t room = kMaxRecord - length_;
+        int length = snprintf(text_ + length_, room, spec, value);
+        if (length < 0) {
+            return;
+        } else if (static_cast<size_t>(length) >= room) {
+            length_ = kMaxRecord - 1;
+            truncated_ = true;
+        } else {
+            length_ += static_cast<size_t>(length);
+        }
+    }
+
+    bool full() const { return length_ == kMaxRecord - 1; }
+
+    // Ends a truncated record with a newline, as the untruncated one would.
+    size_t Finish() {
+        if (truncated_) {
+            text_[length_ - 1] = '\n';
+        }
+        return length_;
+    }
+
+private:
+    char* const text_;
+    size_t length_ = 0;
+    bool truncated_ = false;
+};
+
+class Logger {
+public:
+    Logger() {
+        for (size_t i = 0; i < kSlots; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        pid_length_ = snprintf(pid_, sizeof(pid_), " %lu", trace::ProcessId());
+        thread_ = std::thread([this] { Run(); });
+    }
+
+    void Submit(Level level, const char* prefix, const char* fmt,
+                const internal::Bounds& bounds, const Arg* args,
+                const ArgType* types, size_t num_args) {
+        uint64_t pos = head_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots_[pos % kSlots];
+            uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+            int64_t lag = static_cast<int64_t>(sequence - pos);
+            if (lag == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (lag < 0) {
+                // Full: get the flusher going, or drain ourselves once it
+                // has stopped at exit.
+                if (stopping_.load(std::memory_order_acquire)) {
+                    Flush();
+                } else {
+                    Wake();
+                    std::this_thread::yield();
+                }
+                pos = head_.load(std::memory_order_relaxed);
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+
+        size_t used = 0;
+        size_t text = 0;
+        for (size_t i = 0; i < num_args; i++) {
+            slot->types[i] = types[i];
+            if (types[i] != internal::kString) {
+                slot->args[i] = args[i];
+                continue;
+            }
+            // Copy no more than the format prints, which may be less than
+            // the buffer holds if it isn't NUL-terminated.
+            const char* string = args[i].s != nullptr ? args[i].s : "(null)";
+            size_t limit = kMaxRecord - text;
+            int32_t bound = bounds.arg[i];
+            if (bound == internal::kStarBound && i > 0) {
+                bound = args[i - 1].i >= 0 ? static_cast<int32_t>(args[i - 1].i)
+                                           : internal::kUnbounded;
+            }
+            if (bound >= 0 && static_cast<size_t>(bound) < limit) {
+                limit = static_cast<size_t>(bound);
+            }
+            size_t length = strnlen(string, limit);
+            memcpy(slot->strings + used, string, length);
+            slot->strings[used + length] = '\0';
+            slot->args[i].u = used;
+            used += length + 1;
+            text += length;
+        }
+        slot->level = level;
+        slot->num_args = static_cast<uint32_t>(num_args);
+        slot->prefix = prefix;
+        slot->fmt = fmt;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+
+        if (stopping_.load(std::memory_order_acquire)) {
+            Flush();
+        } else if ((level == kError ||
+                    pos + 1 - tail_.load(std::memory_order_relaxed) >= kWakeBacklog) &&
+                   sleeping_.load(std::memory_order_acquire) &&
+                   sleeping_.exchange(false, std::memory_order_acq_rel)) {
+            // Only the first writer to find the flusher asleep pays for the
+            // wakeup.
+            Wake();
+        }
+    }
+
+    // Writes out every finished record, in order, stopping at the first slot
+    // a writer hasn't finished yet.
+    void Flush() {
+        std::lock_guard<std::mutex> lock(flush_lock_);
+        char batch[kMaxWrite];
+        size_t batch_length = 0;
+        int batch_fd = -1;
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+
+        while (true) {
+            Slot* slot = &slots_[tail % kSlots];
+            if (slot->sequence.load(std::memory_order_acquire) != tail + 1) {
+                break;
+            }
+            int fd = slot->level == kError ? STDERR_FILENO : STDOUT_FILENO;
+            if (fd != batch_fd || batch_length + kMaxRecord > sizeof(batch)) {
+                WriteAll(batch_fd, batch, batch_length);
+                batch_length = 0;
+                batch_fd = fd;
+            }
+            batch_length += Format(*slot, batch + batch_length);
+            slot->sequence.store(tail + kSlots, std::memory_order_release);
+            tail++;
+        }
+        tail_.store(tail, std::memory_order_relaxed);
+        WriteAll(batch_fd, batch, batch_length);
+    }
+
+    // Stops the flusher and writes out whatever is left. Records written
+    // after this are flushed by their writers.
+    void Stop() {
+        stopping_.store(true, std::memory_order_release);
+        Wake();
+        thread_.join();
+        Flush();
+    }
+
+private:
+    void Run() {
+        std::unique_lock<std::mutex> lock(sleep_lock_);
+        while (!stopping_.load(std::memory_order_acquire)) {
+            Flush();
+            sleeping_.store(true, std::memory_order_seq_cst);
+            // A record published after the flush above but before we went
+            // to sleep is picked up on the next pass at the latest.
+            wake_.wait_for(lock, kFlushInterval);
+            sleeping_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    void Wake() { wake_.notify_one(); }
+
+    // Formats |slot| into |text|, which has room for kMaxRecord bytes, and
+    // returns its length.
+    size_t Format(const Slot& slot, char* text) const {
+        RecordBuilder record(text);
+        size_t prefix_length = strlen(slot.prefix);
+        if (prefix_length > 0 && slot.prefix[prefix_length - 1] == ']') {
+            record.Append(slot.prefix, prefix_length - 1);
+            record.Append(pid_, pid_length_);
+            record.Append("] ", 2);
+        } else {
+            record.Append(slot.prefix, prefix_length);
+            record.Append(pid_, pid_length_);
+            record.Append(" ", 1);
+        }
+
+        const char* fmt = slot.fmt;
+        size_t next = 0;
+        while (*fmt != '\0' && !record.full()) {
+            const char* percent = strchr(fmt, '%');
+            if (percent == nullptr) {
+                record.Append(fmt, strlen(fmt));
+                break;
+            }
+            record.Append(fmt, percent - fmt);
+            fmt = percent + 1;
+            if (*fmt == '%') {
+                record.Append("%", 1);
+                fmt++;
+                continue;
+            }
+
+            // Rebuild the conversion with any '*' replaced by its argument,
+            // so it takes exactly one value.
+            char spec[48];
+            size_t length = 0;
+            spec[length++] = '%';
+            while (*fmt != '\0' && strchr("-+ #0'", *fmt) != nullptr &&
+                   length < 8) {
+                spec[length++] = *fmt++;
+            }
+            for (int part = 0; part < 2; part++) {
+                if (part == 1) {
+                    if (*fmt != '.') {
+                        break;
+                    }
+                    spec[length++] = *fmt++;
+                }
+                if (*fmt == '*') {
+                    fmt++;
+                    int value = next < slot.num_args
+                                    ? static_cast<int>(slot.args[next++].i)
+                                    : 0;
+                    length += snprintf(spec + length, 12, "%d", value);
+                } else {
+                    size_t limit = part == 0 ? 24 : 36;
+                    while (*fmt >= '0' && *fmt <= '9' && length < limit) {
+                        spec[length++] = *fmt++;
+                    }
+                }
+            }
+            while (*fmt != '\0' && strchr("hlLqjzt", *fmt) != nullptr &&
+                   length < 44) {
+                spec[length++] = *fmt++;
+            }
+            if (*fmt == '\0' || next >= slot.num_args) {
+                break;
+            }
+            spec[length++] = *fmt++;
+            spec[length] = '\0';
+
+            const Arg& arg = slot.args[next];
+            switch (slot.types[next++]) {
+            case internal::kInt:
+                record.Format(spec, static_cast<int>(arg.i));
+                break;
+            case internal::kUnsigned:
+                record.Format(spec, static_cast<unsigned int>(arg.u));
+                break;
+            case internal::kLong:
+                record.Format(spec, static_cast<long>(arg.i));
+                break;
+            case internal::kUnsignedLong:
+                record.Format(spec, static_cast<unsigned long>(arg.u));
+                break;
+            case internal::kLongLong:
+                record.Format(spec, arg.i);
+                break;
+            case internal::kUnsignedLongLong:
+                record.Format(spec, arg.u);
+                break;
+            case internal::kDouble:
+                record.Format(spec, arg.d);
+                break;
+            case internal::kPointer:
+                record.Format(spec, arg.p);
+                break;
+            case internal::kString:
+                record.Format(spec, slot.strings + arg.u);
+                break;
+            }
+        }
+        return record.Finish();
+    }
+
+    static void WriteAll(int fd, const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t n = write(fd, data, length);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            data += n;
+            length -= static_cast<size_t>(n);
+        }
+    }
+
+    Slot slots_[kSlots];
+    alignas(64) std::atomic<uint64_t> head_{0};
+    // Only written under |flush_lock_|; writers read it to see how far
+    // behind the flusher is.
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    std::mutex flush_lock_;
+    // " <process id>", added to every record's prefix.
+    char pid_[24];
+    size_t pid_length_;
+
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> sleeping_{false};
+    std::mutex sleep_lock_;
+    std::condition_variable wake_;
+    std::thread thread_;
+};
+
+// Created on first use and never destroyed, so records written from static
+// destructors or other atexit handlers still go out.
+Logger* instance() {
+    static Logger* logger = [] {
+        Logger* created = new Logger();
+        atexit([] { instance()->Stop(); });
+        return created;
+    }();
+    return logger;
+}
+
+} // namespace
+
+namespace internal {
+
+void Submit(Level level, const char* prefix, const char* fmt,
+            const Bounds& bounds, const Arg* args, const ArgType* types,
+            size_t num_args) {
+    instance()->Submit(level, prefix, fmt, bounds, args, types, num_args);
+}
+
+} // namespace internal
+
+void Flush() {
+    instance()->Flush();
+}
+
+} // namespace logger
@@ -0,0 +1,133 @@
+#pragma once
+
+// Pooled buffers for channel messages.
+//
+// Allocate hands out blocks in power-of-two size classes from kMinBlock up to
+// ZX_CHANNEL_MAX_MSG_BYTES. Every thread keeps a free list per class, so
+// allocating and freeing is a few pointer moves with no locking. A thread
+// whose list runs dry takes a batch of blocks from a shared arena, and one
+// whose list grows too long hands half of it back. The arena carves its
+// blocks out of slabs it takes from the heap and never returns, so once
+// every class in use has been warmed up (by traffic or by Reserve) the pool
+// no longer touches the heap at all. Stats::heap_allocs counts every slab,
+// which lets a benchmark check that its steady state really is malloc-free.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
+
+#include <zircon/types.h>
+
+namespace msgpool {
+
+// Smallest and largest block, in bytes.
+constexpr size_t kMinBlock = 64;
+constexpr size_t kMaxBlock = ZX_CHANNEL_MAX_MSG_BYTES;
+
+// What the arena has done since the process started. Thread free lists are
+// not counted, so the fast path stays free of shared writes.
+struct Stats {
+    // Slabs taken from the heap, and their total size.
+    uint64_t heap_allocs;
+    uint64_t heap_bytes;
+    // Batches handed to threads whose free list was empty.
+    uint64_t refills;
+    // Batches handed back by threads whose free list was full, or that
+    // exited.
+    uint64_t spills;
+};
+
+// One block from the pool. It goes back to the free list of whichever thread
+// destroys or resets it.
+class Buffer {
+public:
+    Buffer() = default;
+    ~Buffer() { reset(); }
+
+    Buffer(Buffer&& other)
+        : data_(std::exchange(other.data_, nullptr)), size_class_(other.size_class_) {}
+    Buffer& operator=(Buffer&& other) {
+        if (this != &other) {
+            reset();
+            data_ = std::exchange(other.data_, nullptr);
+            size_class_ = other.size_class_;
+        }
+        return *this;
+    }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    void* data() const { return data_; }
+    template <typename T>
+    T* as() const { return static_cast<T*>(data_); }
+
+    // Usable bytes, which is the whole size class; 0 for an empty buffer.
+    size_t capacity() const { return data_ ? kMinBlock << size_class_ : 0; }
+
+    explicit operator bool() const { return data_ != nullptr; }
+
+    void reset();
+
+private:
+    friend zx_status_t Allocate(size_t size, Buffer* out);
+
+    void* data_ = nullptr;
+    uint32_t size_class_ = 0;
+};
+
+// Replaces |out|'s block with one of at least |size| bytes. Fails with
+// ZX_ERR_OUT_OF_RANGE above kMaxBlock, or ZX_ERR_NO_MEMORY if the arena
+// needed a slab and the heap had none.
+zx_status_t Allocate(size_t size, Buffer* out);
+
+// Makes sure the arena can serve the first allocation of |size| bytes on
+// |threads| threads without going to the heap. Call it before a timed run so
+// that warming up stays out of the measurement.
+zx_status_t Reserve(size_t size, uint32_t threads);
+
+Stats GetStats();
+
+// A channel message read into pooled buffers. The buffers are kept from one
+// Read to the next and only replaced by larger ones when a message doesn't
+// fit, so a loop that reads into the same Message settles on buffers of the
+// right size and then never allocates again.
+class Message {
+public:
+    Message() = default;
+    // Closes any handles that weren't taken.
+    ~Message() { CloseHandles(); }
+
+    Message(const Message&) = delete;
+    Message& operator=(const Message&) = delete;
+
+    // Reads the next message from |channel|, growing the buffers first if it
+    // doesn't fit. Handles left over from the previous message are closed.
+    zx_status_t Read(zx_handle_t channel);
+
+    // Grows the byte buffer to hold at least |num_bytes| now, so that reads
+    // of messages up to that size never allocate.
+    zx_status_t Reserve(size_t num_bytes);
+
+    const void* bytes() const { return bytes_.data(); }
+    uint32_t num_bytes() const { return num_bytes_; }
+    uint32_t num_handles() const { return num_handles_; }
+
+    // Hands handle |index| over to the caller. Only the first take of each
+    // handle gets it; later ones get ZX_HANDLE_INVALID.
+    zx_handle_t TakeHandle(uint32_t index) {
+        return std::exchange(handles_.as<zx_handle_t>()[index],
+                             ZX_HANDLE_INVALID);
+    }
+
+private:
+    void CloseHandles();
+
+    Buffer bytes_;
+    Buffer handles_;
+    uint32_t num_bytes_ = 0;
+    uint32_t num_handles_ = 0;
+};
+
+} // namespace msgpool
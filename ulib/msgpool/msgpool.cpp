@@ -0,0 +1,261 @@
+#include <msgpool/msgpool.h>
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <mutex>
+
+#include <trace/syscalls.h>
+#include <zircon/syscalls.h>
+
+namespace msgpool {
+namespace {
+
+// kMinBlock, 2 * kMinBlock, ..., kMaxBlock.
+constexpr uint32_t kNumClasses = 11;
+static_assert((kMinBlock << (kNumClasses - 1)) == kMaxBlock,
+              "size classes must end at kMaxBlock");
+
+// What the arena takes from the heap at a time. Every slab holds a whole
+// number of blocks of any class.
+constexpr size_t kSlabBytes = 4 * kMaxBlock;
+
+// A thread takes about this much from the arena when its free list is empty,
+// and keeps up to twice as much before handing some back.
+constexpr size_t kBatchBytes = 16 << 10;
+
+static_assert(kSlabBytes >= kBatchBytes, "a slab must cover a batch");
+
+// Free blocks are linked through their first bytes.
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct Arena {
+    std::mutex lock;
+    FreeBlock* free[kNumClasses];
+    size_t num_free[kNumClasses];
+    // Read without the lock by GetStats.
+    std::atomic<uint64_t> heap_allocs;
+    std::atomic<uint64_t> refills;
+    std::atomic<uint64_t> spills;
+};
+
+Arena g_arena;
+
+// The calling thread's free lists. Whatever is left on them goes back to the
+// arena when the thread exits.
+struct Cache {
+    FreeBlock* free[kNumClasses] = {};
+    size_t num_free[kNumClasses] = {};
+
+    ~Cache();
+};
+
+thread_local Cache t_cache;
+
+uint32_t size_class_of(size_t size) {
+    if (size <= kMinBlock) {
+        return 0;
+    }
+    // log2 of |size| rounded up, less log2(kMinBlock).
+    return static_cast<uint32_t>(64 - __builtin_clzll(size - 1) - 6);
+}
+
+size_t batch_blocks(uint32_t size_class) {
+    size_t blocks = kBatchBytes / (kMinBlock << size_class);
+    return blocks > 0 ? blocks : 1;
+}
+
+// Carves a new slab into blocks of |size_class|. Called with the arena lock
+// held.
+zx_status_t grow(uint32_t size_class) {
+    uint8_t* slab = static_cast<uint8_t*>(aligned_alloc(kMinBlock, kSlabBytes));
+    if (slab == nullptr) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    size_t block = kMinBlock << size_class;
+    for (size_t offset = 0; offset < kSlabBytes; offset += block) {
+        FreeBlock* free = reinterpret_cast<FreeBlock*>(slab + offset);
+        free->next = g_arena.free[size_class];
+        g_arena.free[size_class] = free;
+    }
+    g_arena.num_free[size_class] += kSlabBytes / block;
+    g_arena.heap_allocs.fetch_add(1, std::memory_order_relaxed);
+    return ZX_OK;
+}
+
+// Moves a batch of blocks from the arena to |cache|.
+zx_status_t refill(Cache* cache, uint32_t size_class) {
+    size_t count = batch_blocks(size_class);
+    std::lock_guard<std::mutex> guard(g_arena.lock);
+    if (g_arena.num_free[size_class] < count) {
+        zx_status_t st = grow(size_class);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+    FreeBlock* first = g_arena.free[size_class];
+    FreeBlock* last = first;
+    for (size_t i = 1; i < count; i++) {
+        last = last->next;
+    }
+    g_arena.free[size_class] = last->next;
+    g_arena.num_free[size_class] -= count;
+    g_arena.refills.fetch_add(1, std::memory_order_relaxed);
+
+    last->next = cache->free[size_class];
+    cache->free[size_class] = first;
+    cache->num_free[size_class] += count;
+    return ZX_OK;
+}
+
+// Moves |count| blocks from |cache| back to the arena.
+void spill(Cache* cache, uint32_t size_class, size_t count) {
+    FreeBlock* first = cache->free[size_class];
+    FreeBlock* last = first;
+    for (size_t i = 1; i < count; i++) {
+        last = last->next;
+    }
+    cache->free[size_class] = last->next;
+    cache->num_free[size_class] -= count;
+
+    std::lock_guard<std::mutex> guard(g_arena.lock);
+    last->next = g_arena.free[size_class];
+    g_arena.free[size_class] = first;
+    g_arena.num_free[size_class] += count;
+    g_arena.spills.fetch_add(1, std::memory_order_relaxed);
+}
+
+Cache::~Cache() {
+    for (uint32_t size_class = 0; size_class < kNumClasses; size_class++) {
+        if (num_free[size_class] > 0) {
+            spill(this, size_class, num_free[size_class]);
+        }
+    }
+}
+
+} // namespace
+
+void Buffer::reset() {
+    if (data_ == nullptr) {
+        return;
+    }
+    Cache* cache = &t_cache;
+    FreeBlock* block = static_cast<FreeBlock*>(data_);
+    block->next = cache->free[size_class_];
+    cache->free[size_class_] = block;
+    cache->num_free[size_class_]++;
+    data_ = nullptr;
+
+    size_t batch = batch_blocks(size_class_);
+    if (cache->num_free[size_class_] > 2 * batch) {
+        spill(cache, size_class_, batch);
+    }
+}
+
+zx_status_t Allocate(size_t size, Buffer* out) {
+    if (size > kMaxBlock) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    uint32_t size_class = size_class_of(size);
+    Cache* cache = &t_cache;
+    if (cache->free[size_class] == nullptr) {
+        zx_status_t st = refill(cache, size_class);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+    FreeBlock* block = cache->free[size_class];
+    cache->free[size_class] = block->next;
+    cache->num_free[size_class]--;
+
+    out->reset();
+    out->data_ = block;
+    out->size_class_ = size_class;
+    return ZX_OK;
+}
+
+zx_status_t Reserve(size_t size, uint32_t threads) {
+    if (size > kMaxBlock) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    uint32_t size_class = size_class_of(size);
+    size_t needed = batch_blocks(size_class) * threads;
+    std::lock_guard<std::mutex> guard(g_arena.lock);
+    while (g_arena.num_free[size_class] < needed) {
+        zx_status_t st = grow(size_class);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+    return ZX_OK;
+}
+
+Stats GetStats() {
+    Stats stats;
+    stats.heap_allocs = g_arena.heap_allocs.load(std::memory_order_relaxed);
+    stats.heap_bytes = stats.heap_allocs * kSlabBytes;
+    stats.refills = g_arena.refills.load(std::memory_order_relaxed);
+    stats.spills = g_arena.spills.load(std::memory_order_relaxed);
+    return stats;
+}
+
+zx_status_t Message::Read(zx_handle_t channel) {
+    CloseHandles();
+    if (!bytes_) {
+        zx_status_t st = Allocate(kMinBlock, &bytes_);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+
+    while (true) {
+        zx_status_t st = trace::channel_read(
+            channel, 0, bytes_.data(), handles_.as<zx_handle_t>(),
+            static_cast<uint32_t>(bytes_.capacity()),
+            static_cast<uint32_t>(handles_.capacity() / sizeof(zx_handle_t)),
+            &num_bytes_, &num_handles_);
+        if (st != ZX_ERR_BUFFER_TOO_SMALL) {
+            if (st != ZX_OK) {
+                num_bytes_ = 0;
+                num_handles_ = 0;
+            }
+            return st;
+        }
+
+        // The message stays queued; retry with buffers it fits in.
+        size_t handle_bytes = num_handles_ * sizeof(zx_handle_t);
+        st = ZX_OK;
+        if (num_bytes_ > bytes_.capacity()) {
+            st = Allocate(num_bytes_, &bytes_);
+        }
+        if (st == ZX_OK && handle_bytes > handles_.capacity()) {
+            st = Allocate(handle_bytes, &handles_);
+        }
+        if (st != ZX_OK) {
+            num_bytes_ = 0;
+            num_handles_ = 0;
+            return st;
+        }
+    }
+}
+
+zx_status_t Message::Reserve(size_t num_bytes) {
+    if (num_bytes <= bytes_.capacity()) {
+        return ZX_OK;
+    }
+    return Allocate(num_bytes, &bytes_);
+}
+
+void Message::CloseHandles() {
+    zx_handle_t* handles = handles_.as<zx_handle_t>();
+    for (uint32_t i = 0; i < num_handles_; i++) {
+        if (handles[i] != ZX_HANDLE_INVALID) {
+            zx_handle_close(handles[i]);
+        }
+    }
+    num_handles_ = 0;
+}
+
+} // namespace msgpool
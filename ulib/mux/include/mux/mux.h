@@ -0,0 +1,199 @@
+#pragma once
+
+// Many logical streams over one channel.
+//
+// A Mux owns one end of a channel and carries a fixed number of numbered
+// streams over it; the Mux at the other end must be created with the same
+// number of streams and the same window. Every message sent on a stream
+// becomes a frame tagged with the stream's id, and Flush packs as many frames
+// as fit into each channel message, so a burst of sends across many streams
+// costs a handful of writes. Pump reads the channel and sorts the frames into
+// per-stream queues.
+//
+// Flow control is per stream and counted in messages. A stream starts with
+// |window| credits; each send takes one, and the peer grants them back as it
+// receives. Credits ride along on the next frame the receiver sends on the
+// same stream, which in request/response traffic is always the response, or
+// go out on their own once half a window has piled up. A stream out of
+// credit fails Send with ZX_ERR_SHOULD_WAIT while the others carry on, so a
+// busy stream can't crowd the others out of the channel. Since no side can
+// send past its credits, the receive queues never hold more than |window|
+// messages per stream, and the frames waiting for room in the channel are
+// bounded the same way. So Send never waits for the channel: it keeps what
+// can't be written yet, and Flush writes it as room frees up.
+//
+// Streams with queued messages are handed out round robin: NextReadable
+// returns them in the order they became readable, and Receive puts a stream
+// that still has messages queued back at the end of the line.
+//
+// Messages carry bytes only, no handles. A Mux is not thread-safe.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+
+#include <msgpool/msgpool.h>
+#include <zircon/types.h>
+
+namespace mux {
+
+// Each channel message holds one or more frames back to back: a
+// frame_header_t, then |size| bytes of payload padded to kFrameAlign.
+typedef struct frame_header {
+    uint32_t stream;
+    // kFrameData if the frame carries a message; otherwise it only grants
+    // credit.
+    uint32_t flags;
+    // Payload bytes.
+    uint32_t size;
+    // Further messages the receiver of this frame may send on |stream|.
+    uint32_t credits;
+} frame_header_t;
+
+constexpr uint32_t kFrameData = 1u << 0;
+constexpr size_t kFrameAlign = 8;
+
+// Largest message a stream carries.
+constexpr uint32_t kMaxMessage = ZX_CHANNEL_MAX_MSG_BYTES - sizeof(frame_header_t);
+
+// Most streams and largest window a Mux takes.
+constexpr uint32_t kMaxStreams = 1u << 20;
+constexpr uint32_t kMaxWindow = 1024;
+
+struct Stats {
+    // Channel messages written and read.
+    uint64_t writes;
+    uint64_t reads;
+    // Frames carrying a message, sent and received.
+    uint64_t frames_sent;
+    uint64_t frames_received;
+    // Frames sent only to grant credit.
+    uint64_t credit_frames;
+    // Sends refused because the stream was out of credit.
+    uint64_t credit_stalls;
+};
+
+class Mux {
+public:
+    // Takes |channel| whether or not it succeeds. Sets aside a buffer for the
+    // largest channel message up front, so Pump never allocates to read one.
+    static zx_status_t Create(zx_handle_t channel, uint32_t num_streams,
+                              uint32_t window, std::unique_ptr<Mux>* out);
+
+    // Closes the channel; anything not yet flushed is lost.
+    ~Mux();
+
+    Mux(const Mux&) = delete;
+    Mux& operator=(const Mux&) = delete;
+
+    // Queues a message on |stream| for the next Flush. Returns
+    // ZX_ERR_SHOULD_WAIT, without queueing it, if the stream is out of
+    // credit.
+    zx_status_t Send(uint32_t stream, const void* bytes, uint32_t num_bytes);
+
+    // Writes every queued frame, and any credit owed to the peer, packed into
+    // as few channel messages as they fit in. Returns ZX_ERR_SHOULD_WAIT if
+    // the channel is full; whatever didn't go out stays queued for the next
+    // Flush.
+    zx_status_t Flush();
+
+    // Reads everything queued on the channel into the stream queues.
+    // Returns ZX_ERR_PEER_CLOSED once the peer is gone and all it sent has
+    // been read, and ZX_ERR_IO_DATA_INTEGRITY if it broke the framing or
+    // sent past its credits. Messages already queued can still be received
+    // either way.
+    zx_status_t Pump();
+
+    // Takes the next message queued on |stream|. Returns ZX_ERR_SHOULD_WAIT
+    // if there is none, and ZX_ERR_BUFFER_TOO_SMALL, with the size in
+    // |actual_bytes|, if it doesn't fit; the message stays queued.
+    zx_status_t Receive(uint32_t stream, void* bytes, uint32_t num_bytes,
+                        uint32_t* actual_bytes);
+
+    // Sets |stream| to the next stream with messages queued. Returns false if
+    // there is none.
+    bool NextReadable(uint32_t* stream);
+
+    // The signals worth waiting for on channel(): READABLE and PEER_CLOSED,
+    // plus WRITABLE while frames or credits are waiting to be flushed.
+    zx_signals_t signals() const;
+
+    // Waits for signals() until |deadline|.
+    zx_status_t Wait(zx_time_t deadline, zx_signals_t* observed);
+
+    zx_handle_t channel() const { return channel_; }
+    uint32_t num_streams() const { return num_streams_; }
+    uint32_t credits(uint32_t stream) const { return streams_[stream].credits; }
+    const Stats& stats() const { return stats_; }
+
+private:
+    // A received message waiting in its stream's queue, or a channel message
+    // waiting to be written.
+    struct Slot {
+        msgpool::Buffer buffer;
+        uint32_t size;
+    };
+
+    struct Stream {
+        // Ring of |window_| slots.
+        std::unique_ptr<Slot[]> queue;
+        uint32_t head = 0;
+        uint32_t count = 0;
+        // Messages we may still send.
+        uint32_t credits = 0;
+        // Messages received since we last granted credit for them.
+        uint32_t to_grant = 0;
+        // On the ready and grant lists.
+        bool ready = false;
+        bool granting = false;
+    };
+
+    // A FIFO of stream ids, each on it at most once.
+    class IdQueue {
+    public:
+        void Init(uint32_t capacity);
+        void Push(uint32_t id);
+        uint32_t Pop();
+        uint32_t Front() const { return ids_[head_]; }
+        bool empty() const { return count_ == 0; }
+
+    private:
+        std::unique_ptr<uint32_t[]> ids_;
+        uint32_t capacity_ = 0;
+        uint32_t head_ = 0;
+        uint32_t count_ = 0;
+    };
+
+    Mux(zx_handle_t channel, uint32_t num_streams, uint32_t window);
+    void Init();
+
+    // Adds a frame to the last channel message waiting to be written,
+    // starting a new one if it doesn't fit.
+    zx_status_t Append(uint32_t stream, uint32_t flags, const void* bytes,
+                       uint32_t size, uint32_t credits);
+
+    // Sorts the frames of one channel message into the stream queues.
+    zx_status_t Deliver(const uint8_t* bytes, uint32_t num_bytes);
+
+    const zx_handle_t channel_;
+    const uint32_t num_streams_;
+    const uint32_t window_;
+    // Credits owed before they go out in a frame of their own.
+    const uint32_t grant_threshold_;
+
+    std::unique_ptr<Stream[]> streams_;
+    IdQueue ready_;
+    // Streams owing at least |grant_threshold_| credits.
+    IdQueue grants_;
+
+    // Channel messages waiting to be written; the last is still being
+    // filled.
+    std::deque<Slot> out_;
+    msgpool::Message in_;
+
+    Stats stats_ = {};
+};
+
+} // namespace mux
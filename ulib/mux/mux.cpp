@@ -0,0 +1,270 @@
+#include <mux/mux.h>
+
+#include <string.h>
+
+#include <trace/syscalls.h>
+#include <zircon/syscalls.h>
+
+namespace mux {
+
+namespace {
+
+uint32_t Padded(uint32_t size) {
+    return static_cast<uint32_t>((size + kFrameAlign - 1) & ~(kFrameAlign - 1));
+}
+
+} // namespace
+
+void Mux::IdQueue::Init(uint32_t capacity) {
+    ids_.reset(new uint32_t[capacity]);
+    capacity_ = capacity;
+}
+
+void Mux::IdQueue::Push(uint32_t id) {
+    ids_[(head_ + count_++) % capacity_] = id;
+}
+
+uint32_t Mux::IdQueue::Pop() {
+    uint32_t id = ids_[head_];
+    head_ = (head_ + 1) % capacity_;
+    count_--;
+    return id;
+}
+
+Mux::Mux(zx_handle_t channel, uint32_t num_streams, uint32_t window)
+    : channel_(channel), num_streams_(num_streams), window_(window),
+      grant_threshold_(window / 2 > 0 ? window / 2 : 1) {}
+
+Mux::~Mux() {
+    zx_handle_close(channel_);
+}
+
+zx_status_t Mux::Create(zx_handle_t channel, uint32_t num_streams,
+                        uint32_t window, std::unique_ptr<Mux>* out) {
+    if (num_streams == 0 || num_streams > kMaxStreams || window == 0 ||
+        window > kMaxWindow) {
+        zx_handle_close(channel);
+        return ZX_ERR_INVALID_ARGS;
+    }
+    std::unique_ptr<Mux> mux(new Mux(channel, num_streams, window));
+    mux->Init();
+    // The peer packs as many frames as fit into each message, so take a
+    // buffer for the largest one now rather than growing into it later.
+    zx_status_t st = mux->in_.Reserve(ZX_CHANNEL_MAX_MSG_BYTES);
+    if (st != ZX_OK) {
+        return st;
+    }
+    *out = std::move(mux);
+    return ZX_OK;
+}
+
+void Mux::Init() {
+    streams_.reset(new Stream[num_streams_]);
+    for (uint32_t i = 0; i < num_streams_; i++) {
+        streams_[i].queue.reset(new Slot[window_]);
+        streams_[i].credits = window_;
+    }
+    ready_.Init(num_streams_);
+    grants_.Init(num_streams_);
+}
+
+zx_status_t Mux::Append(uint32_t stream, uint32_t flags, const void* bytes,
+                        uint32_t size, uint32_t credits) {
+    uint32_t frame = sizeof(frame_header_t) + Padded(size);
+    if (out_.empty() || out_.back().size + frame > ZX_CHANNEL_MAX_MSG_BYTES) {
+        Slot message;
+        zx_status_t st = msgpool::Allocate(ZX_CHANNEL_MAX_MSG_BYTES,
+                                           &message.buffer);
+        if (st != ZX_OK) {
+            return st;
+        }
+        message.size = 0;
+        out_.push_back(std::move(message));
+    }
+    Slot& message = out_.back();
+    uint8_t* at = message.buffer.as<uint8_t>() + message.size;
+    frame_header_t header = {stream, flags, size, credits};
+    memcpy(at, &header, sizeof(header));
+    if (size > 0) {
+        memcpy(at + sizeof(header), bytes, size);
+    }
+    message.size += frame;
+    return ZX_OK;
+}
+
+zx_status_t Mux::Send(uint32_t stream, const void* bytes, uint32_t num_bytes) {
+    if (stream >= num_streams_ || num_bytes > kMaxMessage) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    Stream& s = streams_[stream];
+    if (s.credits == 0) {
+        stats_.credit_stalls++;
+        return ZX_ERR_SHOULD_WAIT;
+    }
+    zx_status_t st = Append(stream, kFrameData, bytes, num_bytes, s.to_grant);
+    if (st != ZX_OK) {
+        return st;
+    }
+    // The frame carries whatever credit the stream owed, so a grant frame
+    // still listed for it has nothing left to say and is skipped.
+    s.to_grant = 0;
+    s.credits--;
+    stats_.frames_sent++;
+    return ZX_OK;
+}
+
+zx_status_t Mux::Flush() {
+    while (!grants_.empty()) {
+        uint32_t stream = grants_.Pop();
+        Stream& s = streams_[stream];
+        s.granting = false;
+        if (s.to_grant > 0) {
+            zx_status_t st = Append(stream, 0, nullptr, 0, s.to_grant);
+            if (st != ZX_OK) {
+                return st;
+            }
+            s.to_grant = 0;
+            stats_.credit_frames++;
+        }
+    }
+
+    while (!out_.empty()) {
+        Slot& message = out_.front();
+        zx_status_t st = trace::channel_write(channel_, 0, message.buffer.data(),
+                                              message.size, nullptr, 0);
+        if (st != ZX_OK) {
+            return st;
+        }
+        out_.pop_front();
+        stats_.writes++;
+    }
+    return ZX_OK;
+}
+
+zx_status_t Mux::Deliver(const uint8_t* bytes, uint32_t num_bytes) {
+    uint32_t offset = 0;
+    while (offset < num_bytes) {
+        frame_header_t header;
+        if (num_bytes - offset < sizeof(header)) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        memcpy(&header, bytes + offset, sizeof(header));
+        offset += sizeof(header);
+        if (header.stream >= num_streams_ || header.size > kMaxMessage ||
+            num_bytes - offset < Padded(header.size)) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+
+        Stream& s = streams_[header.stream];
+        if (header.credits > window_ - s.credits) {
+            // More than we have outstanding.
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        s.credits += header.credits;
+
+        if (header.flags & kFrameData) {
+            if (s.count == window_) {
+                // Sent without credit.
+                return ZX_ERR_IO_DATA_INTEGRITY;
+            }
+            Slot& slot = s.queue[(s.head + s.count) % window_];
+            if (slot.buffer.capacity() < header.size) {
+                zx_status_t st = msgpool::Allocate(
+                    header.size > 0 ? header.size : 1, &slot.buffer);
+                if (st != ZX_OK) {
+                    return st;
+                }
+            }
+            memcpy(slot.buffer.data(), bytes + offset, header.size);
+            slot.size = header.size;
+            s.count++;
+            stats_.frames_received++;
+            if (!s.ready) {
+                s.ready = true;
+                ready_.Push(header.stream);
+            }
+        }
+        offset += Padded(header.size);
+    }
+    return ZX_OK;
+}
+
+zx_status_t Mux::Pump() {
+    while (true) {
+        zx_status_t st = in_.Read(channel_);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            return ZX_OK;
+        } else if (st != ZX_OK) {
+            return st;
+        }
+        stats_.reads++;
+        if (in_.num_handles() > 0) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        st = Deliver(static_cast<const uint8_t*>(in_.bytes()), in_.num_bytes());
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+}
+
+zx_status_t Mux::Receive(uint32_t stream, void* bytes, uint32_t num_bytes,
+                         uint32_t* actual_bytes) {
+    if (stream >= num_streams_) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    Stream& s = streams_[stream];
+    if (s.count == 0) {
+        return ZX_ERR_SHOULD_WAIT;
+    }
+    Slot& slot = s.queue[s.head];
+    if (actual_bytes != nullptr) {
+        *actual_bytes = slot.size;
+    }
+    if (slot.size > num_bytes) {
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    }
+    memcpy(bytes, slot.buffer.data(), slot.size);
+    s.head = (s.head + 1) % window_;
+    s.count--;
+
+    s.to_grant++;
+    if (s.to_grant >= grant_threshold_ && !s.granting) {
+        s.granting = true;
+        grants_.Push(stream);
+    }
+    if (s.count > 0 && s.ready && ready_.Front() == stream) {
+        // Taken straight off the front: go to the back of the line.
+        ready_.Pop();
+        ready_.Push(stream);
+    }
+    return ZX_OK;
+}
+
+bool Mux::NextReadable(uint32_t* stream) {
+    while (!ready_.empty()) {
+        uint32_t id = ready_.Front();
+        Stream& s = streams_[id];
+        if (s.count > 0) {
+            *stream = id;
+            return true;
+        }
+        s.ready = false;
+        ready_.Pop();
+    }
+    return false;
+}
+
+zx_signals_t Mux::signals() const {
+    zx_signals_t signals = ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED;
+    if (!out_.empty() || !grants_.empty()) {
+        signals |= ZX_CHANNEL_WRITABLE;
+    }
+    return signals;
+}
+
+zx_status_t Mux::Wait(zx_time_t deadline, zx_signals_t* observed) {
+    return trace::object_wait_one(channel_, signals(), deadline, observed);
+}
+
+} // namespace mux
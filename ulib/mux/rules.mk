@@ -0,0 +1,22 @@
+# Copyright 2018 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := userlib
+
+MODULE_SRCS += \
+    $(LOCAL_DIR)/mux.cpp
+
+MODULE_STATIC_LIBS := \
+    $(dir $(LOCAL_DIR))msgpool \
+    $(dir $(LOCAL_DIR))trace
+
+MODULE_LIBS := system/ulib/zircon system/ulib/c
+
+MODULE_PACKAGE := static
+
+include make/module.mk
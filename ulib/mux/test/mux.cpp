@@ -0,0 +1,238 @@
+// Mux: per-stream credit, how credit goes back to the sender, and what Pump
+// makes of a peer that breaks the framing or its credit.
+
+#include <memory>
+
+#include <mux/mux.h>
+#include <unittest/unittest.h>
+#include <zircon/syscalls.h>
+
+// Two Muxes on the ends of one channel.
+static bool make_pair(uint32_t num_streams, uint32_t window,
+                      std::unique_ptr<mux::Mux>* a,
+                      std::unique_ptr<mux::Mux>* b) {
+    zx_handle_t ours, theirs;
+    if (zx_channel_create(0, &ours, &theirs) != ZX_OK) {
+        return false;
+    }
+    zx_status_t st = mux::Mux::Create(ours, num_streams, window, a);
+    zx_status_t st2 = mux::Mux::Create(theirs, num_streams, window, b);
+    return st == ZX_OK && st2 == ZX_OK;
+}
+
+// A Mux on one end and the bare channel on the other, for writing frames
+// by hand.
+static bool make_raw(uint32_t num_streams, uint32_t window,
+                     std::unique_ptr<mux::Mux>* mux, zx_handle_t* raw) {
+    zx_handle_t ours;
+    if (zx_channel_create(0, &ours, raw) != ZX_OK) {
+        return false;
+    }
+    return mux::Mux::Create(ours, num_streams, window, mux) == ZX_OK;
+}
+
+static bool credit_exhaustion() {
+    BEGIN_TEST;
+    std::unique_ptr<mux::Mux> client, server;
+    ASSERT_TRUE(make_pair(3, 4, &client, &server));
+
+    uint32_t value = 0;
+    for (; value < 4; value++) {
+        ASSERT_EQ(client->Send(0, &value, sizeof(value)), ZX_OK);
+    }
+    EXPECT_EQ(client->credits(0), 0u);
+    EXPECT_EQ(client->Send(0, &value, sizeof(value)), ZX_ERR_SHOULD_WAIT,
+              "stream 0 is out of credit");
+    EXPECT_EQ(client->stats().credit_stalls, 1u);
+    EXPECT_EQ(client->Send(1, &value, sizeof(value)), ZX_OK,
+              "the other streams carry on");
+    EXPECT_EQ(client->Send(2, &value, sizeof(value)), ZX_OK);
+    EXPECT_EQ(client->Flush(), ZX_OK);
+    EXPECT_EQ(client->stats().writes, 1u, "all six frames in one message");
+
+    ASSERT_EQ(server->Pump(), ZX_OK);
+    EXPECT_EQ(server->stats().frames_received, 6u);
+    uint32_t counts[3] = {};
+    uint32_t stream;
+    while (server->NextReadable(&stream)) {
+        uint32_t actual;
+        ASSERT_EQ(server->Receive(stream, &value, sizeof(value), &actual), ZX_OK);
+        EXPECT_EQ(actual, sizeof(value));
+        if (stream == 0) {
+            EXPECT_EQ(value, counts[0], "stream 0 arrives in order");
+        }
+        counts[stream]++;
+    }
+    EXPECT_EQ(counts[0], 4u);
+    EXPECT_EQ(counts[1], 1u);
+    EXPECT_EQ(counts[2], 1u);
+
+    // Handing the credit back lets stream 0 send again.
+    ASSERT_EQ(server->Flush(), ZX_OK);
+    ASSERT_EQ(client->Pump(), ZX_OK);
+    EXPECT_EQ(client->credits(0), 4u);
+    EXPECT_EQ(client->Send(0, &value, sizeof(value)), ZX_OK);
+    END_TEST;
+}
+
+static bool grant_piggybacks_on_response() {
+    BEGIN_TEST;
+    // With a window of 1 every message received owes a grant at once, so
+    // this also checks that the response takes it over from the grant list.
+    std::unique_ptr<mux::Mux> client, server;
+    ASSERT_TRUE(make_pair(2, 1, &client, &server));
+
+    uint32_t value = 7;
+    ASSERT_EQ(client->Send(1, &value, sizeof(value)), ZX_OK);
+    ASSERT_EQ(client->Flush(), ZX_OK);
+    EXPECT_EQ(client->credits(1), 0u);
+
+    ASSERT_EQ(server->Pump(), ZX_OK);
+    ASSERT_EQ(server->Receive(1, &value, sizeof(value), nullptr), ZX_OK);
+    ASSERT_EQ(server->Send(1, &value, sizeof(value)), ZX_OK);
+    ASSERT_EQ(server->Flush(), ZX_OK);
+    EXPECT_EQ(server->stats().credit_frames, 0u,
+              "the credit rode on the response");
+    EXPECT_EQ(server->stats().writes, 1u);
+
+    ASSERT_EQ(client->Pump(), ZX_OK);
+    EXPECT_EQ(client->credits(1), 1u);
+    ASSERT_EQ(client->Receive(1, &value, sizeof(value), nullptr), ZX_OK);
+    EXPECT_EQ(value, 7u);
+    END_TEST;
+}
+
+static bool grant_on_its_own() {
+    BEGIN_TEST;
+    // A receiver that never answers still grants, in one frame once half a
+    // window is owed.
+    std::unique_ptr<mux::Mux> client, server;
+    ASSERT_TRUE(make_pair(1, 4, &client, &server));
+
+    uint32_t value = 0;
+    for (; value < 4; value++) {
+        ASSERT_EQ(client->Send(0, &value, sizeof(value)), ZX_OK);
+    }
+    ASSERT_EQ(client->Flush(), ZX_OK);
+
+    ASSERT_EQ(server->Pump(), ZX_OK);
+    ASSERT_EQ(server->Receive(0, &value, sizeof(value), nullptr), ZX_OK);
+    EXPECT_EQ(server->signals() & ZX_CHANNEL_WRITABLE, 0u,
+              "one credit owed is below the threshold");
+    while (server->Receive(0, &value, sizeof(value), nullptr) == ZX_OK) {
+    }
+    EXPECT_NE(server->signals() & ZX_CHANNEL_WRITABLE, 0u);
+    ASSERT_EQ(server->Flush(), ZX_OK);
+    EXPECT_EQ(server->stats().credit_frames, 1u);
+    EXPECT_EQ(server->stats().frames_sent, 0u);
+
+    ASSERT_EQ(client->Pump(), ZX_OK);
+    EXPECT_EQ(client->credits(0), 4u);
+    EXPECT_FALSE(client->NextReadable(&value), "a grant carries no message");
+    END_TEST;
+}
+
+// Writes |bytes|, and |handle| if there is one, to a fresh Mux as a single
+// message and returns what its Pump makes of it.
+static zx_status_t pump_raw(uint32_t num_streams, uint32_t window,
+                            const void* bytes, uint32_t num_bytes,
+                            zx_handle_t handle) {
+    std::unique_ptr<mux::Mux> mux;
+    zx_handle_t raw;
+    if (!make_raw(num_streams, window, &mux, &raw)) {
+        return ZX_ERR_INTERNAL;
+    }
+    zx_status_t st = zx_channel_write(raw, 0, bytes, num_bytes, &handle,
+                                      handle == ZX_HANDLE_INVALID ? 0 : 1);
+    if (st == ZX_OK) {
+        st = mux->Pump();
+    }
+    zx_handle_close(raw);
+    return st;
+}
+
+static bool rejects_over_credit() {
+    BEGIN_TEST;
+    // Nothing has been sent, so there is nothing to grant back.
+    mux::frame_header_t grant = {0, 0, 0, 1};
+    EXPECT_EQ(pump_raw(1, 4, &grant, sizeof(grant), ZX_HANDLE_INVALID),
+              ZX_ERR_IO_DATA_INTEGRITY);
+
+    // Five messages against a window of four.
+    struct {
+        mux::frame_header_t header;
+        uint64_t payload;
+    } frames[5];
+    for (auto& frame : frames) {
+        frame.header = {0, mux::kFrameData, sizeof(frame.payload), 0};
+        frame.payload = 0;
+    }
+    EXPECT_EQ(pump_raw(1, 4, frames, sizeof(frames[0]) * 4, ZX_HANDLE_INVALID),
+              ZX_OK, "a full window is fine");
+    EXPECT_EQ(pump_raw(1, 4, frames, sizeof(frames), ZX_HANDLE_INVALID),
+              ZX_ERR_IO_DATA_INTEGRITY);
+    END_TEST;
+}
+
+static bool rejects_malformed() {
+    BEGIN_TEST;
+    struct {
+        mux::frame_header_t header;
+        uint64_t payload;
+    } frame = {{0, mux::kFrameData, sizeof(uint64_t), 0}, 0};
+    ASSERT_EQ(pump_raw(2, 4, &frame, sizeof(frame), ZX_HANDLE_INVALID), ZX_OK);
+
+    EXPECT_EQ(pump_raw(2, 4, &frame, sizeof(frame.header) - 4,
+                       ZX_HANDLE_INVALID),
+              ZX_ERR_IO_DATA_INTEGRITY, "truncated header");
+    EXPECT_EQ(pump_raw(2, 4, &frame, sizeof(frame) - 4, ZX_HANDLE_INVALID),
+              ZX_ERR_IO_DATA_INTEGRITY, "truncated payload");
+
+    frame.header.stream = 2;
+    EXPECT_EQ(pump_raw(2, 4, &frame, sizeof(frame), ZX_HANDLE_INVALID),
+              ZX_ERR_IO_DATA_INTEGRITY, "no such stream");
+    frame.header.stream = 0;
+
+    frame.header.size = mux::kMaxMessage + 1;
+    EXPECT_EQ(pump_raw(2, 4, &frame, sizeof(frame), ZX_HANDLE_INVALID),
+              ZX_ERR_IO_DATA_INTEGRITY, "oversized message");
+    frame.header.size = sizeof(uint64_t);
+
+    zx_handle_t passed, kept;
+    ASSERT_EQ(zx_channel_create(0, &passed, &kept), ZX_OK);
+    EXPECT_EQ(pump_raw(2, 4, &frame, sizeof(frame), passed),
+              ZX_ERR_IO_DATA_INTEGRITY, "handles attached");
+    zx_handle_close(kept);
+    END_TEST;
+}
+
+static bool peer_closed_after_drain() {
+    BEGIN_TEST;
+    std::unique_ptr<mux::Mux> client, server;
+    ASSERT_TRUE(make_pair(1, 4, &client, &server));
+
+    uint32_t value = 42;
+    ASSERT_EQ(client->Send(0, &value, sizeof(value)), ZX_OK);
+    ASSERT_EQ(client->Flush(), ZX_OK);
+    client.reset();
+
+    EXPECT_EQ(server->Pump(), ZX_ERR_PEER_CLOSED);
+    value = 0;
+    EXPECT_EQ(server->Receive(0, &value, sizeof(value), nullptr), ZX_OK,
+              "what arrived before the close is still there");
+    EXPECT_EQ(value, 42u);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(mux_tests)
+RUN_TEST(credit_exhaustion)
+RUN_TEST(grant_piggybacks_on_response)
+RUN_TEST(grant_on_its_own)
+RUN_TEST(rejects_over_credit)
+RUN_TEST(rejects_malformed)
+RUN_TEST(peer_closed_after_drain)
+END_TEST_CASE(mux_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+// Where a thread runs and how it is scheduled.
+//
+// Apply pins the calling thread to one CPU and gives it a scheduling profile.
+// On Zircon both go into a single scheduler profile set on the thread. On the
+// host backend pinning is sched_setaffinity, and the profiles map onto a
+// nice value, SCHED_FIFO and SCHED_DEADLINE. Everything above the default
+// profile usually needs privileges (CAP_SYS_NICE on Linux, a job allowed to
+// create profiles on Zircon); Apply fails rather than leave the thread
+// running somewhere other than asked.
+//
+// Relate tells how two CPUs share hardware, so that results can be reported
+// per topology: the same CPU, SMT siblings of one core, two cores of one
+// package, or two packages.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zircon/types.h>
+
+namespace placement {
+
+// Leaves the thread's CPU affinity alone.
+constexpr int32_t kAnyCpu = -1;
+
+enum class Class {
+    // Leaves the thread's scheduling alone.
+    kDefault,
+    // Above the default priority, still time-shared.
+    kHigh,
+    // Fixed priority, ahead of every time-shared thread.
+    kRealtime,
+    // Guaranteed |capacity| of CPU time every |period|.
+    kDeadline,
+};
+
+struct Profile {
+    Class kind = Class::kDefault;
+    // kDeadline only. The deadline is the end of each period.
+    zx_duration_t capacity = 0;
+    zx_duration_t period = 0;
+};
+
+// Parses "default", "high", "realtime" or "deadline:CAPACITY_US/PERIOD_US".
+// Returns false on anything else.
+bool ParseProfile(const char* spec, Profile* profile);
+
+// Parses a CPU number below NumCpus(). Returns false on anything else.
+bool ParseCpu(const char* spec, int32_t* cpu);
+
+uint32_t NumCpus();
+
+// Pins the calling thread to |cpu|, unless it is kAnyCpu, and applies
+// |profile| to it. Threads it starts afterwards inherit the pin; on the host
+// backend they are reset to the default profile when it is kDeadline, as
+// Linux refuses to clone a deadline thread otherwise. Linux also refuses
+// deadline threads pinned to fewer CPUs than their scheduling domain, so
+// that combination fails there with ZX_ERR_ACCESS_DENIED.
+zx_status_t Apply(int32_t cpu, const Profile& profile);
+
+enum class Topology {
+    // One side or both aren't pinned.
+    kUnpinned,
+    kSameCpu,
+    // Two hardware threads of one core.
+    kSmtSibling,
+    // Two cores of one package.
+    kSamePackage,
+    kCrossPackage,
+    // Two CPUs whose topology we can't read, as on Zircon.
+    kOtherCpu,
+};
+
+Topology Relate(int32_t a, int32_t b);
+
+// "unpinned", "same-cpu", "smt", "same-package", "cross-package" or
+// "other-cpu"; usable as a component of a result name.
+const char* TopologyName(Topology topology);
+
+struct CpuPair {
+    int32_t first;
+    int32_t second;
+};
+
+// Fills |pairs| with one pair of CPUs for every topology this machine has,
+// each starting from CPU 0, and returns how many it wrote. The first is
+// always CPU 0 with itself.
+size_t Representatives(CpuPair* pairs, size_t max_pairs);
+
+} // namespace placement
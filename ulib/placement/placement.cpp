@@ -0,0 +1,298 @@
+#include <placement/placement.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+
+#if defined(__Fuchsia__)
+#include <zircon/process.h>
+#include <zircon/syscalls.h>
+#include <zircon/syscalls/profile.h>
+#else
+#include <errno.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace placement {
+namespace {
+
+#if defined(__Fuchsia__)
+
+// Priorities for Class::kHigh and Class::kRealtime; the default is 16.
+constexpr int32_t kHighPriority = 24;
+constexpr int32_t kRealtimePriority = 31;
+
+#else
+
+// Nice value for Class::kHigh.
+constexpr int kHighNice = -10;
+
+// Not every libc has these yet; see sched_setattr(2).
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#define SCHED_FLAG_RESET_ON_FORK 0x01
+#endif
+
+struct sched_attr_t {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+zx_status_t status_from_errno(int error) {
+    switch (error) {
+    case EPERM:
+        return ZX_ERR_ACCESS_DENIED;
+    case EINVAL:
+        return ZX_ERR_INVALID_ARGS;
+    case EBUSY:
+        return ZX_ERR_BAD_STATE;
+    default:
+        return ZX_ERR_INTERNAL;
+    }
+}
+
+// Reads a number from /sys/devices/system/cpu/cpu<cpu>/topology/<name>.
+// Returns -1 if it isn't there.
+long read_topology(int32_t cpu, const char* name) {
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+             cpu, name);
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return -1;
+    }
+    long value;
+    if (fscanf(file, "%ld", &value) != 1) {
+        value = -1;
+    }
+    fclose(file);
+    return value;
+}
+
+#endif
+
+// Parses a decimal count of microseconds. Returns false unless it is
+// positive and followed by |terminator|.
+bool parse_usec(const char* p, char terminator, zx_duration_t* out,
+                const char** end) {
+    char* stop;
+    unsigned long long usec = strtoull(p, &stop, 10);
+    if (stop == p || *stop != terminator || usec == 0) {
+        return false;
+    }
+    *out = ZX_USEC(usec);
+    *end = stop;
+    return true;
+}
+
+} // namespace
+
+bool ParseProfile(const char* spec, Profile* profile) {
+    *profile = Profile();
+    if (!strcmp(spec, "default")) {
+        return true;
+    } else if (!strcmp(spec, "high")) {
+        profile->kind = Class::kHigh;
+        return true;
+    } else if (!strcmp(spec, "realtime")) {
+        profile->kind = Class::kRealtime;
+        return true;
+    } else if (!strncmp(spec, "deadline:", 9)) {
+        const char* p = spec + 9;
+        if (!parse_usec(p, '/', &profile->capacity, &p) ||
+            !parse_usec(p + 1, '\0', &profile->period, &p) ||
+            profile->capacity > profile->period) {
+            return false;
+        }
+        profile->kind = Class::kDeadline;
+        return true;
+    }
+    return false;
+}
+
+bool ParseCpu(const char* spec, int32_t* cpu) {
+    char* end;
+    unsigned long value = strtoul(spec, &end, 10);
+    if (end == spec || *end != '\0' || value >= NumCpus()) {
+        return false;
+    }
+    *cpu = static_cast<int32_t>(value);
+    return true;
+}
+
+uint32_t NumCpus() {
+    uint32_t cpus = std::thread::hardware_concurrency();
+    return cpus == 0 ? 1 : cpus;
+}
+
+#if defined(__Fuchsia__)
+
+zx_status_t Apply(int32_t cpu, const Profile& profile) {
+    zx_profile_info_t info = {};
+    if (cpu != kAnyCpu) {
+        info.flags |= ZX_PROFILE_INFO_FLAG_CPU_MASK;
+        info.cpu_affinity_mask.mask[cpu / 64] = 1ull << (cpu % 64);
+    }
+    switch (profile.kind) {
+    case Class::kDefault:
+        break;
+    case Class::kHigh:
+        info.flags |= ZX_PROFILE_INFO_FLAG_PRIORITY;
+        info.priority = kHighPriority;
+        break;
+    case Class::kRealtime:
+        info.flags |= ZX_PROFILE_INFO_FLAG_PRIORITY;
+        info.priority = kRealtimePriority;
+        break;
+    case Class::kDeadline:
+        info.flags |= ZX_PROFILE_INFO_FLAG_DEADLINE;
+        info.deadline_params.capacity = profile.capacity;
+        info.deadline_params.relative_deadline = profile.period;
+        info.deadline_params.period = profile.period;
+        break;
+    }
+    if (info.flags == 0) {
+        return ZX_OK;
+    }
+
+    zx_handle_t handle;
+    zx_status_t st = zx_profile_create(zx_job_default(), 0, &info, &handle);
+    if (st != ZX_OK) {
+        return st;
+    }
+    st = zx_object_set_profile(zx_thread_self(), handle, 0);
+    zx_handle_close(handle);
+    return st;
+}
+
+Topology Relate(int32_t a, int32_t b) {
+    if (a == kAnyCpu || b == kAnyCpu) {
+        return Topology::kUnpinned;
+    }
+    // The kernel doesn't tell us how CPUs share hardware.
+    return a == b ? Topology::kSameCpu : Topology::kOtherCpu;
+}
+
+#else
+
+zx_status_t Apply(int32_t cpu, const Profile& profile) {
+    if (cpu != kAnyCpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            return status_from_errno(errno);
+        }
+    }
+
+    int result = 0;
+    switch (profile.kind) {
+    case Class::kDefault:
+        break;
+    case Class::kHigh:
+        // Nice values are per thread on Linux.
+        result = setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)),
+                             kHighNice);
+        break;
+    case Class::kRealtime: {
+        sched_param param = {};
+        param.sched_priority = (sched_get_priority_min(SCHED_FIFO) +
+                                sched_get_priority_max(SCHED_FIFO)) / 2;
+        result = sched_setscheduler(0, SCHED_FIFO, &param);
+        break;
+    }
+    case Class::kDeadline: {
+        sched_attr_t attr = {};
+        attr.size = sizeof(attr);
+        attr.sched_policy = SCHED_DEADLINE;
+        attr.sched_flags = SCHED_FLAG_RESET_ON_FORK;
+        attr.sched_runtime = static_cast<uint64_t>(profile.capacity);
+        attr.sched_deadline = static_cast<uint64_t>(profile.period);
+        attr.sched_period = static_cast<uint64_t>(profile.period);
+        result = static_cast<int>(syscall(SYS_sched_setattr, 0, &attr, 0));
+        break;
+    }
+    }
+    return result == 0 ? ZX_OK : status_from_errno(errno);
+}
+
+Topology Relate(int32_t a, int32_t b) {
+    if (a == kAnyCpu || b == kAnyCpu) {
+        return Topology::kUnpinned;
+    }
+    if (a == b) {
+        return Topology::kSameCpu;
+    }
+    long package_a = read_topology(a, "physical_package_id");
+    long package_b = read_topology(b, "physical_package_id");
+    long core_a = read_topology(a, "core_id");
+    long core_b = read_topology(b, "core_id");
+    if (package_a < 0 || package_b < 0 || core_a < 0 || core_b < 0) {
+        return Topology::kOtherCpu;
+    }
+    if (package_a != package_b) {
+        return Topology::kCrossPackage;
+    }
+    // Core ids are only unique within a package.
+    return core_a == core_b ? Topology::kSmtSibling : Topology::kSamePackage;
+}
+
+#endif
+
+const char* TopologyName(Topology topology) {
+    switch (topology) {
+    case Topology::kUnpinned:
+        return "unpinned";
+    case Topology::kSameCpu:
+        return "same-cpu";
+    case Topology::kSmtSibling:
+        return "smt";
+    case Topology::kSamePackage:
+        return "same-package";
+    case Topology::kCrossPackage:
+        return "cross-package";
+    case Topology::kOtherCpu:
+        return "other-cpu";
+    }
+    return "unknown";
+}
+
+size_t Representatives(CpuPair* pairs, size_t max_pairs) {
+    if (max_pairs == 0) {
+        return 0;
+    }
+    pairs[0] = {0, 0};
+    size_t count = 1;
+
+    const Topology kWanted[] = {
+        Topology::kSmtSibling,
+        Topology::kSamePackage,
+        Topology::kCrossPackage,
+        Topology::kOtherCpu,
+    };
+    int32_t cpus = static_cast<int32_t>(NumCpus());
+    for (Topology wanted : kWanted) {
+        for (int32_t cpu = 1; cpu < cpus && count < max_pairs; cpu++) {
+            if (Relate(0, cpu) == wanted) {
+                pairs[count++] = {0, cpu};
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+} // namespace placement
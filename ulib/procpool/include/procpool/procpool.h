@@ -0,0 +1,142 @@
+#pragma once
+
+// A pool of pre-spawned worker processes.
+//
+// The pool spawns its workers up front and keeps the channel each one was
+// started with. Every job goes out over that channel to an idle worker as one
+// message, a job_header_t followed by the job's payload, with whatever
+// handles the job needs. The worker runs it and answers with a job_done_t,
+// after which it is idle again. Workers live until the pool is destroyed, so
+// only the first job on each worker pays for spawning a process.
+//
+// Workers are started with spawn::Spawn. The worker side is procpool::Serve,
+// which the worker's main calls with the channel spawn::TakeBootstrap gave
+// it.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+
+#include <zircon/compiler.h>
+#include <zircon/syscalls.h>
+#include <zircon/types.h>
+
+namespace procpool {
+
+typedef struct job_header {
+    // Nonzero; the pool numbers jobs from 1.
+    uint64_t id;
+    // What to do, as agreed between the pool's owner and the workers.
+    uint32_t kind;
+    uint32_t reserved;
+} job_header_t;
+
+typedef struct job_done {
+    uint64_t id;
+    zx_status_t status;
+    uint32_t reserved;
+} job_done_t;
+
+constexpr uint32_t kMaxJobPayload =
+    ZX_CHANNEL_MAX_MSG_BYTES - sizeof(job_header_t);
+
+class Pool {
+public:
+    // Spawns |size| workers running |path| with |args| (a nullptr-terminated
+    // argument list) and waits until each of them is ready.
+    static zx_status_t Create(const char* path, const char* const* args,
+                              uint32_t size, std::unique_ptr<Pool>* out);
+
+    // Closing the workers' channels makes them exit.
+    ~Pool();
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    // Hands a job to an idle worker, first waiting for a running job to
+    // finish if every worker is busy. |handles| are transferred to the
+    // worker, or closed if the job can't be sent.
+    zx_status_t Dispatch(uint32_t kind, const void* payload,
+                         uint32_t payload_size, const zx_handle_t* handles,
+                         uint32_t num_handles);
+
+    // Waits until every dispatched job has finished. Returns the first
+    // failure any of them reported since the last call, or ZX_OK.
+    zx_status_t WaitIdle();
+
+    uint32_t size() const { return size_; }
+
+private:
+    struct Worker {
+        zx_handle_t channel = ZX_HANDLE_INVALID;
+        uint64_t job = 0;
+    };
+
+    Pool(uint32_t size, zx_handle_t port);
+
+    // Waits for one running job to finish and marks its worker idle.
+    zx_status_t Reap();
+
+    const uint32_t size_;
+    const zx_handle_t port_;
+    std::unique_ptr<Worker[]> workers_;
+    // Indices of the idle workers; the first |num_idle_| entries are valid.
+    std::unique_ptr<uint32_t[]> idle_;
+    uint32_t num_idle_ = 0;
+    uint64_t next_job_ = 1;
+    zx_status_t first_failure_ = ZX_OK;
+};
+
+// Tells the pool that job |id| finished with |status|.
+zx_status_t ReportDone(zx_handle_t channel, uint64_t id, zx_status_t status);
+
+// Worker side. Runs every job the pool sends on |channel| with
+// |handler(kind, payload, payload_size, handles, num_handles)| and reports
+// what it returned. The handler owns the handles. Returns ZX_OK once
+// the pool closes the channel.
+template <typename Handler>
+zx_status_t Serve(zx_handle_t channel, Handler handler) {
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[ZX_CHANNEL_MAX_MSG_BYTES]);
+    zx_status_t st;
+    while (true) {
+        zx_handle_t handles[ZX_CHANNEL_MAX_MSG_HANDLES];
+        uint32_t actual_bytes;
+        uint32_t actual_handles;
+        st = zx_channel_read(channel, 0, buffer.get(), handles,
+                             ZX_CHANNEL_MAX_MSG_BYTES, countof(handles),
+                             &actual_bytes, &actual_handles);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            st = zx_object_wait_one(channel,
+                                    ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                    ZX_TIME_INFINITE, nullptr);
+            if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        } else if (st == ZX_ERR_PEER_CLOSED) {
+            return ZX_OK;
+        } else if (st != ZX_OK) {
+            return st;
+        }
+
+        job_header_t header;
+        if (actual_bytes < sizeof(header)) {
+            for (uint32_t i = 0; i < actual_handles; i++) {
+                zx_handle_close(handles[i]);
+            }
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        memcpy(&header, buffer.get(), sizeof(header));
+        zx_status_t job_status =
+            handler(header.kind, buffer.get() + sizeof(header),
+                    actual_bytes - static_cast<uint32_t>(sizeof(header)),
+                    handles, actual_handles);
+        st = ReportDone(channel, header.id, job_status);
+        if (st != ZX_OK) {
+            return st == ZX_ERR_PEER_CLOSED ? ZX_OK : st;
+        }
+    }
+}
+
+} // namespace procpool
@@ -0,0 +1,184 @@
+#include <procpool/procpool.h>
+
+#include <fbl/auto_call.h>
+#include <spawn/spawn.h>
+
+namespace procpool {
+namespace {
+
+// Reads the job_done_t a worker sent on |channel|, waiting for it if needed.
+zx_status_t read_done(zx_handle_t channel, job_done_t* done) {
+    while (true) {
+        uint32_t actual_bytes;
+        zx_status_t st = zx_channel_read(channel, 0, done, nullptr,
+                                         sizeof(*done), 0, &actual_bytes,
+                                         nullptr);
+        if (st == ZX_ERR_SHOULD_WAIT) {
+            st = zx_object_wait_one(channel,
+                                    ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                    ZX_TIME_INFINITE, nullptr);
+            if (st != ZX_OK) {
+                return st;
+            }
+            continue;
+        } else if (st != ZX_OK) {
+            return st;
+        }
+        return actual_bytes == sizeof(*done) ? ZX_OK : ZX_ERR_IO_DATA_INTEGRITY;
+    }
+}
+
+} // namespace
+
+zx_status_t ReportDone(zx_handle_t channel, uint64_t id, zx_status_t status) {
+    job_done_t done = {id, status, 0};
+    while (true) {
+        zx_status_t st = zx_channel_write(channel, 0, &done, sizeof(done),
+                                          nullptr, 0);
+        if (st != ZX_ERR_SHOULD_WAIT) {
+            return st;
+        }
+        st = zx_object_wait_one(channel,
+                                ZX_CHANNEL_WRITABLE | ZX_CHANNEL_PEER_CLOSED,
+                                ZX_TIME_INFINITE, nullptr);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+}
+
+zx_status_t Pool::Create(const char* path, const char* const* args,
+                         uint32_t size, std::unique_ptr<Pool>* out) {
+    if (size == 0) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    zx_handle_t port;
+    zx_status_t st = zx_port_create(0, &port);
+    if (st != ZX_OK) {
+        return st;
+    }
+    std::unique_ptr<Pool> pool(new Pool(size, port));
+
+    std::unique_ptr<spawn::child_t[]> children(new spawn::child_t[size]());
+    st = spawn::Spawn(path, args, children.get(), size);
+    if (st != ZX_OK) {
+        return st;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        pool->workers_[i].channel = children[i].channel;
+        pool->idle_[pool->num_idle_++] = i;
+    }
+
+    *out = std::move(pool);
+    return ZX_OK;
+}
+
+Pool::Pool(uint32_t size, zx_handle_t port)
+    : size_(size), port_(port), workers_(new Worker[size]),
+      idle_(new uint32_t[size]) {}
+
+Pool::~Pool() {
+    for (uint32_t i = 0; i < size_; i++) {
+        if (workers_[i].channel != ZX_HANDLE_INVALID) {
+            zx_handle_close(workers_[i].channel);
+        }
+    }
+    zx_handle_close(port_);
+}
+
+zx_status_t Pool::Dispatch(uint32_t kind, const void* payload,
+                           uint32_t payload_size, const zx_handle_t* handles,
+                           uint32_t num_handles) {
+    auto close_handles = fbl::MakeAutoCall([handles, num_handles]() {
+        for (uint32_t i = 0; i < num_handles; i++) {
+            zx_handle_close(handles[i]);
+        }
+    });
+    if (payload_size > kMaxJobPayload) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    while (num_idle_ == 0) {
+        zx_status_t st = Reap();
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+
+    uint32_t index = idle_[num_idle_ - 1];
+    Worker* worker = &workers_[index];
+    job_header_t header = {next_job_, kind, 0};
+    const zx_channel_iovec_t fragments[] = {
+        {&header, sizeof(header), 0},
+        {payload, payload_size, 0},
+    };
+    zx_status_t st;
+    while (true) {
+        st = zx_channel_write(worker->channel, ZX_CHANNEL_WRITE_USE_IOVEC,
+                              fragments, countof(fragments), handles,
+                              num_handles);
+        if (st != ZX_ERR_SHOULD_WAIT) {
+            break;
+        }
+        // Only possible on the host backend, whose channels push back.
+        st = zx_object_wait_one(worker->channel,
+                                ZX_CHANNEL_WRITABLE | ZX_CHANNEL_PEER_CLOSED,
+                                ZX_TIME_INFINITE, nullptr);
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+    if (st != ZX_OK) {
+        return st;
+    }
+    close_handles.cancel();
+
+    st = zx_object_wait_async(worker->channel, port_, index,
+                              ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                              ZX_WAIT_ASYNC_ONCE);
+    if (st != ZX_OK) {
+        return st;
+    }
+    worker->job = next_job_++;
+    num_idle_--;
+    return ZX_OK;
+}
+
+zx_status_t Pool::WaitIdle() {
+    while (num_idle_ < size_) {
+        zx_status_t st = Reap();
+        if (st != ZX_OK) {
+            return st;
+        }
+    }
+    zx_status_t st = first_failure_;
+    first_failure_ = ZX_OK;
+    return st;
+}
+
+zx_status_t Pool::Reap() {
+    zx_port_packet_t packet;
+    zx_status_t st = zx_port_wait(port_, ZX_TIME_INFINITE, &packet);
+    if (st != ZX_OK) {
+        return st;
+    }
+    uint32_t index = static_cast<uint32_t>(packet.key);
+    Worker* worker = &workers_[index];
+
+    job_done_t done;
+    st = read_done(worker->channel, &done);
+    if (st != ZX_OK) {
+        // The worker died with the job; there is nothing to recycle.
+        return st;
+    }
+    if (done.id != worker->job) {
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+    if (done.status != ZX_OK && first_failure_ == ZX_OK) {
+        first_failure_ = done.status;
+    }
+    worker->job = 0;
+    idle_[num_idle_++] = index;
+    return ZX_OK;
+}
+
+} // namespace procpool
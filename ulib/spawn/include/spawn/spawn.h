@@ -0,0 +1,66 @@
+#pragma once
+
+// Starting children from the running program.
+//
+// A child is the running program started again with kChildArg in front of
+// the parent's own arguments, so that both sides see the same options. It
+// gets a bootstrap channel as PA_USER0, plus any extra startup handles the
+// parent hands it, and reports ready on that channel when it takes it with
+// TakeBootstrap. Spawn starts any number of children at once, fanning the
+// spawns out over several threads, and returns once every child is ready.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zircon/types.h>
+
+namespace spawn {
+
+// Tells a program that it was started as a child.
+constexpr char kChildArg[] = "child";
+
+// Most arguments a child is started with, besides kChildArg.
+constexpr int kMaxArgs = 16;
+
+// Most extra startup handles one child can get.
+constexpr uint32_t kMaxStartupHandles = 8;
+
+// An extra handle to start a child with, taken in the child with
+// zx_take_startup_handle(|id|).
+typedef struct startup_handle {
+    uint32_t id;
+    zx_handle_t handle;
+} startup_handle_t;
+
+typedef struct child {
+    // Extra startup handles. They are consumed whether or not the child
+    // starts.
+    const startup_handle_t* handles;
+    uint32_t num_handles;
+    // Set by Spawn to our end of the child's bootstrap channel.
+    zx_handle_t channel;
+} child_t;
+
+// Returns true if kChildArg is among |argv|.
+bool IsChild(int argc, const char* const argv[]);
+
+// Writes the path that starts the running program, invoked as |argv0|, to
+// |path|.
+zx_status_t SelfPath(const char* argv0, char* path, size_t size);
+
+// Fills |args| with the command line for our children: kChildArg followed by
+// our own arguments minus the program name, then nullptr.
+zx_status_t ChildArgs(int argc, const char* const argv[],
+                      const char* (&args)[kMaxArgs + 2]);
+
+// Starts |count| children running |path| with |args| and waits until all of
+// them are ready. The spawns are spread over |threads| threads, or one per
+// CPU if 0. On failure no channel is returned, and the children that did
+// start exit once they notice their channel was closed.
+zx_status_t Spawn(const char* path, const char* const* args, child_t* children,
+                  uint32_t count, uint32_t threads = 0);
+
+// Child side. Takes the bootstrap channel and tells the parent we are ready.
+zx_status_t TakeBootstrap(zx_handle_t* channel);
+
+} // namespace spawn
@@ -0,0 +1,20 @@
+# Copyright 2018 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := userlib
+
+MODULE_SRCS += \
+    $(LOCAL_DIR)/spawn.cpp
+
+MODULE_STATIC_LIBS := system/ulib/fbl
+
+MODULE_LIBS := system/ulib/fdio system/ulib/c system/ulib/zircon
+
+MODULE_PACKAGE := static
+
+include make/module.mk
@@ -0,0 +1,214 @@
+#include <spawn/spawn.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <fbl/auto_call.h>
+#include <lib/fdio/spawn.h>
+
+#include <zircon/process.h>
+#include <zircon/processargs.h>
+#include <zircon/syscalls.h>
+
+namespace spawn {
+namespace {
+
+// What a child sends on its bootstrap channel once it has taken it.
+constexpr uint64_t kReady = 0x7265616479; // "ready"
+
+// Most threads Spawn fans out to.
+constexpr uint32_t kMaxThreads = 64;
+
+void close_startup_handles(const child_t& child) {
+    for (uint32_t i = 0; i < child.num_handles; i++) {
+        zx_handle_close(child.handles[i].handle);
+    }
+}
+
+// Creates |child|'s bootstrap channel and starts it, without waiting for it
+// to be ready.
+zx_status_t spawn_one(const char* path, const char* const* args,
+                      child_t* child) {
+    if (child->num_handles > kMaxStartupHandles) {
+        close_startup_handles(*child);
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+
+    zx_handle_t mine = ZX_HANDLE_INVALID;
+    zx_handle_t other = ZX_HANDLE_INVALID;
+    zx_status_t st = zx_channel_create(0, &mine, &other);
+    if (st != ZX_OK) {
+        close_startup_handles(*child);
+        return st;
+    }
+    auto cleanup_on_failure = fbl::MakeAutoCall([mine]() {
+        zx_handle_close(mine);
+    });
+
+    fdio_spawn_action_t actions[2 + kMaxStartupHandles] = {
+        {.action = FDIO_SPAWN_ACTION_SET_NAME, .name = {.data = "child"}},
+        {.action = FDIO_SPAWN_ACTION_ADD_HANDLE, .h = {.id = PA_USER0, .handle = other}},
+    };
+    size_t num_actions = 2;
+    for (uint32_t i = 0; i < child->num_handles; i++) {
+        actions[num_actions].action = FDIO_SPAWN_ACTION_ADD_HANDLE;
+        actions[num_actions].h.id = child->handles[i].id;
+        actions[num_actions].h.handle = child->handles[i].handle;
+        num_actions++;
+    }
+
+    // fdio_spawn_etc consumes the handles whether or not it succeeds.
+    char error_buffer[FDIO_SPAWN_ERR_MSG_MAX_LENGTH];
+    st = fdio_spawn_etc(ZX_HANDLE_INVALID, FDIO_SPAWN_CLONE_ALL, path, args,
+                        nullptr, num_actions, actions, nullptr, error_buffer);
+    if (st != ZX_OK) {
+        fprintf(stderr, "could not spawn child process, st = %d\n", st);
+        fprintf(stderr, "reason: %s\n", error_buffer);
+        return st;
+    }
+
+    cleanup_on_failure.cancel();
+    child->channel = mine;
+    return ZX_OK;
+}
+
+// Waits for the ready message on a child's bootstrap channel.
+zx_status_t wait_ready(zx_handle_t channel) {
+    zx_signals_t signals;
+    zx_status_t st = zx_object_wait_one(
+        channel, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+        ZX_TIME_INFINITE, &signals);
+    if (st != ZX_OK) {
+        return st;
+    }
+    uint64_t ready;
+    uint32_t actual_bytes;
+    st = zx_channel_read(channel, 0, &ready, nullptr, sizeof(ready), 0,
+                         &actual_bytes, nullptr);
+    if (st != ZX_OK) {
+        return st;
+    }
+    if (actual_bytes != sizeof(ready) || ready != kReady) {
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+    return ZX_OK;
+}
+
+} // namespace
+
+bool IsChild(int argc, const char* const argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(argv[i], kChildArg)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+zx_status_t SelfPath(const char* argv0, char* path, size_t size) {
+#if defined(__Fuchsia__)
+    int length = snprintf(path, size, "/boot/bin/%s", argv0);
+#else
+    // The host backend re-executes this binary as the child.
+    (void)argv0;
+    int length = snprintf(path, size, "/proc/self/exe");
+#endif
+    if (length < 0 || static_cast<size_t>(length) >= size) {
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    }
+    return ZX_OK;
+}
+
+zx_status_t ChildArgs(int argc, const char* const argv[],
+                      const char* (&args)[kMaxArgs + 2]) {
+    if (argc - 1 > kMaxArgs) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    args[0] = kChildArg;
+    for (int i = 1; i < argc; i++) {
+        args[i] = argv[i];
+    }
+    args[argc < 1 ? 1 : argc] = nullptr;
+    return ZX_OK;
+}
+
+zx_status_t Spawn(const char* path, const char* const* args, child_t* children,
+                  uint32_t count, uint32_t threads) {
+    for (uint32_t i = 0; i < count; i++) {
+        children[i].channel = ZX_HANDLE_INVALID;
+    }
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads > kMaxThreads) {
+        threads = kMaxThreads;
+    }
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    // Thread t starts children t, t + threads, t + 2 * threads, ... Once one
+    // spawn fails the rest are skipped, and their startup handles closed.
+    std::atomic<zx_status_t> failure(ZX_OK);
+    auto spawn_share = [&](uint32_t first) {
+        for (uint32_t i = first; i < count; i += threads) {
+            if (failure.load(std::memory_order_relaxed) != ZX_OK) {
+                close_startup_handles(children[i]);
+                continue;
+            }
+            zx_status_t st = spawn_one(path, args, &children[i]);
+            if (st != ZX_OK) {
+                zx_status_t expected = ZX_OK;
+                failure.compare_exchange_strong(expected, st);
+            }
+        }
+    };
+    std::unique_ptr<std::thread[]> helpers(new std::thread[threads - 1]);
+    for (uint32_t t = 1; t < threads; t++) {
+        helpers[t - 1] = std::thread(spawn_share, t);
+    }
+    spawn_share(0);
+    for (uint32_t t = 1; t < threads; t++) {
+        helpers[t - 1].join();
+    }
+
+    // The children start up concurrently whatever order we wait in, so
+    // waiting for them one after the other takes no longer than the slowest.
+    zx_status_t st = failure.load();
+    for (uint32_t i = 0; i < count && st == ZX_OK; i++) {
+        st = wait_ready(children[i].channel);
+    }
+    if (st != ZX_OK) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (children[i].channel != ZX_HANDLE_INVALID) {
+                zx_handle_close(children[i].channel);
+                children[i].channel = ZX_HANDLE_INVALID;
+            }
+        }
+    }
+    return st;
+}
+
+zx_status_t TakeBootstrap(zx_handle_t* channel) {
+    zx_handle_t bootstrap = zx_take_startup_handle(PA_HND(PA_USER0, 0));
+    if (bootstrap == ZX_HANDLE_INVALID) {
+        return ZX_ERR_BAD_HANDLE;
+    }
+    zx_status_t st = zx_channel_write(bootstrap, 0, &kReady, sizeof(kReady),
+                                      nullptr, 0);
+    if (st != ZX_OK) {
+        zx_handle_close(bootstrap);
+        return st;
+    }
+    *channel = bootstrap;
+    return ZX_OK;
+}
+
+} // namespace spawn
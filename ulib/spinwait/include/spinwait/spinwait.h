@@ -0,0 +1,65 @@
+#pragma once
+
+// An adaptive spin-then-block wait.
+//
+// Waiter::Wait is a drop-in replacement for zx_object_wait_one with an
+// infinite deadline. It first polls the handle without blocking for up to a
+// spin budget, and only blocks once the budget is used up. The budget tracks
+// how long recent waits took: a wait satisfied while spinning sets it to
+// twice the recent average (capped at the configured maximum), and every
+// wait that spun in vain halves it, so an idle handle doesn't burn a core.
+//
+// Spinning only helps when the other side runs on another CPU, so it is
+// disabled on uniprocessors.
+//
+// A Waiter is not thread-safe; give each loop its own.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <histogram/histogram.h>
+#include <zircon/types.h>
+
+namespace spinwait {
+
+struct Counters {
+    // Waits that spun before returning or blocking.
+    uint64_t spins;
+    // Waits satisfied while spinning, i.e. that didn't block.
+    uint64_t spin_successes;
+    // Waits that ended up blocking.
+    uint64_t blocks;
+    // Non-blocking polls issued while spinning.
+    uint64_t polls;
+};
+
+class Waiter {
+public:
+    // A |max_budget| of zero disables spinning: every wait blocks straight
+    // away, as zx_object_wait_one would.
+    explicit Waiter(zx_duration_t max_budget);
+
+    zx_status_t Wait(zx_handle_t handle, zx_signals_t signals,
+                     zx_signals_t* observed);
+
+    const Counters& counters() const { return counters_; }
+    zx_duration_t budget() const { return budget_; }
+
+    // Prints the counters as <prefix>.spins, <prefix>.spin_successes and so
+    // on.
+    void PrintCounters(FILE* out, const char* prefix,
+                       histogram::Format format) const;
+
+private:
+    // Feeds how long a wait took into the running average and recomputes the
+    // budget.
+    void Update(zx_duration_t elapsed, bool spun_in_vain);
+
+    const zx_duration_t max_budget_;
+    zx_duration_t budget_;
+    // Exponentially weighted moving average of recent wait times.
+    zx_duration_t average_;
+    Counters counters_ = {};
+};
+
+} // namespace spinwait
@@ -0,0 +1,110 @@
+#include <spinwait/spinwait.h>
+
+#include <zircon/syscalls.h>
+
+#include <thread>
+
+namespace spinwait {
+namespace {
+
+// Weight of the newest sample in the moving average: 1 / 2^kAverageShift.
+constexpr int kAverageShift = 3;
+
+// Polls between clock reads while spinning.
+constexpr int kPollsPerClockRead = 4;
+
+// The budget never drops below 1 / 2^kFloorShift of the maximum, so we
+// notice when messages speed up again.
+constexpr int kFloorShift = 4;
+
+zx_duration_t effective_max_budget(zx_duration_t max_budget) {
+    return std::thread::hardware_concurrency() > 1 ? max_budget : 0;
+}
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+} // namespace
+
+Waiter::Waiter(zx_duration_t max_budget)
+    : max_budget_(effective_max_budget(max_budget)), budget_(max_budget_),
+      average_(0) {}
+
+zx_status_t Waiter::Wait(zx_handle_t handle, zx_signals_t signals,
+                         zx_signals_t* observed) {
+    zx_time_t start = zx_clock_get_monotonic();
+    bool spun = budget_ > 0;
+
+    if (spun) {
+        counters_.spins++;
+        zx_time_t spin_deadline = start + budget_;
+        zx_time_t now = start;
+        while (now < spin_deadline) {
+            for (int i = 0; i < kPollsPerClockRead; i++) {
+                // A deadline in the past makes this a non-blocking poll.
+                counters_.polls++;
+                zx_status_t st = zx_object_wait_one(handle, signals, 0, observed);
+                if (st == ZX_OK) {
+                    counters_.spin_successes++;
+                    Update(zx_clock_get_monotonic() - start, false);
+                    return ZX_OK;
+                } else if (st != ZX_ERR_TIMED_OUT) {
+                    return st;
+                }
+                cpu_relax();
+            }
+            now = zx_clock_get_monotonic();
+        }
+    }
+
+    counters_.blocks++;
+    zx_status_t st = zx_object_wait_one(handle, signals, ZX_TIME_INFINITE,
+                                        observed);
+    if (st == ZX_OK) {
+        Update(zx_clock_get_monotonic() - start, spun);
+    }
+    return st;
+}
+
+void Waiter::Update(zx_duration_t elapsed, bool spun_in_vain) {
+    if (max_budget_ == 0) {
+        return;
+    }
+    average_ += (elapsed - average_) >> kAverageShift;
+
+    if (spun_in_vain) {
+        budget_ >>= 1;
+    } else {
+        budget_ = 2 * average_ < max_budget_ ? 2 * average_ : max_budget_;
+    }
+    if (budget_ < (max_budget_ >> kFloorShift)) {
+        budget_ = max_budget_ >> kFloorShift;
+    }
+}
+
+void Waiter::PrintCounters(FILE* out, const char* prefix,
+                           histogram::Format format) const {
+    static const struct {
+        const char* name;
+        uint64_t Counters::*field;
+    } kFields[] = {
+        {"spins", &Counters::spins},
+        {"spin_successes", &Counters::spin_successes},
+        {"blocks", &Counters::blocks},
+        {"polls", &Counters::polls},
+    };
+    char name[128];
+    for (const auto& field : kFields) {
+        snprintf(name, sizeof(name), "%s.%s", prefix, field.name);
+        histogram::PrintValue(out, name, "count",
+                              static_cast<double>(counters_.*field.field),
+                              format);
+    }
+}
+
+} // namespace spinwait
@@ -0,0 +1,117 @@
+#pragma once
+
+// Traced versions of the IPC syscalls. Each takes the same arguments as the
+// syscall it wraps and records one event around it.
+
+#include <trace/trace.h>
+
+namespace trace {
+
+inline zx_status_t object_wait_one(zx_handle_t handle, zx_signals_t signals,
+                                   zx_time_t deadline, zx_signals_t* observed) {
+    zx_signals_t pending = 0;
+    zx_ticks_t start = Now();
+    zx_status_t st = zx_object_wait_one(handle, signals, deadline, &pending);
+    Record(Op::kObjectWait, start, st, pending, 0);
+    if (observed != nullptr) {
+        *observed = pending;
+    }
+    return st;
+}
+
+inline zx_status_t port_wait(zx_handle_t handle, zx_time_t deadline,
+                             zx_port_packet_t* packet) {
+    zx_ticks_t start = Now();
+    zx_status_t st = zx_port_wait(handle, deadline, packet);
+    Record(Op::kPortWait, start, st, 0, 0);
+    return st;
+}
+
+inline zx_status_t channel_read(zx_handle_t handle, uint32_t options,
+                                void* bytes, zx_handle_t* handles,
+                                uint32_t num_bytes, uint32_t num_handles,
+                                uint32_t* actual_bytes,
+                                uint32_t* actual_handles) {
+    uint32_t read_bytes = 0;
+    uint32_t read_handles = 0;
+    zx_ticks_t start = Now();
+    zx_status_t st = zx_channel_read(handle, options, bytes, handles, num_bytes,
+                                     num_handles, &read_bytes, &read_handles);
+    Record(Op::kChannelRead, start, st, read_bytes, read_handles);
+    if (actual_bytes != nullptr) {
+        *actual_bytes = read_bytes;
+    }
+    if (actual_handles != nullptr) {
+        *actual_handles = read_handles;
+    }
+    return st;
+}
+
+inline zx_status_t channel_write(zx_handle_t handle, uint32_t options,
+                                 const void* bytes, uint32_t num_bytes,
+                                 const zx_handle_t* handles,
+                                 uint32_t num_handles) {
+    zx_ticks_t start = Now();
+    zx_status_t st = zx_channel_write(handle, options, bytes, num_bytes,
+                                      handles, num_handles);
+    uint32_t total = num_bytes;
+    if (options & ZX_CHANNEL_WRITE_USE_IOVEC) {
+        const zx_channel_iovec_t* fragments =
+            static_cast<const zx_channel_iovec_t*>(bytes);
+        total = 0;
+        for (uint32_t i = 0; i < num_bytes; i++) {
+            total += fragments[i].capacity;
+        }
+    }
+    Record(Op::kChannelWrite, start, st, total, num_handles);
+    return st;
+}
+
+inline zx_status_t channel_call(zx_handle_t handle, uint32_t options,
+                                zx_time_t deadline,
+                                const zx_channel_call_args_t* args,
+                                uint32_t* actual_bytes,
+                                uint32_t* actual_handles) {
+    uint32_t read_bytes = 0;
+    uint32_t read_handles = 0;
+    zx_ticks_t start = Now();
+    zx_status_t st = zx_channel_call(handle, options, deadline, args,
+                                     &read_bytes, &read_handles);
+    Record(Op::kChannelCall, start, st, read_bytes, read_handles);
+    if (actual_bytes != nullptr) {
+        *actual_bytes = read_bytes;
+    }
+    if (actual_handles != nullptr) {
+        *actual_handles = read_handles;
+    }
+    return st;
+}
+
+inline zx_status_t fifo_read(zx_handle_t handle, size_t elem_size, void* data,
+                             size_t count, size_t* actual_count) {
+    size_t actual = 0;
+    zx_ticks_t start = Now();
+    zx_status_t st = zx_fifo_read(handle, elem_size, data, count, &actual);
+    Record(Op::kFifoRead, start, st,
+           st == ZX_OK ? static_cast<uint32_t>(actual * elem_size) : 0, 0);
+    if (actual_count != nullptr) {
+        *actual_count = actual;
+    }
+    return st;
+}
+
+inline zx_status_t fifo_write(zx_handle_t handle, size_t elem_size,
+                              const void* data, size_t count,
+                              size_t* actual_count) {
+    size_t actual = 0;
+    zx_ticks_t start = Now();
+    zx_status_t st = zx_fifo_write(handle, elem_size, data, count, &actual);
+    Record(Op::kFifoWrite, start, st,
+           st == ZX_OK ? static_cast<uint32_t>(actual * elem_size) : 0, 0);
+    if (actual_count != nullptr) {
+        *actual_count = actual;
+    }
+    return st;
+}
+
+} // namespace trace
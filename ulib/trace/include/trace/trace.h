@@ -0,0 +1,108 @@
+#pragma once
+
+// Always-on tracing of IPC calls.
+//
+// Every thread records into its own fixed-size ring of events, so recording
+// takes no locks, never allocates after the thread's first event, and costs
+// two tick counter reads and a 32-byte store. Ticks are converted to
+// monotonic time only when the trace is written out. A full ring overwrites its oldest
+// events. trace::Start asks for all rings to be written out as Chrome trace
+// JSON, which Perfetto loads too, when the process exits.
+//
+// <trace/syscalls.h> wraps the syscalls the samples trace; Span covers
+// calls that go through other wrappers.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <zircon/syscalls.h>
+#include <zircon/types.h>
+
+namespace trace {
+
+enum class Op : uint32_t {
+    kObjectWait,
+    kPortWait,
+    kChannelRead,
+    kChannelWrite,
+    kChannelCall,
+    kFifoRead,
+    kFifoWrite,
+    kCount,
+};
+
+typedef struct event {
+    zx_ticks_t start;
+    zx_ticks_t duration;
+    Op op;
+    zx_status_t status;
+    // Bytes moved and handles transferred. Waits store the observed signals
+    // in |bytes|.
+    uint32_t bytes;
+    uint32_t handles;
+} event_t;
+
+static_assert(sizeof(event_t) == 32, "events should stay small");
+
+// Events each thread keeps; older ones are overwritten.
+constexpr size_t kEventsPerThread = 1 << 14;
+
+inline zx_ticks_t Now() {
+    return zx_ticks_get();
+}
+
+// Records a call to |op| that started at |start| and just returned |status|.
+void Record(Op op, zx_ticks_t start, zx_status_t status, uint32_t bytes,
+            uint32_t handles);
+
+// Times one call from construction to End().
+class Span {
+public:
+    explicit Span(Op op) : op_(op), start_(Now()) {}
+
+    void End(zx_status_t status, uint32_t bytes = 0, uint32_t handles = 0) {
+        Record(op_, start_, status, bytes, handles);
+    }
+
+private:
+    const Op op_;
+    const zx_ticks_t start_;
+};
+
+// Calls to each op, counted per thread. Unlike the events these never wrap,
+// so the difference between two snapshots taken on one thread is exactly the
+// calls it made in between.
+typedef struct counts {
+    uint64_t calls[static_cast<size_t>(Op::kCount)];
+
+    uint64_t total() const {
+        uint64_t sum = 0;
+        for (uint64_t n : calls) {
+            sum += n;
+        }
+        return sum;
+    }
+} counts_t;
+
+// The calling thread's counts so far.
+counts_t ThreadCounts();
+
+// This process's koid on Zircon, its pid elsewhere. Trace files and log
+// records are tagged with it.
+uint64_t ProcessId();
+
+// The syscall |op| stands for, e.g. "zx_channel_write".
+const char* OpName(Op op);
+
+// Writes every thread's events to <|prefix|>.<process id>.json when the
+// process exits, naming the process |name| in the trace. Each process of a
+// sample writes its own file; merge them with
+//   jq -s '{traceEvents: map(.traceEvents) | add}' <prefix>.*.json
+// Returns false if called twice.
+bool Start(const char* prefix, const char* name);
+
+// Writes the events recorded so far as a Chrome trace JSON object.
+void Dump(FILE* out);
+
+} // namespace trace
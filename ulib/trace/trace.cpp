@@ -0,0 +1,193 @@
+#include <trace/trace.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#if defined(__Fuchsia__)
+#include <zircon/process.h>
+#include <zircon/syscalls/object.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace trace {
+namespace {
+
+// One thread's events. Only the owning thread writes to it; buffers are never
+// freed, so the events of threads that already exited still get dumped.
+struct ThreadBuffer {
+    event_t events[kEventsPerThread];
+    // Events ever recorded; the newest is at (next - 1) % kEventsPerThread.
+    std::atomic<uint64_t> next{0};
+    // Only ever read by the owning thread, through ThreadCounts.
+    counts_t counts = {};
+    uint32_t tid = 0;
+    ThreadBuffer* link = nullptr;
+};
+
+// Every thread's buffer, newest first. Threads only ever push.
+std::atomic<ThreadBuffer*> g_buffers{nullptr};
+std::atomic<uint32_t> g_next_tid{1};
+
+thread_local ThreadBuffer* t_buffer = nullptr;
+
+const char* const kOpNames[] = {
+    "zx_object_wait_one",
+    "zx_port_wait",
+    "zx_channel_read",
+    "zx_channel_write",
+    "zx_channel_call",
+    "zx_fifo_read",
+    "zx_fifo_write",
+};
+static_assert(sizeof(kOpNames) / sizeof(kOpNames[0]) ==
+                  static_cast<size_t>(Op::kCount),
+              "every op needs a name");
+
+// A tick count and the monotonic time it was read at. The trace maps ticks
+// onto monotonic time through the line between the pair taken when the
+// process started and the one taken when the trace is written, so every
+// process of a sample lands on the same timeline.
+struct ClockPair {
+    zx_ticks_t ticks;
+    zx_time_t time;
+
+    static ClockPair Now() {
+        return ClockPair{zx_ticks_get(), zx_clock_get_monotonic()};
+    }
+};
+
+const ClockPair g_start = ClockPair::Now();
+
+char g_prefix[256];
+char g_name[64];
+std::atomic<bool> g_started{false};
+
+ThreadBuffer* register_thread() {
+    ThreadBuffer* buffer = new ThreadBuffer();
+    buffer->tid = g_next_tid.fetch_add(1, std::memory_order_relaxed);
+    ThreadBuffer* head = g_buffers.load(std::memory_order_relaxed);
+    do {
+        buffer->link = head;
+    } while (!g_buffers.compare_exchange_weak(head, buffer,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+    t_buffer = buffer;
+    return buffer;
+}
+
+void dump_at_exit() {
+    char path[sizeof(g_prefix) + 32];
+    snprintf(path, sizeof(path), "%s.%lu.json", g_prefix, ProcessId());
+    FILE* out = fopen(path, "w");
+    if (out == nullptr) {
+        fprintf(stderr, "trace: can't open %s\n", path);
+        return;
+    }
+    Dump(out);
+    fclose(out);
+}
+
+} // namespace
+
+void Record(Op op, zx_ticks_t start, zx_status_t status, uint32_t bytes,
+            uint32_t handles) {
+    zx_ticks_t end = Now();
+    ThreadBuffer* buffer = t_buffer;
+    if (buffer == nullptr) {
+        buffer = register_thread();
+    }
+    uint64_t index = buffer->next.load(std::memory_order_relaxed);
+    event_t* event = &buffer->events[index % kEventsPerThread];
+    event->start = start;
+    event->duration = end - start;
+    event->op = op;
+    event->status = status;
+    event->bytes = bytes;
+    event->handles = handles;
+    buffer->next.store(index + 1, std::memory_order_release);
+    buffer->counts.calls[static_cast<size_t>(op)]++;
+}
+
+counts_t ThreadCounts() {
+    ThreadBuffer* buffer = t_buffer;
+    return buffer != nullptr ? buffer->counts : counts_t{};
+}
+
+uint64_t ProcessId() {
+#if defined(__Fuchsia__)
+    zx_info_handle_basic_t info;
+    if (zx_object_get_info(zx_process_self(), ZX_INFO_HANDLE_BASIC, &info,
+                           sizeof(info), nullptr, nullptr) != ZX_OK) {
+        return 0;
+    }
+    return info.koid;
+#else
+    return static_cast<uint64_t>(getpid());
+#endif
+}
+
+const char* OpName(Op op) {
+    return kOpNames[static_cast<size_t>(op)];
+}
+
+bool Start(const char* prefix, const char* name) {
+    if (g_started.exchange(true)) {
+        return false;
+    }
+    snprintf(g_prefix, sizeof(g_prefix), "%s", prefix);
+    snprintf(g_name, sizeof(g_name), "%s", name);
+    atexit(dump_at_exit);
+    return true;
+}
+
+void Dump(FILE* out) {
+    uint64_t pid = ProcessId();
+    ClockPair now = ClockPair::Now();
+    double ns_per_tick = 1.0;
+    if (now.ticks != g_start.ticks) {
+        ns_per_tick = static_cast<double>(now.time - g_start.time) /
+                      static_cast<double>(now.ticks - g_start.ticks);
+    }
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %lu, "
+                 "\"args\": {\"name\": \"%s\"}}",
+            pid, g_name[0] ? g_name : "process");
+
+    // Threads that are still running may overwrite the oldest events we are
+    // about to print; the trace is only exact for threads that are idle.
+    for (ThreadBuffer* buffer = g_buffers.load(std::memory_order_acquire);
+         buffer != nullptr; buffer = buffer->link) {
+        uint64_t next = buffer->next.load(std::memory_order_acquire);
+        uint64_t first = next > kEventsPerThread ? next - kEventsPerThread : 0;
+        fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", "
+                     "\"pid\": %lu, \"tid\": %u, \"args\": {\"name\": "
+                     "\"thread %u\", \"dropped_events\": %lu}}",
+                pid, buffer->tid, buffer->tid, first);
+
+        for (uint64_t i = first; i < next; i++) {
+            const event_t& event = buffer->events[i % kEventsPerThread];
+            bool wait = event.op == Op::kObjectWait || event.op == Op::kPortWait;
+            // Chrome traces count in microseconds.
+            fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %lu, "
+                         "\"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, "
+                         "\"args\": {\"status\": %d",
+                    kOpNames[static_cast<size_t>(event.op)], pid, buffer->tid,
+                    (g_start.time + (event.start - g_start.ticks) * ns_per_tick) /
+                        1000.0,
+                    event.duration * ns_per_tick / 1000.0,
+                    event.status);
+            if (wait) {
+                fprintf(out, ", \"observed\": \"0x%x\"}}", event.bytes);
+            } else {
+                fprintf(out, ", \"bytes\": %u, \"handles\": %u}}", event.bytes,
+                        event.handles);
+            }
+        }
+    }
+    fprintf(out, "\n]}\n");
+}
+
+} // namespace trace
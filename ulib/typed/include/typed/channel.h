@@ -0,0 +1,106 @@
+#pragma once
+
+// A channel whose message layouts are part of its type.
+//
+// Channel<Out, In> writes Out messages and reads In messages; the other end
+// is a Channel<In, Out>. Reads check that the message is exactly one In, so a
+// peer speaking a different protocol is caught instead of being reinterpreted.
+// Everything is inline and goes through the traced syscalls in
+// <trace/syscalls.h>, like typed::Fifo.
+
+#include <stdint.h>
+
+#include <type_traits>
+#include <utility>
+
+#include <trace/syscalls.h>
+#include <typed/handle.h>
+#include <zircon/syscalls.h>
+#include <zircon/types.h>
+
+namespace typed {
+
+template <typename Out, typename In>
+class Channel {
+    static_assert(std::is_trivially_copyable<Out>::value &&
+                      std::is_trivially_copyable<In>::value,
+                  "channel messages are copied byte for byte by the kernel");
+    static_assert(sizeof(Out) <= ZX_CHANNEL_MAX_MSG_BYTES &&
+                      sizeof(In) <= ZX_CHANNEL_MAX_MSG_BYTES,
+                  "message is larger than ZX_CHANNEL_MAX_MSG_BYTES");
+
+public:
+    using out_type = Out;
+    using in_type = In;
+    using peer_type = Channel<In, Out>;
+
+    Channel() = default;
+    explicit Channel(Handle handle) : handle_(std::move(handle)) {}
+
+    static zx_status_t Create(Channel* mine, peer_type* theirs) {
+        zx_handle_t out0, out1;
+        zx_status_t st = zx_channel_create(0, &out0, &out1);
+        if (st != ZX_OK) {
+            return st;
+        }
+        *mine = Channel(Handle(out0));
+        *theirs = peer_type(Handle(out1));
+        return ZX_OK;
+    }
+
+    // Returns ZX_ERR_SHOULD_WAIT if the peer's queue is full (host backend
+    // only; Zircon channels don't push back).
+    zx_status_t Write(const Out& message) {
+        return trace::channel_write(handle_.get(), 0, &message, sizeof(Out),
+                                    nullptr, 0);
+    }
+
+    // Returns ZX_ERR_SHOULD_WAIT if no message is queued, and
+    // ZX_ERR_IO_DATA_INTEGRITY if the message isn't an In.
+    zx_status_t Read(In* message) {
+        uint32_t actual_bytes;
+        zx_status_t st = trace::channel_read(handle_.get(), 0, message, nullptr,
+                                             sizeof(In), 0, &actual_bytes,
+                                             nullptr);
+        if (st == ZX_OK && actual_bytes != sizeof(In)) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        return st;
+    }
+
+    // Writes |request| and waits for the In that answers it, with one
+    // zx_channel_call. Both types must start with a zx_txid_t: the kernel
+    // overwrites the request's and matches the reply on it.
+    zx_status_t Call(const Out& request, In* response, zx_time_t deadline) {
+        static_assert(sizeof(Out) >= sizeof(zx_txid_t) &&
+                          sizeof(In) >= sizeof(zx_txid_t),
+                      "zx_channel_call messages start with a txid");
+        zx_channel_call_args_t args = {};
+        args.wr_bytes = &request;
+        args.wr_num_bytes = sizeof(Out);
+        args.rd_bytes = response;
+        args.rd_num_bytes = sizeof(In);
+        uint32_t actual_bytes;
+        zx_status_t st = trace::channel_call(handle_.get(), 0, deadline, &args,
+                                             &actual_bytes, nullptr);
+        if (st == ZX_OK && actual_bytes != sizeof(In)) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        return st;
+    }
+
+    zx_status_t wait_one(zx_signals_t signals, zx_time_t deadline,
+                         zx_signals_t* observed) const {
+        return trace::object_wait_one(handle_.get(), signals, deadline,
+                                      observed);
+    }
+
+    const Handle& handle() const { return handle_; }
+    // Gives up the channel, e.g. to send it to another process.
+    Handle TakeHandle() { return std::move(handle_); }
+
+private:
+    Handle handle_;
+};
+
+} // namespace typed
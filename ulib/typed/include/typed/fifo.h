@@ -0,0 +1,111 @@
+#pragma once
+
+// A fifo whose element type and depth are part of its type.
+//
+// Fifo<T, Depth> can only be created with Depth elements of sizeof(T) bytes,
+// and can only move T in and out, so a call site can't pass the wrong element
+// size or a buffer that is too small. Everything is inline and goes through
+// the traced syscalls in <trace/syscalls.h>, so the calls still show up in
+// traces and syscall counts.
+
+#include <stddef.h>
+
+#include <type_traits>
+#include <utility>
+
+#include <trace/syscalls.h>
+#include <typed/handle.h>
+#include <zircon/syscalls.h>
+#include <zircon/types.h>
+
+namespace typed {
+
+// A fixed-capacity buffer of elements, reused across batched reads so the hot
+// loop never allocates.
+template <typename T, size_t Capacity>
+struct Batch {
+    T items[Capacity];
+    // Number of valid elements in |items|.
+    size_t count = 0;
+
+    T* begin() { return items; }
+    T* end() { return items + count; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+};
+
+template <typename T, size_t Depth>
+class Fifo {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "fifo elements are copied byte for byte by the kernel");
+    static_assert(Depth > 0 && (Depth & (Depth - 1)) == 0,
+                  "fifo depth must be a power of two");
+    static_assert(sizeof(T) * Depth <= ZX_FIFO_MAX_SIZE_BYTES,
+                  "fifo is larger than ZX_FIFO_MAX_SIZE_BYTES");
+
+public:
+    using element_type = T;
+    using batch_type = Batch<T, Depth>;
+    static constexpr size_t kDepth = Depth;
+
+    Fifo() = default;
+    explicit Fifo(Handle handle) : handle_(std::move(handle)) {}
+
+    static zx_status_t Create(Fifo* end0, Fifo* end1) {
+        return zx_fifo_create(Depth, sizeof(T), 0,
+                              end0->handle_.reset_and_get_address(),
+                              end1->handle_.reset_and_get_address());
+    }
+
+    // Writes one element. Returns ZX_ERR_SHOULD_WAIT if the fifo is full.
+    zx_status_t Write(const T& element) {
+        size_t actual;
+        return trace::fifo_write(handle_.get(), sizeof(T), &element, 1, &actual);
+    }
+
+    // Writes as many of |count| elements as fit.
+    zx_status_t Write(const T* elements, size_t count, size_t* actual) {
+        return trace::fifo_write(handle_.get(), sizeof(T), elements, count,
+                                 actual);
+    }
+
+    template <size_t N>
+    zx_status_t Write(const T (&elements)[N], size_t* actual) {
+        return Write(elements, N, actual);
+    }
+
+    // Reads one element. Returns ZX_ERR_SHOULD_WAIT if the fifo is empty.
+    zx_status_t Read(T* element) {
+        size_t actual;
+        return trace::fifo_read(handle_.get(), sizeof(T), element, 1, &actual);
+    }
+
+    // Reads as many elements as are queued, up to |limit| and the depth of
+    // the fifo.
+    zx_status_t Read(batch_type* batch, size_t limit = Depth) {
+        zx_status_t st = trace::fifo_read(handle_.get(), sizeof(T), batch->items,
+                                          limit < Depth ? limit : Depth,
+                                          &batch->count);
+        if (st != ZX_OK) {
+            batch->count = 0;
+        }
+        return st;
+    }
+
+    zx_status_t wait_one(zx_signals_t signals, zx_time_t deadline,
+                         zx_signals_t* observed) const {
+        return trace::object_wait_one(handle_.get(), signals, deadline,
+                                      observed);
+    }
+
+    const Handle& handle() const { return handle_; }
+    // Gives up the fifo, e.g. to send it to another process.
+    Handle TakeHandle() { return std::move(handle_); }
+
+private:
+    Handle handle_;
+};
+
+} // namespace typed
@@ -0,0 +1,60 @@
+#pragma once
+
+// A move-only owner of a Zircon handle. The handle is closed when the owner
+// goes out of scope, which replaces the fbl::MakeAutoCall cleanup that would
+// otherwise follow every handle we create or receive.
+
+#include <zircon/syscalls.h>
+#include <zircon/types.h>
+
+namespace typed {
+
+class Handle {
+public:
+    constexpr Handle() = default;
+    explicit Handle(zx_handle_t value) : value_(value) {}
+    ~Handle() { reset(); }
+
+    Handle(Handle&& other) : value_(other.release()) {}
+    Handle& operator=(Handle&& other) {
+        reset(other.release());
+        return *this;
+    }
+
+    Handle(const Handle&) = delete;
+    Handle& operator=(const Handle&) = delete;
+
+    zx_handle_t get() const { return value_; }
+    bool is_valid() const { return value_ != ZX_HANDLE_INVALID; }
+    explicit operator bool() const { return is_valid(); }
+
+    // Gives up ownership without closing, e.g. to transfer the handle.
+    zx_handle_t release() {
+        zx_handle_t value = value_;
+        value_ = ZX_HANDLE_INVALID;
+        return value;
+    }
+
+    void reset(zx_handle_t value = ZX_HANDLE_INVALID) {
+        if (value_ != ZX_HANDLE_INVALID) {
+            zx_handle_close(value_);
+        }
+        value_ = value;
+    }
+
+    // For syscalls that return a new handle through an out parameter.
+    zx_handle_t* reset_and_get_address() {
+        reset();
+        return &value_;
+    }
+
+    zx_status_t wait_one(zx_signals_t signals, zx_time_t deadline,
+                         zx_signals_t* observed) const {
+        return zx_object_wait_one(value_, signals, deadline, observed);
+    }
+
+private:
+    zx_handle_t value_ = ZX_HANDLE_INVALID;
+};
+
+} // namespace typed